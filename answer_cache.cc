@@ -0,0 +1,282 @@
+#include "answer_cache.h"
+
+#include <algorithm>
+#include <cctype>
+#include <functional>
+
+#include "wire.h"
+
+namespace homedns {
+
+namespace {
+
+// The TTL field of an OPT pseudo-record holds flags, not a lifetime.
+constexpr uint16_t kOPTRecordType = 41;
+
+// Walks a serialized response and collects the offset of every record's TTL
+// field, along with the lowest TTL seen.
+bool FindTTLOffsets(const uint8_t* data,
+                    size_t len,
+                    std::vector<uint16_t>* offsets,
+                    uint32_t* min_ttl) {
+  if (len < wire::kHeaderSize)
+    return false;
+  uint16_t questions = wire::ReadU16(data + 4);
+  uint32_t records = wire::ReadU16(data + 6) + wire::ReadU16(data + 8) +
+                     wire::ReadU16(data + 10);
+  size_t offset = wire::kHeaderSize;
+  for (uint16_t i = 0; i < questions; i++) {
+    if (!wire::SkipName(data, len, &offset))
+      return false;
+    offset += 4;
+  }
+  *min_ttl = UINT32_MAX;
+  for (uint32_t i = 0; i < records; i++) {
+    if (!wire::SkipName(data, len, &offset) || offset + 10 > len)
+      return false;
+    if (wire::ReadU16(data + offset) != kOPTRecordType) {
+      offsets->push_back(offset + 4);
+      *min_ttl = std::min(*min_ttl, wire::ReadU32(data + offset + 4));
+    }
+    offset += 10 + wire::ReadU16(data + offset + 8);
+  }
+  return offset <= len;
+}
+
+}  // namespace
+
+// static
+CacheKey CacheKey::Create(std::string name, uint16_t type, uint16_t klass) {
+  if (!name.empty() && name.back() == '.')
+    name.pop_back();
+  std::transform(name.begin(), name.end(), name.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  return CacheKey{std::move(name), type, klass};
+}
+
+bool CacheKey::operator==(const CacheKey& other) const {
+  return type == other.type && klass == other.klass && name == other.name;
+}
+
+size_t CacheKeyHash::operator()(const CacheKey& key) const {
+  size_t hash = std::hash<std::string>()(key.name);
+  return hash ^ ((static_cast<size_t>(key.type) << 16 | key.klass) *
+                 0x9E3779B97F4A7C15ull);
+}
+
+AnswerCache::AnswerCache() : AnswerCache(Options()) {}
+
+AnswerCache::AnswerCache(Options options) : options_(options) {}
+
+bool AnswerCache::Lookup(const CacheKey& key,
+                         const uint8_t* query,
+                         size_t query_len,
+                         std::vector<uint8_t>* out,
+                         Clock::time_point now) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return LookupLocked(key, query, query_len, out, now);
+}
+
+bool AnswerCache::LookupLocked(const CacheKey& key,
+                               const uint8_t* query,
+                               size_t query_len,
+                               std::vector<uint8_t>* out,
+                               Clock::time_point now) {
+  auto it = entries_.find(key);
+  if (it == entries_.end()) {
+    stats_.misses++;
+    return false;
+  }
+
+  Entry& entry = it->second;
+  if (entry.expires <= now) {
+    // Once an entry has been answered stale, keep doing so for a while rather
+    // than making every asker wait out the same slow upstream first.
+    bool refreshing = entry.served_stale.has_value() &&
+                      now - *entry.served_stale <
+                          std::chrono::seconds(options_.stale_ttl);
+    if (refreshing && ServeStale(&entry, query, query_len, out, now)) {
+      if (!PrefetchPending(entry, now))
+        QueuePrefetch(key, &entry, now);
+      return true;
+    }
+    stats_.misses++;
+    return false;
+  }
+
+  entry.hits++;
+  entry.referenced = true;
+  stats_.hits++;
+  if (entry.replaced_expiry.has_value() && now >= *entry.replaced_expiry)
+    stats_.prefetch_hits_saved++;
+
+  if (ShouldPrefetch(entry, now))
+    QueuePrefetch(key, &entry, now);
+
+  // Rounded up, so that no live entry goes out with a TTL of 0, which
+  // downstream caches wouldn't keep.
+  uint32_t remaining =
+      std::chrono::ceil<std::chrono::seconds>(entry.expires - now).count();
+  Serve(entry, query, query_len, out, remaining);
+  return true;
+}
+
+bool AnswerCache::LookupStale(const CacheKey& key,
+                              const uint8_t* query,
+                              size_t query_len,
+                              std::vector<uint8_t>* out,
+                              Clock::time_point now) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(key);
+  if (it == entries_.end())
+    return false;
+  if (it->second.expires > now)
+    return LookupLocked(key, query, query_len, out, now);
+  if (!ServeStale(&it->second, query, query_len, out, now))
+    return false;
+  it->second.served_stale = now;
+  return true;
+}
+
+bool AnswerCache::ServeStale(Entry* entry,
+                             const uint8_t* query,
+                             size_t query_len,
+                             std::vector<uint8_t>* out,
+                             Clock::time_point now) {
+  if (!IsStale(*entry, now))
+    return false;
+  entry->hits++;
+  stats_.stale_hits++;
+  Serve(*entry, query, query_len, out, options_.stale_ttl);
+  return true;
+}
+
+void AnswerCache::Serve(const Entry& entry,
+                        const uint8_t* query,
+                        size_t query_len,
+                        std::vector<uint8_t>* out,
+                        uint32_t ttl) {
+  out->assign(entry.wire.begin(), entry.wire.end());
+  wire::PatchFromQuery(out->data(), out->size(), query, query_len);
+  for (uint16_t offset : entry.ttl_offsets)
+    wire::WriteU32(out->data() + offset, ttl);
+}
+
+void AnswerCache::Insert(const CacheKey& key,
+                         const uint8_t* data,
+                         size_t len,
+                         Clock::time_point now) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<uint16_t> offsets;
+  uint32_t ttl;
+  if (!FindTTLOffsets(data, len, &offsets, &ttl) || offsets.empty() || !ttl)
+    return;
+
+  uint32_t hits = 0;
+  std::optional<Clock::time_point> replaced_expiry;
+  size_t slot = 0;
+  auto it = entries_.find(key);
+  if (it != entries_.end()) {
+    // Popularity carries over into the refreshed entry, decayed so that a
+    // name which stops being asked for eventually stops being prefetched.
+    hits = it->second.hits / 2;
+    if (it->second.prefetch_queued && it->second.expires > now)
+      replaced_expiry = it->second.expires;
+  } else {
+    slot = MakeRoom(now);
+  }
+
+  auto [at, inserted] = entries_.try_emplace(key);
+  Entry& entry = at->second;
+  if (inserted) {
+    if (slot == clock_.size())
+      clock_.push_back(&*at);
+    else
+      clock_[slot] = &*at;
+  }
+  entry.wire.assign(data, data + len);
+  entry.ttl_offsets = std::move(offsets);
+  entry.inserted = now;
+  entry.expires = now + std::chrono::seconds(ttl);
+  entry.ttl = ttl;
+  entry.hits = hits;
+  entry.prefetch_queued.reset();
+  entry.replaced_expiry = replaced_expiry;
+  entry.served_stale.reset();
+  stats_.inserts++;
+}
+
+std::vector<CacheKey> AnswerCache::TakePrefetches() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return std::move(prefetches_);
+}
+
+bool AnswerCache::PrefetchPending(const Entry& entry,
+                                  Clock::time_point now) const {
+  return entry.prefetch_queued &&
+         now - *entry.prefetch_queued < options_.prefetch_timeout;
+}
+
+bool AnswerCache::ShouldPrefetch(const Entry& entry,
+                                 Clock::time_point now) const {
+  if (PrefetchPending(entry, now))
+    return false;
+  if (entry.ttl < options_.prefetch_min_ttl)
+    return false;
+  if (entry.hits < options_.prefetch_min_hits)
+    return false;
+  std::chrono::duration<double> window(entry.ttl * options_.prefetch_fraction);
+  return entry.expires - now <= window;
+}
+
+void AnswerCache::QueuePrefetch(const CacheKey& key,
+                                Entry* entry,
+                                Clock::time_point now) {
+  entry->prefetch_queued = now;
+  stats_.prefetches_issued++;
+  prefetches_.push_back(key);
+}
+
+bool AnswerCache::IsStale(const Entry& entry, Clock::time_point now) const {
+  return entry.expires <= now && now < entry.expires + options_.stale_window;
+}
+
+// Returns the slot on the clock for a new entry, evicting one to free it once
+// the cache is full. The hand sweeps the entries in turn: an expired one goes
+// as soon as the hand reaches it, and a live one only if it hasn't been hit
+// since the hand last passed, so that popular entries stay put while each
+// insert costs at most one lap.
+size_t AnswerCache::MakeRoom(Clock::time_point now) {
+  if (entries_.size() < options_.max_entries || clock_.empty())
+    return clock_.size();
+
+  for (;;) {
+    if (hand_ >= clock_.size())
+      hand_ = 0;
+    size_t slot = hand_++;
+    Entry& entry = clock_[slot]->second;
+    if (entry.expires > now && entry.referenced) {
+      entry.referenced = false;
+      continue;
+    }
+    entries_.erase(entries_.find(clock_[slot]->first));
+    stats_.evictions++;
+    return slot;
+  }
+}
+
+base::json::Object AnswerCache::Render() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::map<std::string, base::json::JSON> result;
+  result["Entries"] = (int)entries_.size();
+  result["Hits"] = (int)stats_.hits;
+  result["Misses"] = (int)stats_.misses;
+  result["Inserts"] = (int)stats_.inserts;
+  result["Evictions"] = (int)stats_.evictions;
+  result["Prefetches Issued"] = (int)stats_.prefetches_issued;
+  result["Prefetch Hits Saved"] = (int)stats_.prefetch_hits_saved;
+  result["Stale Hits"] = (int)stats_.stale_hits;
+  return base::json::Object(std::move(result));
+}
+
+}  // namespace homedns
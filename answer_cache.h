@@ -0,0 +1,188 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "base/json/json.h"
+
+namespace homedns {
+
+struct CacheKey {
+  std::string name;  // lowercased long form, ie "www.google.com"
+  uint16_t type;
+  uint16_t klass;
+
+  static CacheKey Create(std::string name, uint16_t type, uint16_t klass);
+  bool operator==(const CacheKey& other) const;
+};
+
+struct CacheKeyHash {
+  size_t operator()(const CacheKey& key) const;
+};
+
+// Caches fully serialized responses keyed by their question. Entries track how
+// often they are hit, and a hot entry which is close to expiring gets queued
+// for a refresh, so that popular names never fall out of the cache.
+//
+// Thread safe: each call holds a lock for as long as it takes, which is a
+// hash lookup and a copy of the reply.
+class AnswerCache {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  struct Options {
+    // An entry is prefetched once less than this fraction of its TTL remains.
+    double prefetch_fraction = 0.1;
+
+    // An entry needs at least this many hits during its lifetime before it is
+    // considered popular enough to prefetch.
+    uint32_t prefetch_min_hits = 8;
+
+    // Entries with a TTL lower than this are never prefetched, since the
+    // prefetch window would be too short to be useful.
+    uint32_t prefetch_min_ttl = 10;
+
+    // How long a queued refresh is waited on. One whose response hasn't been
+    // inserted by then is taken to have failed, and the entry can be queued
+    // again. Longer than the forwarder's timeout, so as not to ask twice.
+    std::chrono::seconds prefetch_timeout{10};
+
+    // How long an expired entry is kept around to be served stale while its
+    // refresh is slow or failing (RFC 8767 suggests one to three days).
+    std::chrono::seconds stale_window{24 * 60 * 60};
+
+    // The TTL given to stale answers, and how long after serving one the
+    // entry is answered stale straight away instead of waiting on upstream
+    // again (the "stale-refresh-timer" of RFC 8767).
+    uint32_t stale_ttl = 30;
+
+    size_t max_entries = 4096;
+  };
+
+  struct Stats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t inserts = 0;
+    uint64_t evictions = 0;
+    // Refreshes queued, whether of a hot entry before expiry or of one that is
+    // being answered stale.
+    uint64_t prefetches_issued = 0;
+
+    // Hits which happened after the entry would have expired, had it not been
+    // refreshed by a prefetch. Each of these would otherwise have been a miss.
+    uint64_t prefetch_hits_saved = 0;
+
+    uint64_t stale_hits = 0;
+  };
+
+  AnswerCache();
+  explicit AnswerCache(Options options);
+
+  // Copies the cached response for |key| into |out|, with the ID and question
+  // section of |query| patched in (so that the asker gets back their own name
+  // casing), and the TTLs of all records counted down to the time remaining.
+  // Returns false on a miss.
+  //
+  // An expired entry which was served stale within the last |stale_ttl|
+  // seconds is also a hit; it is answered stale and queued for a refresh.
+  bool Lookup(const CacheKey& key,
+              const uint8_t* query,
+              size_t query_len,
+              std::vector<uint8_t>* out,
+              Clock::time_point now = Clock::now());
+
+  // Like Lookup, but will also answer from an expired entry, as long as it is
+  // still within the stale window. Stale answers carry a TTL of |stale_ttl|.
+  // This is for when upstream has failed to answer in time, so unlike Lookup
+  // it doesn't queue a refresh; one is assumed to be in flight already.
+  bool LookupStale(const CacheKey& key,
+                   const uint8_t* query,
+                   size_t query_len,
+                   std::vector<uint8_t>* out,
+                   Clock::time_point now = Clock::now());
+
+  // Stores a serialized response. The lifetime of the entry is the lowest TTL
+  // of all of the records in it. Responses without records are not cached.
+  void Insert(const CacheKey& key,
+              const uint8_t* data,
+              size_t len,
+              Clock::time_point now = Clock::now());
+
+  // Hands back every key that has been queued for a prefetch since the last
+  // call. The owner is expected to refresh them after the current reply has
+  // been sent, and Insert the new response.
+  std::vector<CacheKey> TakePrefetches();
+
+  size_t Size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_.size();
+  }
+  Stats GetStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+  }
+  base::json::Object Render() const;
+
+ private:
+  struct Entry {
+    std::vector<uint8_t> wire;
+    std::vector<uint16_t> ttl_offsets;
+    Clock::time_point inserted;
+    Clock::time_point expires;
+    uint32_t ttl = 0;
+    uint32_t hits = 0;
+    // When a refresh of this entry was last queued, if one was.
+    std::optional<Clock::time_point> prefetch_queued;
+
+    // If this entry was written by a prefetch, the time at which the entry
+    // that it replaced would have expired.
+    std::optional<Clock::time_point> replaced_expiry;
+
+    // The last time this entry was served stale, if it has expired.
+    std::optional<Clock::time_point> served_stale;
+
+    // Whether this entry has been hit since the clock's hand last passed it.
+    bool referenced = false;
+  };
+
+  // Lookup, for a caller already holding |mutex_|.
+  bool LookupLocked(const CacheKey& key,
+                    const uint8_t* query,
+                    size_t query_len,
+                    std::vector<uint8_t>* out,
+                    Clock::time_point now);
+  // Whether a refresh of |entry| was queued, and could still land.
+  bool PrefetchPending(const Entry& entry, Clock::time_point now) const;
+  bool ShouldPrefetch(const Entry& entry, Clock::time_point now) const;
+  void QueuePrefetch(const CacheKey& key, Entry* entry, Clock::time_point now);
+  bool IsStale(const Entry& entry, Clock::time_point now) const;
+  void Serve(const Entry& entry,
+             const uint8_t* query,
+             size_t query_len,
+             std::vector<uint8_t>* out,
+             uint32_t ttl);
+  bool ServeStale(Entry* entry,
+                  const uint8_t* query,
+                  size_t query_len,
+                  std::vector<uint8_t>* out,
+                  Clock::time_point now);
+  size_t MakeRoom(Clock::time_point now);
+
+  Options options_;
+  mutable std::mutex mutex_;
+  Stats stats_;
+  std::unordered_map<CacheKey, Entry, CacheKeyHash> entries_;
+  std::vector<CacheKey> prefetches_;
+
+  // Every entry, in the order eviction considers them. Map nodes never move,
+  // so these stay valid until the entry is erased.
+  std::vector<std::pair<const CacheKey, Entry>*> clock_;
+  size_t hand_ = 0;
+};
+
+}  // namespace homedns
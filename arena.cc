@@ -0,0 +1,22 @@
+#include "arena.h"
+
+#include <algorithm>
+
+namespace homedns {
+
+Arena::Arena(size_t initial_size)
+    : initial_(std::make_unique<std::byte[]>(initial_size)),
+      buffer_(initial_.get(), initial_size) {}
+
+void Arena::Reset() {
+  buffer_.release();
+  allocated_ = 0;
+}
+
+void* Arena::do_allocate(size_t bytes, size_t alignment) {
+  allocated_ += bytes;
+  high_water_ = std::max(high_water_, allocated_);
+  return buffer_.allocate(bytes, alignment);
+}
+
+}  // namespace homedns
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+
+namespace homedns {
+
+// A bump allocator for everything one query needs: the parsed packet, its
+// names and sections, and the response built for it. Nothing is freed on its
+// own; Reset() drops it all at once after the reply has gone out.
+//
+// The first |initial_size| bytes are allocated up front and reused by every
+// query, so a typical query never touches the heap at all. Bigger ones spill
+// over into blocks from the default resource, which Reset() gives back.
+//
+// Not thread safe: each worker loop owns its own.
+class Arena : public std::pmr::memory_resource {
+ public:
+  static constexpr size_t kDefaultSize = 32 << 10;
+
+  explicit Arena(size_t initial_size = kDefaultSize);
+
+  // Releases everything allocated since the last reset. Anything still using
+  // the arena must already be gone.
+  void Reset();
+
+  // Bytes handed out since the last reset, and the most there have ever been.
+  size_t BytesAllocated() const { return allocated_; }
+  size_t HighWater() const { return high_water_; }
+
+  // Resets |arena| when it goes out of scope, which should be after every
+  // packet built in it.
+  class ScopedReset {
+   public:
+    explicit ScopedReset(Arena* arena) : arena_(arena) {}
+    ~ScopedReset() { arena_->Reset(); }
+
+   private:
+    Arena* arena_;
+  };
+
+ private:
+  void* do_allocate(size_t bytes, size_t alignment) override;
+  void do_deallocate(void*, size_t, size_t) override {}
+  bool do_is_equal(const memory_resource& other) const noexcept override {
+    return this == &other;
+  }
+
+  std::unique_ptr<std::byte[]> initial_;
+  std::pmr::monotonic_buffer_resource buffer_;
+  size_t allocated_ = 0;
+  size_t high_water_ = 0;
+};
+
+// Deletes objects made with NewObject, handing their memory back to the
+// resource it came from.
+struct ResourceDeleter {
+  std::pmr::memory_resource* memory;
+
+  template <typename T>
+  void operator()(T* object) const {
+    std::pmr::polymorphic_allocator<T>(memory).delete_object(object);
+  }
+};
+
+template <typename T>
+using ResourcePtr = std::unique_ptr<T, ResourceDeleter>;
+
+template <typename T, typename... Args>
+ResourcePtr<T> NewObject(std::pmr::memory_resource* memory, Args&&... args) {
+  std::pmr::polymorphic_allocator<T> allocator(memory);
+  return ResourcePtr<T>(allocator.template new_object<T>(
+                            std::forward<Args>(args)...),
+                        ResourceDeleter{memory});
+}
+
+}  // namespace homedns
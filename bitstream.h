@@ -1,24 +1,23 @@
 #pragma once
 
+#include <algorithm>
 #include <bitset>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
-#include <sstream>
 #include <type_traits>
 
 #include "status.h"
 
 namespace homedns {
 
-#define AssignOrRetError(d_ptr, expr)                 \
-  do {                                                \
-    auto v_or_error = (expr);                         \
-    if (v_or_error.has_value())                       \
-      *d_ptr = std::move(v_or_error).value();         \
-    else                                              \
-      return std::move(v_or_error).error().AddHere(); \
+// Bails out of a stream read with the error, which is only a code.
+#define RETURN_IF_STREAM_ERROR(expr) \
+  do {                               \
+    auto st = (expr);                \
+    if (!st.is_ok())                 \
+      return st;                     \
   } while (0)
 
 class ReadStream {
@@ -30,13 +29,12 @@ class ReadStream {
   uint8_t* buffer_ = nullptr;
   bool owns_buffer_ = false;
 
-  BitstreamStatus::Or<uint8_t> ReadByte(size_t index) const {
-    if (index >= size_) {
-      return BitstreamStatus(BitstreamStatus::Codes::kOutOfBounds)
-          .WithData("byte", static_cast<int>(index))
-          .WithData("length", static_cast<int>(size_));
-    }
-    return BitstreamStatus::Or<uint8_t>(buffer_[index]);
+  BitstreamStatus ReadByte(size_t index, uint8_t* into) const {
+    if (index >= size_)
+      return {BitstreamStatus::Codes::kOutOfBounds,
+              static_cast<uint32_t>(index)};
+    *into = buffer_[index];
+    return base::OkStatus();
   }
 
  public:
@@ -70,7 +68,7 @@ class ReadStream {
     size_t i = 0;
     uint8_t byte_value;
 
-    AssignOrRetError(&byte_value, ReadByte(byte + i));
+    RETURN_IF_STREAM_ERROR(ReadByte(byte + i, &byte_value));
     while (bitsread > 0) {
       bitsread--;
       buffer <<= 1;
@@ -79,7 +77,7 @@ class ReadStream {
         bitoffset = 8;
         i++;
         if (bitsread)
-          AssignOrRetError(&byte_value, ReadByte(byte + i));
+          RETURN_IF_STREAM_ERROR(ReadByte(byte + i, &byte_value));
       } else {
         bitoffset--;
       }
@@ -125,8 +123,9 @@ class ReadStream {
 
       while (bitcount >= 8) {
         // puts("  reading full byte");
-        T temp;
-        AssignOrRetError(&temp, ReadByte(next_));
+        uint8_t byte;
+        RETURN_IF_STREAM_ERROR(ReadByte(next_, &byte));
+        T temp = byte;
         next_++;
         bitcount -= 8;
         buffer_msb -= 8;
@@ -137,7 +136,7 @@ class ReadStream {
       if (bitcount) {
         // std::cout << "  Remaining " << bitcount << " bits, filling buffer\n
         // ";
-        AssignOrRetError(&bitbuffer_, ReadByte(next_));
+        RETURN_IF_STREAM_ERROR(ReadByte(next_, &bitbuffer_));
         next_++;
         bitlag_ = 8;
       }
@@ -146,6 +145,22 @@ class ReadStream {
     *into = buffer;
     return base::OkStatus();
   }
+
+  // Reads |length| whole bytes, which is a memcpy when the stream is byte
+  // aligned.
+  BitstreamStatus NextBytes(uint8_t* into, size_t length) {
+    if (bitlag_) {
+      for (size_t i = 0; i < length; i++)
+        RETURN_IF_STREAM_ERROR(Next<8>(&into[i]));
+      return base::OkStatus();
+    }
+    if (length > size_ - next_)
+      return {BitstreamStatus::Codes::kOutOfBounds,
+              static_cast<uint32_t>(size_)};
+    memcpy(into, buffer_ + next_, length);
+    next_ += length;
+    return base::OkStatus();
+  }
 };
 
 class WriteStream {
@@ -157,12 +172,10 @@ class WriteStream {
   size_t bit_ = 7;
 
   BitstreamStatus WriteNextBit(uint8_t bit) {
-    if (byte_ >= size_) {
-      std::stringstream msg;
-      msg << "OOB Write on byte: " << byte_ << ", length: " << size_;
-      return {BitstreamStatus::Codes::kOutOfBounds, msg.str()};
-    }
-    buffer_[byte_] |= (bit << bit_);
+    if (byte_ >= size_)
+      return {BitstreamStatus::Codes::kOutOfBounds,
+              static_cast<uint32_t>(byte_)};
+    buffer_[byte_] = (buffer_[byte_] & ~(1 << bit_)) | (bit << bit_);
     if (bit_) {
       bit_--;
     } else {
@@ -195,6 +208,20 @@ class WriteStream {
 
   size_t CurrentByte() const { return byte_; }
 
+  size_t Capacity() const { return size_; }
+
+  // Discards everything written from |byte| onwards, and continues writing
+  // from there.
+  void Rewind(size_t byte) {
+    if (byte >= byte_ && bit_ == 7)
+      return;
+    size_t end = std::min(byte_ + 1, size_);
+    if (byte < end)
+      memset(buffer_ + byte, 0, end - byte);
+    byte_ = byte;
+    bit_ = 7;
+  }
+
   std::unique_ptr<ReadStream> Convert() {
     uint8_t* buffer = static_cast<uint8_t*>(malloc(byte_));
     memcpy(buffer, buffer_, byte_);
@@ -207,10 +234,24 @@ class WriteStream {
     static_assert(std::is_integral_v<T>);
     for (int i = bits; i; i--) {
       uint8_t bit = (from >> (i - 1)) & 0x01;
-      auto st = WriteNextBit(bit);
-      if (!st.is_ok())
-        return std::move(st).AddHere();
+      RETURN_IF_STREAM_ERROR(WriteNextBit(bit));
+    }
+    return base::OkStatus();
+  }
+
+  // Writes |length| whole bytes, which is a memcpy when the stream is byte
+  // aligned.
+  BitstreamStatus WriteBytes(const uint8_t* from, size_t length) {
+    if (bit_ != 7) {
+      for (size_t i = 0; i < length; i++)
+        RETURN_IF_STREAM_ERROR(Write<8>(from[i]));
+      return base::OkStatus();
     }
+    if (length > size_ - byte_)
+      return {BitstreamStatus::Codes::kOutOfBounds,
+              static_cast<uint32_t>(size_)};
+    memcpy(buffer_ + byte_, from, length);
+    byte_ += length;
     return base::OkStatus();
   }
 
@@ -223,8 +264,10 @@ class WriteStream {
     BitstreamStatus st = Write<bits, T>(from);
     byte_ = o_byte;
     bit_ = o_bit_;
-    return std::move(st).AddHere();
+    return st;
   }
 };
 
-}  // namespace homedns
\ No newline at end of file
+}  // namespace homedns
+
+#undef RETURN_IF_STREAM_ERROR
\ No newline at end of file
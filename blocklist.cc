@@ -0,0 +1,278 @@
+#include "blocklist.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include "error_reply.h"
+#include "suffix_tree.h"
+#include "wire.h"
+
+namespace homedns {
+
+namespace {
+
+constexpr uint64_t kOffsetBasis = 14695981039346656037ull;
+constexpr uint64_t kPrime = 1099511628211ull;
+
+constexpr uint16_t kARecordType = 1;
+constexpr uint16_t kAAAARecordType = 28;
+constexpr uint16_t kInternetClass = 1;
+
+// FNV-1a over one more label, with its length first so that "ab.c" and
+// "a.bc" differ.
+uint64_t MixLabel(uint64_t hash, std::string_view label) {
+  hash = (hash ^ label.size()) * kPrime;
+  for (char c : label)
+    hash = (hash ^ _suffix_tree::Lower(c)) * kPrime;
+  return hash;
+}
+
+// FNV leaves the high bits poorly mixed, and both the table and the filter
+// index by them.
+uint64_t Finish(uint64_t hash) {
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdull;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ull;
+  hash ^= hash >> 33;
+  // The low bit is the entry's match, and 0 is an empty slot.
+  hash &= ~uint64_t(1);
+  return hash ? hash : 2;
+}
+
+// Maps |hash| onto [0, n) without a division.
+size_t Reduce(uint64_t hash, size_t n) {
+  return (static_cast<unsigned __int128>(hash) * n) >> 64;
+}
+
+bool IsHostnameChar(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+         (c >= '0' && c <= '9') || c == '-' || c == '_';
+}
+
+bool IsAddress(std::string_view token) {
+  if (token.find(':') != std::string_view::npos)
+    return true;
+  return !token.empty() &&
+         std::all_of(token.begin(), token.end(),
+                     [](char c) { return (c >= '0' && c <= '9') || c == '.'; });
+}
+
+std::string_view NextToken(std::string_view* line) {
+  size_t start = line->find_first_not_of(" \t\r");
+  if (start == std::string_view::npos) {
+    *line = {};
+    return {};
+  }
+  line->remove_prefix(start);
+  size_t end = line->find_first_of(" \t\r");
+  std::string_view token = line->substr(0, end);
+  line->remove_prefix(token.size());
+  return token;
+}
+
+void AppendU16(std::vector<uint8_t>* out, uint16_t value) {
+  out->push_back(value >> 8);
+  out->push_back(value);
+}
+
+// One record for the question's name, by a pointer to it, with an all zeros
+// address.
+std::vector<uint8_t> NullRecord(uint16_t type, uint16_t length, uint32_t ttl) {
+  std::vector<uint8_t> record;
+  AppendU16(&record, 0xC000 | wire::kHeaderSize);
+  AppendU16(&record, type);
+  AppendU16(&record, kInternetClass);
+  AppendU16(&record, ttl >> 16);
+  AppendU16(&record, ttl);
+  AppendU16(&record, length);
+  record.resize(record.size() + length, 0);
+  return record;
+}
+
+}  // namespace
+
+bool Blocklist::Builder::Add(std::string_view name, Match match) {
+  std::string_view labels[_suffix_tree::kMaxLabels];
+  size_t count = _suffix_tree::SplitName(name, labels);
+  if (count == 0)
+    return false;
+  uint64_t hash = kOffsetBasis;
+  for (size_t i = count; i > 0; i--) {
+    std::string_view label = labels[i - 1];
+    if (label.empty() || label.size() > 63 ||
+        !std::all_of(label.begin(), label.end(), IsHostnameChar)) {
+      return false;
+    }
+    hash = MixLabel(hash, label);
+  }
+  entries_.push_back(Finish(hash) | (match == Match::kSubdomains ? 1 : 0));
+  return true;
+}
+
+void Blocklist::Builder::Parse(std::string_view text, Match match) {
+  while (!text.empty()) {
+    size_t newline = text.find('\n');
+    std::string_view line = text.substr(0, newline);
+    text.remove_prefix(newline == std::string_view::npos ? text.size()
+                                                         : newline + 1);
+    // Adblock style exceptions and element hiding rules aren't names.
+    if (line.starts_with("@@") || line.find("##") != std::string_view::npos ||
+        line.find("#@#") != std::string_view::npos) {
+      continue;
+    }
+    line = line.substr(0, line.find_first_of("#!"));
+
+    std::string_view first = NextToken(&line);
+    if (first.empty())
+      continue;
+    if (IsAddress(first)) {
+      // Hosts files list the machine's own names too, none of which are
+      // worth blocking.
+      for (std::string_view name = NextToken(&line); !name.empty();
+           name = NextToken(&line)) {
+        if (name.find('.') != std::string_view::npos &&
+            !name.starts_with("localhost"))
+          Add(name, match);
+      }
+      continue;
+    }
+    if (!NextToken(&line).empty())
+      continue;
+    if (first.starts_with("||") && first.ends_with("^")) {
+      Add(first.substr(2, first.size() - 3), Match::kSubdomains);
+    } else if (first.starts_with("*.")) {
+      Add(first.substr(2), Match::kSubdomains);
+    } else {
+      Add(first, match);
+    }
+  }
+}
+
+ConfigStatus Blocklist::Builder::Load(const std::string& path, Match match) {
+  std::ifstream file(path);
+  if (!file)
+    return ConfigStatus(ConfigStatus::Codes::kFileNotFound, path);
+  std::stringstream contents;
+  contents << file.rdbuf();
+  Parse(contents.str(), match);
+  return base::OkStatus();
+}
+
+Blocklist Blocklist::Builder::Build() && {
+  // Lists overlap a lot; keep one entry a name, covering its subdomains if
+  // any of its entries did.
+  std::sort(entries_.begin(), entries_.end());
+  size_t kept = 0;
+  for (uint64_t entry : entries_) {
+    if (kept && (entries_[kept - 1] | 1) == (entry | 1))
+      entries_[kept - 1] |= entry;
+    else
+      entries_[kept++] = entry;
+  }
+  entries_.resize(kept);
+
+  Blocklist list;
+  list.size_ = kept;
+  if (kept == 0)
+    return list;
+  list.table_.resize(kept + kept / 4 + 1);
+  list.bloom_.resize((kept * kBloomBits + 511) / 512);
+  for (uint64_t entry : entries_) {
+    list.table_[list.Find(entry)] = entry;
+    uint64_t fingerprint = entry & ~uint64_t(1);
+    uint64_t bits = fingerprint * 0x9e3779b97f4a7c15ull;
+    Block& block = list.bloom_[Reduce(fingerprint, list.bloom_.size())];
+    for (size_t i = 0; i < kBloomProbes; i++) {
+      size_t bit = (bits >> (i * 9)) & 511;
+      block.words[bit / 64] |= uint64_t(1) << (bit % 64);
+    }
+  }
+  entries_ = {};
+  return list;
+}
+
+bool Blocklist::Blocks(std::string_view name) const {
+  std::string_view labels[_suffix_tree::kMaxLabels];
+  return Blocks(labels, _suffix_tree::SplitName(name, labels));
+}
+
+bool Blocklist::Blocks(const DnsLabelSeq& name) const {
+  std::string_view labels[_suffix_tree::kMaxLabels];
+  return Blocks(labels, _suffix_tree::SplitName(name, labels));
+}
+
+bool Blocklist::Blocks(const std::string_view* labels, size_t count) const {
+  if (size_ == 0)
+    return false;
+  uint64_t hash = kOffsetBasis;
+  for (size_t i = count; i > 0; i--) {
+    hash = MixLabel(hash, labels[i - 1]);
+    uint64_t fingerprint = Finish(hash);
+    if (!MayContain(fingerprint))
+      continue;
+    uint64_t entry = table_[Find(fingerprint)];
+    // Only the whole name matches an exact entry.
+    if (entry && ((entry & 1) || i == 1))
+      return true;
+  }
+  return false;
+}
+
+bool Blocklist::MayContain(uint64_t fingerprint) const {
+  uint64_t bits = fingerprint * 0x9e3779b97f4a7c15ull;
+  const Block& block = bloom_[Reduce(fingerprint, bloom_.size())];
+  for (size_t i = 0; i < kBloomProbes; i++) {
+    size_t bit = (bits >> (i * 9)) & 511;
+    if (!(block.words[bit / 64] & (uint64_t(1) << (bit % 64))))
+      return false;
+  }
+  return true;
+}
+
+size_t Blocklist::Find(uint64_t fingerprint) const {
+  size_t slot = Reduce(fingerprint, table_.size());
+  while (table_[slot] && (table_[slot] | 1) != (fingerprint | 1)) {
+    if (++slot == table_.size())
+      slot = 0;
+  }
+  return slot;
+}
+
+BlockedReplies::BlockedReplies(Mode mode, uint32_t ttl)
+    : mode_(mode),
+      a_(NullRecord(kARecordType, 4, ttl)),
+      aaaa_(NullRecord(kAAAARecordType, 16, ttl)) {}
+
+size_t BlockedReplies::Write(const uint8_t* query,
+                             size_t len,
+                             uint8_t* out,
+                             size_t out_len) const {
+  if (mode_ == Mode::kNameError)
+    return WriteErrorReply(query, len, ResponseCode::kNameError, out, out_len);
+  size_t offset =
+      WriteErrorReply(query, len, ResponseCode::kNoError, out, out_len);
+  if (offset <= wire::kHeaderSize)
+    return offset;
+  // Anything but an address query gets an empty answer.
+  const std::vector<uint8_t>* record = nullptr;
+  switch (wire::ReadU16(out + offset - 4)) {
+    case kARecordType:
+      record = &a_;
+      break;
+    case kAAAARecordType:
+      record = &aaaa_;
+      break;
+    default:
+      return offset;
+  }
+  if (offset + record->size() > out_len)
+    return offset;
+  memcpy(out + offset, record->data(), record->size());
+  wire::WriteU16(out + 6, 1);
+  return offset + record->size();
+}
+
+}  // namespace homedns
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "labels.h"
+#include "status.h"
+
+namespace homedns {
+
+// The set of names that are answered with a blocked reply instead of being
+// resolved, loaded from ad and tracker lists with up to millions of entries.
+// An entry either blocks exactly its name, or its name and every name below
+// it.
+//
+// Names are kept only as 64 bit fingerprints of their lowercased labels, in
+// an open addressed table at 80% load: about 10 bytes a name, whatever its
+// length. Two names share a fingerprint with odds of one in 2^64 divided by
+// the number of names, which is a risk a blocklist can take. In front of the
+// table sits a blocked Bloom filter of 10 bits a name, one cache line per
+// probe, small enough to stay in cache. Most names asked about aren't
+// blocked, and most of those never get past it.
+//
+// Fingerprints are computed from the last label towards the first, so one
+// pass over a name yields the fingerprint of every one of its suffixes,
+// which is all that checking the entries that cover it takes.
+//
+// The set is immutable once built; to change it, build a new one and swap it
+// in.
+class Blocklist {
+ public:
+  enum class Match : uint8_t {
+    kExact,
+    kSubdomains,
+  };
+
+  class Builder {
+   public:
+    // Adds |name|. Returns false if it isn't a name that could be asked for.
+    bool Add(std::string_view name, Match match);
+
+    // Adds every name of a list, which may be a hosts file ("0.0.0.0 a.com
+    // b.com"), or a list of one name a line. Plain names block exactly
+    // themselves, or with |match| of kSubdomains, everything below them too;
+    // "*.a.com" and "||a.com^" always do. Blank lines and anything after a
+    // '#' or '!' are ignored, and so are lines that don't hold a name, since
+    // published lists are full of those.
+    void Parse(std::string_view text, Match match = Match::kExact);
+    ConfigStatus Load(const std::string& path, Match match = Match::kExact);
+
+    Blocklist Build() &&;
+
+   private:
+    std::vector<uint64_t> entries_;
+  };
+
+  Blocklist() = default;
+
+  // Whether |name|, or a name covering its subdomains, is on the list.
+  bool Blocks(std::string_view name) const;
+  bool Blocks(const DnsLabelSeq& name) const;
+
+  size_t Size() const { return size_; }
+  size_t MemoryUsage() const {
+    return table_.capacity() * sizeof(uint64_t) +
+           bloom_.capacity() * sizeof(Block);
+  }
+
+ private:
+  // Bits of the Bloom filter a name, and how many of them it sets.
+  static constexpr size_t kBloomBits = 10;
+  static constexpr size_t kBloomProbes = 6;
+
+  struct alignas(64) Block {
+    uint64_t words[8];
+  };
+
+  bool Blocks(const std::string_view* labels, size_t count) const;
+  bool MayContain(uint64_t fingerprint) const;
+  // The table slot holding |fingerprint|, or the empty one it would go in.
+  size_t Find(uint64_t fingerprint) const;
+
+  // Entries are fingerprints with the low bit replaced by whether they cover
+  // subdomains; 0 marks an empty slot.
+  std::vector<uint64_t> table_;
+  std::vector<Block> bloom_;
+  size_t size_ = 0;
+};
+
+// Answers blocked names, either as not existing at all, or as existing at
+// the null address (0.0.0.0 or ::), which some clients give up on sooner.
+// The answer records are serialized once up front, so each reply is a copy of
+// the query's header and question and, for an address query, of one record.
+class BlockedReplies {
+ public:
+  enum class Mode : uint8_t {
+    kNullAddress,
+    kNameError,
+  };
+
+  BlockedReplies(Mode mode, uint32_t ttl);
+
+  // Returns the length of the reply, or 0 if |query| should not be answered.
+  size_t Write(const uint8_t* query,
+               size_t len,
+               uint8_t* out,
+               size_t out_len) const;
+
+ private:
+  Mode mode_;
+  std::vector<uint8_t> a_;
+  std::vector<uint8_t> aaaa_;
+};
+
+}  // namespace homedns
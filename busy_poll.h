@@ -0,0 +1,59 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+
+namespace homedns {
+
+// Decides how long a loop spins on non-blocking receives before it gives up
+// and sleeps in poll(). Spinning takes the wake-up out of the query path, at
+// the cost of a core while it lasts.
+//
+// The budget backs off by half every time a spin comes up empty, down to
+// kMinSpin, and goes back to the full budget as soon as one doesn't; so a
+// busy socket is spun on all the time, and an idle one mostly slept on.
+class BusyPoller {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  static constexpr std::chrono::nanoseconds kMinSpin =
+      std::chrono::microseconds(5);
+
+  struct Stats {
+    // Spins which received something, and which gave up and slept.
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+  };
+
+  explicit BusyPoller(std::chrono::microseconds budget)
+      : budget_(std::max<std::chrono::nanoseconds>(budget, kMinSpin)),
+        current_(budget_) {}
+
+  // Runs |receive| until it returns true, or the current budget is used up.
+  // Returns whether it ever did.
+  template <typename F>
+  bool Spin(F&& receive) {
+    Clock::time_point deadline = Clock::now() + current_;
+    do {
+      if (receive()) {
+        current_ = budget_;
+        stats_.hits++;
+        return true;
+      }
+    } while (Clock::now() < deadline);
+    current_ = std::max(current_ / 2, kMinSpin);
+    stats_.misses++;
+    return false;
+  }
+
+  std::chrono::nanoseconds CurrentBudget() const { return current_; }
+  const Stats& GetStats() const { return stats_; }
+
+ private:
+  const std::chrono::nanoseconds budget_;
+  std::chrono::nanoseconds current_;
+  Stats stats_;
+};
+
+}  // namespace homedns
@@ -0,0 +1,84 @@
+#include "client_acl.h"
+
+#include <fstream>
+#include <sstream>
+
+namespace homedns {
+
+namespace {
+
+std::string_view Trim(std::string_view text) {
+  while (!text.empty() && isspace(static_cast<unsigned char>(text.front())))
+    text.remove_prefix(1);
+  while (!text.empty() && isspace(static_cast<unsigned char>(text.back())))
+    text.remove_suffix(1);
+  return text;
+}
+
+}  // namespace
+
+ConfigStatus ClientAcl::Builder::Add(std::string_view text, Action action) {
+  auto m_prefix = AddressPrefix::Parse(text);
+  if (!m_prefix.has_value())
+    return std::move(m_prefix).error();
+  AddressPrefix prefix = std::move(m_prefix).value();
+  if (prefix.family == AF_INET)
+    v4_.Insert(prefix.bytes, prefix.bits, action);
+  else
+    v6_.Insert(prefix.bytes, prefix.bits, action);
+  return base::OkStatus();
+}
+
+ClientAcl ClientAcl::Builder::Build() && {
+  ClientAcl acl;
+  acl.v4_ = std::move(v4_).Build();
+  acl.v6_ = std::move(v6_).Build();
+  return acl;
+}
+
+// static
+ConfigStatus::Or<ClientAcl> ClientAcl::Parse(std::string_view text) {
+  Builder builder;
+  size_t line_number = 0;
+  while (!text.empty()) {
+    line_number++;
+    size_t newline = text.find('\n');
+    std::string_view line = text.substr(0, newline);
+    text.remove_prefix(newline == std::string_view::npos ? text.size()
+                                                         : newline + 1);
+    line = Trim(line.substr(0, line.find('#')));
+    if (line.empty())
+      continue;
+
+    size_t space = line.find_first_of(" \t");
+    std::string_view verb = line.substr(0, space);
+    std::string_view prefix =
+        space == std::string_view::npos ? "" : Trim(line.substr(space));
+    Action action;
+    if (verb == "allow") {
+      action = Action::kAllow;
+    } else if (verb == "deny") {
+      action = Action::kDeny;
+    } else {
+      return ConfigStatus(ConfigStatus::Codes::kSyntaxError,
+                          "expected allow or deny: " + std::string(line))
+          .WithData("line", (int)line_number);
+    }
+    auto status = builder.Add(prefix, action);
+    if (!status.is_ok())
+      return std::move(status).WithData("line", (int)line_number);
+  }
+  return std::move(builder).Build();
+}
+
+// static
+ConfigStatus::Or<ClientAcl> ClientAcl::Load(const std::string& path) {
+  std::ifstream file(path);
+  if (!file)
+    return ConfigStatus(ConfigStatus::Codes::kFileNotFound, path);
+  std::stringstream contents;
+  contents << file.rdbuf();
+  return Parse(contents.str());
+}
+
+}  // namespace homedns
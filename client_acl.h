@@ -0,0 +1,63 @@
+#pragma once
+
+#include <netinet/in.h>
+#include <string>
+#include <string_view>
+
+#include "prefix_table.h"
+#include "status.h"
+
+namespace homedns {
+
+// Decides which clients may query the server, from a list of allowed and
+// denied IPv4 and IPv6 prefixes. The longest matching prefix wins, and clients
+// matching no prefix at all are denied. This runs before a packet is looked
+// at, so it is a couple of table lookups and nothing else.
+class ClientAcl {
+ public:
+  enum class Action : uint8_t { kDeny, kAllow };
+
+  class Builder {
+   public:
+    // Adds an address ("10.1.2.3", "fe80::1") or a prefix ("10.0.0.0/8").
+    ConfigStatus Add(std::string_view text, Action action);
+    ClientAcl Build() &&;
+
+   private:
+    PrefixTable<Action, 4>::Builder v4_;
+    PrefixTable<Action, 16>::Builder v6_;
+  };
+
+  // Parses an ACL file, which has one "allow <prefix>" or "deny <prefix>" per
+  // line. Blank lines and anything after a '#' are ignored.
+  static ConfigStatus::Or<ClientAcl> Parse(std::string_view text);
+  static ConfigStatus::Or<ClientAcl> Load(const std::string& path);
+
+  Action Check(const struct sockaddr_in& client) const {
+    const Action* action =
+        v4_.Lookup(reinterpret_cast<const uint8_t*>(&client.sin_addr.s_addr));
+    return action ? *action : Action::kDeny;
+  }
+
+  // IPv4 mapped addresses (::ffff:a.b.c.d) are checked against the IPv4
+  // prefixes, as that is what a dual stack socket reports IPv4 clients as.
+  Action Check(const struct in6_addr& client) const {
+    const Action* action;
+    if (IN6_IS_ADDR_V4MAPPED(&client))
+      action = v4_.Lookup(client.s6_addr + 12);
+    else
+      action = v6_.Lookup(client.s6_addr);
+    return action ? *action : Action::kDeny;
+  }
+
+  size_t PrefixCount() const {
+    return v4_.PrefixCount() + v6_.PrefixCount();
+  }
+  size_t MemoryUsage() const { return v4_.MemoryUsage() + v6_.MemoryUsage(); }
+
+ private:
+  PrefixTable<Action, 4> v4_;
+  PrefixTable<Action, 16> v6_;
+};
+
+}  // namespace homedns
@@ -1,118 +1,928 @@
 
 #include <arpa/inet.h>
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <optional>
+#include <thread>
 
 #include "base/bind/bind.h"
 #include "base/json/json_io.h"
 
+#include "answer_cache.h"
+#include "arena.h"
 #include "bitstream.h"
+#include "blocklist.h"
+#include "client_acl.h"
+#include "dynamic_zone.h"
+#include "error_reply.h"
+#include "forward_rules.h"
+#include "forwarder.h"
+#include "header_filter.h"
+#include "host_table.h"
+#include "hosts_watcher.h"
 #include "packet.h"
+#include "pipeline.h"
+#include "qname_steering.h"
+#include "reverse_index.h"
 #include "udp_server.h"
+#include "views.h"
+#include "wire.h"
 
 #include "responders/responders.h"
 
 namespace homedns {
 
-PacketStatus::Or<DnsPacket> RespondTo(const DnsQuestion* question,
+// A pool of upstreams that forwarding rules send names to, with a cache of
+// its own, since its answers may differ from everyone else's.
+struct UpstreamPool {
+  std::string name;  // ForwardRules::Render() of its upstreams.
+  std::unique_ptr<Forwarder> forwarder;
+  std::unique_ptr<AnswerCache> cache;
+};
+
+// A set of forwarding rules, with the pool for each of its pool indexes.
+struct Routes {
+  ForwardRules rules;
+  std::vector<UpstreamPool*> pools;
+};
+
+struct Resolver {
+  HeaderFilter filter;
+
+  // Checked before anything else, so that unwanted clients cost as little as
+  // possible. Reloaded from |acl_path| on SIGHUP, if it is set, by swapping
+  // in a new one; workers still checking against the old one keep it alive.
+  std::atomic<std::shared_ptr<const ClientAcl>> acl;
+  std::string acl_path;
+
+  // Names answered with |blocked| instead of being resolved. Reloaded from
+  // |blocklist_paths| on SIGHUP, the same way as the ACL.
+  std::atomic<std::shared_ptr<const Blocklist>> blocklist;
+  std::vector<std::string> blocklist_paths;
+  std::unique_ptr<BlockedReplies> blocked;
+
+  // Each client's view decides which names are answered locally, and holds
+  // the cache for those answers.
+  std::unique_ptr<Views> views;
+
+  // The names of the addresses in |hosts| and |updates|, answering PTR
+  // queries for them straight off the wire. Set along with either.
+  std::unique_ptr<ReverseIndex> reverse;
+
+  // Names and addresses from hosts files and DHCP leases, kept up to date
+  // as those change, for every view.
+  std::unique_ptr<HostTable> hosts;
+  std::unique_ptr<HostsWatcher> hosts_watcher;
+
+  // Records that clients register for themselves with UPDATEs, for every
+  // view. Without it, UPDATEs aren't implemented.
+  std::unique_ptr<DynamicZone> updates;
+
+  // Answers from upstream, which are the same for every view, split by
+  // QnameSteering so that each of several loops steered by name only ever
+  // uses its own partition.
+  std::vector<std::unique_ptr<AnswerCache>> caches;
+
+  // When set, names which aren't in the client's view are sent upstream
+  // instead of being answered by the local responders.
+  std::unique_ptr<Forwarder> forwarder;
+  // For |forwarder| and every pool.
+  Forwarder::Options upstream_options;
+
+  // Names covered by a forwarding rule go to its pool instead, whether or
+  // not there is a |forwarder|. Reloaded from |routes_path| on SIGHUP, the
+  // same way as the ACL. Pools are kept for as long as the server runs, so
+  // that queries in flight on one that a reload routes away from are still
+  // answered, and rules that keep their upstreams keep their cache.
+  std::atomic<std::shared_ptr<const Routes>> routes;
+  std::string routes_path;
+  std::vector<std::unique_ptr<UpstreamPool>> pools;
+
+  // Negative answers for names the local responders don't know about.
+  std::unique_ptr<NegativeReplies> negative;
+
+  // When set, requests are handled on its worker threads instead of the loop.
+  std::unique_ptr<Pipeline> pipeline;
+
+  // What asynchronous responders wait on.
+  ResponderContext responders;
+};
+
+// Holds every packet built while handling one request, and is reset once the
+// request is done with. Each thread that handles requests has its own.
+Arena* RequestArena() {
+  thread_local Arena arena;
+  return &arena;
+}
+
+PacketStatus::Or<DnsPacket> RespondTo(const Zone& zone,
+                                      const DnsQuestion* question,
                                       DnsPacket response) {
   response = std::move(response).AddQuestion(*question).Unwrap();
+  if (zone.Contains(question->LabelSequence))
+    return zone.Answer(question, std::move(response));
+
+  return FindResponder(question->Type)(question, std::move(response));
+}
+
+DnsPacket CreateResponse(uint16_t id, std::pmr::memory_resource* memory) {
+  return DnsPacket::Create(id, memory)
+      .SetQuestionOrResponse(DnsPacket::PacketType::kResponse)
+      .SetOpCode(0)
+      .SetIsAuthoritative(1)
+      .SetIsTruncated(0)
+      .SetRecursionDesired(1)
+      .SetRecursionAvailable(0)
+      .SetResponseCode(0)
+      .SetReserved(0);
+}
+
+PacketStatus::Or<DnsPacket> BuildResponse(const View* view,
+                                          DnsPacket* query,
+                                          std::pmr::memory_resource* memory) {
+  DnsPacket response = CreateResponse(query->GetPacketHeader().ID, memory);
+
+  size_t q_count = query->GetNumQuestions();
+  for (size_t q_index = 0; q_index < q_count; q_index++) {
+    std::optional<const DnsQuestion*> q = query->GetQuestion(q_index);
+    if (!q.has_value()) {
+      perror("Tried to get a question with bounds check, but failed");
+      std::cout << query->Render() << "\n";
+      exit(1);
+    }
+    auto m_response = RespondTo(view->zone, q.value(), std::move(response));
+    if (!m_response.has_value())
+      return std::move(m_response).error();
+    response = std::move(m_response).value();
+  }
+  return response;
+}
+
+AnswerCache* UpstreamCache(Resolver* resolver, const CacheKey& key) {
+  size_t shard = QnameSteering::Shard(QnameSteering::HashName(key.name),
+                                      resolver->caches.size());
+  return resolver->caches[shard].get();
+}
+
+PacketStatus::Or<DnsPacket> BuildDynamicResponse(
+    const DynamicZone* updates,
+    DnsPacket* query,
+    std::pmr::memory_resource* memory) {
+  const DnsQuestion* question = query->GetQuestion(0).value();
+  auto m_response =
+      CreateResponse(query->GetPacketHeader().ID, memory).AddQuestion(*question);
+  if (!m_response.has_value())
+    return std::move(m_response).error();
+  return updates->Answer(question, std::move(m_response).value());
+}
+
+PacketStatus::Or<DnsPacket> BuildHostsResponse(
+    const HostTable* hosts,
+    DnsPacket* query,
+    std::pmr::memory_resource* memory) {
+  const DnsQuestion* question = query->GetQuestion(0).value();
+  auto m_response =
+      CreateResponse(query->GetPacketHeader().ID, memory).AddQuestion(*question);
+  if (!m_response.has_value())
+    return std::move(m_response).error();
+  return hosts->Answer(question, std::move(m_response).value());
+}
+
+void CacheReply(AnswerCache* cache,
+                const CacheKey& key,
+                const uint8_t* data,
+                size_t len) {
+  // Only complete NOERROR and NXDOMAIN answers are worth keeping.
+  uint8_t rcode = data[3] & 0x0F;
+  bool truncated = data[2] & 0x02;
+  if (!truncated && (rcode == 0 || rcode == 3))
+    cache->Insert(key, data, len);
+}
+
+void CacheUpstreamReply(Resolver* resolver,
+                        const CacheKey& key,
+                        const uint8_t* data,
+                        size_t len) {
+  CacheReply(UpstreamCache(resolver, key), key, data, len);
+}
+
+// Rebuilds the answer for a cache entry that is about to expire, either in
+// |view|'s cache or, without a view, the upstream one. This runs after the
+// reply which triggered it has already gone out, so the client that made it
+// hot doesn't pay for the refresh.
+void Prefetch(Resolver* resolver,
+              View* view,
+              Forwarder* upstream,
+              const CacheKey& key) {
+  if (view == nullptr) {
+    upstream->Refresh(key);
+    return;
+  }
+  auto m_query = DnsPacket::Create(0, RequestArena())
+                     .AddQuestion(key.name, key.type, key.klass);
+  if (!m_query.has_value())
+    return;
+  DnsPacket query = std::move(m_query).value();
+  auto m_response = BuildResponse(view, &query, RequestArena());
+  if (!m_response.has_value())
+    return;
+  DnsPacket response = std::move(m_response).value();
+  uint8_t reply[512];
+  WriteStream ws(sizeof(reply), reply);
+  if (!response.Export(&ws).is_ok())
+    return;
+  CacheReply(view->cache.get(), key, reply, ws.CurrentByte());
+}
+
+void RunPrefetches(Resolver* resolver,
+                   View* view,
+                   Forwarder* upstream,
+                   AnswerCache* cache) {
+  for (const CacheKey& key : cache->TakePrefetches())
+    Prefetch(resolver, view, upstream, key);
+}
+
+bool LookupStale(Resolver* resolver,
+                 const CacheKey& key,
+                 const uint8_t* query,
+                 size_t len,
+                 std::vector<uint8_t>* out) {
+  return UpstreamCache(resolver, key)->LookupStale(key, query, len, out);
+}
+
+bool LookupStaleInPool(UpstreamPool* pool,
+                       const CacheKey& key,
+                       const uint8_t* query,
+                       size_t len,
+                       std::vector<uint8_t>* out) {
+  return pool->cache->LookupStale(key, query, len, out);
+}
+
+// The pool a forwarding rule sends |name| to, if any.
+template <typename Name>
+UpstreamPool* Route(Resolver* resolver, const Name& name) {
+  if (resolver->routes_path.empty())
+    return nullptr;
+  std::shared_ptr<const Routes> routes = resolver->routes.load();
+  const uint32_t* index = routes ? routes->rules.Route(name) : nullptr;
+  return index ? routes->pools[*index] : nullptr;
+}
+
+void ReadUpstream(Forwarder* forwarder) {
+  forwarder->ReadReplies();
+}
+
+void ReadHostsEvents(HostsWatcher* watcher) {
+  watcher->ReadEvents();
+}
+
+// Splits a list of paths separated by colons, as in $PATH.
+std::vector<std::string> SplitPaths(std::string_view paths) {
+  std::vector<std::string> split;
+  while (!paths.empty()) {
+    size_t colon = paths.find(':');
+    if (colon)
+      split.emplace_back(paths.substr(0, colon));
+    paths.remove_prefix(colon == std::string_view::npos ? paths.size()
+                                                        : colon + 1);
+  }
+  return split;
+}
+
+// How often the forwarder looks for clients past their deadline, and queries
+// past their timeout; when it races queries, as often as a race may start.
+constexpr std::chrono::milliseconds kExpireInterval{50};
+
+std::chrono::milliseconds ExpireInterval(const Forwarder::Options& options) {
+  if (options.race_percentile <= 0)
+    return kExpireInterval;
+  return std::clamp(options.race_floor, std::chrono::milliseconds(1),
+                    kExpireInterval);
+}
+
+void ExpireQueries(Forwarder* forwarder,
+                   UDPServer* server,
+                   std::chrono::milliseconds interval) {
+  forwarder->ExpireQueries(server->Now());
+  server->RunAfter(interval, base::BindRepeating(&ExpireQueries, forwarder,
+                                                 server, interval));
+}
+
+// Responders' questions go wherever a client's for the same name would: to
+// the pool a rule routes it to, or else the default upstream, if there is one.
+void LookupUpstream(Resolver* resolver,
+                    const CacheKey& key,
+                    Forwarder::LookupCB cb) {
+  Forwarder* forwarder = resolver->forwarder.get();
+  if (UpstreamPool* pool = Route(resolver, key.name))
+    forwarder = pool->forwarder.get();
+  if (!forwarder) {
+    cb.Run({});
+    return;
+  }
+  forwarder->Lookup(key, std::move(cb));
+}
+
+void RunAfter(UDPServer* server,
+              std::chrono::milliseconds delay,
+              base::RepeatingCallback<void()> cb) {
+  server->RunAfter(delay, std::move(cb));
+}
+
+volatile std::sig_atomic_t reload_requested = 0;
+volatile std::sig_atomic_t stats_requested = 0;
+
+void RequestReload(int) {
+  reload_requested = 1;
+}
+
+void RequestStats(int) {
+  stats_requested = 1;
+}
+
+// The new ACL only replaces the old one once it has parsed completely, so a
+// broken file never leaves the server open (or closed).
+void ReloadAcl(Resolver* resolver) {
+  auto m_acl = ClientAcl::Load(resolver->acl_path);
+  if (!m_acl.has_value()) {
+    std::move(m_acl).error().Print();
+    return;
+  }
+  auto acl = std::make_shared<const ClientAcl>(std::move(m_acl).value());
+  resolver->acl = acl;
+  std::cout << "Loaded " << acl->PrefixCount()
+            << " ACL prefixes from " << resolver->acl_path << "\n";
+}
+
+// Likewise, a list that fails to load leaves the old one in place.
+void ReloadBlocklist(Resolver* resolver) {
+  Blocklist::Builder builder;
+  for (const std::string& path : resolver->blocklist_paths) {
+    auto status = builder.Load(path);
+    if (!status.is_ok()) {
+      status.Print();
+      return;
+    }
+  }
+  auto blocklist = std::make_shared<const Blocklist>(std::move(builder).Build());
+  resolver->blocklist = blocklist;
+  std::cout << "Loaded " << blocklist->Size() << " blocked names ("
+            << blocklist->MemoryUsage() / 1024 << " KB) from "
+            << resolver->blocklist_paths.size() << " lists\n";
+}
+
+// And rules that fail to load leave the old ones in place. Pools are looked
+// up by their upstreams, and only pools that no rule used before are
+// started, on |server|'s loop.
+void ReloadRoutes(Resolver* resolver, UDPServer* server) {
+  auto m_rules = ForwardRules::Load(resolver->routes_path);
+  if (!m_rules.has_value()) {
+    std::move(m_rules).error().Print();
+    return;
+  }
+  auto routes = std::make_shared<Routes>();
+  routes->rules = std::move(m_rules).value();
+  for (const ForwardRules::Pool& upstreams : routes->rules.Pools()) {
+    std::string name = ForwardRules::Render(upstreams);
+    auto it = std::find_if(
+        resolver->pools.begin(), resolver->pools.end(),
+        [&name](const auto& pool) { return pool->name == name; });
+    if (it != resolver->pools.end()) {
+      routes->pools.push_back(it->get());
+      continue;
+    }
+    auto forwarder = Forwarder::Create(upstreams, resolver->upstream_options);
+    if (!forwarder)
+      return;
+    auto pool = std::make_unique<UpstreamPool>(
+        UpstreamPool{name, std::move(forwarder),
+                     std::make_unique<AnswerCache>()});
+    Forwarder* started = pool->forwarder.get();
+    started->OnReply(base::BindRepeating(&CacheReply, pool->cache.get()));
+    started->OnStale(base::BindRepeating(&LookupStaleInPool, pool.get()));
+    server->Watch(started->GetFD(),
+                  base::BindRepeating(&ReadUpstream, started));
+    ExpireQueries(started, server,
+                  ExpireInterval(resolver->upstream_options));
+    routes->pools.push_back(pool.get());
+    resolver->pools.push_back(std::move(pool));
+  }
+  resolver->routes = std::shared_ptr<const Routes>(std::move(routes));
+  std::cout << "Loaded " << resolver->routes.load()->rules.RuleCount()
+            << " forwarding rules for " << resolver->pools.size()
+            << " upstream pools from " << resolver->routes_path << "\n";
+}
+
+void Tick(Resolver* resolver, UDPServer* server) {
+  if (reload_requested) {
+    reload_requested = 0;
+    if (!resolver->acl_path.empty())
+      ReloadAcl(resolver);
+    if (!resolver->blocklist_paths.empty())
+      ReloadBlocklist(resolver);
+    if (!resolver->routes_path.empty())
+      ReloadRoutes(resolver, server);
+  }
+  if (stats_requested) {
+    stats_requested = 0;
+    if (resolver->pipeline)
+      std::cout << resolver->pipeline->Render() << "\n";
+  }
+}
 
-  switch(question->Type) {
-    case DnsARecord::TYPE:
-      return ReplyARecord(question, std::move(response));
-    case DnsNSRecord::TYPE:
-      return ReplyNSRecord(question, std::move(response));
-    case DnsCNAMERecord::TYPE:
-      return ReplyCNAMERecord(question, std::move(response));
-    case DnsMXRecord::TYPE:
-      return ReplyMXRecord(question, std::move(response));
-    case DnsAAAARecord::TYPE:
-      return ReplyAAAARecord(question, std::move(response));
-    case DnsLOCRecord::TYPE:
-      return ReplyLOCRecord(question, std::move(response));
-    case DnsRPRecord::TYPE:
-      return ReplyRPRecord(question, std::move(response));
-    case DnsSOARecord::TYPE:
-      return ReplySOARecord(question, std::move(response));
-    case DnsTXTRecord::TYPE:
-      return ReplyTXTRecord(question, std::move(response));
+void ReplyWithError(Response* write_out,
+                    const uint8_t* data,
+                    size_t len,
+                    ResponseCode rcode) {
+  uint8_t reply[512];
+  size_t reply_len = WriteErrorReply(data, len, rcode, reply, sizeof(reply));
+  if (reply_len)
+    write_out->SendData(reply, reply_len);
+}
+
+// Answers a query that the responders couldn't, so that the client isn't left
+// to time out and ask again.
+void ReplyToFailure(Resolver* resolver,
+                    Response* write_out,
+                    const uint8_t* data,
+                    size_t len,
+                    const PacketStatus& error) {
+  uint8_t reply[512];
+  size_t reply_len = 0;
+  switch (error.code()) {
+    case PacketStatus::Codes::kNameNotFound:
+      reply_len = resolver->negative->WriteNameError(data, len, reply,
+                                                     sizeof(reply));
+      break;
+    case PacketStatus::Codes::kInvalidRecordType:
+      reply_len =
+          resolver->negative->WriteNoData(data, len, reply, sizeof(reply));
+      break;
     default:
-      return PacketStatus::Codes::kInvalidRecordType;
+      error.Print();
+      reply_len = WriteErrorReply(data, len, ResponseCode::kServerFailure,
+                                  reply, sizeof(reply));
+      break;
   }
+  if (reply_len)
+    write_out->SendData(reply, reply_len);
 }
 
-void OnRequest(Response write_out,
+// Sends the responders' answer to |data|, and caches it under |key|.
+void SendResponse(Resolver* resolver,
+                  View* view,
+                  const std::optional<CacheKey>& key,
+                  Response* write_out,
+                  const uint8_t* data,
+                  size_t len,
+                  PacketStatus::Or<DnsPacket> m_response) {
+  if (!m_response.has_value()) {
+    ReplyToFailure(resolver, write_out, data, len,
+                   std::move(m_response).error());
+    return;
+  }
+  DnsPacket response = std::move(m_response).value();
+
+  uint8_t reply[512];
+  WriteStream ws(sizeof(reply), reply);
+  auto ext = response.Export(&ws);
+  if (!ext.is_ok()) {
+    ext.Print();
+    ReplyWithError(write_out, data, len, ResponseCode::kServerFailure);
+    return;
+  }
+  write_out->SendData(reply, ws.CurrentByte());
+  if (key.has_value())
+    CacheReply(view->cache.get(), *key, reply, ws.CurrentByte());
+}
+
+void SendAsyncResponse(Resolver* resolver,
+                       View* view,
+                       const CacheKey& key,
+                       const std::vector<uint8_t>& query,
+                       Response write_out,
+                       PacketStatus::Or<DnsPacket> m_response) {
+  SendResponse(resolver, view, key, &write_out, query.data(), query.size(),
+               std::move(m_response));
+}
+
+// Starts |respond| on a response of its own, off the arena, since it may
+// well outlive this request's. The loop carries on while it waits, and the
+// reply goes out from wherever it finishes.
+void RespondLater(Resolver* resolver,
+                  AsyncResponder respond,
+                  View* view,
+                  const CacheKey& key,
+                  DnsPacket* packet,
+                  const uint8_t* data,
+                  size_t len,
+                  Response write_out) {
+  auto m_response =
+      BuildResponse(view, packet, std::pmr::get_default_resource());
+  if (!m_response.has_value()) {
+    ReplyToFailure(resolver, &write_out, data, len,
+                   std::move(m_response).error());
+    return;
+  }
+  // Only the header and question are needed to patch up an error reply.
+  size_t question_end = wire::QuestionEnd(data, len);
+  std::vector<uint8_t> query(data, data + (question_end ? question_end : len));
+  Spawn(respond(&resolver->responders, std::move(m_response).value()),
+        base::RepeatingCallback<void(PacketStatus::Or<DnsPacket>)>(
+            base::BindRepeating(&SendAsyncResponse, resolver, view, key,
+                                std::move(query), write_out)));
+}
+
+// Applies an UPDATE from |client|, whose reply is only ever its header and
+// zone, with the outcome as the rcode.
+void OnUpdate(Resolver* resolver,
+              Response* write_out,
+              uint8_t* data,
+              size_t len,
+              const struct sockaddr_in& client) {
+  if (!resolver->updates) {
+    ReplyWithError(write_out, data, len, ResponseCode::kNotImplemented);
+    return;
+  }
+  Arena* arena = RequestArena();
+  Arena::ScopedReset reset_arena(arena);
+  ReadStream stream(len, data);
+  auto m_packet = DnsPacket::Import(&stream, arena);
+  if (!m_packet.has_value()) {
+    if (TraceErrors())
+      std::move(m_packet).error().Print();
+    ReplyWithError(write_out, data, len, ResponseCode::kFormatError);
+    return;
+  }
+  DnsPacket update = std::move(m_packet).value();
+  homedns::HostAddress sender{AF_INET, {}};
+  memcpy(sender.bytes, &client.sin_addr, sizeof(client.sin_addr));
+  ReplyWithError(write_out, data, len,
+                 resolver->updates->Update(&update, sender));
+}
+
+void OnRequest(Resolver* resolver,
+               Response write_out,
                uint8_t* data,
                size_t len,
                struct sockaddr_in client) {
-  // 50.35.80.74, 127.0.0.1
-  uint32_t safe_addr = 0x4A502332;
-  uint32_t home_addr = 0x0100007F;
-  uint32_t cli_addr = client.sin_addr.s_addr;
-  if (cli_addr != safe_addr && cli_addr != home_addr)
+  if (resolver->acl.load()->Check(client) != ClientAcl::Action::kAllow) {
+    ReplyWithError(&write_out, data, len, ResponseCode::kRefused);
     return;
+  }
+  View* view = resolver->views->Select(client);
 
-  auto m_packet = DnsPacket::Import(std::make_unique<ReadStream>(len, data));
+  // Turn away anything that isn't a well formed standard query with a single
+  // question, without parsing the rest.
+  switch (resolver->filter.Classify(data, len)) {
+    case HeaderFilter::Reason::kAccept:
+      break;
+    case HeaderFilter::Reason::kUpdate:
+      OnUpdate(resolver, &write_out, data, len, client);
+      return;
+    case HeaderFilter::Reason::kTooShort:
+    case HeaderFilter::Reason::kResponse:
+      return;
+    case HeaderFilter::Reason::kUnsupportedOpcode:
+      ReplyWithError(&write_out, data, len, ResponseCode::kNotImplemented);
+      return;
+    default:
+      ReplyWithError(&write_out, data, len, ResponseCode::kFormatError);
+      return;
+  }
 
-  // If we can't parse the incoming packet, do _not_ write back. It's probably
-  // some kind of nasty hacking attack, and we might as well just mess with the
-  // sender.
+  // Reverse lookups of local addresses are answered before any parsing.
+  if (resolver->reverse) {
+    uint8_t reply[512];
+    size_t reply_len =
+        resolver->reverse->Write(data, len, reply, sizeof(reply));
+    if (reply_len) {
+      write_out.SendData(reply, reply_len);
+      return;
+    }
+  }
+
+  // Declared before any packet, so that it resets the arena after they are
+  // all gone.
+  Arena* arena = RequestArena();
+  Arena::ScopedReset reset_arena(arena);
+  ReadStream stream(len, data);
+  auto m_packet = DnsPacket::Import(&stream, arena);
   if (!m_packet.has_value()) {
-    std::move(m_packet).error().Print();
+    // Malformed queries are routine; only say why when asked to.
+    if (TraceErrors())
+      std::move(m_packet).error().Print();
+    ReplyWithError(&write_out, data, len, ResponseCode::kFormatError);
     return;
   }
 
-  // Build the default response packet
   DnsPacket query = std::move(m_packet).value();
-  DnsPacket response =
-      DnsPacket::Create(query.GetPacketHeader().ID)
-          .SetQuestionOrResponse(DnsPacket::PacketType::kResponse)
-          .SetOpCode(0)
-          .SetIsAuthoritative(1)
-          .SetIsTruncated(0)
-          .SetRecursionDesired(1)
-          .SetRecursionAvailable(0)
-          .SetResponseCode(0)
-          .SetReserved(0);
-
-  size_t q_count = query.GetNumQuestions();
-  for (size_t q_index = 0; q_index < q_count; q_index++) {
-    std::optional<const DnsQuestion*> q = query.GetQuestion(q_index);
-    if (!q.has_value()) {
-      perror("Tried to get a question with bounds check, but failed");
-      std::cout << query.Render() << "\n";
-      exit(1);
+
+  // Only single question queries are cached, which is all anybody sends.
+  std::optional<CacheKey> key;
+  if (query.GetNumQuestions() == 1) {
+    const DnsQuestion* q = query.GetQuestion(0).value();
+    std::shared_ptr<const Blocklist> blocklist = resolver->blocklist.load();
+    if (blocklist && blocklist->Blocks(q->LabelSequence)) {
+      uint8_t reply[512];
+      size_t reply_len =
+          resolver->blocked->Write(data, len, reply, sizeof(reply));
+      if (reply_len)
+        write_out.SendData(reply, reply_len);
+      return;
+    }
+    // Leases and registrations come and go, so neither is cached; both
+    // tables are as quick to ask.
+    if (resolver->hosts && resolver->hosts->Contains(q->LabelSequence)) {
+      SendResponse(resolver, view, std::nullopt, &write_out, data, len,
+                   BuildHostsResponse(resolver->hosts.get(), &query, arena));
+      return;
+    }
+    if (resolver->updates && resolver->updates->Contains(q->LabelSequence)) {
+      SendResponse(
+          resolver, view, std::nullopt, &write_out, data, len,
+          BuildDynamicResponse(resolver->updates.get(), &query, arena));
+      return;
+    }
+    key = CacheKey::Create(q->LabelSequence.Render(), q->Type, q->Class);
+    // The view's own names are always answered locally. A forwarding rule
+    // decides where the rest go, and failing that the default upstream.
+    bool in_zone = view->zone.Contains(q->LabelSequence);
+    Forwarder* upstream = nullptr;
+    AnswerCache* cache = view->cache.get();
+    if (!in_zone) {
+      if (UpstreamPool* pool = Route(resolver, q->LabelSequence)) {
+        upstream = pool->forwarder.get();
+        cache = pool->cache.get();
+      } else if (resolver->forwarder) {
+        upstream = resolver->forwarder.get();
+        cache = UpstreamCache(resolver, *key);
+      }
+    }
+    std::vector<uint8_t> cached;
+    if (cache->Lookup(*key, data, len, &cached)) {
+      write_out.SendData(std::move(cached));
+      RunPrefetches(resolver, upstream ? nullptr : view, upstream, cache);
+      return;
     }
-    auto m_response = RespondTo(q.value(), std::move(response));
-    if (m_response.has_value()) {
-      response = std::move(m_response).value();
-    } else {
-      std::move(m_response).error().Print();
-      // TODO: figure out how we reply here, since this was our failure to add
-      // a response.
+    if (upstream) {
+      upstream->Resolve(*key, data, len, std::move(write_out));
       return;
     }
   }
 
-  auto ws = std::make_unique<WriteStream>(512);
-  auto ext = response.Export(ws.get());
-  if (!ext.is_ok()) {
-    ext.Print();
-    // TODO: figure out how to reply here.
-    return;
+  auto m_response = BuildResponse(view, &query, arena);
+  if (key.has_value() && m_response.has_value()) {
+    // An answer that ends in an alias to a name the view doesn't have is
+    // finished by a responder that asks upstream for the rest.
+    DnsPacket response = std::move(m_response).value();
+    AsyncResponder respond = FindAsyncResponder(key->type);
+    std::optional<std::string> target =
+        respond ? AliasTarget(response) : std::nullopt;
+    if (target.has_value() && !view->zone.Contains(*target)) {
+      RespondLater(resolver, respond, view, *key, &query, data, len,
+                   std::move(write_out));
+      return;
+    }
+    m_response = std::move(response);
   }
-  auto rs = ws->Convert();
-  write_out.SendData(rs->GetBuffer(), rs->Size());
+  SendResponse(resolver, view, key, &write_out, data, len,
+               std::move(m_response));
 }
 
 }  // namespace homedns
 
 
-int main() {
-  auto server = homedns::UDPServer::Create(5300);
-  if (!server) {
-    return 1;
+int main(int argc, char** argv) {
+  // HOMEDNS_SOCKETS=<n> answers on n sockets sharing the port, each with a
+  // loop and a partition of the upstream cache of its own, and steers each
+  // query to the socket whose partition holds its name.
+  size_t sockets = 1;
+  if (const char* count = getenv("HOMEDNS_SOCKETS"))
+    sockets = std::max(1, atoi(count));
+  std::vector<std::unique_ptr<homedns::UDPServer>> servers;
+  for (size_t i = 0; i < sockets; i++) {
+    servers.push_back(homedns::UDPServer::Create(5300, sockets > 1));
+    if (!servers.back()) {
+      return 1;
+    }
+  }
+  // Timers, the upstream socket and signals are all handled on the first.
+  homedns::UDPServer* server = servers[0].get();
+
+  // dns_resolver [upstream ip[,ip...]|-] [acl file|-] [views file]
+  //
+  // With more than one upstream, each query goes to the one that has been
+  // answering fastest. HOMEDNS_RACE=<percentile> also sends a query to the
+  // next fastest once it has taken longer than that fraction of replies do,
+  // such as 0.9.
+  //
+  // HOMEDNS_TRACE=1 in the environment makes errors carry, and print, full
+  // diagnostics.
+  if (const char* trace = getenv("HOMEDNS_TRACE"))
+    homedns::SetTraceErrors(strcmp(trace, "0") != 0);
+  homedns::Resolver resolver;
+
+  // HOMEDNS_BLOCKLIST=<file>[:<file>...] blocks the names on those lists,
+  // answering them with the null address, or with NXDOMAIN given
+  // HOMEDNS_BLOCK_WITH=nxdomain.
+  if (const char* lists = getenv("HOMEDNS_BLOCKLIST")) {
+    resolver.blocklist_paths = homedns::SplitPaths(lists);
+    const char* with = getenv("HOMEDNS_BLOCK_WITH");
+    resolver.blocked = std::make_unique<homedns::BlockedReplies>(
+        with && !strcmp(with, "nxdomain")
+            ? homedns::BlockedReplies::Mode::kNameError
+            : homedns::BlockedReplies::Mode::kNullAddress,
+        /*ttl=*/60);
+    homedns::ReloadBlocklist(&resolver);
+    if (!resolver.blocklist.load())
+      return 1;
+    signal(SIGHUP, &homedns::RequestReload);
+  }
+  if (argc > 2 && strcmp(argv[2], "-")) {
+    resolver.acl_path = argv[2];
+    homedns::ReloadAcl(&resolver);
+    if (!resolver.acl.load())
+      return 1;
+    signal(SIGHUP, &homedns::RequestReload);
+  } else {
+    // Without an ACL file, only answer this machine and home.
+    homedns::ClientAcl::Builder acl;
+    acl.Add("127.0.0.1", homedns::ClientAcl::Action::kAllow);
+    acl.Add("50.35.80.74", homedns::ClientAcl::Action::kAllow);
+    resolver.acl =
+        std::make_shared<const homedns::ClientAcl>(std::move(acl).Build());
+  }
+  if (argc > 3) {
+    auto m_views = homedns::Views::Load(argv[3]);
+    if (!m_views.has_value()) {
+      std::move(m_views).error().Print();
+      return 1;
+    }
+    resolver.views =
+        std::make_unique<homedns::Views>(std::move(m_views).value());
+  } else {
+    resolver.views =
+        std::make_unique<homedns::Views>(homedns::Views::Default());
+  }
+  for (size_t i = 0; i < sockets; i++)
+    resolver.caches.push_back(std::make_unique<homedns::AnswerCache>());
+  resolver.negative = std::make_unique<homedns::NegativeReplies>(
+      "lan", "ns.lan", "hostmaster.lan", /*serial=*/1, /*minimum_ttl=*/60);
+
+  if (const char* race = getenv("HOMEDNS_RACE"))
+    resolver.upstream_options.race_percentile = atof(race);
+  if (argc > 1 && strcmp(argv[1], "-")) {
+    auto upstreams = homedns::ForwardRules::ParsePool(argv[1]);
+    if (!upstreams.has_value()) {
+      std::cerr << "bad upstreams: " << argv[1] << "\n";
+      return 1;
+    }
+    resolver.forwarder = homedns::Forwarder::Create(
+        std::move(*upstreams), resolver.upstream_options);
+    if (!resolver.forwarder) {
+      return 1;
+    }
+    homedns::Forwarder* forwarder = resolver.forwarder.get();
+    forwarder->OnReply(
+        base::BindRepeating(&homedns::CacheUpstreamReply, &resolver));
+    forwarder->OnStale(base::BindRepeating(&homedns::LookupStale, &resolver));
+    server->Watch(forwarder->GetFD(),
+                  base::BindRepeating(&homedns::ReadUpstream, forwarder));
+    homedns::ExpireQueries(forwarder, server,
+                           homedns::ExpireInterval(resolver.upstream_options));
+  }
+  // HOMEDNS_HOSTS=<file>[:<file>...] and HOMEDNS_LEASES=<file>[:<file>...]
+  // answer for the names in those hosts files and dnsmasq lease files, as
+  // they change; bare names are put under .lan.
+  const char* hosts_files = getenv("HOMEDNS_HOSTS");
+  const char* lease_files = getenv("HOMEDNS_LEASES");
+  const char* journal = getenv("HOMEDNS_JOURNAL");
+  if (hosts_files || lease_files || journal)
+    resolver.reverse = std::make_unique<homedns::ReverseIndex>();
+  if (hosts_files || lease_files) {
+    resolver.hosts =
+        std::make_unique<homedns::HostTable>(resolver.reverse.get());
+    resolver.hosts_watcher =
+        homedns::HostsWatcher::Create(resolver.hosts.get(), "lan");
+    if (!resolver.hosts_watcher)
+      return 1;
+    const std::pair<const char*, homedns::HostsWatcher::Format> sources[] = {
+        {hosts_files, homedns::HostsWatcher::Format::kHosts},
+        {lease_files, homedns::HostsWatcher::Format::kLeases},
+    };
+    for (const auto& [paths, format] : sources) {
+      for (const std::string& path : homedns::SplitPaths(paths ? paths : "")) {
+        auto status = resolver.hosts_watcher->Watch(path, format);
+        if (!status.is_ok()) {
+          status.Print();
+          return 1;
+        }
+      }
+    }
+    server->Watch(resolver.hosts_watcher->GetFD(),
+                  base::BindRepeating(&homedns::ReadHostsEvents,
+                                      resolver.hosts_watcher.get()));
+  }
+  // HOMEDNS_JOURNAL=<file> accepts UPDATEs to .lan from any client the ACL
+  // lets in, keeping what they register in that file across restarts.
+  // Updates aren't signed (no TSIG), so a client is known only by its source
+  // address: each name belongs to the address that registered it, which
+  // stops clients from taking over each other's names, but any client the
+  // ACL admits can still register any free name, and one that can spoof or
+  // take over an owner's address can change its names. Only set this where
+  // everyone the ACL lets in is trusted that far.
+  if (journal) {
+    auto m_updates =
+        homedns::DynamicZone::Open("lan", journal, resolver.reverse.get());
+    if (!m_updates.has_value()) {
+      std::move(m_updates).error().Print();
+      return 1;
+    }
+    resolver.updates = std::move(m_updates).value();
+    std::cout << "Replayed " << resolver.updates->NameCount()
+              << " updated names from " << journal << "\n";
+  }
+  // HOMEDNS_FORWARD=<file> sends the names its rules cover to their own
+  // upstreams, with or without a default upstream for the rest.
+  if (const char* rules = getenv("HOMEDNS_FORWARD")) {
+    resolver.routes_path = rules;
+    homedns::ReloadRoutes(&resolver, server);
+    if (!resolver.routes.load())
+      return 1;
+    signal(SIGHUP, &homedns::RequestReload);
+  }
+  // Reverse lookups answered locally say what a forwarded reply would.
+  if (resolver.reverse) {
+    resolver.reverse->SetRecursionAvailable(resolver.forwarder ||
+                                            !resolver.routes_path.empty());
+  }
+  server->OnTick(base::BindRepeating(&homedns::Tick, &resolver, server));
+  resolver.responders.ask_upstream =
+      base::BindRepeating(&homedns::LookupUpstream, &resolver);
+  resolver.responders.run_after =
+      base::BindRepeating(&homedns::RunAfter, server);
+
+  // HOMEDNS_RRL=<responses per second> rate limits responses, for a server
+  // that answers beyond the home. It is off by default: every NXDOMAIN to a
+  // /24 shares one bucket, which a busy LAN's search-domain probes and
+  // blocked names would soon empty. Every socket charges the same buckets,
+  // so the rate holds however many there are.
+  std::shared_ptr<homedns::RateLimiter> rrl;
+  if (const char* rate = getenv("HOMEDNS_RRL")) {
+    homedns::RateLimiter::Options options;
+    options.responses_per_second = std::max(1, atoi(rate));
+    options.burst = 2 * options.responses_per_second;
+    rrl = std::make_shared<homedns::RateLimiter>(options);
+  }
+
+  // HOMEDNS_BUSY_POLL=<microseconds> spins on the socket for that long
+  // before sleeping, trading a core for lower latency.
+  std::chrono::microseconds busy_poll(0);
+  if (const char* spin = getenv("HOMEDNS_BUSY_POLL"))
+    busy_poll = std::chrono::microseconds(atoi(spin));
+
+  for (const auto& each : servers) {
+    // The kernel filter only drops what OnRequest would drop silently too, so
+    // it only saves work, and the loop carries on without it.
+    each->AttachFilter(homedns::HeaderFilter::KernelProgram());
+    if (rrl)
+      each->LimitResponses(rrl);
+    each->OnData(base::BindRepeating(&homedns::OnRequest, &resolver));
+    if (busy_poll.count() > 0)
+      each->EnableBusyPoll(busy_poll);
   }
-  server->OnData(base::BindRepeating(&homedns::OnRequest));
+  // Likewise steering; without it, every loop's partition still answers
+  // whatever it is sent, the kernel just spreads queries by client instead.
+  if (sockets > 1)
+    server->AttachSteering(homedns::QnameSteering::KernelProgram(sockets));
+
+  // HOMEDNS_WORKERS=<n> answers requests on a pipeline of n worker threads
+  // (0 for one per core) instead of on the loop. SIGUSR1 prints its stats.
+  if (const char* workers = getenv("HOMEDNS_WORKERS")) {
+    if (sockets > 1) {
+      std::cerr << "HOMEDNS_WORKERS and HOMEDNS_SOCKETS don't mix\n";
+      return 1;
+    }
+    homedns::Pipeline::Options options;
+    options.workers = atoi(workers);
+    options.busy_poll = busy_poll;
+    resolver.pipeline = std::make_unique<homedns::Pipeline>(
+        server, base::BindRepeating(&homedns::OnRequest, &resolver),
+        options);
+    resolver.pipeline->Start();
+    signal(SIGUSR1, &homedns::RequestStats);
+  }
+  std::vector<std::thread> loops;
+  for (size_t i = 1; i < sockets; i++)
+    loops.emplace_back(&homedns::UDPServer::Start, servers[i].get());
   server->Start();
-}
\ No newline at end of file
+  for (size_t i = 1; i < sockets; i++) {
+    servers[i]->Stop();
+    loops[i - 1].join();
+  }
+}
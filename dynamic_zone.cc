@@ -0,0 +1,719 @@
+#include "dynamic_zone.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
+
+#include "records.h"
+#include "suffix_tree.h"
+#include "wire.h"
+
+namespace homedns {
+
+namespace {
+
+constexpr uint16_t kInternetClass = 1;
+constexpr uint16_t kNoneClass = 254;
+constexpr uint16_t kAnyClass = 255;
+constexpr uint16_t kAnyType = 255;
+
+// A journal isn't rewritten until it is at least this big.
+constexpr uint64_t kCompactSize = 1 << 20;
+
+// So that no client can grow one name without bound.
+constexpr size_t kMaxRecordsPerName = 256;
+
+std::string_view StripDot(std::string_view name) {
+  if (!name.empty() && name.back() == '.')
+    name.remove_suffix(1);
+  return name;
+}
+
+std::string Key(std::string_view name) {
+  std::string key(StripDot(name));
+  std::transform(key.begin(), key.end(), key.begin(), _suffix_tree::Lower);
+  return key;
+}
+
+std::string Key(const DnsRecordPreamble& preamble) {
+  return preamble.LabelSequence.value
+             ? Key(preamble.LabelSequence.value->longform)
+             : std::string();
+}
+
+uint64_t HashName(std::string_view name) {
+  name = StripDot(name);
+  uint64_t hash = 14695981039346656037ull;
+  for (char c : name)
+    hash = (hash ^ static_cast<uint8_t>(_suffix_tree::Lower(c))) *
+           1099511628211ull;
+  return hash >> 32;
+}
+
+// Orders a lowercased |key| against a |name| in any case.
+bool KeyLess(std::string_view key, std::string_view name) {
+  name = StripDot(name);
+  return std::lexicographical_compare(
+      key.begin(), key.end(), name.begin(), name.end(),
+      [](char a, char b) { return a < _suffix_tree::Lower(b); });
+}
+
+bool KeyEquals(std::string_view key, std::string_view name) {
+  name = StripDot(name);
+  return key.size() == name.size() &&
+         std::equal(key.begin(), key.end(), name.begin(), [](char a, char b) {
+           return a == _suffix_tree::Lower(b);
+         });
+}
+
+// Query types and pseudo records, which never live in a zone.
+bool IsMetaType(uint16_t type) {
+  return type == DnsOPTRecord::TYPE || (type >= 128 && type <= 255);
+}
+
+// The machine itself, whose updates may change any name.
+bool IsLoopback(const HostAddress& address) {
+  static constexpr uint8_t kLoopback6[16] = {0, 0, 0, 0, 0, 0, 0, 0,
+                                             0, 0, 0, 0, 0, 0, 0, 1};
+  if (address.family == AF_INET)
+    return address.bytes[0] == 127;
+  return address.family == AF_INET6 &&
+         memcmp(address.bytes, kLoopback6, sizeof(kLoopback6)) == 0;
+}
+
+bool HasType(const std::vector<DynamicZone::Record>& records, uint16_t type) {
+  return std::any_of(records.begin(), records.end(),
+                     [type](const auto& r) { return r.type == type; });
+}
+
+uint32_t Checksum(std::string_view data) {
+  uint32_t hash = 2166136261u;
+  for (char c : data)
+    hash = (hash ^ static_cast<uint8_t>(c)) * 16777619u;
+  return hash;
+}
+
+void AppendU16(std::string* out, uint16_t value) {
+  out->push_back(value >> 8);
+  out->push_back(value);
+}
+
+void AppendU32(std::string* out, uint32_t value) {
+  AppendU16(out, value >> 16);
+  AppendU16(out, value);
+}
+
+// A journal entry is its payload's length and checksum, then the payload:
+// the serial, and each changed name with its owner's address and every record
+// it now has.
+template <typename Changes>
+std::string EncodeEntry(const Changes& names, uint32_t serial) {
+  std::string payload;
+  AppendU32(&payload, serial);
+  AppendU32(&payload, names.size());
+  for (const auto& [name, change] : names) {
+    payload.push_back(name.size());
+    payload += name;
+    std::string_view owner = change.owner.family ? change.owner.Key() : "";
+    payload.push_back(owner.size());
+    payload += owner;
+    AppendU16(&payload, change.records.size());
+    for (const DynamicZone::Record& record : change.records) {
+      AppendU16(&payload, record.type);
+      AppendU32(&payload, record.ttl);
+      AppendU16(&payload, record.rdata.size());
+      payload.append(record.rdata.begin(), record.rdata.end());
+    }
+  }
+  std::string entry;
+  AppendU32(&entry, payload.size());
+  AppendU32(&entry, Checksum(payload));
+  return entry + payload;
+}
+
+class EntryReader {
+ public:
+  explicit EntryReader(std::string_view data) : data_(data) {}
+
+  bool U8(uint8_t* out) { return Read(1, out); }
+  bool U16(uint16_t* out) { return Read(2, out); }
+  bool U32(uint32_t* out) { return Read(4, out); }
+  bool Bytes(size_t n, std::string_view* out) {
+    if (data_.size() < n)
+      return false;
+    *out = data_.substr(0, n);
+    data_.remove_prefix(n);
+    return true;
+  }
+  bool Done() const { return data_.empty(); }
+
+ private:
+  template <typename T>
+  bool Read(size_t n, T* out) {
+    std::string_view bytes;
+    if (!Bytes(n, &bytes))
+      return false;
+    const auto* data = reinterpret_cast<const uint8_t*>(bytes.data());
+    *out = n == 1 ? data[0] : n == 2 ? wire::ReadU16(data) : wire::ReadU32(data);
+    return true;
+  }
+
+  std::string_view data_;
+};
+
+// Decodes one entry's payload into |changes|, leaving it untouched unless the
+// whole payload is well formed.
+template <typename Changes>
+bool DecodeEntry(std::string_view payload, uint32_t* serial, Changes* changes) {
+  EntryReader reader(payload);
+  uint32_t names;
+  Changes decoded;
+  if (!reader.U32(serial) || !reader.U32(&names))
+    return false;
+  for (uint32_t i = 0; i < names; i++) {
+    uint8_t name_length;
+    std::string_view name;
+    uint8_t owner_length;
+    std::string_view owner;
+    uint16_t count;
+    if (!reader.U8(&name_length) || !reader.Bytes(name_length, &name) ||
+        !reader.U8(&owner_length) || !reader.Bytes(owner_length, &owner) ||
+        !reader.U16(&count)) {
+      return false;
+    }
+    auto& change = decoded[std::string(name)];
+    if (owner_length == 4 || owner_length == 16) {
+      change.owner.family = owner_length == 4 ? AF_INET : AF_INET6;
+      memcpy(change.owner.bytes, owner.data(), owner_length);
+    } else if (owner_length != 0) {
+      return false;
+    }
+    auto& records = change.records;
+    for (uint16_t j = 0; j < count; j++) {
+      DynamicZone::Record record;
+      uint16_t length;
+      std::string_view rdata;
+      if (!reader.U16(&record.type) || !reader.U32(&record.ttl) ||
+          !reader.U16(&length) || !reader.Bytes(length, &rdata)) {
+        return false;
+      }
+      record.rdata.assign(rdata.begin(), rdata.end());
+      records.push_back(std::move(record));
+    }
+  }
+  if (!reader.Done())
+    return false;
+  for (auto& [name, change] : decoded)
+    (*changes)[name] = std::move(change);
+  return true;
+}
+
+std::atomic<uint64_t> next_id = 0;
+
+bool WriteAll(int fd, std::string_view data) {
+  while (!data.empty()) {
+    ssize_t n = write(fd, data.data(), data.size());
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    data.remove_prefix(n);
+  }
+  return true;
+}
+
+}  // namespace
+
+// static
+ConfigStatus::Or<std::unique_ptr<DynamicZone>> DynamicZone::Open(
+    std::string_view zone,
+    const std::string& journal_path,
+    ReverseIndex* reverse) {
+  int journal =
+      open(journal_path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (journal < 0)
+    return ConfigStatus(ConfigStatus::Codes::kFileNotFound, journal_path);
+  std::unique_ptr<DynamicZone> dynamic_zone(
+      new DynamicZone(Key(zone), journal_path, journal, reverse));
+  ConfigStatus status = dynamic_zone->Replay();
+  if (!status.is_ok())
+    return status;
+  dynamic_zone->MaybeCompact(*dynamic_zone->index_.load());
+  return dynamic_zone;
+}
+
+DynamicZone::DynamicZone(std::string zone,
+                         std::string journal_path,
+                         int journal,
+                         ReverseIndex* reverse)
+    : zone_(std::move(zone)),
+      journal_path_(std::move(journal_path)),
+      journal_(journal),
+      reverse_(reverse),
+      index_(std::make_shared<const Index>()),
+      id_(next_id.fetch_add(1, std::memory_order_relaxed)) {}
+
+DynamicZone::~DynamicZone() {
+  close(journal_);
+}
+
+bool DynamicZone::InZone(std::string_view name) const {
+  name = StripDot(name);
+  if (name.size() < zone_.size())
+    return false;
+  if (name.size() > zone_.size() && name[name.size() - zone_.size() - 1] != '.')
+    return false;
+  return KeyEquals(zone_, name.substr(name.size() - zone_.size()));
+}
+
+const DynamicZone::Index& DynamicZone::Snapshot() const {
+  struct Kept {
+    uint64_t id = UINT64_MAX;
+    uint64_t version = 0;
+    std::shared_ptr<const Index> index;
+  };
+  thread_local Kept kept;
+  uint64_t version = version_.load(std::memory_order_acquire);
+  if (kept.id != id_ || kept.version != version) {
+    kept.index = index_.load();
+    kept.id = id_;
+    kept.version = version;
+  }
+  return *kept.index;
+}
+
+// static
+const DynamicZone::Node* DynamicZone::Find(const Index& index,
+                                           std::string_view name) {
+  const Bucket* bucket = index.buckets[HashName(name) % kBuckets].get();
+  if (bucket == nullptr)
+    return nullptr;
+  auto it = std::partition_point(
+      bucket->nodes.begin(), bucket->nodes.end(),
+      [name](const auto& node) { return KeyLess(node->name, name); });
+  if (it == bucket->nodes.end() || !KeyEquals((*it)->name, name))
+    return nullptr;
+  return it->get();
+}
+
+// static
+std::shared_ptr<const DynamicZone::Index> DynamicZone::Publish(
+    const Index& base,
+    Changes changes,
+    uint32_t serial) {
+  auto index = std::make_shared<Index>(base);
+  index->serial = serial;
+  // Each bucket is copied once, however many of its names changed.
+  std::array<std::shared_ptr<Bucket>, kBuckets> copies;
+  for (auto& [name, change] : changes) {
+    size_t at = HashName(name) % kBuckets;
+    if (!copies[at]) {
+      copies[at] = base.buckets[at] ? std::make_shared<Bucket>(*base.buckets[at])
+                                    : std::make_shared<Bucket>();
+      index->buckets[at] = copies[at];
+    }
+    auto& nodes = copies[at]->nodes;
+    auto it = std::partition_point(
+        nodes.begin(), nodes.end(),
+        [&name](const auto& node) { return node->name < name; });
+    bool found = it != nodes.end() && (*it)->name == name;
+    if (change.records.empty()) {
+      if (found) {
+        nodes.erase(it);
+        index->names--;
+      }
+      continue;
+    }
+    auto node = std::make_shared<const Node>(
+        Node{name, change.owner, std::move(change.records)});
+    if (found) {
+      *it = std::move(node);
+    } else {
+      nodes.insert(it, std::move(node));
+      index->names++;
+    }
+  }
+  return index;
+}
+
+ResponseCode DynamicZone::Update(DnsPacket* update,
+                                 const HostAddress& client) {
+  if (update->GetNumQuestions() != 1)
+    return ResponseCode::kFormatError;
+  const DnsQuestion* zone = update->GetQuestion(0).value();
+  if (zone->Type != DnsSOARecord::TYPE)
+    return ResponseCode::kFormatError;
+  if (zone->LabelSequence.value == nullptr || zone->Class != kInternetClass ||
+      !KeyEquals(zone_, zone->LabelSequence.value->longform)) {
+    return ResponseCode::kNotAuth;
+  }
+
+  std::lock_guard lock(update_mutex_);
+  std::shared_ptr<const Index> index = index_.load();
+  ResponseCode rcode = CheckPrerequisites(*index, update->GetAnswers());
+  if (rcode != ResponseCode::kNoError)
+    return rcode;
+  rcode = CheckUpdates(update->GetAuthorities());
+  if (rcode != ResponseCode::kNoError)
+    return rcode;
+
+  Changes changes;
+  ApplyUpdates(*index, update->GetAuthorities(), client, &changes);
+  // Names that ended up as they were aren't worth journaling.
+  std::erase_if(changes, [&index](const auto& change) {
+    const Node* node = Find(*index, change.first);
+    return node ? node->records == change.second.records
+                : change.second.records.empty();
+  });
+  if (changes.empty())
+    return ResponseCode::kNoError;
+  // Nobody else's name is any client's to change.
+  if (!IsLoopback(client)) {
+    for (const auto& [name, change] : changes) {
+      if (!(change.owner == client))
+        return ResponseCode::kRefused;
+    }
+  }
+
+  uint32_t serial = index->serial + 1;
+  if (!Append(changes, serial))
+    return ResponseCode::kServerFailure;
+  Reindex(*index, changes);
+  std::shared_ptr<const Index> next =
+      Publish(*index, std::move(changes), serial);
+  index_.store(next);
+  version_.fetch_add(1, std::memory_order_release);
+  MaybeCompact(*next);
+  return ResponseCode::kNoError;
+}
+
+ResponseCode DynamicZone::CheckPrerequisites(
+    const Index& index,
+    const RecordStore& prerequisites) const {
+  // RRsets that have to exist with exactly these RDATAs.
+  std::map<std::pair<std::string, uint16_t>, std::vector<std::vector<uint8_t>>>
+      expected;
+  for (size_t i = 0; i < prerequisites.Size(); i++) {
+    const DnsRecordPreamble& preamble = prerequisites.Preamble(i);
+    std::string name = Key(preamble);
+    if (preamble.TTL != 0)
+      return ResponseCode::kFormatError;
+    if (!InZone(name))
+      return ResponseCode::kNotZone;
+    const Node* node = Find(index, name);
+    bool has_type = node && HasType(node->records, preamble.Type);
+    if (preamble.Class == kAnyClass || preamble.Class == kNoneClass) {
+      if (preamble.Length != 0)
+        return ResponseCode::kFormatError;
+      bool exists = preamble.Type == kAnyType ? node != nullptr : has_type;
+      bool wanted = preamble.Class == kAnyClass;
+      if (exists != wanted) {
+        if (preamble.Type == kAnyType)
+          return wanted ? ResponseCode::kNameError : ResponseCode::kYXDomain;
+        return wanted ? ResponseCode::kNXRRSet : ResponseCode::kYXRRSet;
+      }
+    } else if (preamble.Class == kInternetClass) {
+      std::span<const uint8_t> rdata = prerequisites.Rdata(i);
+      expected[{name, preamble.Type}].emplace_back(rdata.begin(), rdata.end());
+    } else {
+      return ResponseCode::kFormatError;
+    }
+  }
+
+  for (auto& [set, rdatas] : expected) {
+    std::vector<std::vector<uint8_t>> have;
+    if (const Node* node = Find(index, set.first)) {
+      for (const Record& record : node->records) {
+        if (record.type == set.second)
+          have.push_back(record.rdata);
+      }
+    }
+    std::sort(rdatas.begin(), rdatas.end());
+    rdatas.erase(std::unique(rdatas.begin(), rdatas.end()), rdatas.end());
+    std::sort(have.begin(), have.end());
+    if (have != rdatas)
+      return ResponseCode::kNXRRSet;
+  }
+  return ResponseCode::kNoError;
+}
+
+ResponseCode DynamicZone::CheckUpdates(const RecordStore& updates) const {
+  for (size_t i = 0; i < updates.Size(); i++) {
+    const DnsRecordPreamble& preamble = updates.Preamble(i);
+    if (!InZone(Key(preamble)))
+      return ResponseCode::kNotZone;
+    bool meta = IsMetaType(preamble.Type);
+    switch (preamble.Class) {
+      case kInternetClass:
+        if (meta)
+          return ResponseCode::kFormatError;
+        break;
+      case kAnyClass:
+        if (preamble.TTL != 0 || preamble.Length != 0 ||
+            (meta && preamble.Type != kAnyType)) {
+          return ResponseCode::kFormatError;
+        }
+        break;
+      case kNoneClass:
+        if (preamble.TTL != 0 || meta)
+          return ResponseCode::kFormatError;
+        break;
+      default:
+        return ResponseCode::kFormatError;
+    }
+  }
+  return ResponseCode::kNoError;
+}
+
+void DynamicZone::ApplyUpdates(const Index& index,
+                               const RecordStore& updates,
+                               const HostAddress& client,
+                               Changes* changes) const {
+  for (size_t i = 0; i < updates.Size(); i++) {
+    const DnsRecordPreamble& preamble = updates.Preamble(i);
+    std::span<const uint8_t> rdata = updates.Rdata(i);
+    auto [it, fresh] = changes->try_emplace(Key(preamble));
+    if (fresh) {
+      // A name keeps its owner; a new one is the sender's.
+      if (const Node* node = Find(index, it->first))
+        it->second = {node->owner, node->records};
+      else
+        it->second.owner = client;
+    }
+    std::vector<Record>& records = it->second.records;
+    auto same_rdata = [&](const Record& r) {
+      return r.type == preamble.Type &&
+             std::equal(r.rdata.begin(), r.rdata.end(), rdata.begin(),
+                        rdata.end());
+    };
+
+    if (preamble.Class == kAnyClass) {
+      if (preamble.Type == kAnyType)
+        records.clear();
+      else
+        std::erase_if(records, [&](const Record& r) {
+          return r.type == preamble.Type;
+        });
+      continue;
+    }
+    if (preamble.Class == kNoneClass) {
+      std::erase_if(records, same_rdata);
+      continue;
+    }
+
+    // The zone's SOA isn't anyone's to change, and an alias can't share its
+    // name with anything else; those adds are silently ignored (RFC 2136
+    // section 3.4.2.2).
+    if (preamble.Type == DnsSOARecord::TYPE)
+      continue;
+    bool alias = preamble.Type == DnsCNAMERecord::TYPE;
+    bool has_alias = HasType(records, DnsCNAMERecord::TYPE);
+    if (alias ? !records.empty() && !has_alias : has_alias)
+      continue;
+    if (alias)
+      records.clear();
+    auto existing = std::find_if(records.begin(), records.end(), same_rdata);
+    if (existing != records.end()) {
+      existing->ttl = preamble.TTL;
+      continue;
+    }
+    if (records.size() >= kMaxRecordsPerName)
+      continue;
+    // Keep each RRset together.
+    auto last = std::find_if(records.rbegin(), records.rend(), [&](auto& r) {
+      return r.type == preamble.Type;
+    });
+    records.insert(last.base(), Record{preamble.Type, preamble.TTL,
+                                       {rdata.begin(), rdata.end()}});
+  }
+}
+
+void DynamicZone::Reindex(const Index& index, const Changes& changes) {
+  if (reverse_ == nullptr)
+    return;
+  auto addresses = [](const std::vector<Record>& records) {
+    std::vector<HostAddress> addresses;
+    for (const Record& record : records) {
+      HostAddress address;
+      if (record.type == DnsARecord::TYPE && record.rdata.size() == 4)
+        address.family = AF_INET;
+      else if (record.type == DnsAAAARecord::TYPE && record.rdata.size() == 16)
+        address.family = AF_INET6;
+      else
+        continue;
+      memcpy(address.bytes, record.rdata.data(), record.rdata.size());
+      addresses.push_back(address);
+    }
+    return addresses;
+  };
+  for (const auto& [name, change] : changes) {
+    std::vector<HostAddress> before;
+    if (const Node* node = Find(index, name))
+      before = addresses(node->records);
+    std::vector<HostAddress> after = addresses(change.records);
+    for (const HostAddress& address : before) {
+      if (std::find(after.begin(), after.end(), address) == after.end())
+        reverse_->Remove(address, name);
+    }
+    for (const HostAddress& address : after) {
+      if (std::find(before.begin(), before.end(), address) == before.end())
+        reverse_->Add(address, name);
+    }
+  }
+}
+
+bool DynamicZone::Append(const Changes& changes, uint32_t serial) {
+  std::string entry = EncodeEntry(changes, serial);
+  // On disk before anything is answered with it: a client told NOERROR
+  // won't send the update again, so losing it to a power cut loses it.
+  if (!WriteAll(journal_, entry) || fdatasync(journal_) < 0) {
+    perror("journal");
+    // Don't leave half an entry for the next one to follow.
+    if (ftruncate(journal_, journal_size_) < 0)
+      perror("journal");
+    return false;
+  }
+  journal_size_ += entry.size();
+  return true;
+}
+
+ConfigStatus DynamicZone::Replay() {
+  struct stat st;
+  if (fstat(journal_, &st) < 0)
+    return ConfigStatus(ConfigStatus::Codes::kFileNotFound, journal_path_);
+  std::string data(st.st_size, '\0');
+  size_t done = 0;
+  while (done < data.size()) {
+    ssize_t n = pread(journal_, data.data() + done, data.size() - done, done);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return ConfigStatus(ConfigStatus::Codes::kFileNotFound, journal_path_);
+    done += n;
+  }
+
+  Changes state;
+  uint32_t serial = 0;
+  size_t offset = 0;
+  while (offset + 8 <= data.size()) {
+    const auto* header = reinterpret_cast<const uint8_t*>(&data[offset]);
+    uint32_t length = wire::ReadU32(header);
+    if (length > data.size() - offset - 8)
+      break;
+    std::string_view payload(&data[offset + 8], length);
+    if (Checksum(payload) != wire::ReadU32(header + 4) ||
+        !DecodeEntry(payload, &serial, &state)) {
+      break;
+    }
+    offset += 8 + length;
+  }
+  if (offset != data.size()) {
+    std::cout << "Cut " << data.size() - offset
+              << " torn bytes off the end of " << journal_path_ << "\n";
+    if (ftruncate(journal_, offset) < 0)
+      return ConfigStatus(ConfigStatus::Codes::kFileNotFound, journal_path_);
+  }
+  journal_size_ = offset;
+  Reindex(Index(), state);
+  // Names emptied along the way are simply left out.
+  index_.store(Publish(Index(), std::move(state), serial));
+  version_.fetch_add(1, std::memory_order_release);
+  return base::OkStatus();
+}
+
+void DynamicZone::MaybeCompact(const Index& index) {
+  uint64_t size = journal_size_;
+  if (size < kCompactSize || size < 4 * compacted_size_)
+    return;
+  Changes names;
+  for (const auto& bucket : index.buckets) {
+    if (bucket == nullptr)
+      continue;
+    for (const auto& node : bucket->nodes)
+      names[node->name] = {node->owner, node->records};
+  }
+  std::string entry = EncodeEntry(names, index.serial);
+
+  // Written aside and renamed over, so a crash leaves one or the other.
+  std::string temp = journal_path_ + ".new";
+  int journal =
+      open(temp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+  if (journal < 0 || !WriteAll(journal, entry) || fsync(journal) < 0 ||
+      rename(temp.c_str(), journal_path_.c_str()) < 0) {
+    perror("compacting journal");
+    if (journal >= 0)
+      close(journal);
+    unlink(temp.c_str());
+    // Try again once it has grown as much again.
+    compacted_size_ = size;
+    return;
+  }
+  close(journal_);
+  journal_ = journal;
+  journal_size_ = entry.size();
+  compacted_size_ = entry.size();
+}
+
+bool DynamicZone::Contains(const DnsLabelSeq& name) const {
+  if (name.value == nullptr || !InZone(name.value->longform))
+    return false;
+  return Find(Snapshot(), name.value->longform) != nullptr;
+}
+
+PacketStatus::Or<DnsPacket> DynamicZone::Answer(const DnsQuestion* question,
+                                                DnsPacket response) const {
+  if (question->LabelSequence.value == nullptr)
+    return PacketStatus::Codes::kNameNotFound;
+  const Node* node =
+      Find(Snapshot(), question->LabelSequence.value->longform);
+  if (node == nullptr)
+    return PacketStatus::Codes::kNameNotFound;
+
+  // An alias stands in for every type but itself.
+  uint16_t type = question->Type;
+  if (!HasType(node->records, type))
+    type = DnsCNAMERecord::TYPE;
+  if (!HasType(node->records, type))
+    return PacketStatus::Codes::kInvalidRecordType;
+
+  std::string name = question->LabelSequence.Render();
+  for (const Record& record : node->records) {
+    if (record.type != type)
+      continue;
+    auto added =
+        std::move(response).AddRecordData<DnsPacket::RecordType::kAnswer>(
+            name, type, question->Class, record.ttl, record.rdata);
+    if (!added.has_value())
+      return std::move(added).error();
+    response = std::move(added).value();
+  }
+  return response;
+}
+
+std::vector<DynamicZone::Record> DynamicZone::Lookup(std::string_view name,
+                                                     uint16_t type) const {
+  std::vector<Record> records;
+  if (const Node* node = Find(Snapshot(), name)) {
+    for (const Record& record : node->records) {
+      if (type == kAnyType || record.type == type)
+        records.push_back(record);
+    }
+  }
+  return records;
+}
+
+uint32_t DynamicZone::Serial() const {
+  return Snapshot().serial;
+}
+
+size_t DynamicZone::NameCount() const {
+  return Snapshot().names;
+}
+
+}  // namespace homedns
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "error_reply.h"
+#include "packet.h"
+#include "reverse_index.h"
+#include "status.h"
+
+namespace homedns {
+
+// Records that clients register for themselves with RFC 2136 UPDATEs, for
+// names in one zone.
+//
+// Readers never take a lock: the names are an immutable index, published
+// through one atomic pointer. An update copies what it touches, that is the
+// index's table of buckets, each bucket holding a changed name, and the
+// changed names themselves, and then publishes the copy; everything else is
+// shared with the index before it, and readers still holding that one keep
+// it alive. Each thread keeps the index it last read, and only goes back
+// to the shared pointer once a version number says there is a newer one,
+// so a lookup costs one atomic load of a counter that is only written by
+// updates. Updates are applied one at a time.
+//
+// A name belongs to the client that registered it: once it has records, an
+// update from any other address that would change them is refused, so one
+// client can't take over another's name. Loopback clients, that is the
+// machine itself, may change any name.
+//
+// Every update is appended to a journal, and synced to disk, before it is
+// published or answered, as the new contents and owner of each name it
+// changed, so replaying the journal at startup is one pass with a hash table
+// and a single build of the index. A torn entry at the end, as left by a
+// crash mid-write, is cut off. Once the journal has grown well past what it
+// describes, it is rewritten as a single entry.
+class DynamicZone {
+ public:
+  struct Record {
+    uint16_t type;
+    uint32_t ttl;
+    // In uncompressed wire format, as RecordStore keeps it.
+    std::vector<uint8_t> rdata;
+
+    bool operator==(const Record&) const = default;
+  };
+
+  // Serves |zone|, with the records journaled in |journal_path|, which is
+  // created if it doesn't exist. The A and AAAA records are kept in
+  // |reverse|, if it is set, which has to outlive the zone.
+  static ConfigStatus::Or<std::unique_ptr<DynamicZone>> Open(
+      std::string_view zone,
+      const std::string& journal_path,
+      ReverseIndex* reverse = nullptr);
+  ~DynamicZone();
+
+  // Checks |update|'s prerequisites and applies its changes, all or nothing,
+  // as sent by |client|. Returns the rcode to reply with.
+  ResponseCode Update(DnsPacket* update, const HostAddress& client);
+
+  // Whether |name| has any records.
+  bool Contains(const DnsLabelSeq& name) const;
+
+  // Adds the records answering |question| to |response|. Fails with
+  // kNameNotFound if the name has no records, and kInvalidRecordType if it
+  // has none of the type.
+  PacketStatus::Or<DnsPacket> Answer(const DnsQuestion* question,
+                                     DnsPacket response) const;
+
+  // The records at |name|, of every type if |type| is 255 (ANY).
+  std::vector<Record> Lookup(std::string_view name, uint16_t type) const;
+
+  // Bumped by every update that changed something.
+  uint32_t Serial() const;
+  size_t NameCount() const;
+  uint64_t JournalSize() const {
+    return journal_size_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  static constexpr size_t kBuckets = 64;
+
+  struct Node {
+    // Lowercased, without the trailing dot.
+    std::string name;
+    // Whoever registered it, which may change it.
+    HostAddress owner;
+    std::vector<Record> records;
+  };
+  struct Bucket {
+    // Sorted by name.
+    std::vector<std::shared_ptr<const Node>> nodes;
+  };
+  struct Index {
+    std::array<std::shared_ptr<const Bucket>, kBuckets> buckets;
+    uint32_t serial = 0;
+    size_t names = 0;
+  };
+  struct Change {
+    HostAddress owner{};
+    std::vector<Record> records;
+  };
+  using Changes = std::unordered_map<std::string, Change>;
+
+  DynamicZone(std::string zone,
+              std::string journal_path,
+              int journal,
+              ReverseIndex* reverse);
+
+  bool InZone(std::string_view name) const;
+  // The latest index, as this thread last saw it. Good until the thread's
+  // next call.
+  const Index& Snapshot() const;
+  static const Node* Find(const Index& index, std::string_view name);
+  static std::shared_ptr<const Index> Publish(const Index& base,
+                                              Changes changes,
+                                              uint32_t serial);
+
+  ResponseCode CheckPrerequisites(const Index& index,
+                                  const RecordStore& prerequisites) const;
+  ResponseCode CheckUpdates(const RecordStore& updates) const;
+  void ApplyUpdates(const Index& index,
+                    const RecordStore& updates,
+                    const HostAddress& client,
+                    Changes* changes) const;
+
+  // Moves the addresses of the names in |changes| from what they were in
+  // |index| to what they are about to be.
+  void Reindex(const Index& index, const Changes& changes);
+
+  bool Append(const Changes& changes, uint32_t serial);
+  ConfigStatus Replay();
+  void MaybeCompact(const Index& index);
+
+  const std::string zone_;
+  const std::string journal_path_;
+  int journal_;
+  ReverseIndex* reverse_;
+  std::atomic<uint64_t> journal_size_ = 0;
+  // What the journal came to when it was last rewritten.
+  uint64_t compacted_size_ = 0;
+
+  std::atomic<std::shared_ptr<const Index>> index_;
+  // Bumped after each new index is published, and unique to this zone, so
+  // that threads can tell whether the one they kept is still current.
+  const uint64_t id_;
+  std::atomic<uint64_t> version_ = 0;
+  std::mutex update_mutex_;
+};
+
+}  // namespace homedns
@@ -0,0 +1,162 @@
+#include "error_reply.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+#include "wire.h"
+
+namespace homedns {
+
+namespace {
+
+constexpr uint16_t kSOARecordType = 6;
+constexpr uint16_t kInternetClass = 1;
+
+void AppendU16(std::vector<uint8_t>* out, uint16_t value) {
+  out->push_back(value >> 8);
+  out->push_back(value);
+}
+
+void AppendU32(std::vector<uint8_t>* out, uint32_t value) {
+  AppendU16(out, value >> 16);
+  AppendU16(out, value);
+}
+
+void AppendName(std::vector<uint8_t>* out, const std::string& name) {
+  size_t start = 0;
+  while (start < name.size()) {
+    size_t dot = name.find('.', start);
+    if (dot == std::string::npos)
+      dot = name.size();
+    out->push_back(dot - start);
+    out->insert(out->end(), name.begin() + start, name.begin() + dot);
+    start = dot + 1;
+  }
+  out->push_back(0);
+}
+
+// Writes the header and question of a reply to |query|, leaving every record
+// count at zero. Returns the offset just past the question, or 0.
+size_t WriteHeaderAndQuestion(const uint8_t* query,
+                              size_t len,
+                              ResponseCode rcode,
+                              bool authoritative,
+                              uint8_t* out,
+                              size_t out_len) {
+  if (len < wire::kHeaderSize || out_len < wire::kHeaderSize)
+    return 0;
+  // Never answer a response; that way lies a reply loop.
+  if (query[2] & 0x80)
+    return 0;
+
+  size_t question_end = 0;
+  if (wire::ReadU16(query + 4) >= 1)
+    question_end = wire::QuestionEnd(query, len);
+  if (question_end > out_len)
+    return 0;
+
+  memset(out, 0, wire::kHeaderSize);
+  out[0] = query[0];
+  out[1] = query[1];
+  // QR, then the opcode and RD bit as asked.
+  out[2] = 0x80 | (query[2] & 0x79) | (authoritative ? 0x04 : 0);
+  out[3] = static_cast<uint8_t>(rcode);
+  if (question_end) {
+    wire::WriteU16(out + 4, 1);
+    memcpy(out + wire::kHeaderSize, query + wire::kHeaderSize,
+           question_end - wire::kHeaderSize);
+    return question_end;
+  }
+  return wire::kHeaderSize;
+}
+
+}  // namespace
+
+size_t WriteErrorReply(const uint8_t* query,
+                       size_t len,
+                       ResponseCode rcode,
+                       uint8_t* out,
+                       size_t out_len) {
+  return WriteHeaderAndQuestion(query, len, rcode, false, out, out_len);
+}
+
+NegativeReplies::NegativeReplies(const std::string& zone,
+                                 const std::string& mname,
+                                 const std::string& rname,
+                                 uint32_t serial,
+                                 uint32_t minimum_ttl) {
+  AppendName(&zone_, zone);
+  std::transform(zone_.begin(), zone_.end(), zone_.begin(),
+                 [](uint8_t c) { return std::tolower(c); });
+  AppendName(&soa_, zone);
+  AppendU16(&soa_, kSOARecordType);
+  AppendU16(&soa_, kInternetClass);
+  // RFC 2308: negative answers are cached for the lower of the SOA's TTL and
+  // its MINIMUM field, so keep them the same.
+  AppendU32(&soa_, minimum_ttl);
+  size_t length_at = soa_.size();
+  AppendU16(&soa_, 0);
+  AppendName(&soa_, mname);
+  AppendName(&soa_, rname);
+  AppendU32(&soa_, serial);
+  AppendU32(&soa_, 3600);   // refresh
+  AppendU32(&soa_, 600);    // retry
+  AppendU32(&soa_, 86400);  // expire
+  AppendU32(&soa_, minimum_ttl);
+  wire::WriteU16(soa_.data() + length_at, soa_.size() - length_at - 2);
+}
+
+size_t NegativeReplies::WriteNameError(const uint8_t* query,
+                                       size_t len,
+                                       uint8_t* out,
+                                       size_t out_len) const {
+  return Write(query, len, ResponseCode::kNameError, out, out_len);
+}
+
+size_t NegativeReplies::WriteNoData(const uint8_t* query,
+                                    size_t len,
+                                    uint8_t* out,
+                                    size_t out_len) const {
+  return Write(query, len, ResponseCode::kNoError, out, out_len);
+}
+
+size_t NegativeReplies::Write(const uint8_t* query,
+                              size_t len,
+                              ResponseCode rcode,
+                              uint8_t* out,
+                              size_t out_len) const {
+  size_t offset =
+      WriteHeaderAndQuestion(query, len, rcode, true, out, out_len);
+  if (offset == 0)
+    return 0;
+  if (offset == wire::kHeaderSize || !InZone(out, offset)) {
+    out[2] &= ~0x04;
+    return offset;
+  }
+  // Without the SOA the answer is still correct, just not cacheable.
+  if (offset + soa_.size() > out_len)
+    return offset;
+  memcpy(out + offset, soa_.data(), soa_.size());
+  wire::WriteU16(out + 8, 1);
+  return offset + soa_.size();
+}
+
+bool NegativeReplies::InZone(const uint8_t* reply, size_t question_end) const {
+  // The name ends just before the type and class.
+  size_t end = question_end - 4;
+  for (size_t at = wire::kHeaderSize; at < end; at += reply[at] + 1) {
+    // A compression pointer; real queries don't use them in the question.
+    if (reply[at] >= 0xC0)
+      return false;
+    // Length bytes are below 'A', so lowering the lot leaves them be.
+    if (end - at == zone_.size() &&
+        std::equal(zone_.begin(), zone_.end(), reply + at,
+                   [](uint8_t a, uint8_t b) { return a == std::tolower(b); })) {
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace homedns
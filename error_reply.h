@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace homedns {
+
+enum class ResponseCode : uint8_t {
+  kNoError = 0,
+  kFormatError = 1,
+  kServerFailure = 2,
+  kNameError = 3,
+  kNotImplemented = 4,
+  kRefused = 5,
+  // RFC 2136 UPDATE outcomes.
+  kYXDomain = 6,
+  kYXRRSet = 7,
+  kNXRRSet = 8,
+  kNotAuth = 9,
+  kNotZone = 10,
+};
+
+// Writes a reply to |query| which carries only the query's question (if it
+// has a readable one) and |rcode|. This works straight off the wire, without
+// importing the query or building a DnsPacket, so that it stays cheap when the
+// server is being flooded with junk.
+//
+// Returns the length of the reply, or 0 if |query| should not be answered at
+// all: it is too short to hold a header, is itself a response, or the reply
+// doesn't fit in |out_len|.
+size_t WriteErrorReply(const uint8_t* query,
+                       size_t len,
+                       ResponseCode rcode,
+                       uint8_t* out,
+                       size_t out_len);
+
+// Authoritative negative answers for a local zone. The zone's SOA record is
+// serialized once up front, so each reply is a header, a copy of the question
+// and a copy of the SOA. A query about a name outside the zone, or with no
+// question at all, isn't the zone's to deny: it gets the same rcode, but as
+// WriteErrorReply() would write it, without AA or the SOA.
+class NegativeReplies {
+ public:
+  NegativeReplies(const std::string& zone,
+                  const std::string& mname,
+                  const std::string& rname,
+                  uint32_t serial,
+                  uint32_t minimum_ttl);
+
+  // NXDOMAIN: the name doesn't exist at all.
+  size_t WriteNameError(const uint8_t* query,
+                        size_t len,
+                        uint8_t* out,
+                        size_t out_len) const;
+
+  // NODATA: the name exists, but has no records of the asked for type.
+  size_t WriteNoData(const uint8_t* query,
+                     size_t len,
+                     uint8_t* out,
+                     size_t out_len) const;
+
+ private:
+  size_t Write(const uint8_t* query,
+               size_t len,
+               ResponseCode rcode,
+               uint8_t* out,
+               size_t out_len) const;
+  // Whether the question of |reply|, which ends at |question_end|, is about
+  // the zone or a name below it.
+  bool InZone(const uint8_t* reply, size_t question_end) const;
+
+  // The zone's name, lowercased, in wire format.
+  std::vector<uint8_t> zone_;
+  std::vector<uint8_t> soa_;
+};
+
+}  // namespace homedns
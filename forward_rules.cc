@@ -0,0 +1,152 @@
+#include "forward_rules.h"
+
+#include <arpa/inet.h>
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <fstream>
+#include <set>
+#include <sstream>
+
+namespace homedns {
+
+namespace {
+
+std::string_view Trim(std::string_view text) {
+  while (!text.empty() && isspace(static_cast<unsigned char>(text.front())))
+    text.remove_prefix(1);
+  while (!text.empty() && isspace(static_cast<unsigned char>(text.back())))
+    text.remove_suffix(1);
+  return text;
+}
+
+std::string_view NextField(std::string_view* text,
+                           const char* separators = " \t") {
+  while (!text->empty() && strchr(separators, text->front()))
+    text->remove_prefix(1);
+  size_t end = std::min(text->find_first_of(separators), text->size());
+  std::string_view field = text->substr(0, end);
+  text->remove_prefix(end);
+  return field;
+}
+
+// "10.0.0.53" or "10.0.0.53:5353".
+bool ParseUpstream(std::string_view field, struct sockaddr_in* out) {
+  uint16_t port = 53;
+  size_t colon = field.find(':');
+  if (colon != std::string_view::npos) {
+    std::string_view digits = field.substr(colon + 1);
+    auto [end, error] =
+        std::from_chars(digits.data(), digits.data() + digits.size(), port);
+    if (error != std::errc() || end != digits.data() + digits.size() ||
+        port == 0) {
+      return false;
+    }
+    field = field.substr(0, colon);
+  }
+  memset(out, 0, sizeof(*out));
+  out->sin_family = AF_INET;
+  out->sin_port = htons(port);
+  return inet_pton(AF_INET, std::string(field).c_str(), &out->sin_addr) == 1;
+}
+
+ConfigStatus BadLine(const char* problem,
+                     std::string_view line,
+                     size_t line_number) {
+  return ConfigStatus(ConfigStatus::Codes::kSyntaxError,
+                      std::string(problem) + ": " + std::string(line))
+      .WithData("line", (int)line_number);
+}
+
+}  // namespace
+
+// static
+ConfigStatus::Or<ForwardRules> ForwardRules::Parse(std::string_view text) {
+  ForwardRules rules;
+  SuffixTree<uint32_t>::Builder builder;
+  std::set<std::string> suffixes;
+
+  size_t line_number = 0;
+  while (!text.empty()) {
+    line_number++;
+    size_t newline = text.find('\n');
+    std::string_view line = text.substr(0, newline);
+    text.remove_prefix(newline == std::string_view::npos ? text.size()
+                                                         : newline + 1);
+    line = Trim(line.substr(0, line.find('#')));
+    if (line.empty())
+      continue;
+
+    std::string_view rest = line;
+    std::string suffix(NextField(&rest));
+    if (suffix.starts_with("*."))
+      suffix.erase(0, 2);
+    if (!suffix.empty() && suffix.back() == '.')
+      suffix.pop_back();
+    std::transform(suffix.begin(), suffix.end(), suffix.begin(),
+                   _suffix_tree::Lower);
+    if (suffix.empty() || suffix.find('*') != std::string::npos)
+      return BadLine("expected <suffix> <upstream>...", line, line_number);
+    if (!suffixes.insert(suffix).second)
+      return BadLine("suffix already has a rule", line, line_number);
+
+    std::optional<Pool> pool = ParsePool(rest);
+    if (!pool.has_value())
+      return BadLine("expected upstream addresses", line, line_number);
+
+    std::string key = Render(*pool);
+    auto it = std::find_if(
+        rules.pools_.begin(), rules.pools_.end(),
+        [&key](const Pool& other) { return Render(other) == key; });
+    uint32_t index = it - rules.pools_.begin();
+    if (it == rules.pools_.end())
+      rules.pools_.push_back(std::move(*pool));
+    if (!builder.Insert(suffix, index))
+      return BadLine("suffix has too many labels", line, line_number);
+  }
+  rules.rules_ = std::move(builder).Build();
+  return rules;
+}
+
+// static
+ConfigStatus::Or<ForwardRules> ForwardRules::Load(const std::string& path) {
+  std::ifstream file(path);
+  if (!file)
+    return ConfigStatus(ConfigStatus::Codes::kFileNotFound, path);
+  std::stringstream contents;
+  contents << file.rdbuf();
+  return Parse(contents.str());
+}
+
+// static
+std::optional<ForwardRules::Pool> ForwardRules::ParsePool(
+    std::string_view text) {
+  Pool pool;
+  for (std::string_view field = NextField(&text, " \t,"); !field.empty();
+       field = NextField(&text, " \t,")) {
+    struct sockaddr_in upstream;
+    if (!ParseUpstream(field, &upstream))
+      return std::nullopt;
+    pool.push_back(upstream);
+  }
+  if (pool.empty())
+    return std::nullopt;
+  return pool;
+}
+
+// static
+std::string ForwardRules::Render(const Pool& pool) {
+  std::string rendered;
+  for (const struct sockaddr_in& upstream : pool) {
+    char address[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &upstream.sin_addr, address, sizeof(address));
+    if (!rendered.empty())
+      rendered += ", ";
+    rendered += address;
+    if (ntohs(upstream.sin_port) != 53)
+      rendered += ":" + std::to_string(ntohs(upstream.sin_port));
+  }
+  return rendered;
+}
+
+}  // namespace homedns
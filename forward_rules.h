@@ -0,0 +1,62 @@
+#pragma once
+
+#include <netinet/in.h>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "labels.h"
+#include "status.h"
+#include "suffix_tree.h"
+
+namespace homedns {
+
+// Conditional forwarding: which pool of upstreams a name is sent to, by the
+// longest suffix of it that a rule names, so "corp.example" covers itself and
+// every name below it, and "eng.corp.example" can send part of that
+// elsewhere. Names no rule covers take the default path.
+//
+// The rules are compiled into a SuffixTree, so routing a query is one walk
+// over its labels with no locks or allocations. Rules naming the same
+// upstreams, in the same order, share a pool. The set is immutable once
+// built; to change it, build a new one and swap it in.
+class ForwardRules {
+ public:
+  using Pool = std::vector<struct sockaddr_in>;
+
+  // Parses a rules file of "<suffix> <upstream>..." lines, where each
+  // upstream is an IPv4 address, with a ":<port>" if it isn't 53. A leading
+  // "*." on the suffix is allowed, and means the same. Blank lines and
+  // anything after a '#' are ignored.
+  static ConfigStatus::Or<ForwardRules> Parse(std::string_view text);
+  static ConfigStatus::Or<ForwardRules> Load(const std::string& path);
+
+  // Parses upstreams separated by whitespace or commas, as above. Fails if
+  // there are none, or any is malformed.
+  static std::optional<Pool> ParsePool(std::string_view text);
+
+  ForwardRules() = default;
+
+  // The index in Pools() of the pool |name| goes to, or null if no rule
+  // covers it.
+  const uint32_t* Route(const DnsLabelSeq& name) const {
+    return rules_.LongestMatch(name).value;
+  }
+  const uint32_t* Route(std::string_view name) const {
+    return rules_.LongestMatch(name).value;
+  }
+
+  const std::vector<Pool>& Pools() const { return pools_; }
+  size_t RuleCount() const { return rules_.ValueCount(); }
+
+  // "10.0.0.53, 10.0.0.54:5353", which identifies a pool across rule sets.
+  static std::string Render(const Pool& pool);
+
+ private:
+  SuffixTree<uint32_t> rules_;
+  std::vector<Pool> pools_;
+};
+
+}  // namespace homedns
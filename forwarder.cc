@@ -0,0 +1,494 @@
+#include "forwarder.h"
+
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iterator>
+
+#include "bitstream.h"
+#include "error_reply.h"
+#include "packet.h"
+#include "wire.h"
+
+namespace homedns {
+
+namespace {
+
+// How much of the way each sample moves a smoothed value, as a shift.
+constexpr int kSmoothing = 3;
+
+Forwarder::Clock::duration Smooth(Forwarder::Clock::duration smoothed,
+                                  Forwarder::Clock::duration sample) {
+  if (smoothed == Forwarder::Clock::duration(0))
+    return sample;
+  return smoothed + (sample - smoothed) / (1 << kSmoothing);
+}
+
+// How much the other upstreams' times decay on every pick, in 1/64ths.
+constexpr int kDecay = 63;
+
+// Whether |data| is a response to a standard query, with an rcode that is
+// one's to carry, and so could be a reply at all.
+bool IsReply(const uint8_t* data) {
+  return (data[2] & 0x80) && (data[2] & 0x78) == 0 &&
+         (data[3] & 0x0F) <= static_cast<uint8_t>(ResponseCode::kRefused);
+}
+
+void IgnoreReply(const CacheKey&, const uint8_t*, size_t) {}
+
+bool NoStaleAnswer(const CacheKey&,
+                   const uint8_t*,
+                   size_t,
+                   std::vector<uint8_t>*) {
+  return false;
+}
+
+}  // namespace
+
+// static
+std::unique_ptr<Forwarder> Forwarder::Create(struct sockaddr_in upstream) {
+  return Create(upstream, Options());
+}
+
+// static
+std::unique_ptr<Forwarder> Forwarder::Create(struct sockaddr_in upstream,
+                                             Options options) {
+  return Create(std::vector<struct sockaddr_in>{upstream}, options);
+}
+
+// static
+std::unique_ptr<Forwarder> Forwarder::Create(
+    std::vector<struct sockaddr_in> upstreams,
+    Options options) {
+  if (upstreams.empty())
+    return nullptr;
+  int epoll = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll < 0) {
+    perror("no epoll");
+    return nullptr;
+  }
+  return std::unique_ptr<Forwarder>(
+      new Forwarder(epoll, std::move(upstreams), options));
+}
+
+Forwarder::Forwarder(int epoll,
+                     std::vector<struct sockaddr_in> upstreams,
+                     Options options)
+    : epoll_(epoll),
+      options_(options),
+      reply_cb_(base::BindRepeating(&IgnoreReply)),
+      stale_cb_(base::BindRepeating(&NoStaleAnswer)),
+      random_(std::random_device()()) {
+  for (const struct sockaddr_in& address : upstreams)
+    upstreams_.push_back({address});
+}
+
+Forwarder::~Forwarder() {
+  for (const auto& [key, entry] : in_flight_)
+    close(entry.socket);
+  close(epoll_);
+}
+
+void Forwarder::OnReply(ReplyCB cb) {
+  reply_cb_ = std::move(cb);
+}
+
+void Forwarder::OnStale(StaleCB cb) {
+  stale_cb_ = std::move(cb);
+}
+
+void Forwarder::Resolve(const CacheKey& key,
+                        const uint8_t* query,
+                        size_t len,
+                        Response response) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t question_end = wire::QuestionEnd(query, len);
+  const uint8_t* end = query + (question_end ? question_end : len);
+  Waiter waiter = {std::move(response), std::vector<uint8_t>(query, end),
+                   Clock::now()};
+
+  InFlightQuery* entry = StartQuery(key);
+  if (entry == nullptr) {
+    // Upstream is unreachable; there's no point making the client wait.
+    std::vector<Waiter> waiters;
+    waiters.push_back(std::move(waiter));
+    AnswerStale(key, &waiters, Clock::time_point::max());
+    AnswerFailure(&waiters);
+    return;
+  }
+  entry->waiters.push_back(std::move(waiter));
+}
+
+void Forwarder::Refresh(const CacheKey& key) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  StartQuery(key);
+}
+
+void Forwarder::Lookup(const CacheKey& key, LookupCB cb) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  InFlightQuery* entry = StartQuery(key);
+  if (entry) {
+    entry->lookups.push_back(std::move(cb));
+    return;
+  }
+  lock.unlock();
+  cb.Run({});
+}
+
+Forwarder::InFlightQuery* Forwarder::StartQuery(const CacheKey& key) {
+  auto it = in_flight_.find(key);
+  if (it != in_flight_.end()) {
+    stats_.coalesced++;
+    return &it->second;
+  }
+
+  if (by_id_.size() >= UINT16_MAX)
+    return nullptr;
+  uint16_t id;
+  do {
+    id = random_();
+  } while (by_id_.find(id) != by_id_.end());
+
+  // The upstream query is rebuilt from the normalized key rather than copied
+  // from whichever client happened to ask first, so that every waiter gets an
+  // answer to the same question.
+  auto m_packet = DnsPacket::Create(id)
+                      .SetRecursionDesired(1)
+                      .AddQuestion(key.name, key.type, key.klass);
+  if (!m_packet.has_value())
+    return nullptr;
+  DnsPacket packet = std::move(m_packet).value();
+  auto ws = std::make_unique<WriteStream>(512);
+  if (!packet.Export(ws.get()).is_ok())
+    return nullptr;
+  auto rs = ws->Convert();
+  int socket = OpenSocket();
+  if (socket < 0)
+    return nullptr;
+  Clock::time_point now = Clock::now();
+  size_t upstream = PickUpstream(now);
+  if (!Send(upstream, socket, rs->GetBuffer(), rs->Size())) {
+    close(socket);
+    return nullptr;
+  }
+
+  InFlightQuery& entry = in_flight_[key];
+  entry.upstream_id = id;
+  entry.socket = socket;
+  entry.upstream = upstream;
+  entry.sent = now;
+  entry.question.assign(rs->GetBuffer() + wire::kHeaderSize,
+                        rs->GetBuffer() + rs->Size());
+  by_id_[id] = key;
+  stats_.upstream_queries++;
+  return &entry;
+}
+
+void Forwarder::ReadReplies() {
+  struct epoll_event events[64];
+  int ready = epoll_wait(epoll_, events, std::size(events), 0);
+  if (ready < 0) {
+    if (errno != EINTR)
+      perror("epoll upstream");
+    return;
+  }
+  uint8_t buf[4096];
+  for (int i = 0; i < ready; i++) {
+    int socket = events[i].data.fd;
+    while (true) {
+      struct sockaddr_in from;
+      socklen_t from_len = sizeof(from);
+      ssize_t bytes = recvfrom(socket, buf, sizeof(buf), MSG_DONTWAIT,
+                               reinterpret_cast<sockaddr*>(&from), &from_len);
+      if (bytes < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+          perror("recv upstream");
+        break;
+      }
+      if (HandleReply(buf, bytes, from, socket))
+        break;
+    }
+  }
+}
+
+bool Forwarder::HandleReply(const uint8_t* data,
+                            size_t len,
+                            const struct sockaddr_in& from,
+                            int socket) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (len < wire::kHeaderSize || !IsReply(data)) {
+    stats_.mismatched++;
+    return false;
+  }
+  auto id_it = by_id_.find(wire::ReadU16(data));
+  if (id_it == by_id_.end()) {
+    stats_.mismatched++;
+    return false;
+  }
+  auto it = in_flight_.find(id_it->second);
+  if (it->second.socket != socket) {
+    stats_.mismatched++;
+    return false;
+  }
+  auto sent_to = [&from, this](size_t upstream) {
+    if (upstream == kNoUpstream)
+      return false;
+    const struct sockaddr_in& to = upstreams_[upstream].address;
+    return from.sin_family == AF_INET && from.sin_port == to.sin_port &&
+           from.sin_addr.s_addr == to.sin_addr.s_addr;
+  };
+  bool won_race = sent_to(it->second.racer);
+  if (!won_race && !sent_to(it->second.upstream)) {
+    stats_.mismatched++;
+    return false;
+  }
+  const std::vector<uint8_t>& question = it->second.question;
+  size_t question_end = wire::QuestionEnd(data, len);
+  if (question_end - wire::kHeaderSize != question.size() ||
+      memcmp(data + wire::kHeaderSize, question.data(), question.size())) {
+    stats_.mismatched++;
+    return false;
+  }
+
+  stats_.replies++;
+  Clock::time_point now = Clock::now();
+  if (won_race) {
+    stats_.races_won++;
+    RecordReply(it->second.racer, now - it->second.raced);
+    // The first upstream hasn't answered yet, which is worth knowing too.
+    Upstream& slow = upstreams_[it->second.upstream];
+    slow.srtt = std::max(slow.srtt, Smooth(slow.srtt, now - it->second.sent));
+  } else {
+    RecordReply(it->second.upstream, now - it->second.sent);
+  }
+  CacheKey key = std::move(id_it->second);
+  InFlightQuery entry = std::move(it->second);
+  in_flight_.erase(it);
+  by_id_.erase(id_it);
+  close(socket);
+
+  reply_cb_.Run(key, data, len);
+  std::vector<uint8_t> reply;
+  for (Waiter& waiter : entry.waiters) {
+    reply.assign(data, data + len);
+    wire::PatchFromQuery(reply.data(), reply.size(), waiter.query.data(),
+                         waiter.query.size());
+    waiter.response.SendData(reply.data(), reply.size());
+  }
+
+  lock.unlock();
+  for (const LookupCB& cb : entry.lookups)
+    cb.Run(std::vector<uint8_t>(data, data + len));
+  return true;
+}
+
+void Forwarder::ExpireQueries(Clock::time_point now) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  std::vector<LookupCB> failed;
+  Clock::duration race_after = RaceAfter();
+  for (auto it = in_flight_.begin(); it != in_flight_.end();) {
+    InFlightQuery& entry = it->second;
+    if (now - entry.sent >= options_.timeout) {
+      RecordTimeout(entry.upstream, now);
+      if (entry.racer != kNoUpstream)
+        RecordTimeout(entry.racer, now);
+      AnswerStale(it->first, &entry.waiters, Clock::time_point::max());
+      AnswerFailure(&entry.waiters);
+      std::move(entry.lookups.begin(), entry.lookups.end(),
+                std::back_inserter(failed));
+      by_id_.erase(entry.upstream_id);
+      close(entry.socket);
+      it = in_flight_.erase(it);
+      stats_.timeouts++;
+    } else {
+      if (entry.racer == kNoUpstream && now - entry.sent >= race_after)
+        Race(&entry, now);
+      AnswerStale(it->first, &entry.waiters, now - options_.client_deadline);
+      it++;
+    }
+  }
+
+  lock.unlock();
+  for (const LookupCB& cb : failed)
+    cb.Run({});
+}
+
+size_t Forwarder::PickUpstream(Clock::time_point now, size_t except) {
+  size_t best = kNoUpstream;
+  Clock::duration best_score = Clock::duration::max();
+  // Failing that, the one that is next out of the penalty box.
+  size_t next = kNoUpstream;
+  for (size_t i = 0; i < upstreams_.size(); i++) {
+    const Upstream& upstream = upstreams_[i];
+    if (i == except)
+      continue;
+    if (upstream.penalized_until > now) {
+      if (next == kNoUpstream ||
+          upstream.penalized_until < upstreams_[next].penalized_until) {
+        next = i;
+      }
+      continue;
+    }
+    // What a query to it can be expected to cost.
+    auto score = upstream.srtt +
+                 std::chrono::duration_cast<Clock::duration>(
+                     options_.timeout * upstream.failure_rate);
+    if (score < best_score) {
+      best = i;
+      best_score = score;
+    }
+  }
+  if (best == kNoUpstream)
+    best = next;
+  for (size_t i = 0; i < upstreams_.size(); i++) {
+    if (i != best)
+      upstreams_[i].srtt = upstreams_[i].srtt * kDecay / 64;
+  }
+  return best;
+}
+
+int Forwarder::OpenSocket() {
+  // Not connected, since a raced query goes to a second upstream from the
+  // same socket; HandleReply checks where each reply came from instead.
+  int socket = ::socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (socket < 0) {
+    perror("upstream socket");
+    return -1;
+  }
+  // Bound to port 0, Linux picks a free ephemeral port at random.
+  struct sockaddr_in local;
+  memset(&local, 0, sizeof(local));
+  local.sin_family = AF_INET;
+  struct epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.fd = socket;
+  if (bind(socket, reinterpret_cast<const sockaddr*>(&local),
+           sizeof(local)) < 0 ||
+      epoll_ctl(epoll_, EPOLL_CTL_ADD, socket, &event) < 0) {
+    perror("upstream socket");
+    close(socket);
+    return -1;
+  }
+  return socket;
+}
+
+bool Forwarder::Send(size_t upstream,
+                     int socket,
+                     const uint8_t* data,
+                     size_t len) {
+  const struct sockaddr_in& to = upstreams_[upstream].address;
+  if (sendto(socket, data, len, 0, reinterpret_cast<const sockaddr*>(&to),
+             sizeof(to)) < 0) {
+    perror("send upstream");
+    return false;
+  }
+  return true;
+}
+
+void Forwarder::RecordReply(size_t upstream, Clock::duration rtt) {
+  Upstream& entry = upstreams_[upstream];
+  entry.srtt = Smooth(entry.srtt, rtt);
+  entry.failure_rate -= entry.failure_rate / (1 << kSmoothing);
+  entry.timeouts_in_a_row = 0;
+  rtts_.Record(rtt);
+}
+
+void Forwarder::RecordTimeout(size_t upstream, Clock::time_point now) {
+  Upstream& entry = upstreams_[upstream];
+  entry.failure_rate += (1 - entry.failure_rate) / (1 << kSmoothing);
+  int doublings = std::min(entry.timeouts_in_a_row++, 16);
+  entry.penalized_until =
+      now + std::min<Clock::duration>(options_.penalty * (1 << doublings),
+                                      options_.max_penalty);
+}
+
+Forwarder::Clock::duration Forwarder::RaceAfter() const {
+  if (options_.race_percentile <= 0 || upstreams_.size() < 2)
+    return Clock::duration::max();
+  return std::max<Clock::duration>(rtts_.Percentile(options_.race_percentile),
+                                   options_.race_floor);
+}
+
+void Forwarder::Race(InFlightQuery* entry, Clock::time_point now) {
+  size_t racer = PickUpstream(now, entry->upstream);
+  if (racer == kNoUpstream)
+    return;
+  // The same query again, under the same ID, so either reply will do.
+  std::vector<uint8_t> query(wire::kHeaderSize);
+  wire::WriteU16(query.data(), entry->upstream_id);
+  query[2] = 0x01;  // RD
+  wire::WriteU16(query.data() + 4, 1);
+  query.insert(query.end(), entry->question.begin(), entry->question.end());
+  if (!Send(racer, entry->socket, query.data(), query.size()))
+    return;
+  entry->racer = racer;
+  entry->raced = now;
+  stats_.races++;
+}
+
+void Forwarder::AnswerStale(const CacheKey& key,
+                            std::vector<Waiter>* waiters,
+                            Clock::time_point asked_before) {
+  std::vector<uint8_t> reply;
+  auto answered = [&](Waiter& waiter) {
+    if (waiter.asked > asked_before)
+      return false;
+    if (!stale_cb_.Run(key, waiter.query.data(), waiter.query.size(), &reply))
+      return false;
+    waiter.response.SendData(reply.data(), reply.size());
+    stats_.stale_answers++;
+    return true;
+  };
+  waiters->erase(std::remove_if(waiters->begin(), waiters->end(), answered),
+                 waiters->end());
+}
+
+void Forwarder::AnswerFailure(std::vector<Waiter>* waiters) {
+  uint8_t reply[512];
+  for (Waiter& waiter : *waiters) {
+    size_t len = WriteErrorReply(waiter.query.data(), waiter.query.size(),
+                                 ResponseCode::kServerFailure, reply,
+                                 sizeof(reply));
+    if (len)
+      waiter.response.SendData(reply, len);
+    stats_.failures++;
+  }
+  waiters->clear();
+}
+
+base::json::Object Forwarder::Render() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::map<std::string, base::json::JSON> result;
+  std::vector<base::json::JSON> upstreams;
+  for (const Upstream& upstream : upstreams_) {
+    char address[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &upstream.address.sin_addr, address, sizeof(address));
+    std::map<std::string, base::json::JSON> fields;
+    fields["Address"] = std::string(address) + ":" +
+                        std::to_string(ntohs(upstream.address.sin_port));
+    fields["SRTT us"] = (int)std::chrono::duration_cast<
+                            std::chrono::microseconds>(upstream.srtt)
+                            .count();
+    fields["Failure %"] = (int)(upstream.failure_rate * 100);
+    fields["Penalized"] = upstream.penalized_until > Clock::now();
+    upstreams.push_back(base::json::Object(std::move(fields)));
+  }
+  result["Upstreams"] = base::json::Array(std::move(upstreams));
+  result["In Flight"] = (int)in_flight_.size();
+  result["Upstream Queries"] = (int)stats_.upstream_queries;
+  result["Coalesced"] = (int)stats_.coalesced;
+  result["Replies"] = (int)stats_.replies;
+  result["Mismatched"] = (int)stats_.mismatched;
+  result["Timeouts"] = (int)stats_.timeouts;
+  result["Stale Answers"] = (int)stats_.stale_answers;
+  result["Races"] = (int)stats_.races;
+  result["Races Won"] = (int)stats_.races_won;
+  result["Failures"] = (int)stats_.failures;
+  return base::json::Object(std::move(result));
+}
+
+}  // namespace homedns
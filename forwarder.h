@@ -0,0 +1,229 @@
+#pragma once
+
+#include <netinet/in.h>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include "base/bind/bind.h"
+#include "base/json/json.h"
+
+#include "answer_cache.h"
+#include "latency_histogram.h"
+#include "udp_server.h"
+
+namespace homedns {
+
+// Forwards queries to a pool of upstream resolvers. Questions which arrive
+// while an identical one is already outstanding are not sent upstream again;
+// they wait on the existing query and are all answered from its single reply,
+// each with their own ID and name casing patched back in. A reply is only
+// taken from an upstream its query went to.
+//
+// Each upstream query goes out on a socket of its own, on a port the kernel
+// picks at random, so that a forged reply has to guess the port as well as
+// the ID (RFC 5452). GetFD() is an epoll set of those sockets. Only a
+// response to a standard query, with one of the rcodes such a response can
+// carry, is taken as a reply.
+//
+// Each query goes to the upstream expected to answer soonest: the one with
+// the lowest smoothed round trip time, plus its recent share of timeouts
+// times the timeout. Every pick lets the others' times decay a little, so
+// that an upstream which was slow gets tried again now and then. One that
+// times out is left alone for a penalty that doubles with each timeout in a
+// row. A query that is taking longer than most can also be raced against the
+// next best upstream, so that one slow upstream doesn't set the tail latency.
+//
+// Thread safe, so that workers can hand queries over while the loop reads the
+// replies. The callbacks run with the forwarder locked, and mustn't call
+// back into it.
+class Forwarder {
+ public:
+  using Clock = std::chrono::steady_clock;
+  using ReplyCB =
+      base::RepeatingCallback<void(const CacheKey&, const uint8_t*, size_t)>;
+  using StaleCB = base::RepeatingCallback<
+      bool(const CacheKey&, const uint8_t*, size_t, std::vector<uint8_t>*)>;
+  using LookupCB = base::RepeatingCallback<void(std::vector<uint8_t>)>;
+
+  struct Options {
+    // How long an upstream query is given before it is abandoned.
+    std::chrono::milliseconds timeout{5000};
+
+    // How long a client is kept waiting on upstream before it is given a
+    // stale answer instead, if there is one (RFC 8767 suggests 1.8 seconds).
+    // The upstream query carries on in the background regardless.
+    std::chrono::milliseconds client_deadline{1800};
+
+    // How long an upstream is passed over after a timeout, doubling with
+    // each further timeout in a row up to |max_penalty|. When every upstream
+    // is being passed over, the one whose penalty ends first is used.
+    std::chrono::milliseconds penalty{1000};
+    std::chrono::milliseconds max_penalty{60000};
+
+    // Once a query has been outstanding for longer than this percentile of
+    // upstream round trip times, it is sent to the next best upstream too,
+    // and whichever answers first wins. 0 turns racing off. Races never
+    // start sooner than |race_floor|, and need two upstreams.
+    double race_percentile = 0;
+    std::chrono::milliseconds race_floor{10};
+  };
+
+  struct Stats {
+    uint64_t upstream_queries = 0;
+    uint64_t coalesced = 0;
+    uint64_t replies = 0;
+    uint64_t mismatched = 0;
+    uint64_t timeouts = 0;
+    uint64_t stale_answers = 0;
+
+    // Queries sent to a second upstream, and how many of those it answered
+    // first.
+    uint64_t races = 0;
+    uint64_t races_won = 0;
+
+    // Clients answered with SERVFAIL, having neither an upstream nor a stale
+    // answer to go on.
+    uint64_t failures = 0;
+  };
+
+  static std::unique_ptr<Forwarder> Create(struct sockaddr_in upstream);
+  static std::unique_ptr<Forwarder> Create(struct sockaddr_in upstream,
+                                           Options options);
+  static std::unique_ptr<Forwarder> Create(
+      std::vector<struct sockaddr_in> upstreams,
+      Options options);
+  ~Forwarder();
+
+  // Answers |response| with the upstream's answer for |key|, which must be the
+  // first question of |query|.
+  void Resolve(const CacheKey& key,
+               const uint8_t* query,
+               size_t len,
+               Response response);
+
+  // Asks upstream about |key| without anybody waiting on the answer. Used to
+  // refresh cache entries ahead of their expiry.
+  void Refresh(const CacheKey& key);
+
+  // Runs |cb| with the upstream's reply for |key| as it arrived, or with
+  // nothing if there is none before the timeout. Unlike the other callbacks,
+  // |cb| runs with the forwarder unlocked, so it may ask again; it may also
+  // run before Lookup returns.
+  void Lookup(const CacheKey& key, LookupCB cb);
+
+  // Runs |cb| for every reply that comes back from upstream, before the
+  // waiting clients are answered.
+  void OnReply(ReplyCB cb);
+
+  // Runs |cb| to look for a stale answer for clients that have outlived the
+  // client deadline, or whose query couldn't be sent at all. |cb| should fill
+  // in the reply (patched for the given query) and return true if it has one.
+  void OnStale(StaleCB cb);
+
+  // Drains the upstream sockets. Should be run whenever GetFD() is readable.
+  void ReadReplies();
+
+  // Answers clients past their deadline from stale data, races queries that
+  // are taking too long, and gives up on queries that have been outstanding
+  // for longer than the timeout, answering anybody still waiting with
+  // SERVFAIL. Should be run regularly, and often enough for races to start
+  // on time.
+  void ExpireQueries(Clock::time_point now = Clock::now());
+
+  int GetFD() const { return epoll_; }
+  size_t InFlight() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return in_flight_.size();
+  }
+  Stats GetStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+  }
+  base::json::Object Render() const;
+
+ private:
+  struct Waiter {
+    Response response;
+    std::vector<uint8_t> query;  // Header and first question, as asked.
+    Clock::time_point asked;
+  };
+
+  static constexpr size_t kNoUpstream = SIZE_MAX;
+
+  struct Upstream {
+    struct sockaddr_in address;
+    // Moved an eighth of the way towards each new sample, as TCP does (RFC
+    // 6298). Zero until the first reply, so that every upstream is tried.
+    Clock::duration srtt{0};
+    // The share of recent queries that timed out, smoothed the same way.
+    double failure_rate = 0;
+    int timeouts_in_a_row = 0;
+    Clock::time_point penalized_until;
+  };
+
+  struct InFlightQuery {
+    uint16_t upstream_id;
+    // Its own; replies that arrive on any other are not for it.
+    int socket;
+    size_t upstream;  // Index into |upstreams_|.
+    Clock::time_point sent;
+    // The second upstream, once the query has been raced.
+    size_t racer = kNoUpstream;
+    Clock::time_point raced;
+    std::vector<uint8_t> question;  // Question section, as sent upstream.
+    std::vector<Waiter> waiters;
+    std::vector<LookupCB> lookups;
+  };
+
+  Forwarder(int epoll,
+            std::vector<struct sockaddr_in> upstreams,
+            Options options);
+
+  // Starts an upstream query for |key| unless one is already in flight, and
+  // returns the entry that replies for |key| will be delivered to.
+  InFlightQuery* StartQuery(const CacheKey& key);
+  // Returns whether the reply ended the query, and closed |socket|.
+  bool HandleReply(const uint8_t* data,
+                   size_t len,
+                   const struct sockaddr_in& from,
+                   int socket);
+
+  // The upstream expected to answer soonest, other than |except|.
+  size_t PickUpstream(Clock::time_point now, size_t except = kNoUpstream);
+  // A socket for one upstream query, in the epoll set, or -1.
+  int OpenSocket();
+  bool Send(size_t upstream, int socket, const uint8_t* data, size_t len);
+  void RecordReply(size_t upstream, Clock::duration rtt);
+  void RecordTimeout(size_t upstream, Clock::time_point now);
+  // How long a query may be outstanding before it is raced.
+  Clock::duration RaceAfter() const;
+  void Race(InFlightQuery* entry, Clock::time_point now);
+
+  // Answers, and removes, every waiter that asked before |asked_before| and
+  // for which there is a stale answer.
+  void AnswerStale(const CacheKey& key,
+                   std::vector<Waiter>* waiters,
+                   Clock::time_point asked_before);
+
+  // Answers, and removes, every waiter with SERVFAIL.
+  void AnswerFailure(std::vector<Waiter>* waiters);
+
+  int epoll_;
+  std::vector<Upstream> upstreams_;
+  // Round trip times of every reply, for RaceAfter().
+  LatencyHistogram rtts_;
+  Options options_;
+  ReplyCB reply_cb_;
+  StaleCB stale_cb_;
+  mutable std::mutex mutex_;
+  std::unordered_map<CacheKey, InFlightQuery, CacheKeyHash> in_flight_;
+  std::unordered_map<uint16_t, CacheKey> by_id_;
+  std::mt19937 random_;
+  Stats stats_;
+};
+
+}  // namespace homedns
@@ -0,0 +1,43 @@
+#include "header_filter.h"
+
+namespace homedns {
+
+namespace {
+
+// Socket filters on a UDP socket see the datagram from its UDP header.
+constexpr uint32_t kUDPHeaderSize = 8;
+
+}  // namespace
+
+base::json::Object HeaderFilter::Render() const {
+  std::map<std::string, base::json::JSON> result;
+  result["Accepted"] = (int)Count(Reason::kAccept);
+  result["Updates"] = (int)Count(Reason::kUpdate);
+  result["Too Short"] = (int)Count(Reason::kTooShort);
+  result["Responses"] = (int)Count(Reason::kResponse);
+  result["Unsupported Opcode"] = (int)Count(Reason::kUnsupportedOpcode);
+  result["No Question"] = (int)Count(Reason::kNoQuestion);
+  result["Extra Questions"] = (int)Count(Reason::kExtraQuestions);
+  result["Bad Question"] = (int)Count(Reason::kBadQuestion);
+  return base::json::Object(std::move(result));
+}
+
+// static
+std::vector<struct sock_filter> HeaderFilter::KernelProgram() {
+  constexpr uint32_t kFlags = kUDPHeaderSize + 2;
+  return {
+      // 0: if (len < udp header + dns header) drop
+      BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0),
+      BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, kUDPHeaderSize + wire::kHeaderSize,
+               0, 3),
+      // 2: if (QR) drop
+      BPF_STMT(BPF_LD | BPF_B | BPF_ABS, kFlags),
+      BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x80, 1, 0),
+      // 4: accept the whole datagram
+      BPF_STMT(BPF_RET | BPF_K, UINT32_MAX),
+      // 5: drop
+      BPF_STMT(BPF_RET | BPF_K, 0),
+  };
+}
+
+}  // namespace homedns
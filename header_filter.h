@@ -0,0 +1,77 @@
+#pragma once
+
+#include <linux/filter.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "base/json/json.h"
+#include "wire.h"
+
+namespace homedns {
+
+// Sorts incoming datagrams by their fixed 12 byte header (and a walk over the
+// first question name), so that junk is turned away before anything is
+// imported or allocated. Every verdict is counted by reason, with relaxed
+// atomics so that any number of workers can share one filter.
+class HeaderFilter {
+ public:
+  enum class Reason : uint8_t {
+    kAccept,
+    kUpdate,             // An RFC 2136 UPDATE, with its zone as the question.
+    kTooShort,           // Dropped: not even a header.
+    kResponse,           // Dropped: answering it could start a reply loop.
+    kUnsupportedOpcode,  // NOTIMP: anything other than a standard query.
+    kNoQuestion,         // FORMERR.
+    kExtraQuestions,     // FORMERR: nobody supports more than one.
+    kBadQuestion,        // FORMERR: the question runs off the end.
+    kCount,
+  };
+
+  static constexpr uint8_t kUpdateOpcode = 5;
+
+  static Reason ClassifyHeader(const uint8_t* data, size_t len) {
+    if (len < wire::kHeaderSize)
+      return Reason::kTooShort;
+    if (data[2] & 0x80)
+      return Reason::kResponse;
+    uint8_t opcode = (data[2] >> 3) & 0x0F;
+    if (opcode != 0 && opcode != kUpdateOpcode)
+      return Reason::kUnsupportedOpcode;
+    uint16_t questions = wire::ReadU16(data + 4);
+    if (questions == 0)
+      return Reason::kNoQuestion;
+    if (questions > 1)
+      return Reason::kExtraQuestions;
+    if (wire::QuestionEnd(data, len) == 0)
+      return Reason::kBadQuestion;
+    return opcode == kUpdateOpcode ? Reason::kUpdate : Reason::kAccept;
+  }
+
+  Reason Classify(const uint8_t* data, size_t len) {
+    Reason reason = ClassifyHeader(data, len);
+    counts_[static_cast<size_t>(reason)].fetch_add(1,
+                                                    std::memory_order_relaxed);
+    return reason;
+  }
+
+  uint64_t Count(Reason reason) const {
+    return counts_[static_cast<size_t>(reason)].load(
+        std::memory_order_relaxed);
+  }
+
+  base::json::Object Render() const;
+
+  // A classic BPF program for SO_ATTACH_FILTER on the server's UDP socket. It
+  // drops datagrams which are too short or are responses, in the kernel,
+  // before they are queued or woken up for. Those are the only verdicts that
+  // are silent anyway; anything owed a FORMERR or NOTIMP is let through to
+  // get it. The kernel doesn't say what it dropped, so these aren't counted.
+  static std::vector<struct sock_filter> KernelProgram();
+
+ private:
+  std::atomic<uint64_t> counts_[static_cast<size_t>(Reason::kCount)] = {};
+};
+
+}  // namespace homedns
@@ -0,0 +1,153 @@
+#include "host_table.h"
+
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+
+#include "records.h"
+#include "suffix_tree.h"
+
+namespace homedns {
+
+namespace {
+
+std::string_view StripDot(std::string_view name) {
+  if (!name.empty() && name.back() == '.')
+    name.remove_suffix(1);
+  return name;
+}
+
+template <typename T>
+PacketStatus::Or<DnsPacket> AddAddress(DnsPacket response,
+                                       const std::string& name,
+                                       uint16_t klass,
+                                       uint32_t ttl,
+                                       const HostAddress& address) {
+  T record;
+  memcpy(record.IP, address.bytes, sizeof(record.IP));
+  return std::move(response).AddRecord<DnsPacket::RecordType::kAnswer>(
+      name, klass, ttl, record);
+}
+
+}  // namespace
+
+size_t HostTable::NameHash::operator()(std::string_view name) const {
+  name = StripDot(name);
+  uint64_t hash = 14695981039346656037ull;
+  for (char c : name)
+    hash = (hash ^ _suffix_tree::Lower(c)) * 1099511628211ull;
+  return hash;
+}
+
+bool HostTable::NameEquals::operator()(std::string_view a,
+                                       std::string_view b) const {
+  a = StripDot(a);
+  b = StripDot(b);
+  return a.size() == b.size() &&
+         std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+           return _suffix_tree::Lower(x) == _suffix_tree::Lower(y);
+         });
+}
+
+HostTable::HostTable(ReverseIndex* reverse, uint32_t ttl)
+    : reverse_(reverse), ttl_(ttl) {}
+
+HostTable::ForwardShard& HostTable::Forward(std::string_view name) const {
+  return forward_[(NameHash()(name) >> 32) % kShards];
+}
+
+void HostTable::Add(std::string_view name, const HostAddress& address) {
+  std::string key(StripDot(name));
+  std::transform(key.begin(), key.end(), key.begin(), _suffix_tree::Lower);
+  {
+    ForwardShard& shard = Forward(key);
+    std::unique_lock lock(shard.mutex);
+    auto& addresses = shard.addresses[key];
+    auto it = std::find_if(addresses.begin(), addresses.end(),
+                           [&](const auto& a) { return a.value == address; });
+    if (it != addresses.end()) {
+      it->refs++;
+      return;
+    }
+    addresses.push_back({address, 1});
+  }
+  size_++;
+  if (reverse_)
+    reverse_->Add(address, key);
+}
+
+void HostTable::Remove(std::string_view name, const HostAddress& address) {
+  std::string key(StripDot(name));
+  std::transform(key.begin(), key.end(), key.begin(), _suffix_tree::Lower);
+  {
+    ForwardShard& shard = Forward(key);
+    std::unique_lock lock(shard.mutex);
+    auto found = shard.addresses.find(key);
+    if (found == shard.addresses.end())
+      return;
+    auto& addresses = found->second;
+    auto it = std::find_if(addresses.begin(), addresses.end(),
+                           [&](const auto& a) { return a.value == address; });
+    if (it == addresses.end() || --it->refs > 0)
+      return;
+    addresses.erase(it);
+    if (addresses.empty())
+      shard.addresses.erase(found);
+  }
+  size_--;
+  if (reverse_)
+    reverse_->Remove(address, key);
+}
+
+std::vector<HostAddress> HostTable::Addresses(std::string_view name) const {
+  std::vector<HostAddress> addresses;
+  ForwardShard& shard = Forward(name);
+  std::shared_lock lock(shard.mutex);
+  auto found = shard.addresses.find(name);
+  if (found != shard.addresses.end()) {
+    for (const auto& address : found->second)
+      addresses.push_back(address.value);
+  }
+  return addresses;
+}
+
+bool HostTable::Contains(const DnsLabelSeq& name) const {
+  if (Size() == 0 || name.value == nullptr)
+    return false;
+  std::string_view text = name.value->longform;
+  ForwardShard& shard = Forward(text);
+  std::shared_lock lock(shard.mutex);
+  return shard.addresses.find(text) != shard.addresses.end();
+}
+
+PacketStatus::Or<DnsPacket> HostTable::Answer(const DnsQuestion* question,
+                                              DnsPacket response) const {
+  if (question->LabelSequence.value == nullptr)
+    return PacketStatus::Codes::kNameNotFound;
+  std::string_view text = question->LabelSequence.value->longform;
+  std::string name = question->LabelSequence.Render();
+  std::vector<HostAddress> addresses = Addresses(text);
+  if (addresses.empty())
+    return PacketStatus::Codes::kNameNotFound;
+  size_t answers = 0;
+  for (const HostAddress& address : addresses) {
+    bool a = question->Type == DnsARecord::TYPE && address.family == AF_INET;
+    bool aaaa =
+        question->Type == DnsAAAARecord::TYPE && address.family == AF_INET6;
+    if (!a && !aaaa)
+      continue;
+    auto added = a ? AddAddress<DnsARecord>(std::move(response), name,
+                                            question->Class, ttl_, address)
+                   : AddAddress<DnsAAAARecord>(std::move(response), name,
+                                               question->Class, ttl_, address);
+    if (!added.has_value())
+      return std::move(added).error();
+    response = std::move(added).value();
+    answers++;
+  }
+  if (answers == 0)
+    return PacketStatus::Codes::kInvalidRecordType;
+  return response;
+}
+
+}  // namespace homedns
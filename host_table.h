@@ -0,0 +1,86 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "packet.h"
+#include "reverse_index.h"
+#include "status.h"
+
+namespace homedns {
+
+// The names of local hosts and their addresses, answering A and AAAA queries
+// for them, and keeping a ReverseIndex in step for PTR queries. Unlike a
+// Zone, entries come and go one at a time, as hosts files and DHCP leases
+// change underneath it (see HostsWatcher), so it is a hash table in shards,
+// each behind a reader writer lock: a change holds one shard's lock for a
+// hash table update, and lookups only ever wait for that.
+//
+// The same name and address can be added by more than one source, and stay
+// until each has removed them. Changes come from one thread at a time;
+// lookups from any number.
+class HostTable {
+ public:
+  // |reverse| may be null, and otherwise has to outlive the table.
+  explicit HostTable(ReverseIndex* reverse = nullptr, uint32_t ttl = 60);
+
+  void Add(std::string_view name, const HostAddress& address);
+  void Remove(std::string_view name, const HostAddress& address);
+
+  // Whether |name| is a host's name.
+  bool Contains(const DnsLabelSeq& name) const;
+
+  // Adds the records answering |question| to |response|. Fails with
+  // kNameNotFound if the table doesn't have the name, and kInvalidRecordType
+  // if it has the name but no records of the type.
+  PacketStatus::Or<DnsPacket> Answer(const DnsQuestion* question,
+                                     DnsPacket response) const;
+
+  std::vector<HostAddress> Addresses(std::string_view name) const;
+
+  // The number of distinct name and address pairs.
+  size_t Size() const { return size_.load(std::memory_order_relaxed); }
+
+ private:
+  static constexpr size_t kShards = 16;
+
+  // Names compare case-insensitively, so that a lookup can go straight from
+  // the question's name without lowercasing a copy of it.
+  struct NameHash {
+    using is_transparent = void;
+    size_t operator()(std::string_view name) const;
+  };
+  struct NameEquals {
+    using is_transparent = void;
+    bool operator()(std::string_view a, std::string_view b) const;
+  };
+
+  template <typename T>
+  struct Counted {
+    T value;
+    uint32_t refs;
+  };
+  struct ForwardShard {
+    mutable std::shared_mutex mutex;
+    std::unordered_map<std::string,
+                       std::vector<Counted<HostAddress>>,
+                       NameHash,
+                       NameEquals>
+        addresses;
+  };
+
+  ForwardShard& Forward(std::string_view name) const;
+
+  ReverseIndex* reverse_;
+  uint32_t ttl_;
+  std::atomic<size_t> size_ = 0;
+  mutable std::array<ForwardShard, kShards> forward_;
+};
+
+}  // namespace homedns
@@ -0,0 +1,316 @@
+#include "hosts_watcher.h"
+
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <set>
+
+namespace homedns {
+
+namespace {
+
+constexpr uint32_t kEvents = IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO |
+                             IN_MOVED_FROM | IN_CREATE | IN_DELETE;
+
+// FNV-1a, carried on from |hash|, so that what a file had can be hashed a
+// piece at a time as it grows.
+uint64_t Hash(std::string_view text, uint64_t hash = 14695981039346656037ull) {
+  for (char c : text)
+    hash = (hash ^ static_cast<uint8_t>(c)) * 1099511628211ull;
+  return hash;
+}
+
+// Takes the first line off |text|, which ends in a newline.
+std::string_view NextLine(std::string_view* text) {
+  size_t newline = text->find('\n');
+  std::string_view line = text->substr(0, newline);
+  text->remove_prefix(newline + 1);
+  if (!line.empty() && line.back() == '\r')
+    line.remove_suffix(1);
+  return line;
+}
+
+std::string_view NextField(std::string_view* text) {
+  size_t start = text->find_first_not_of(" \t\r");
+  if (start == std::string_view::npos) {
+    *text = {};
+    return {};
+  }
+  text->remove_prefix(start);
+  size_t end = std::min(text->find_first_of(" \t\r"), text->size());
+  std::string_view field = text->substr(0, end);
+  text->remove_prefix(end);
+  return field;
+}
+
+bool IsHostname(std::string_view name) {
+  if (name.empty() || name.size() > 253)
+    return false;
+  size_t label = 0;
+  for (char c : name) {
+    if (c == '.') {
+      if (label == 0)
+        return false;
+      label = 0;
+      continue;
+    }
+    bool ok = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+              (c >= '0' && c <= '9') || c == '-' || c == '_';
+    if (!ok || ++label > 63)
+      return false;
+  }
+  return label > 0;
+}
+
+// Reads [offset, offset + len) of |fd|. Returns less if the file is shorter
+// by now.
+std::string ReadAt(int fd, uint64_t offset, uint64_t len) {
+  std::string data(len, '\0');
+  size_t done = 0;
+  while (done < len) {
+    ssize_t n = pread(fd, data.data() + done, len - done, offset + done);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    done += n;
+  }
+  data.resize(done);
+  return data;
+}
+
+}  // namespace
+
+// static
+std::unique_ptr<HostsWatcher> HostsWatcher::Create(HostTable* table,
+                                                   std::string domain) {
+  int inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotify < 0) {
+    perror("inotify_init1");
+    return nullptr;
+  }
+  return std::unique_ptr<HostsWatcher>(
+      new HostsWatcher(table, std::move(domain), inotify));
+}
+
+HostsWatcher::HostsWatcher(HostTable* table, std::string domain, int inotify)
+    : table_(table), domain_(std::move(domain)), inotify_(inotify) {}
+
+HostsWatcher::~HostsWatcher() {
+  close(inotify_);
+}
+
+ConfigStatus HostsWatcher::Watch(const std::string& path, Format format) {
+  // The directory is watched rather than the file, so that a file replaced
+  // by a rename is still seen.
+  size_t slash = path.rfind('/');
+  std::string dir = slash == std::string::npos ? "."
+                    : slash == 0               ? "/"
+                                               : path.substr(0, slash);
+  int watch = inotify_add_watch(inotify_, dir.c_str(), kEvents);
+  if (watch < 0)
+    return ConfigStatus(ConfigStatus::Codes::kFileNotFound, dir);
+
+  auto file = std::make_unique<File>();
+  file->path = path;
+  file->format = format;
+  file->watch = watch;
+  file->base = slash == std::string::npos ? path : path.substr(slash + 1);
+  Update(file.get());
+  files_.push_back(std::move(file));
+  return base::OkStatus();
+}
+
+void HostsWatcher::ReadEvents() {
+  // A burst of writes to one file is caught up with once.
+  std::set<File*> changed;
+  alignas(struct inotify_event) char buffer[4096];
+  while (true) {
+    ssize_t len = read(inotify_, buffer, sizeof(buffer));
+    if (len < 0 && errno == EINTR)
+      continue;
+    if (len <= 0)
+      break;
+    for (char* at = buffer; at < buffer + len;) {
+      auto* event = reinterpret_cast<struct inotify_event*>(at);
+      at += sizeof(struct inotify_event) + event->len;
+      for (const auto& file : files_) {
+        if (event->mask & IN_Q_OVERFLOW) {
+          changed.insert(file.get());
+        } else if (event->wd == file->watch && event->len &&
+                   file->base == event->name) {
+          changed.insert(file.get());
+        }
+      }
+    }
+  }
+  for (File* file : changed)
+    Update(file);
+}
+
+void HostsWatcher::Update(File* file) {
+  int fd = open(file->path.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    // Gone, for now: so is everything it held.
+    if (fd >= 0)
+      close(fd);
+    std::vector<std::pair<uint64_t, uint32_t>> lines;
+    for (const auto& [hash, line] : file->lines)
+      lines.push_back({hash, line.count});
+    for (const auto& [hash, count] : lines)
+      RemoveLine(file, hash, count);
+    file->inode = 0;
+    file->size = 0;
+    file->consumed = 0;
+    file->prefix_hash = 0;
+    return;
+  }
+  uint64_t size = st.st_size;
+  int64_t mtime = st.st_mtim.tv_sec * 1000000000ll + st.st_mtim.tv_nsec;
+  if (st.st_ino == file->inode && size == file->size && mtime == file->mtime) {
+    close(fd);
+    return;
+  }
+  // Only whole lines are read; a partial one waits for the rest of it.
+  std::string data = ReadAt(fd, 0, size);
+  close(fd);
+  size_t end = data.rfind('\n');
+  data.resize(end == std::string::npos ? 0 : end + 1);
+  if (st.st_ino != file->inode || data.size() < file->consumed ||
+      !Append(file, data)) {
+    Rescan(file, data);
+  }
+  file->inode = st.st_ino;
+  file->size = size;
+  file->mtime = mtime;
+}
+
+bool HostsWatcher::Append(File* file, std::string_view data) {
+  // Reading and hashing the file is cheap next to parsing it and updating
+  // the table, and anything short of all of it would miss a line rewritten
+  // in place before the end.
+  if (Hash(data.substr(0, file->consumed)) != file->prefix_hash)
+    return false;
+  std::string_view text = data.substr(file->consumed);
+  if (text.empty())
+    return true;
+  stats_.appends++;
+  file->prefix_hash = Hash(text, file->prefix_hash);
+  file->consumed = data.size();
+  while (!text.empty())
+    AddLine(file, NextLine(&text), 1);
+  return true;
+}
+
+void HostsWatcher::Rescan(File* file, std::string_view data) {
+  stats_.rescans++;
+
+  struct Seen {
+    uint32_t count = 0;
+    std::string_view text;
+  };
+  std::unordered_map<uint64_t, Seen> seen;
+  for (std::string_view text = data; !text.empty();) {
+    std::string_view line = NextLine(&text);
+    Seen& entry = seen[Hash(line)];
+    entry.count++;
+    entry.text = line;
+  }
+
+  // New entries go in before old ones come out, so that a host whose line
+  // changed for some other reason doesn't disappear in between.
+  for (const auto& [hash, entry] : seen) {
+    auto old = file->lines.find(hash);
+    uint32_t had = old == file->lines.end() ? 0 : old->second.count;
+    if (entry.count > had)
+      AddLine(file, entry.text, entry.count - had);
+  }
+  std::vector<std::pair<uint64_t, uint32_t>> gone;
+  for (const auto& [hash, line] : file->lines) {
+    auto now = seen.find(hash);
+    uint32_t has = now == seen.end() ? 0 : now->second.count;
+    if (has < line.count)
+      gone.push_back({hash, line.count - has});
+  }
+  for (const auto& [hash, times] : gone)
+    RemoveLine(file, hash, times);
+
+  file->consumed = data.size();
+  file->prefix_hash = Hash(data);
+}
+
+void HostsWatcher::AddLine(File* file, std::string_view text, uint32_t times) {
+  Line& line = file->lines[Hash(text)];
+  if (line.count == 0) {
+    line.entries = Parse(file->format, text);
+    stats_.lines_parsed++;
+  }
+  line.count += times;
+  for (uint32_t i = 0; i < times; i++) {
+    for (const Entry& entry : line.entries)
+      table_->Add(entry.name, entry.address);
+  }
+  stats_.entries_added += times * line.entries.size();
+}
+
+void HostsWatcher::RemoveLine(File* file, uint64_t hash, uint32_t times) {
+  auto found = file->lines.find(hash);
+  if (found == file->lines.end())
+    return;
+  Line& line = found->second;
+  times = std::min(times, line.count);
+  for (uint32_t i = 0; i < times; i++) {
+    for (const Entry& entry : line.entries)
+      table_->Remove(entry.name, entry.address);
+  }
+  stats_.entries_removed += times * line.entries.size();
+  line.count -= times;
+  if (line.count == 0)
+    file->lines.erase(found);
+}
+
+std::vector<HostsWatcher::Entry> HostsWatcher::Parse(
+    Format format,
+    std::string_view line) const {
+  line = line.substr(0, line.find('#'));
+  std::vector<std::string_view> names;
+  std::string_view address;
+  if (format == Format::kHosts) {
+    address = NextField(&line);
+    for (std::string_view name = NextField(&line); !name.empty();
+         name = NextField(&line)) {
+      names.push_back(name);
+    }
+  } else {
+    std::string_view expiry = NextField(&line);
+    if (expiry.empty() ||
+        !std::all_of(expiry.begin(), expiry.end(), ::isdigit)) {
+      return {};
+    }
+    NextField(&line);
+    address = NextField(&line);
+    std::string_view name = NextField(&line);
+    if (name != "*")
+      names.push_back(name);
+  }
+
+  std::optional<HostAddress> parsed = HostAddress::Parse(address);
+  if (!parsed.has_value())
+    return {};
+  std::vector<Entry> entries;
+  for (std::string_view name : names) {
+    std::string qualified(name);
+    if (!domain_.empty() && qualified.find('.') == std::string::npos)
+      qualified += "." + domain_;
+    if (IsHostname(qualified))
+      entries.push_back({std::move(qualified), *parsed});
+  }
+  return entries;
+}
+
+}  // namespace homedns
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <sys/types.h>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "host_table.h"
+#include "status.h"
+
+namespace homedns {
+
+// Keeps a HostTable in step with hosts files and DHCP lease files, watching
+// them with inotify. Only what changed is parsed and applied:
+//
+//  - A file that has only grown since it was last read (as a lease file
+//    being appended to does) is only parsed from where reading left off,
+//    once a hash of everything before there shows that it hasn't changed.
+//  - Anything else, such as a lease file rewritten and renamed into place,
+//    is read whole, but only its lines are hashed; lines whose hash is new
+//    are parsed and added, and the entries of lines whose hash is gone are
+//    removed. A lease that changed costs one line's parse and a couple of
+//    table updates, however long the file is.
+//
+// Both kinds of file are line based: a hosts file has an address and its
+// names on each line, and a lease file is dnsmasq's, with "<expiry> <mac or
+// iaid> <address> <hostname> <client id>" on each line. Names without a dot
+// are put under |domain|, which is how DHCP clients name themselves.
+//
+// Runs on the loop: GetFD() is readable whenever a watched file has changed,
+// and ReadEvents() then catches up with them.
+class HostsWatcher {
+ public:
+  enum class Format : uint8_t {
+    kHosts,
+    kLeases,
+  };
+
+  struct Stats {
+    uint64_t lines_parsed = 0;
+    uint64_t entries_added = 0;
+    uint64_t entries_removed = 0;
+    // How each change was caught up with.
+    uint64_t appends = 0;
+    uint64_t rescans = 0;
+  };
+
+  static std::unique_ptr<HostsWatcher> Create(HostTable* table,
+                                              std::string domain);
+  ~HostsWatcher();
+
+  // Loads |path| into the table, and watches it from then on. The file
+  // doesn't have to exist yet, but its directory does.
+  ConfigStatus Watch(const std::string& path, Format format);
+
+  int GetFD() const { return inotify_; }
+  void ReadEvents();
+
+  const Stats& GetStats() const { return stats_; }
+
+ private:
+  struct Entry {
+    std::string name;
+    HostAddress address;
+  };
+  struct Line {
+    // How many times the line appears in the file; its entries are added
+    // once for each.
+    uint32_t count = 0;
+    std::vector<Entry> entries;
+  };
+  struct File {
+    std::string path;
+    Format format;
+    int watch;
+    std::string base;
+    // What the file looked like when it was last read, to skip events that
+    // changed nothing.
+    ino_t inode = 0;
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    // How far the file has been read, always to the end of a line, and the
+    // hash of what it held up to there, to tell whether it has only been
+    // appended to.
+    uint64_t consumed = 0;
+    uint64_t prefix_hash = 0;
+    std::unordered_map<uint64_t, Line> lines;
+  };
+
+  HostsWatcher(HostTable* table, std::string domain, int inotify);
+
+  void Update(File* file);
+  bool Append(File* file, std::string_view data);
+  void Rescan(File* file, std::string_view data);
+  void AddLine(File* file, std::string_view text, uint32_t times);
+  void RemoveLine(File* file, uint64_t hash, uint32_t times);
+  std::vector<Entry> Parse(Format format, std::string_view line) const;
+
+  HostTable* table_;
+  std::string domain_;
+  int inotify_;
+  std::vector<std::unique_ptr<File>> files_;
+  Stats stats_;
+};
+
+}  // namespace homedns
@@ -2,76 +2,103 @@
 
 #include <cstring>
 
-#define CAUSE_ON_ERROR(expr)                                  \
-  do {                                                        \
-    auto st = (expr);                                         \
-    if (!st.is_ok())                                          \
-      return PacketStatus(PacketStatus::Codes::kParsingError) \
-          .AddCause(std::move(st));                           \
+#define CAUSE_ON_ERROR(expr)                       \
+  do {                                             \
+    auto st = (expr);                              \
+    if (!st.is_ok())                               \
+      return CausedBy<PacketStatus>(               \
+          PacketStatus::Codes::kParsingError, st); \
   } while (0)
 
 namespace homedns {
 
-Segment* LabelManager::ExpandLongForm(LongForm input) {
+LabelManager::LabelManager(std::pmr::memory_resource* memory)
+    : memory_(memory), segments_(memory), segment_write_positions_(memory) {}
+
+Segment* LabelManager::Intern(std::string_view longform,
+                              size_t label_length,
+                              Segment* next) {
+  auto it = segments_.find(longform);
+  if (it != segments_.end())
+    return &it->second;
+  it = segments_
+           .emplace(std::piecewise_construct, std::forward_as_tuple(longform),
+                    std::forward_as_tuple())
+           .first;
+  // The views point into the key, which doesn't move as long as the map
+  // doesn't.
+  Segment* segment = &it->second;
+  segment->longform = it->first;
+  segment->segment = segment->longform.substr(0, label_length);
+  segment->next = next;
+  return segment;
+}
+
+Segment* LabelManager::Intern(std::string_view label, Segment* next) {
+  if (next == nullptr)
+    return Intern(label, label.size(), nullptr);
+  std::pmr::string longform(memory_);
+  longform.reserve(label.size() + 1 + next->longform.size());
+  longform.append(label).append(".").append(next->longform);
+  return Intern(longform, label.size(), next);
+}
+
+Segment* LabelManager::ExpandLongForm(std::string_view input) {
   if (input.length() == 0)
     return nullptr;
 
-  if (segments_.find(input) != segments_.end())
-    return segments_[input].get();
+  auto it = segments_.find(input);
+  if (it != segments_.end())
+    return &it->second;
 
-  LongForm longform = input;
   size_t dotpos = input.find(".");
-  if (dotpos == std::string::npos) {
-    // It doesn't exist already, and has no "." in it, so create it.
-    segments_[longform] = std::make_unique<Segment>(input, longform, nullptr);
-  } else {
-    ShortForm segment = input.substr(0, dotpos);
-    input.erase(0, dotpos + 1);
-    Segment* next = ExpandLongForm(input);
-    if (next == nullptr)
-      return nullptr;
-    segments_[longform] = std::make_unique<Segment>(segment, longform, next);
-  }
-  return segments_[longform].get();
+  if (dotpos == std::string_view::npos)
+    return Intern(input, input.size(), nullptr);
+  Segment* next = ExpandLongForm(input.substr(dotpos + 1));
+  if (next == nullptr)
+    return nullptr;
+  return Intern(input, dotpos, next);
 }
 
 void LabelManager::ResetWritePositions() {
   segment_write_positions_.clear();
 }
 
-PacketStatus::Or<std::unique_ptr<DnsLabelSeq>> LabelManager::GetLabelSeq(
-    LongForm input) {
-  Segment* segment = ExpandLongForm(input);
+PacketStatus::Or<DnsLabelSeq> LabelManager::GetLabelSeq(std::string_view name) {
+  // The root is the one name without any segments.
+  if (name.empty() || name == ".")
+    return DnsLabelSeq{nullptr};
+  Segment* segment = ExpandLongForm(name);
   if (segment == nullptr)
     return PacketStatus::Codes::kParsingError;
-  return std::make_unique<DnsLabelSeq>(segment);
+  return DnsLabelSeq{segment};
 }
 
 PacketStatus LabelManager::ExportLabelSeq(WriteStream* stream,
-                                          DnsLabelSeq* seq) {
-  Segment* seg = seq->value;
+                                          const DnsLabelSeq& seq) {
+  const Segment* seg = seq.value;
   while (seg) {
-    if (segment_write_positions_.find(seg) != segment_write_positions_.end()) {
-      uint16_t position = segment_write_positions_[seg];
-      CAUSE_ON_ERROR(stream->Write<16>(position | 0xC000));
+    auto written = segment_write_positions_.find(seg);
+    if (written != segment_write_positions_.end()) {
+      CAUSE_ON_ERROR(stream->Write<16>(written->second | 0xC000));
       return base::OkStatus();
     }
     segment_write_positions_[seg] = stream->CurrentByte();
     CAUSE_ON_ERROR(stream->Write<8>(seg->segment.length()));
-    for (size_t i = 0; i < seg->segment.length(); i++)
-      CAUSE_ON_ERROR(stream->Write<8>(seg->segment.c_str()[i]));
+    for (char c : seg->segment)
+      CAUSE_ON_ERROR(stream->Write<8>(static_cast<uint8_t>(c)));
     seg = seg->next;
   }
   CAUSE_ON_ERROR(stream->Write<8>(0));
   return base::OkStatus();
 }
 
-PacketStatus::Or<std::unique_ptr<DnsLabelSeq>>
-LabelManager::ImportLabelSequence(ReadStream* stream) {
+PacketStatus::Or<DnsLabelSeq> LabelManager::ImportLabelSequence(
+    ReadStream* stream) {
   auto m_segment = Import(stream);
   if (m_segment.has_error())
-    return std::move(m_segment).error().AddHere();
-  return std::make_unique<DnsLabelSeq>(std::move(m_segment).value());
+    RETURN_TRACED(std::move(m_segment).error());
+  return DnsLabelSeq{std::move(m_segment).value()};
 }
 
 PacketStatus::Or<Segment*> LabelManager::Import(ReadStream* stream) {
@@ -87,20 +114,15 @@ PacketStatus::Or<Segment*> LabelManager::Import(ReadStream* stream) {
     location |= ((length ^ 0xC0) << 8);
     return ImportNonDestructive(stream, location);
   } else {
-    std::stringstream token;
-    while (length-- > 0) {
-      uint8_t byte;
-      CAUSE_ON_ERROR(stream->Next<8>(&byte));
-      token << byte;
-    }
+    uint8_t token[0xC0];
+    for (uint8_t i = 0; i < length; i++)
+      CAUSE_ON_ERROR(stream->Next<8>(&token[i]));
     PacketStatus::Or<Segment*> rest = Import(stream);
     if (!rest.has_value())
-      return std::move(rest).error().AddHere();
-    Segment* next = std::move(rest).value();
-    LongForm total = next ? (token.str() + "." + next->longform) : token.str();
-    if (segments_.find(total) == segments_.end())
-      segments_[total] = std::make_unique<Segment>(token.str(), total, next);
-    return segments_[total].get();
+      RETURN_TRACED(std::move(rest).error());
+    return Intern(
+        std::string_view(reinterpret_cast<const char*>(token), length),
+        std::move(rest).value());
   }
 }
 
@@ -118,25 +140,24 @@ PacketStatus::Or<Segment*> LabelManager::ImportNonDestructive(
     address++;
     CAUSE_ON_ERROR(stream->Read<8>(&location, address));
     location |= ((length ^ 0xC0) << 8);
+    // Pointers may only go backwards, which is also what keeps a loop of them
+    // from recursing forever.
+    if (location + 1 >= address)
+      return PacketStatus::Codes::kParsingError;
     return ImportNonDestructive(stream, location);
   } else {
-    std::stringstream token;
-    while (length-- > 0) {
+    uint8_t token[0xC0];
+    for (uint8_t i = 0; i < length; i++) {
       address++;
-      uint8_t byte;
-      CAUSE_ON_ERROR(stream->Read<8>(&byte, address));
-      token << byte;
+      CAUSE_ON_ERROR(stream->Read<8>(&token[i], address));
     }
     PacketStatus::Or<Segment*> rest = ImportNonDestructive(stream, address + 1);
     if (!rest.has_value())
-      return std::move(rest).error().AddHere();
-    Segment* next = std::move(rest).value();
-    LongForm total = next ? (token.str() + "." + next->longform) : token.str();
-
-    if (segments_.find(total) == segments_.end())
-      segments_[total] = std::make_unique<Segment>(token.str(), total, next);
-    return segments_[total].get();
+      RETURN_TRACED(std::move(rest).error());
+    return Intern(
+        std::string_view(reinterpret_cast<const char*>(token), length),
+        std::move(rest).value());
   }
 }
 
-}  // namespace homedns
\ No newline at end of file
+}  // namespace homedns
@@ -2,43 +2,60 @@
 
 #include <cstdint>
 #include <cstdlib>
+#include <map>
+#include <memory_resource>
+#include <string>
+#include <string_view>
 
 #include "bitstream.h"
 #include "status.h"
 
 namespace homedns {
 
-using LongForm = std::string;
-using ShortForm = std::string;
-
 struct Segment {
-  ShortForm segment;
-  LongForm longform;
+  std::string_view segment;   // "www"
+  std::string_view longform;  // "www.google.com"
   Segment* next;
 };
 
 struct DnsLabelSeq {
   Segment* value;
-  std::string Render() { return value ? value->longform : "ERROR"; }
+  std::string Render() const {
+    return value ? std::string(value->longform) : "ERROR";
+  }
+  // The size of the name in uncompressed wire format.
+  size_t WireSize() const { return value ? value->longform.size() + 2 : 1; }
 };
 
+// Interns names for one packet, so that each distinct suffix is stored once
+// and compression can refer back to it. Everything, including the text of the
+// names, is allocated from |memory|, and segments stay put until the manager
+// is destroyed.
 class LabelManager {
  private:
-  std::map<LongForm, std::unique_ptr<Segment>> segments_;
-  std::map<Segment*, uint16_t> segment_write_positions_;
-
-  Segment* ExpandLongForm(LongForm input);
+  std::pmr::memory_resource* memory_;
+  std::pmr::map<std::pmr::string, Segment, std::less<>> segments_;
+  std::pmr::map<const Segment*, uint16_t> segment_write_positions_;
+
+  Segment* ExpandLongForm(std::string_view input);
+  Segment* Intern(std::string_view longform, size_t label_length,
+                  Segment* next);
+  Segment* Intern(std::string_view label, Segment* next);
   PacketStatus::Or<Segment*> Import(ReadStream* stream);
   PacketStatus::Or<Segment*> ImportNonDestructive(const ReadStream* stream,
                                                   uint16_t address);
 
  public:
+  explicit LabelManager(
+      std::pmr::memory_resource* memory = std::pmr::get_default_resource());
+  LabelManager(const LabelManager&) = delete;
+  LabelManager& operator=(const LabelManager&) = delete;
+
   void ResetWritePositions();
-  PacketStatus::Or<std::unique_ptr<DnsLabelSeq>> GetLabelSeq(LongForm);
+  PacketStatus::Or<DnsLabelSeq> GetLabelSeq(std::string_view name);
 
-  PacketStatus ExportLabelSeq(WriteStream* stream, DnsLabelSeq* seq);
-  PacketStatus::Or<std::unique_ptr<DnsLabelSeq>> ImportLabelSequence(
-      ReadStream* stream);
+  PacketStatus ExportLabelSeq(WriteStream* stream, const DnsLabelSeq& seq);
+  PacketStatus::Or<DnsLabelSeq> ImportLabelSequence(ReadStream* stream);
 };
 
 }  // namespace homedns
\ No newline at end of file
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace homedns {
+
+// Counts latencies in buckets a power of two wide, each split into eight, so
+// that any percentile read back is within an eighth of the truth. Recording
+// is a couple of relaxed loads and stores, with no locks or allocation.
+//
+// Each histogram has a single writer, but can be read (or merged into
+// another) from any thread while it's being written. Give every thread its
+// own, and merge them to report.
+class LatencyHistogram {
+ public:
+  using Duration = std::chrono::nanoseconds;
+
+  struct Summary {
+    uint64_t count = 0;
+    Duration p50{0};
+    Duration p99{0};
+    Duration max{0};
+  };
+
+  void Record(Duration latency) {
+    uint64_t ns = latency.count() > 0 ? latency.count() : 0;
+    Bump(&counts_[Bucket(ns)], 1);
+    Bump(&total_, 1);
+    if (ns > max_.load(std::memory_order_relaxed))
+      max_.store(ns, std::memory_order_relaxed);
+  }
+
+  // Adds |other|'s samples to this one, which nothing else may be writing.
+  void Merge(const LatencyHistogram& other) {
+    for (size_t i = 0; i < kBuckets; i++)
+      Bump(&counts_[i], other.counts_[i].load(std::memory_order_relaxed));
+    Bump(&total_, other.total_.load(std::memory_order_relaxed));
+    uint64_t max = other.max_.load(std::memory_order_relaxed);
+    if (max > max_.load(std::memory_order_relaxed))
+      max_.store(max, std::memory_order_relaxed);
+  }
+
+  uint64_t Count() const { return total_.load(std::memory_order_relaxed); }
+  Duration Max() const { return Duration(max_.load(std::memory_order_relaxed)); }
+
+  // The latency that |fraction| (0.5 for the median) of samples were no
+  // slower than, rounded up to the top of its bucket.
+  Duration Percentile(double fraction) const {
+    uint64_t total = Count();
+    if (total == 0)
+      return Duration(0);
+    uint64_t rank = static_cast<uint64_t>(fraction * total);
+    rank = rank < 1 ? 1 : rank > total ? total : rank;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kBuckets; i++) {
+      seen += counts_[i].load(std::memory_order_relaxed);
+      if (seen >= rank)
+        return Duration(std::min(UpperBound(i), Max().count()));
+    }
+    return Max();
+  }
+
+  Summary Summarize() const {
+    return {Count(), Percentile(0.5), Percentile(0.99), Max()};
+  }
+
+ private:
+  static constexpr size_t kSubBuckets = 8;
+  static constexpr size_t kBuckets = 62 * kSubBuckets;
+
+  // Values below 8 get a bucket each; above that, the top three bits after
+  // the leading one pick one of eight buckets within each power of two.
+  static size_t Bucket(uint64_t ns) {
+    if (ns < kSubBuckets)
+      return ns;
+    int exponent = std::bit_width(ns) - 1;
+    size_t sub = (ns >> (exponent - 3)) & (kSubBuckets - 1);
+    return (exponent - 2) * kSubBuckets + sub;
+  }
+
+  static int64_t UpperBound(size_t bucket) {
+    if (bucket < kSubBuckets)
+      return bucket;
+    int exponent = bucket / kSubBuckets + 2;
+    uint64_t sub = bucket % kSubBuckets;
+    return static_cast<int64_t>(((kSubBuckets + sub + 1) << (exponent - 3)) -
+                                1);
+  }
+
+  static void Bump(std::atomic<uint64_t>* counter, uint64_t by) {
+    counter->store(counter->load(std::memory_order_relaxed) + by,
+                   std::memory_order_relaxed);
+  }
+
+  std::array<std::atomic<uint64_t>, kBuckets> counts_ = {};
+  std::atomic<uint64_t> total_ = 0;
+  std::atomic<uint64_t> max_ = 0;
+};
+
+}  // namespace homedns
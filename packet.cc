@@ -38,38 +38,37 @@ struct uint_s {
 
 }  // namespace
 
-#define ASSIGN_OR_ERROR(ato, expr)               \
-  do {                                           \
-    auto maybe = (expr);                         \
-    if (maybe.has_error())                       \
-      return std::move(maybe).error().AddHere(); \
-    ato = std::move(maybe).value();              \
+#define ASSIGN_OR_ERROR(ato, expr)             \
+  do {                                         \
+    auto maybe = (expr);                       \
+    if (maybe.has_error())                     \
+      RETURN_TRACED(std::move(maybe).error()); \
+    ato = std::move(maybe).value();            \
   } while (0)
 
-#define RETURN_ON_ERROR(expr)         \
-  do {                                \
-    auto st = (expr);                 \
-    if (!st.is_ok())                  \
-      return std::move(st).AddHere(); \
+#define RETURN_ON_ERROR(expr) \
+  do {                        \
+    auto st = (expr);         \
+    if (!st.is_ok())          \
+      RETURN_TRACED(st);      \
   } while (0)
 
-#define CAUSE_ON_ERROR(expr)                                  \
-  do {                                                        \
-    auto st = (expr);                                         \
-    if (!st.is_ok())                                          \
-      return PacketStatus(PacketStatus::Codes::kParsingError) \
-          .AddCause(std::move(st));                           \
+#define CAUSE_ON_ERROR(expr)                       \
+  do {                                             \
+    auto st = (expr);                              \
+    if (!st.is_ok())                               \
+      return CausedBy<PacketStatus>(               \
+          PacketStatus::Codes::kParsingError, st); \
   } while (0)
 
-#define READBITFIELD(bits, assign, stream)                        \
-  do {                                                            \
-    uint_s<bits>::type value;                                     \
-    auto st = stream->Next<bits>(&value);                         \
-    if (st.is_ok()) {                                             \
-      assign = value;                                             \
-    } else {                                                      \
-      return {PacketStatus::Codes::kParsingError, std::move(st)}; \
-    }                                                             \
+#define READBITFIELD(bits, assign, stream)         \
+  do {                                             \
+    uint_s<bits>::type value;                      \
+    auto st = stream->Next<bits>(&value);          \
+    if (!st.is_ok())                               \
+      return CausedBy<PacketStatus>(               \
+          PacketStatus::Codes::kParsingError, st); \
+    assign = value;                                \
   } while (0)
 
 PacketStatus DnsPacketHeader::Import(DnsPacketHeader* header,
@@ -103,37 +102,47 @@ void DnsPacket::CheckLM() {
 
 void DnsPacket::operator=(DnsPacket&& packet) {
   label_manager_ = std::move(packet.label_manager_);
-  header_ = std::move(packet.header_);
+  header_ = packet.header_;
   questions_ = std::move(packet.questions_);
   answers_ = std::move(packet.answers_);
   authorities_ = std::move(packet.authorities_);
   additional_ = std::move(packet.additional_);
 }
 
-DnsPacket::DnsPacket(uint16_t ID) {
-  header_ = std::make_unique<DnsPacketHeader>(
-      /*.ID = */ ID,
-      /*.QR = */ 0,
-      /*.OP = */ 0,
-      /*.AA = */ 0,
-      /*.TC = */ 0,
-      /*.RD = */ 0,
-      /*.RA = */ 0,
-      /*.RZ = */ 0,
-      /*.RC = */ 0,
-      /*.QC = */ 0,
-      /*.AC = */ 0,
-      /*.NC = */ 0,
-      /*.DC = */ 0);
-  label_manager_ = std::make_unique<LabelManager>();
-}
-
-DnsPacket::DnsPacket(DnsPacket&& src) {
-  *this = std::move(src);
-}
-
-DnsPacket DnsPacket::Create(uint16_t ID) {
-  return DnsPacket{ID};
+DnsPacket::DnsPacket(uint16_t ID, std::pmr::memory_resource* memory)
+    : label_manager_(NewObject<LabelManager>(memory, memory)),
+      header_{
+          /*.ID = */ ID,
+          /*.QR = */ 0,
+          /*.OP = */ 0,
+          /*.AA = */ 0,
+          /*.TC = */ 0,
+          /*.RD = */ 0,
+          /*.RA = */ 0,
+          /*.RZ = */ 0,
+          /*.RC = */ 0,
+          /*.QC = */ 0,
+          /*.AC = */ 0,
+          /*.NC = */ 0,
+          /*.DC = */ 0,
+      },
+      questions_(memory),
+      answers_(memory),
+      authorities_(memory),
+      additional_(memory) {}
+
+// Moving constructs each section from the source's, which keeps its memory
+// resource; assigning (above) keeps this packet's instead.
+DnsPacket::DnsPacket(DnsPacket&& src)
+    : label_manager_(std::move(src.label_manager_)),
+      header_(src.header_),
+      questions_(std::move(src.questions_)),
+      answers_(std::move(src.answers_)),
+      authorities_(std::move(src.authorities_)),
+      additional_(std::move(src.additional_)) {}
+
+DnsPacket DnsPacket::Create(uint16_t ID, std::pmr::memory_resource* memory) {
+  return DnsPacket{ID, memory};
 }
 
 namespace _exporting {
@@ -158,181 +167,152 @@ PacketStatus ExportHeader(WriteStream* stream, const DnsPacketHeader& header) {
 PacketStatus ExportQuestion(WriteStream* stream,
                             const DnsQuestion& question,
                             LabelManager* labels) {
-  RETURN_ON_ERROR(labels->ExportLabelSeq(stream, question.LabelSequence.get()));
+  RETURN_ON_ERROR(labels->ExportLabelSeq(stream, question.LabelSequence));
   CAUSE_ON_ERROR(stream->Write<16>(question.Type));
   CAUSE_ON_ERROR(stream->Write<16>(question.Class));
   return base::OkStatus();
 }
 
 PacketStatus ExportQuestions(WriteStream* stream,
-                             const std::vector<DnsQuestion>& questions,
+                             const std::pmr::vector<DnsQuestion>& questions,
                              LabelManager* labels) {
   for (const auto& question : questions)
     RETURN_ON_ERROR(ExportQuestion(stream, question, labels));
   return base::OkStatus();
 }
 
-PacketStatus ExportRecord(WriteStream* stream,
-                          const PreambleAndRecord& record,
-                          LabelManager* labels) {
-  RETURN_ON_ERROR(
-      labels->ExportLabelSeq(stream, std::get<0>(record).LabelSequence.get()));
-  CAUSE_ON_ERROR(stream->Write<16>(std::get<0>(record).Type));
-  CAUSE_ON_ERROR(stream->Write<16>(std::get<0>(record).Class));
-  CAUSE_ON_ERROR(stream->Write<32>(std::get<0>(record).TTL));
-  uint16_t length_location = stream->CurrentByte();
-  CAUSE_ON_ERROR(stream->Write<16>(0));
-
-#define EXPORT(TYPENAME)                                                 \
-  case TYPENAME::TYPE: {                                                 \
-    RETURN_ON_ERROR(                                                     \
-        std::get<TYPENAME>(std::get<1>(record)).Export(stream, labels)); \
-    break;                                                               \
-  }
-  switch (std::get<0>(record).Type) {
-    EXPORT(DnsARecord)
-    EXPORT(DnsNSRecord)
-    EXPORT(DnsCNAMERecord)
-    EXPORT(DnsMXRecord)
-    EXPORT(DnsAAAARecord)
-    default: {
-      RETURN_ON_ERROR(std::get<DnsUnknownRecord>(std::get<1>(record))
-                          .Export(stream, labels));
-    }
-  }
-#undef EXPORT
-
-  uint16_t end_of_data = stream->CurrentByte() - length_location;
-  CAUSE_ON_ERROR(stream->WriteAt<16>(end_of_data - 2, length_location));
-
-  return base::OkStatus();
-}
-
 PacketStatus ExportRecords(WriteStream* stream,
-                           const std::vector<PreambleAndRecord>& records,
+                           const RecordStore& records,
                            LabelManager* labels) {
-  for (const auto& record : records)
-    RETURN_ON_ERROR(ExportRecord(stream, record, labels));
+  for (size_t i = 0; i < records.Size(); i++)
+    RETURN_ON_ERROR(records.Export(i, stream, labels));
   return base::OkStatus();
 }
 
+// Exports whole RRsets from |records| for as long as they fit in |stream|.
+// Returns how many records were written, and sets |full| if some didn't fit.
+PacketStatus::Or<uint16_t> ExportRecordsUntilFull(WriteStream* stream,
+                                                  const RecordStore& records,
+                                                  LabelManager* labels,
+                                                  bool* full) {
+  size_t i = 0;
+  while (i < records.Size()) {
+    size_t end = records.RRsetEnd(i);
+    size_t checkpoint = stream->CurrentByte();
+    for (size_t j = i; j < end; j++) {
+      PacketStatus status = records.Export(j, stream, labels);
+      if (status.is_ok())
+        continue;
+      // Running out of room is the only way a set that can't fit fails.
+      if (checkpoint + records.EstimateSize(i, end) <= stream->Capacity())
+        return std::move(status).AddHere();
+      stream->Rewind(checkpoint);
+      *full = true;
+      return static_cast<uint16_t>(i);
+    }
+    i = end;
+  }
+  return static_cast<uint16_t>(i);
+}
+
 }  // namespace _exporting
 
+size_t DnsPacket::EstimateSize() const {
+  size_t size = 12;
+  for (const auto& question : questions_)
+    size += question.LabelSequence.WireSize() + 4;
+  for (const auto* records : {&answers_, &authorities_, &additional_})
+    size += records->EstimateSize(0, records->Size());
+  return size;
+}
+
 PacketStatus DnsPacket::Export(WriteStream* stream) {
   label_manager_->ResetWritePositions();
-  RETURN_ON_ERROR(_exporting::ExportHeader(stream, *header_));
+  size_t start = stream->CurrentByte();
+  RETURN_ON_ERROR(_exporting::ExportHeader(stream, header_));
   RETURN_ON_ERROR(
       _exporting::ExportQuestions(stream, questions_, label_manager_.get()));
-  RETURN_ON_ERROR(
-      _exporting::ExportRecords(stream, answers_, label_manager_.get()));
-  RETURN_ON_ERROR(
-      _exporting::ExportRecords(stream, authorities_, label_manager_.get()));
-  RETURN_ON_ERROR(
-      _exporting::ExportRecords(stream, additional_, label_manager_.get()));
+
+  // Most packets fit easily, and can skip the bookkeeping for truncation.
+  if (start + EstimateSize() <= stream->Capacity()) {
+    RETURN_ON_ERROR(
+        _exporting::ExportRecords(stream, answers_, label_manager_.get()));
+    RETURN_ON_ERROR(
+        _exporting::ExportRecords(stream, authorities_, label_manager_.get()));
+    RETURN_ON_ERROR(
+        _exporting::ExportRecords(stream, additional_, label_manager_.get()));
+    return base::OkStatus();
+  }
+
+  // Otherwise send as many whole RRsets as fit. Per RFC 2181 section 9, only
+  // a missing answer or authority RRset makes the reply truncated; additional
+  // records are just a hint, and are dropped silently.
+  const RecordStore* sections[] = {&answers_, &authorities_, &additional_};
+  uint16_t counts[3] = {0, 0, 0};
+  bool full = false;
+  bool truncated = false;
+  for (size_t s = 0; s < 3 && !full; s++) {
+    auto written = _exporting::ExportRecordsUntilFull(
+        stream, *sections[s], label_manager_.get(), &full);
+    if (!written.has_value())
+      return std::move(written).error().AddHere();
+    counts[s] = std::move(written).value();
+    truncated = full && s < 2;
+  }
+  if (!full)
+    return base::OkStatus();
+
+  uint8_t flags = (header_.QR << 7) | (header_.OP << 3) |
+                  (header_.AA << 2) | ((truncated || header_.TC) << 1) |
+                  header_.RD;
+  CAUSE_ON_ERROR(stream->WriteAt<8>(flags, start + 2));
+  CAUSE_ON_ERROR(stream->WriteAt<16>(counts[0], start + 6));
+  CAUSE_ON_ERROR(stream->WriteAt<16>(counts[1], start + 8));
+  CAUSE_ON_ERROR(stream->WriteAt<16>(counts[2], start + 10));
   return base::OkStatus();
 }
 
 namespace _importing {
 
-PacketStatus::Or<std::vector<DnsQuestion>>
-ImportQuestions(uint16_t qc, ReadStream* stream, LabelManager* labels) {
-  std::vector<DnsQuestion> questions;
+PacketStatus ImportQuestions(uint16_t qc,
+                             ReadStream* stream,
+                             LabelManager* labels,
+                             std::pmr::vector<DnsQuestion>* questions) {
   for (uint16_t i = 0; i < qc; i++) {
     DnsQuestion question;
     ASSIGN_OR_ERROR(question.LabelSequence,
                     labels->ImportLabelSequence(stream));
     CAUSE_ON_ERROR(stream->Next<16>(&question.Type));
     CAUSE_ON_ERROR(stream->Next<16>(&question.Class));
-    questions.push_back(std::move(question));
+    questions->push_back(question);
   }
-  return questions;
+  return base::OkStatus();
 }
 
-PacketStatus::Or<DnsRecord> ImportRecord(ReadStream* stream,
-                                         LabelManager* labels,
-                                         uint16_t type,
-                                         uint16_t length) {
-  std::cout << "importing record: " << type << "\n";
-  switch (type) {
-    case DnsARecord::TYPE: {
-      DnsARecord result;
-      RETURN_ON_ERROR(result.Import(stream, labels));
-      return DnsRecord{result};
-    }
-    case DnsNSRecord::TYPE: {
-      DnsNSRecord result;
-      RETURN_ON_ERROR(result.Import(stream, labels));
-      return DnsRecord{result};
-    }
-    case DnsCNAMERecord::TYPE: {
-      DnsCNAMERecord result;
-      RETURN_ON_ERROR(result.Import(stream, labels));
-      return DnsRecord{result};
-    }
-    case DnsMXRecord::TYPE: {
-      DnsMXRecord result;
-      RETURN_ON_ERROR(result.Import(stream, labels));
-      return DnsRecord{result};
-    }
-    case DnsAAAARecord::TYPE: {
-      DnsAAAARecord result;
-      RETURN_ON_ERROR(result.Import(stream, labels));
-      return DnsRecord{result};
-    }
-    default: {
-      std::vector<uint8_t> data;
-      while (length-- > 0) {
-        uint8_t b;
-        CAUSE_ON_ERROR(stream->Next<8>(&b));
-        data.push_back(b);
-      }
-      return DnsRecord{DnsUnknownRecord{std::move(data)}};
-    }
-  }
-}
+}  // namespace _importing
 
-PacketStatus::Or<std::vector<PreambleAndRecord>>
-ImportRecords(uint16_t rc, ReadStream* stream, LabelManager* labels) {
-  std::vector<PreambleAndRecord> records;
-  for (uint16_t i = 0; i < rc; i++) {
-    DnsRecordPreamble preamble;
-    ASSIGN_OR_ERROR(preamble.LabelSequence,
-                    labels->ImportLabelSequence(stream));
-    CAUSE_ON_ERROR(stream->Next<16>(&preamble.Type));
-    CAUSE_ON_ERROR(stream->Next<16>(&preamble.Class));
-    CAUSE_ON_ERROR(stream->Next<32>(&preamble.TTL));
-    CAUSE_ON_ERROR(stream->Next<16>(&preamble.Length));
-
-    auto m_record =
-        ImportRecord(stream, labels, preamble.Type, preamble.Length);
-    if (m_record.has_error())
-      return std::move(m_record).error().AddHere();
-    records.push_back(std::make_tuple<DnsRecordPreamble, DnsRecord>(
-        std::move(preamble), std::move(m_record).value()));
-  }
-  return records;
+// static
+PacketStatus::Or<DnsPacket> DnsPacket::Import(
+    ReadStream* stream,
+    std::pmr::memory_resource* memory) {
+  DnsPacket result{0, memory};
+  LabelManager* labels = result.label_manager_.get();
+  RETURN_ON_ERROR(DnsPacketHeader::Import(&result.header_, stream));
+  RETURN_ON_ERROR(_importing::ImportQuestions(result.header_.QC, stream,
+                                              labels, &result.questions_));
+  RETURN_ON_ERROR(
+      result.answers_.Import(result.header_.AC, stream, labels));
+  RETURN_ON_ERROR(
+      result.authorities_.Import(result.header_.NC, stream, labels));
+  RETURN_ON_ERROR(
+      result.additional_.Import(result.header_.DC, stream, labels));
+  return result;
 }
 
-}  // namespace _importing
-
 // static
 PacketStatus::Or<DnsPacket> DnsPacket::Import(
     std::unique_ptr<ReadStream> stream) {
-  DnsPacket result{0};
-  RETURN_ON_ERROR(DnsPacketHeader::Import(result.header_.get(), stream.get()));
-  ASSIGN_OR_ERROR(result.questions_,
-                  _importing::ImportQuestions(result.header_->QC, stream.get(),
-                                              result.label_manager_.get()));
-  ASSIGN_OR_ERROR(result.answers_,
-                  _importing::ImportRecords(result.header_->AC, stream.get(),
-                                            result.label_manager_.get()));
-  ASSIGN_OR_ERROR(result.authorities_,
-                  _importing::ImportRecords(result.header_->NC, stream.get(),
-                                            result.label_manager_.get()));
-  ASSIGN_OR_ERROR(result.additional_,
-                  _importing::ImportRecords(result.header_->DC, stream.get(),
-                                            result.label_manager_.get()));
-  return result;
+  return Import(stream.get());
 }
 
 namespace _rendering {
@@ -351,11 +331,11 @@ std::string Bits(N numeric) {
   return stream.str();
 }
 
-base::json::Array RenderQuestions(const std::vector<DnsQuestion>& qs) {
+base::json::Array RenderQuestions(const std::pmr::vector<DnsQuestion>& qs) {
   std::vector<base::json::JSON> result;
   for (const DnsQuestion& q : qs) {
     std::map<std::string, base::json::JSON> fields;
-    fields["Label"] = q.LabelSequence->Render();
+    fields["Label"] = q.LabelSequence.Render();
     fields["Type"] = q.Type;
     fields["Class"] = q.Class;
     result.push_back(base::json::Object(std::move(fields)));
@@ -363,112 +343,80 @@ base::json::Array RenderQuestions(const std::vector<DnsQuestion>& qs) {
   return base::json::Array(std::move(result));
 }
 
-base::json::Object RenderRecord(const DnsRecord& record) {
-  std::map<std::string, base::json::JSON> blob;
-  if (const auto* type = std::get_if<DnsARecord>(&record)) {
-    return type->Render();
-  } else if (const auto* type = std::get_if<DnsNSRecord>(&record)) {
-    return type->Render();
-  } else if (const auto* type = std::get_if<DnsCNAMERecord>(&record)) {
-    return type->Render();
-  } else if (const auto* type = std::get_if<DnsMXRecord>(&record)) {
-    return type->Render();
-  } else if (const auto* type = std::get_if<DnsAAAARecord>(&record)) {
-    return type->Render();
-  }
-  return base::json::Object(std::move(blob));
-}
-
-base::json::Array RenderRecords(const std::vector<PreambleAndRecord>& rs) {
-  std::vector<base::json::JSON> result;
-  for (const auto& record : rs) {
-    const DnsRecordPreamble& preamble = std::get<0>(record);
-    std::map<std::string, base::json::JSON> fields;
-    fields["Label"] = preamble.LabelSequence->Render();
-    fields["Type"] = preamble.Type;
-    fields["Class"] = preamble.Class;
-    fields["TTL"] = preamble.TTL;
-    fields["Length"] = preamble.Length;
-    fields["Record"] = RenderRecord(std::get<1>(record));
-    result.push_back(base::json::Object(std::move(fields)));
-  }
-  return base::json::Array(std::move(result));
-}
-
 }  // namespace _rendering
 
 base::json::Object DnsPacket::Render() {
   std::map<std::string, base::json::JSON> header;
   std::stringstream stream;
-  header["ID"] = _rendering::Hex(header_->ID);
-  header["Type"] = (header_->QR ? "Query" : "Response");
-  header["Opcode"] = _rendering::Bits<4>(header_->OP);
-  header["Authoritative"] = (header_->AA ? "Yes" : "No");
-  header["Truncated"] = (header_->TC ? "Yes" : "No");
-  header["Recursion Desired"] = (header_->RD ? "Yes" : "No");
-  header["Recursion Available"] = (header_->RA ? "Yes" : "No");
-  header["Reserved"] = _rendering::Bits<3>(header_->RZ);
-  header["Response Code"] = _rendering::Bits<4>(header_->RC);
-  if (header_->QC) {
-    header["QC"] = (int)header_->QC;
+  header["ID"] = _rendering::Hex(header_.ID);
+  header["Type"] = (header_.QR ? "Query" : "Response");
+  header["Opcode"] = _rendering::Bits<4>(header_.OP);
+  header["Authoritative"] = (header_.AA ? "Yes" : "No");
+  header["Truncated"] = (header_.TC ? "Yes" : "No");
+  header["Recursion Desired"] = (header_.RD ? "Yes" : "No");
+  header["Recursion Available"] = (header_.RA ? "Yes" : "No");
+  header["Reserved"] = _rendering::Bits<3>(header_.RZ);
+  header["Response Code"] = _rendering::Bits<4>(header_.RC);
+  if (header_.QC) {
+    header["QC"] = (int)header_.QC;
     header["Questions"] = _rendering::RenderQuestions(questions_);
   }
-  if (header_->AC) {
-    header["AC"] = (int)header_->AC;
-    header["Answers"] = _rendering::RenderRecords(answers_);
+  if (header_.AC) {
+    header["AC"] = (int)header_.AC;
+    header["Answers"] = answers_.Render();
   }
-  if (header_->NC) {
-    header["NC"] = (int)header_->NC;
-    header["Authorities"] = _rendering::RenderRecords(authorities_);
+  if (header_.NC) {
+    header["NC"] = (int)header_.NC;
+    header["Authorities"] = authorities_.Render();
   }
-  if (header_->DC) {
-    header["DC"] = (int)header_->DC;
-    header["Additional"] = _rendering::RenderRecords(additional_);
+  if (header_.DC) {
+    header["DC"] = (int)header_.DC;
+    header["Additional"] = additional_.Render();
   }
   return base::json::Object(std::move(header));
 }
 
 const DnsPacketHeader& DnsPacket::GetPacketHeader() const {
-  return *header_;
+  return header_;
 }
 
 DnsPacket DnsPacket::SetQuestionOrResponse(PacketType type) && {
-  header_->QR = (type == PacketType::kQuestion ? 0 : 1);
+  header_.QR = (type == PacketType::kQuestion ? 0 : 1);
   return std::move(*this);
 }
 
 DnsPacket DnsPacket::SetOpCode(uint8_t code) && {
-  header_->OP = code;
+  header_.OP = code;
   return std::move(*this);
 }
 
 DnsPacket DnsPacket::SetIsAuthoritative(bool authoritative) && {
-  header_->AA = authoritative;
+  header_.AA = authoritative;
   return std::move(*this);
 }
 
 DnsPacket DnsPacket::SetIsTruncated(bool truncated) && {
-  header_->TC = truncated;
+  header_.TC = truncated;
   return std::move(*this);
 }
 
 DnsPacket DnsPacket::SetRecursionDesired(bool recursion) && {
-  header_->RD = recursion;
+  header_.RD = recursion;
   return std::move(*this);
 }
 
 DnsPacket DnsPacket::SetRecursionAvailable(bool recursion) && {
-  header_->RA = recursion;
+  header_.RA = recursion;
   return std::move(*this);
 }
 
 DnsPacket DnsPacket::SetResponseCode(uint8_t code) && {
-  header_->RC = code;
+  header_.RC = code;
   return std::move(*this);
 }
 
 DnsPacket DnsPacket::SetReserved(uint8_t reserved) && {
-  header_->RZ = reserved;
+  header_.RZ = reserved;
   return std::move(*this);
 }
 
@@ -478,40 +426,23 @@ std::optional<const DnsQuestion*> DnsPacket::GetQuestion(size_t q_num) {
   return &questions_[q_num];
 }
 
-std::optional<const PreambleAndRecord*> DnsPacket::GetAnswer(size_t a_num) {
-  if (a_num > answers_.size())
-    return std::nullopt;
-  return &answers_[a_num];
-}
-
-std::optional<const PreambleAndRecord*> DnsPacket::GetAuthority(size_t a_num) {
-  if (a_num > authorities_.size())
-    return std::nullopt;
-  return &authorities_[a_num];
-}
-
-std::optional<const PreambleAndRecord*> DnsPacket::GetAdditional(size_t a_num) {
-  if (a_num > additional_.size())
-    return std::nullopt;
-  return &additional_[a_num];
-}
-
-PacketStatus::Or<DnsPacket> DnsPacket::AddQuestion(std::string name,
+PacketStatus::Or<DnsPacket> DnsPacket::AddQuestion(std::string_view name,
                                                    uint16_t Type,
                                                    uint16_t Class) {
   auto label = label_manager_->GetLabelSeq(name);
   if (!label.has_value())
     return std::move(label).error();
 
-  DnsQuestion question = {std::move(label).value(), Type, Class};
-  questions_.push_back(std::move(question));
-  header_->QC++;
+  questions_.push_back({std::move(label).value(), Type, Class});
+  header_.QC++;
   return std::move(*this);
 }
 
 PacketStatus::Or<DnsPacket> DnsPacket::AddQuestion(
     const DnsQuestion& question) {
-  return AddQuestion(question.LabelSequence->Render(), question.Type,
+  if (question.LabelSequence.value == nullptr)
+    return PacketStatus::Codes::kParsingError;
+  return AddQuestion(question.LabelSequence.value->longform, question.Type,
                      question.Class);
 }
 
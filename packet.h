@@ -1,26 +1,24 @@
 #pragma once
 
+#include <memory_resource>
+#include <string_view>
+#include <vector>
+
+#include "arena.h"
 #include "bitstream.h"
 #include "labels.h"
+#include "record_store.h"
 #include "records.h"
 #include "status.h"
 
 namespace homedns {
 
 struct DnsQuestion {
-  std::unique_ptr<DnsLabelSeq> LabelSequence;
+  DnsLabelSeq LabelSequence;
   uint16_t Type;
   uint16_t Class;
 };
 
-struct DnsRecordPreamble {
-  std::unique_ptr<DnsLabelSeq> LabelSequence;
-  uint16_t Type;
-  uint16_t Class;
-  uint32_t TTL;
-  uint16_t Length;
-};
-
 struct DnsPacketHeader {
   uint16_t ID : 16;  // ID
   uint16_t QR : 1;   // Question / Response
@@ -41,8 +39,6 @@ struct DnsPacketHeader {
 
 static_assert(sizeof(DnsPacketHeader) == 12);
 
-using PreambleAndRecord = std::tuple<DnsRecordPreamble, DnsRecord>;
-
 class DnsPacket {
  public:
   /* inner types */
@@ -51,25 +47,59 @@ class DnsPacket {
 
  private:
   /* label manager owned directly */
-  std::unique_ptr<LabelManager> label_manager_;
+  ResourcePtr<LabelManager> label_manager_;
 
   /* data fields that get serialized / deserialized */
-  std::unique_ptr<DnsPacketHeader> header_;
-  std::vector<DnsQuestion> questions_;
-  std::vector<PreambleAndRecord> answers_;
-  std::vector<PreambleAndRecord> authorities_;
-  std::vector<PreambleAndRecord> additional_;
+  DnsPacketHeader header_;
+  std::pmr::vector<DnsQuestion> questions_;
+  RecordStore answers_;
+  RecordStore authorities_;
+  RecordStore additional_;
+
+  template <RecordType R>
+  RecordStore* Section() {
+    if constexpr (R == RecordType::kAnswer)
+      return &answers_;
+    else if constexpr (R == RecordType::kAuthority)
+      return &authorities_;
+    else
+      return &additional_;
+  }
+
+  template <RecordType R>
+  void CountRecord() {
+    if constexpr (R == RecordType::kAnswer)
+      header_.AC++;
+    else if constexpr (R == RecordType::kAuthority)
+      header_.NC++;
+    else
+      header_.DC++;
+  }
 
  public:
   /* lifetime */
   ~DnsPacket() = default;
   DnsPacket(DnsPacket&&);
   void operator=(DnsPacket&&);
-  explicit DnsPacket(uint16_t ID);
-  static DnsPacket Create(uint16_t ID);
+  // Everything the packet holds is allocated from |memory|, which has to
+  // outlive it. Responses are usually built in the same arena as the query
+  // they answer, so that all of it can be dropped at once.
+  explicit DnsPacket(
+      uint16_t ID,
+      std::pmr::memory_resource* memory = std::pmr::get_default_resource());
+  static DnsPacket Create(
+      uint16_t ID,
+      std::pmr::memory_resource* memory = std::pmr::get_default_resource());
 
   /* Importers and exporters */
+  // Records that don't fit in |stream| are left out a whole RRset at a time,
+  // and the reply is marked truncated if any of them were answers.
   PacketStatus Export(WriteStream* stream);
+  // An upper bound on the exported size of this packet.
+  size_t EstimateSize() const;
+  static PacketStatus::Or<DnsPacket> Import(
+      ReadStream* stream,
+      std::pmr::memory_resource* memory = std::pmr::get_default_resource());
   static PacketStatus::Or<DnsPacket> Import(std::unique_ptr<ReadStream> stream);
   base::json::Object Render();
 
@@ -85,51 +115,50 @@ class DnsPacket {
   DnsPacket SetReserved(uint8_t reserved) &&;
 
   size_t GetNumQuestions() const { return questions_.size(); }
-  size_t GetNumAnswers() const { return answers_.size(); }
-  size_t GetNumAuthorities() const { return authorities_.size(); }
-  size_t GetNumAdditional() const { return additional_.size(); }
+  size_t GetNumAnswers() const { return answers_.Size(); }
+  size_t GetNumAuthorities() const { return authorities_.Size(); }
+  size_t GetNumAdditional() const { return additional_.Size(); }
 
   std::optional<const DnsQuestion*> GetQuestion(size_t q_num);
-  std::optional<const PreambleAndRecord*> GetAnswer(size_t a_num);
-  std::optional<const PreambleAndRecord*> GetAuthority(size_t a_num);
-  std::optional<const PreambleAndRecord*> GetAdditional(size_t a_num);
+  const RecordStore& GetAnswers() const { return answers_; }
+  const RecordStore& GetAuthorities() const { return authorities_; }
+  const RecordStore& GetAdditional() const { return additional_; }
 
   void CheckLM();
 
   PacketStatus::Or<DnsPacket> AddQuestion(const DnsQuestion& question);
-  PacketStatus::Or<DnsPacket> AddQuestion(std::string name,
+  PacketStatus::Or<DnsPacket> AddQuestion(std::string_view name,
                                           uint16_t Type,
                                           uint16_t Class);
 
   template <RecordType R, typename T>
-  PacketStatus::Or<DnsPacket> AddRecord(std::string Name,
+  PacketStatus::Or<DnsPacket> AddRecord(std::string_view Name,
                                         uint16_t Class,
                                         uint32_t TTL,
-                                        T Record) {
-    std::vector<PreambleAndRecord>* vec;
-    if constexpr (R == RecordType::kAnswer)
-      vec = &answers_;
-    else if constexpr (R == RecordType::kAuthority)
-      vec = &authorities_;
-    else if constexpr (R == RecordType::kAdditional)
-      vec = &additional_;
-    else
-      return PacketStatus::Codes::kIndexOutOfRange;
-
+                                        const T& Record) {
     auto label = label_manager_->GetLabelSeq(Name);
     if (!label.has_value())
       return std::move(label).error();
+    if (!Section<R>()->Add(std::move(label).value(), Class, TTL, Record))
+      return PacketStatus::Codes::kParsingError;
+    CountRecord<R>();
+    return std::move(*this);
+  }
 
-    vec->push_back(std::make_tuple<DnsRecordPreamble, DnsRecord>(
-        {std::move(label).value(), T::TYPE, Class, TTL, 0}, std::move(Record)));
-
-    if constexpr (R == RecordType::kAnswer)
-      header_->AC++;
-    else if constexpr (R == RecordType::kAuthority)
-      header_->NC++;
-    else if constexpr (R == RecordType::kAdditional)
-      header_->DC++;
-
+  // Adds a record whose RDATA is already in (uncompressed) wire format, such
+  // as one copied out of another RecordStore.
+  template <RecordType R>
+  PacketStatus::Or<DnsPacket> AddRecordData(std::string_view name,
+                                            uint16_t type,
+                                            uint16_t klass,
+                                            uint32_t ttl,
+                                            std::span<const uint8_t> rdata) {
+    auto label = label_manager_->GetLabelSeq(name);
+    if (!label.has_value())
+      return std::move(label).error();
+    if (!Section<R>()->Add(std::move(label).value(), type, klass, ttl, rdata))
+      return PacketStatus::Codes::kParsingError;
+    CountRecord<R>();
     return std::move(*this);
   }
 };
@@ -0,0 +1,281 @@
+#include "pipeline.h"
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <map>
+#include <string>
+
+#include "error_reply.h"
+
+namespace homedns {
+
+namespace {
+
+Pipeline::Options WithDefaults(Pipeline::Options options) {
+  options.receivers = std::max<size_t>(options.receivers, 1);
+  options.batch = std::max<size_t>(options.batch, 1);
+  if (options.workers == 0) {
+    size_t cores = std::thread::hardware_concurrency();
+    options.workers = cores > options.receivers ? cores - options.receivers : 1;
+  }
+  return options;
+}
+
+// Enough that the pool only runs dry once every queue is full: each queue's
+// worth, one in each worker's hands, and a batch for each receiver.
+size_t SlotCount(const Pipeline::Options& options) {
+  size_t queue = std::bit_ceil(std::max<size_t>(options.queue_capacity, 2));
+  return options.workers * (queue + 1) + options.receivers * options.batch;
+}
+
+void RenderSummary(const char* name,
+                   const LatencyHistogram::Summary& summary,
+                   std::map<std::string, base::json::JSON>* result) {
+  std::string prefix(name);
+  (*result)[prefix + " p50 (ns)"] = (int)summary.p50.count();
+  (*result)[prefix + " p99 (ns)"] = (int)summary.p99.count();
+  (*result)[prefix + " Max (ns)"] = (int)summary.max.count();
+}
+
+}  // namespace
+
+Pipeline::Pipeline(UDPServer* server, UDPServer::DataCB cb, Options options)
+    : server_(server),
+      cb_(std::move(cb)),
+      options_(WithDefaults(options)),
+      slots_(std::make_unique<Slot[]>(SlotCount(options_))),
+      free_(SlotCount(options_)) {
+  for (uint32_t i = 0; i < SlotCount(options_); i++)
+    free_.TryPush(i);
+  for (size_t i = 0; i < options_.receivers; i++)
+    receivers_.push_back(std::make_unique<Receiver>());
+  for (size_t i = 0; i < options_.workers; i++)
+    workers_.push_back(std::make_unique<Worker>(options_.queue_capacity));
+}
+
+Pipeline::~Pipeline() {
+  Stop();
+}
+
+void Pipeline::Start() {
+  if (running_.exchange(true))
+    return;
+  server_->SetReceiving(false);
+  for (size_t i = 0; i < workers_.size(); i++)
+    workers_[i]->thread = std::thread(&Pipeline::Work, this, i);
+  for (size_t i = 0; i < receivers_.size(); i++) {
+    receivers_[i]->thread = std::thread(&Pipeline::Receive, this,
+                                        receivers_[i].get(), i);
+  }
+}
+
+void Pipeline::Stop() {
+  if (!running_.exchange(false))
+    return;
+  wake_.fetch_add(1);
+  wake_.notify_all();
+  for (auto& receiver : receivers_)
+    receiver->thread.join();
+  for (auto& worker : workers_)
+    worker->thread.join();
+  server_->SetReceiving(true);
+}
+
+void Pipeline::Receive(Receiver* self, size_t first_worker) {
+  const size_t batch = options_.batch;
+  std::vector<uint32_t> owned;
+  std::vector<struct mmsghdr> messages(batch);
+  std::vector<struct iovec> buffers(batch);
+  // Somewhere to read into when the pool is empty, just to shed what's read.
+  Slot overflow;
+  size_t next = first_worker;
+  std::unique_ptr<BusyPoller> poller;
+  if (options_.busy_poll.count() > 0)
+    poller = std::make_unique<BusyPoller>(options_.busy_poll);
+
+  while (running_) {
+    uint32_t index;
+    while (owned.size() < batch && free_.TryPop(&index))
+      owned.push_back(index);
+    size_t count = owned.empty() ? 1 : owned.size();
+    for (size_t i = 0; i < count; i++) {
+      Slot* slot = owned.empty() ? &overflow : &slots_[owned[i]];
+      buffers[i] = {slot->data, sizeof(slot->data)};
+      messages[i].msg_hdr = {};
+      messages[i].msg_hdr.msg_name = &slot->client;
+      messages[i].msg_hdr.msg_namelen = sizeof(slot->client);
+      messages[i].msg_hdr.msg_iov = &buffers[i];
+      messages[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int received = 0;
+    auto receive = [&] {
+      received = recvmmsg(server_->GetFD(), messages.data(), count,
+                          MSG_DONTWAIT, nullptr);
+      return received > 0;
+    };
+    if (!poller || !poller->Spin(receive)) {
+      struct pollfd fd = {server_->GetFD(), POLLIN, 0};
+      if (poll(&fd, 1, UDPServer::kTickMillis) <= 0)
+        continue;
+      receive();
+    }
+    if (received <= 0) {
+      if (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+        perror("recvmmsg");
+      continue;
+    }
+    self->received.store(self->received.load(std::memory_order_relaxed) +
+                             received,
+                         std::memory_order_relaxed);
+
+    Clock::time_point now = Clock::now();
+    size_t kept = 0;
+    bool dispatched = false;
+    for (int i = 0; i < received; i++) {
+      Slot& slot = owned.empty() ? overflow : slots_[owned[i]];
+      slot.received = now;
+      slot.len = messages[i].msg_len;
+      if (!owned.empty() && Dispatch(self, owned[i], &next)) {
+        dispatched = true;
+        continue;
+      }
+      Shed(self, slot);
+      if (!owned.empty())
+        owned[kept++] = owned[i];
+    }
+    if (!owned.empty()) {
+      // Slots that weren't read into are still ours too.
+      std::copy(owned.begin() + received, owned.end(), owned.begin() + kept);
+      owned.resize(kept + owned.size() - received);
+    }
+    if (dispatched) {
+      wake_.fetch_add(1);
+      if (sleepers_.load())
+        wake_.notify_all();
+    }
+  }
+
+  for (uint32_t index : owned)
+    free_.TryPush(index);
+}
+
+bool Pipeline::Dispatch(Receiver* self, uint32_t index, size_t* next) {
+  for (size_t i = 0; i < workers_.size(); i++) {
+    size_t target = (*next + i) % workers_.size();
+    Worker* worker = workers_[target].get();
+    if (!worker->queue.TryPush(index))
+      continue;
+    *next = target + 1;
+    size_t depth = worker->queue.ApproxSize();
+    if (depth > self->max_queue_depth.load(std::memory_order_relaxed))
+      self->max_queue_depth.store(depth, std::memory_order_relaxed);
+    return true;
+  }
+  return false;
+}
+
+void Pipeline::Shed(Receiver* self, const Slot& slot) {
+  self->shed.store(self->shed.load(std::memory_order_relaxed) + 1,
+                   std::memory_order_relaxed);
+  if (options_.overload != Overload::kRefuse)
+    return;
+  uint8_t reply[512];
+  size_t len = WriteErrorReply(slot.data, slot.len, ResponseCode::kRefused,
+                               reply, sizeof(reply));
+  if (len)
+    server_->SendData(reply, len, slot.client);
+}
+
+void Pipeline::Work(size_t index) {
+  Worker* self = workers_[index].get();
+  while (running_) {
+    uint32_t slot_index;
+    if (!self->queue.TryPop(&slot_index) && !Steal(index, &slot_index)) {
+      Sleep();
+      continue;
+    }
+    Slot& slot = slots_[slot_index];
+    Clock::time_point start = Clock::now();
+    self->wait.Record(start - slot.received);
+    cb_.Run(Response{server_, slot.client}, slot.data, slot.len, slot.client);
+    self->service.Record(Clock::now() - start);
+    self->handled.store(self->handled.load(std::memory_order_relaxed) + 1,
+                        std::memory_order_relaxed);
+    free_.TryPush(slot_index);
+  }
+}
+
+bool Pipeline::Steal(size_t thief, uint32_t* index) {
+  for (size_t i = 1; i < workers_.size(); i++) {
+    Worker* victim = workers_[(thief + i) % workers_.size()].get();
+    if (victim->queue.TryPop(index)) {
+      Worker* self = workers_[thief].get();
+      self->stolen.store(self->stolen.load(std::memory_order_relaxed) + 1,
+                         std::memory_order_relaxed);
+      return true;
+    }
+  }
+  return false;
+}
+
+// Reading |wake_| before looking at the queues one last time means that work
+// queued after the look has also bumped |wake_|, so the wait can't miss it.
+void Pipeline::Sleep() {
+  uint32_t seen = wake_.load();
+  sleepers_.fetch_add(1);
+  if (running_ && !AnyQueued())
+    wake_.wait(seen);
+  sleepers_.fetch_sub(1);
+}
+
+bool Pipeline::AnyQueued() const {
+  for (const auto& worker : workers_) {
+    if (worker->queue.ApproxSize() > 0)
+      return true;
+  }
+  return false;
+}
+
+Pipeline::Stats Pipeline::GetStats() const {
+  Stats stats;
+  for (const auto& receiver : receivers_) {
+    stats.received += receiver->received.load(std::memory_order_relaxed);
+    stats.shed += receiver->shed.load(std::memory_order_relaxed);
+    stats.max_queue_depth =
+        std::max(stats.max_queue_depth,
+                 receiver->max_queue_depth.load(std::memory_order_relaxed));
+  }
+  LatencyHistogram wait;
+  LatencyHistogram service;
+  for (const auto& worker : workers_) {
+    stats.handled += worker->handled.load(std::memory_order_relaxed);
+    stats.stolen += worker->stolen.load(std::memory_order_relaxed);
+    stats.queue_depth += worker->queue.ApproxSize();
+    wait.Merge(worker->wait);
+    service.Merge(worker->service);
+  }
+  stats.wait = wait.Summarize();
+  stats.service = service.Summarize();
+  return stats;
+}
+
+base::json::Object Pipeline::Render() const {
+  Stats stats = GetStats();
+  std::map<std::string, base::json::JSON> result;
+  result["Workers"] = (int)workers_.size();
+  result["Received"] = (int)stats.received;
+  result["Handled"] = (int)stats.handled;
+  result["Shed"] = (int)stats.shed;
+  result["Stolen"] = (int)stats.stolen;
+  result["Queue Depth"] = (int)stats.queue_depth;
+  result["Max Queue Depth"] = (int)stats.max_queue_depth;
+  RenderSummary("Wait", stats.wait, &result);
+  RenderSummary("Service", stats.service, &result);
+  return base::json::Object(std::move(result));
+}
+
+}  // namespace homedns
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <netinet/in.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "base/json/json.h"
+#include "busy_poll.h"
+#include "latency_histogram.h"
+#include "mpmc_queue.h"
+#include "udp_server.h"
+
+namespace homedns {
+
+// Spreads the queries from one socket over several cores, for when they can't
+// be spread over several sockets (SO_REUSEPORT hashes a single busy client to
+// just one of them).
+//
+// Receiver threads read the socket a batch at a time with recvmmsg, into
+// slots from a fixed pool, and hand each slot's index to one of the workers'
+// bounded lock-free queues, round robin. A worker runs the server's data
+// callback on its own queue first, then steals from the others, and sleeps
+// only once they are all empty. Workers send their replies themselves.
+//
+// When every queue is full the query is shed on the spot: dropped, or
+// answered REFUSED, so that an overloaded server fails fast instead of
+// answering everybody late.
+class Pipeline {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  enum class Overload : uint8_t { kDrop, kRefuse };
+
+  struct Options {
+    size_t receivers = 1;
+    // Zero means one for each core the receivers leave free.
+    size_t workers = 0;
+    // Per worker, rounded up to a power of two.
+    size_t queue_capacity = 256;
+    // The most datagrams read by one recvmmsg.
+    size_t batch = 32;
+    Overload overload = Overload::kRefuse;
+    // How long receivers spin on an empty socket before sleeping, as for
+    // UDPServer::EnableBusyPoll. Zero sleeps straight away.
+    std::chrono::microseconds busy_poll{0};
+  };
+
+  struct Stats {
+    uint64_t received = 0;
+    uint64_t handled = 0;
+    uint64_t shed = 0;
+    // Handled by a worker other than the one they were queued for.
+    uint64_t stolen = 0;
+    // Queries waiting right now, and the most any one queue has held.
+    size_t queue_depth = 0;
+    size_t max_queue_depth = 0;
+    // From being read off the socket to a worker picking the query up, and
+    // from there to the reply having been sent.
+    LatencyHistogram::Summary wait;
+    LatencyHistogram::Summary service;
+  };
+
+  // |server| keeps running its loop for watched descriptors and ticks, but
+  // stops reading its socket while the pipeline runs. |cb| runs on the
+  // workers, so everything it touches has to be thread safe.
+  Pipeline(UDPServer* server, UDPServer::DataCB cb, Options options);
+  ~Pipeline();
+
+  void Start();
+  void Stop();
+
+  size_t WorkerCount() const { return workers_.size(); }
+
+  Stats GetStats() const;
+  base::json::Object Render() const;
+
+ private:
+  struct Slot {
+    Clock::time_point received;
+    struct sockaddr_in client;
+    uint32_t len;
+    uint8_t data[512];
+  };
+
+  struct alignas(64) Worker {
+    explicit Worker(size_t capacity) : queue(capacity) {}
+    MpmcQueue<uint32_t> queue;
+    LatencyHistogram wait;
+    LatencyHistogram service;
+    std::atomic<uint64_t> handled = 0;
+    std::atomic<uint64_t> stolen = 0;
+    std::thread thread;
+  };
+
+  struct alignas(64) Receiver {
+    std::atomic<uint64_t> received = 0;
+    std::atomic<uint64_t> shed = 0;
+    std::atomic<size_t> max_queue_depth = 0;
+    std::thread thread;
+  };
+
+  void Receive(Receiver* self, size_t first_worker);
+  // Queues slot |index| on the first worker from |*next| on with room, and
+  // moves |*next| past it.
+  bool Dispatch(Receiver* self, uint32_t index, size_t* next);
+  void Shed(Receiver* self, const Slot& slot);
+
+  void Work(size_t index);
+  bool Steal(size_t thief, uint32_t* index);
+  void Sleep();
+  bool AnyQueued() const;
+
+  UDPServer* const server_;
+  const UDPServer::DataCB cb_;
+  const Options options_;
+
+  std::unique_ptr<Slot[]> slots_;
+  MpmcQueue<uint32_t> free_;
+  std::vector<std::unique_ptr<Receiver>> receivers_;
+  std::vector<std::unique_ptr<Worker>> workers_;
+
+  std::atomic<bool> running_ = false;
+  // Bumped whenever there is new work, for sleeping workers to wait on.
+  std::atomic<uint32_t> wake_ = 0;
+  std::atomic<uint32_t> sleepers_ = 0;
+};
+
+}  // namespace homedns
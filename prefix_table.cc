@@ -0,0 +1,39 @@
+#include "prefix_table.h"
+
+#include <arpa/inet.h>
+#include <charconv>
+#include <string>
+
+namespace homedns {
+
+// static
+ConfigStatus::Or<AddressPrefix> AddressPrefix::Parse(std::string_view text) {
+  std::string address(text.substr(0, text.find('/')));
+  AddressPrefix prefix = {};
+  if (inet_pton(AF_INET, address.c_str(), prefix.bytes) == 1) {
+    prefix.family = AF_INET;
+    prefix.bits = 32;
+  } else if (inet_pton(AF_INET6, address.c_str(), prefix.bytes) == 1) {
+    prefix.family = AF_INET6;
+    prefix.bits = 128;
+  } else {
+    return ConfigStatus(ConfigStatus::Codes::kSyntaxError,
+                        "bad address: " + std::string(text));
+  }
+
+  if (address.size() == text.size())
+    return prefix;
+  size_t max_bits = prefix.bits;
+  std::string_view length = text.substr(address.size() + 1);
+  auto [end, error] =
+      std::from_chars(length.data(), length.data() + length.size(),
+                      prefix.bits);
+  if (error != std::errc() || end != length.data() + length.size() ||
+      prefix.bits > max_bits) {
+    return ConfigStatus(ConfigStatus::Codes::kSyntaxError,
+                        "bad prefix length: " + std::string(text));
+  }
+  return prefix;
+}
+
+}  // namespace homedns
@@ -0,0 +1,210 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#include "status.h"
+
+namespace homedns {
+
+// An IPv4 or IPv6 prefix, as written in config files: "10.0.0.0/8",
+// "fd00::/8", or a bare address for a single host.
+struct AddressPrefix {
+  int family;  // AF_INET or AF_INET6.
+  uint8_t bytes[16];
+  size_t bits;
+
+  static ConfigStatus::Or<AddressPrefix> Parse(std::string_view text);
+};
+
+// A longest prefix match table over fixed width addresses (4 bytes for IPv4,
+// 16 for IPv6), laid out as a poptrie: a multibit trie with a stride of one
+// byte, where each node keeps two 256 bit vectors instead of 256 pointers.
+// One marks which slots have a child node, and the other marks the slots where
+// the run of leaf values changes. A lookup is one popcount per byte of the
+// address, and nodes with a handful of prefixes stay small.
+//
+// Shorter prefixes are pushed down into the slots of longer ones when the
+// table is built, so a lookup never has to backtrack. The table is immutable
+// once built; to change it, build a new one and swap it in.
+template <typename T, size_t kBytes>
+class PrefixTable {
+ public:
+  class Builder {
+   public:
+    // Adds (or replaces) the value for the first |bits| bits of |addr|.
+    // Returns false if |bits| is longer than the address.
+    bool Insert(const uint8_t* addr, size_t bits, T value);
+    PrefixTable Build() &&;
+
+   private:
+    struct Prefix {
+      uint8_t bits;  // Length of the prefix within its node's byte, 0 to 8.
+      uint8_t slot;  // The first slot it covers.
+      uint32_t value;
+    };
+    struct BuildNode {
+      std::vector<Prefix> prefixes;
+      std::map<uint8_t, std::unique_ptr<BuildNode>> children;
+    };
+    BuildNode root_;
+    std::vector<T> values_;
+    size_t prefix_count_ = 0;
+  };
+
+  PrefixTable() = default;
+
+  // Returns the value for the longest prefix covering |addr|, or nullptr.
+  const T* Lookup(const uint8_t* addr) const;
+
+  size_t PrefixCount() const { return prefix_count_; }
+  size_t NodeCount() const { return nodes_.size(); }
+  size_t MemoryUsage() const {
+    return nodes_.capacity() * sizeof(Node) +
+           leaves_.capacity() * sizeof(uint32_t) +
+           values_.capacity() * sizeof(T);
+  }
+
+ private:
+  static constexpr uint32_t kNoValue = UINT32_MAX;
+
+  struct Node {
+    uint64_t children[4];  // Slots with a child node.
+    uint64_t leaves[4];    // Slots where a new run of leaf values starts.
+    uint32_t first_child;  // Index of the first child in |nodes_|.
+    uint32_t first_leaf;   // Index of the first leaf in |leaves_|.
+    // How many bits are set in the words before each word of the vectors.
+    uint16_t child_rank[4];
+    uint16_t leaf_rank[4];
+  };
+
+  std::vector<Node> nodes_;
+  std::vector<uint32_t> leaves_;  // Indices into |values_|, or kNoValue.
+  std::vector<T> values_;
+  size_t prefix_count_ = 0;
+};
+
+template <typename T, size_t kBytes>
+bool PrefixTable<T, kBytes>::Builder::Insert(const uint8_t* addr,
+                                             size_t bits,
+                                             T value) {
+  if (bits > kBytes * 8)
+    return false;
+  // A prefix lives in the node for the byte holding its last bit.
+  size_t depth = bits ? (bits - 1) / 8 : 0;
+  BuildNode* node = &root_;
+  for (size_t i = 0; i < depth; i++) {
+    auto& child = node->children[addr[i]];
+    if (!child)
+      child = std::make_unique<BuildNode>();
+    node = child.get();
+  }
+  uint8_t in_node = bits - depth * 8;
+  uint8_t mask = in_node ? 0xFF << (8 - in_node) : 0;
+  uint8_t slot = addr[depth] & mask;
+  for (Prefix& prefix : node->prefixes) {
+    if (prefix.bits == in_node && prefix.slot == slot) {
+      values_[prefix.value] = std::move(value);
+      return true;
+    }
+  }
+  node->prefixes.push_back({in_node, slot, uint32_t(values_.size())});
+  values_.push_back(std::move(value));
+  prefix_count_++;
+  return true;
+}
+
+template <typename T, size_t kBytes>
+PrefixTable<T, kBytes> PrefixTable<T, kBytes>::Builder::Build() && {
+  PrefixTable table;
+  table.values_ = std::move(values_);
+  table.prefix_count_ = prefix_count_;
+  table.nodes_.push_back({});
+
+  // Breadth first, so that every node's children end up next to each other.
+  // Each node inherits the value of the slot above it.
+  struct Pending {
+    BuildNode* node;
+    uint32_t index;
+    uint32_t inherited;
+  };
+  std::vector<Pending> queue = {{&root_, 0, kNoValue}};
+  for (size_t head = 0; head < queue.size(); head++) {
+    Pending pending = queue[head];
+    BuildNode* build_node = pending.node;
+
+    uint32_t slots[256];
+    std::fill(std::begin(slots), std::end(slots), pending.inherited);
+    std::stable_sort(
+        build_node->prefixes.begin(), build_node->prefixes.end(),
+        [](const Prefix& a, const Prefix& b) { return a.bits < b.bits; });
+    for (const Prefix& prefix : build_node->prefixes) {
+      size_t span = size_t(1) << (8 - prefix.bits);
+      std::fill(slots + prefix.slot, slots + prefix.slot + span, prefix.value);
+    }
+
+    Node node = {};
+    node.first_child = table.nodes_.size();
+    node.first_leaf = table.leaves_.size();
+    for (auto& [byte, child] : build_node->children) {
+      node.children[byte >> 6] |= uint64_t(1) << (byte & 63);
+      queue.push_back({child.get(), uint32_t(table.nodes_.size()),
+                       slots[byte]});
+      table.nodes_.push_back({});
+    }
+    // Slots with children are never read as leaves, so they don't break up a
+    // run of equal values.
+    bool started = false;
+    uint32_t last = kNoValue;
+    for (size_t i = 0; i < 256; i++) {
+      if (node.children[i >> 6] & (uint64_t(1) << (i & 63)))
+        continue;
+      if (started && slots[i] == last)
+        continue;
+      node.leaves[i >> 6] |= uint64_t(1) << (i & 63);
+      table.leaves_.push_back(slots[i]);
+      last = slots[i];
+      started = true;
+    }
+    for (size_t w = 1; w < 4; w++) {
+      node.child_rank[w] =
+          node.child_rank[w - 1] + std::popcount(node.children[w - 1]);
+      node.leaf_rank[w] =
+          node.leaf_rank[w - 1] + std::popcount(node.leaves[w - 1]);
+    }
+    table.nodes_[pending.index] = node;
+  }
+  root_.children.clear();
+  root_.prefixes.clear();
+  return table;
+}
+
+template <typename T, size_t kBytes>
+const T* PrefixTable<T, kBytes>::Lookup(const uint8_t* addr) const {
+  if (nodes_.empty())
+    return nullptr;
+  const Node* node = &nodes_[0];
+  for (size_t i = 0; i < kBytes; i++) {
+    size_t word = addr[i] >> 6;
+    size_t bit = addr[i] & 63;
+    uint64_t below = (uint64_t(1) << bit) - 1;
+    if (node->children[word] & (uint64_t(1) << bit)) {
+      node = &nodes_[node->first_child + node->child_rank[word] +
+                     std::popcount(node->children[word] & below)];
+      continue;
+    }
+    // The leaf for this slot is the last run that started at or before it.
+    uint64_t through = (below << 1) | 1;
+    uint32_t value = leaves_[node->first_leaf + node->leaf_rank[word] +
+                             std::popcount(node->leaves[word] & through) - 1];
+    return value == kNoValue ? nullptr : &values_[value];
+  }
+  return nullptr;
+}
+
+}  // namespace homedns
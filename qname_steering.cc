@@ -0,0 +1,84 @@
+#include "qname_steering.h"
+
+#include "wire.h"
+
+namespace homedns {
+
+// static
+uint32_t QnameSteering::HashQuery(const uint8_t* data, size_t len) {
+  uint32_t hash = kOffsetBasis;
+  for (size_t i = wire::kHeaderSize;
+       i < len && i < wire::kHeaderSize + kHashedBytes && data[i] != 0; i++) {
+    hash = Mix(hash, data[i]);
+  }
+  return Finish(hash);
+}
+
+// static
+uint32_t QnameSteering::HashName(std::string_view name) {
+  if (!name.empty() && name.back() == '.')
+    name.remove_suffix(1);
+  uint32_t hash = kOffsetBasis;
+  size_t hashed = 0;
+  while (!name.empty() && hashed < kHashedBytes) {
+    size_t dot = name.find('.');
+    std::string_view label = name.substr(0, dot);
+    name = dot == std::string_view::npos ? "" : name.substr(dot + 1);
+    // Labels are never empty, so their length byte is never the terminator.
+    hash = Mix(hash, label.size());
+    hashed++;
+    for (size_t i = 0; i < label.size() && hashed < kHashedBytes; i++) {
+      if (label[i] == 0)
+        return Finish(hash);
+      hash = Mix(hash, label[i]);
+      hashed++;
+    }
+  }
+  return Finish(hash);
+}
+
+// static
+std::vector<struct sock_filter> QnameSteering::KernelProgram(size_t sockets) {
+  // Reuseport programs see the datagram from after its UDP header. Jumps
+  // only reach 255 instructions, so every byte's block leaves through its own
+  // long jump to the end.
+  constexpr uint32_t kBlockSize = 11;
+  std::vector<struct sock_filter> program = {
+      BPF_STMT(BPF_LD | BPF_IMM, kOffsetBasis),
+      BPF_STMT(BPF_ST, 0),
+  };
+  for (uint32_t i = 0; i < kHashedBytes; i++) {
+    uint32_t offset = wire::kHeaderSize + i;
+    uint32_t to_end = (kHashedBytes - i - 1) * kBlockSize + 6;
+    std::vector<struct sock_filter> block = {
+        // 0: if (len <= offset) goto end
+        BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0),
+        BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, offset + 1, 0, 2),
+        // 2: if (byte == 0) goto end
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, offset),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 1),
+        BPF_JUMP(BPF_JMP | BPF_JA, to_end, 0, 0),
+        // 5: M[0] = (M[0] ^ (byte | 0x20)) * prime
+        BPF_STMT(BPF_ALU | BPF_OR | BPF_K, 0x20),
+        BPF_STMT(BPF_MISC | BPF_TAX, 0),
+        BPF_STMT(BPF_LD | BPF_MEM, 0),
+        BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+        BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, kPrime),
+        BPF_STMT(BPF_ST, 0),
+    };
+    program.insert(program.end(), block.begin(), block.end());
+  }
+  std::vector<struct sock_filter> end = {
+      // end: return (M[0] ^ (M[0] >> 16)) % sockets
+      BPF_STMT(BPF_LD | BPF_MEM, 0),
+      BPF_STMT(BPF_MISC | BPF_TAX, 0),
+      BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 16),
+      BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+      BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, static_cast<uint32_t>(sockets)),
+      BPF_STMT(BPF_RET | BPF_A, 0),
+  };
+  program.insert(program.end(), end.begin(), end.end());
+  return program;
+}
+
+}  // namespace homedns
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <linux/filter.h>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace homedns {
+
+// Picks which of a group of SO_REUSEPORT sockets gets a query by a hash of its
+// question name, instead of the kernel's hash of the client's address and
+// port. Each socket's loop then sees a disjoint slice of the names, so the
+// cache partition it owns only ever holds its own slice, and stays small and
+// hot in that core's cache instead of every loop caching every popular name.
+//
+// The hash is FNV-1a over the first kHashedBytes bytes of the name in wire
+// format, up to its terminating zero, with 0x20 or'ed into each byte so that
+// case doesn't matter. It is computed the same way by the kernel program
+// and here, so that anything the loops share can be split the same way.
+class QnameSteering {
+ public:
+  static constexpr size_t kHashedBytes = 64;
+
+  // Of the datagram |data|, which must be at least a header long.
+  static uint32_t HashQuery(const uint8_t* data, size_t len);
+  // Of a dotted name ("www.example.com"), as it would be in a query.
+  static uint32_t HashName(std::string_view name);
+
+  static size_t Shard(uint32_t hash, size_t shards) { return hash % shards; }
+
+  // A classic BPF program for SO_ATTACH_REUSEPORT_CBPF that returns
+  // Shard(HashQuery(datagram), |sockets|). Sockets are numbered in the order
+  // they joined the group.
+  static std::vector<struct sock_filter> KernelProgram(size_t sockets);
+
+ private:
+  static constexpr uint32_t kOffsetBasis = 2166136261u;
+  static constexpr uint32_t kPrime = 16777619u;
+
+  static uint32_t Mix(uint32_t hash, uint8_t byte) {
+    return (hash ^ (byte | 0x20)) * kPrime;
+  }
+  // Folds the high bits down, since the shard only takes the low ones.
+  static uint32_t Finish(uint32_t hash) { return hash ^ (hash >> 16); }
+};
+
+}  // namespace homedns
@@ -0,0 +1,159 @@
+#include "rate_limiter.h"
+
+#include <algorithm>
+#include <bit>
+#include <random>
+
+#include "wire.h"
+
+namespace homedns {
+
+namespace {
+
+constexpr uint64_t kMilli = 1000;
+constexpr int kTimeBits = 40;
+constexpr uint64_t kTimeMask = (uint64_t(1) << kTimeBits) - 1;
+constexpr uint64_t kMaxBurst = 16000;
+
+uint64_t Pack(uint64_t millitokens, uint64_t millis) {
+  return (millitokens << kTimeBits) | (millis & kTimeMask);
+}
+
+// splitmix64's finalizer.
+uint64_t Mix(uint64_t value) {
+  value ^= value >> 30;
+  value *= 0xbf58476d1ce4e5b9;
+  value ^= value >> 27;
+  value *= 0x94d049bb133111eb;
+  return value ^ (value >> 31);
+}
+
+// Hashes what a response says, rather than who it goes to.
+uint64_t Identity(const uint8_t* reply, size_t len) {
+  if (len < wire::kHeaderSize)
+    return 0;
+  uint8_t rcode = reply[3] & 0x0F;
+  uint64_t hash = 0xcbf29ce484222325 ^ rcode;
+  if (rcode != 0)
+    return Mix(hash);
+  // FNV-1a over the question, with names folded to lowercase.
+  size_t end = wire::QuestionEnd(reply, len);
+  for (size_t i = wire::kHeaderSize; i < end; i++) {
+    uint8_t c = reply[i];
+    hash = (hash ^ ((c >= 'A' && c <= 'Z') ? (c | 0x20) : c)) *
+           0x100000001b3;
+  }
+  return Mix(hash);
+}
+
+}  // namespace
+
+RateLimiter::RateLimiter() : RateLimiter(Options()) {}
+
+RateLimiter::RateLimiter(Options options)
+    : options_(options),
+      // A millisecond back, so that no charged bucket is ever all zeroes.
+      epoch_(Clock::now() - std::chrono::milliseconds(1)),
+      seed_((uint64_t(std::random_device()()) << 32) | std::random_device()()),
+      mask_(std::bit_ceil(std::max<size_t>(options.table_size, 1)) - 1),
+      buckets_(new Bucket[mask_ + 1]) {
+  for (size_t i = 0; i <= mask_; i++)
+    buckets_[i].state.store(0, std::memory_order_relaxed);
+}
+
+RateLimiter::Action RateLimiter::Check(const struct sockaddr_in& client,
+                                       const uint8_t* reply,
+                                       size_t len,
+                                       Clock::time_point now) {
+  // s_addr is in network order, so its first three bytes are the /24.
+  const uint8_t* bytes =
+      reinterpret_cast<const uint8_t*>(&client.sin_addr.s_addr);
+  uint64_t prefix = (uint64_t(bytes[0]) << 16) | (bytes[1] << 8) | bytes[2];
+  return Charge(Mix(Mix(prefix ^ seed_) ^ Identity(reply, len)), now);
+}
+
+RateLimiter::Action RateLimiter::Check(const struct in6_addr& client,
+                                       const uint8_t* reply,
+                                       size_t len,
+                                       Clock::time_point now) {
+  // The /56 is the first seven bytes; the top bit keeps it apart from IPv4.
+  uint64_t prefix = uint64_t(1) << 63;
+  for (size_t i = 0; i < 7; i++)
+    prefix |= uint64_t(client.s6_addr[i]) << (8 * (6 - i));
+  return Charge(Mix(Mix(prefix ^ seed_) ^ Identity(reply, len)), now);
+}
+
+RateLimiter::Action RateLimiter::Charge(uint64_t key, Clock::time_point now) {
+  uint64_t millis = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        now - epoch_)
+                        .count();
+  uint64_t capacity = std::min<uint64_t>(options_.burst, kMaxBurst) * kMilli;
+  Bucket& bucket = buckets_[key & mask_];
+
+  // A key taking over a slot inherits its tokens rather than a full bucket,
+  // or two keys alternating in one slot would never be limited.
+  uint64_t old_state = bucket.state.load(std::memory_order_relaxed);
+  while (true) {
+    // A bucket nothing has been charged to yet starts full. That is decided
+    // by the same compare and swap as the charge, so threads sharing the
+    // limiter can't each start it over.
+    uint64_t tokens = old_state ? old_state >> kTimeBits : capacity;
+    uint64_t last = old_state ? old_state & kTimeMask : millis;
+    uint64_t elapsed = millis > last ? millis - last : 0;
+    // responses_per_second tokens a second is that many millitokens a
+    // millisecond.
+    tokens += elapsed * options_.responses_per_second;
+    tokens = std::min(capacity, tokens);
+    bool allowed = tokens >= kMilli;
+    uint64_t new_state =
+        Pack(allowed ? tokens - kMilli : tokens, std::max(millis, last));
+    if (!bucket.state.compare_exchange_weak(old_state, new_state,
+                                            std::memory_order_relaxed)) {
+      continue;
+    }
+    if (allowed) {
+      sent_.fetch_add(1, std::memory_order_relaxed);
+      return Action::kSend;
+    }
+    break;
+  }
+
+  uint64_t limited = limited_.fetch_add(1, std::memory_order_relaxed) + 1;
+  if (options_.slip && limited % options_.slip == 0) {
+    slipped_.fetch_add(1, std::memory_order_relaxed);
+    return Action::kSlip;
+  }
+  return Action::kDrop;
+}
+
+// static
+size_t RateLimiter::Slip(uint8_t* reply, size_t len) {
+  if (len < wire::kHeaderSize)
+    return len;
+  size_t end = wire::QuestionEnd(reply, len);
+  reply[2] |= 0x02;
+  wire::WriteU16(reply + 4, end ? 1 : 0);
+  wire::WriteU16(reply + 6, 0);
+  wire::WriteU16(reply + 8, 0);
+  wire::WriteU16(reply + 10, 0);
+  return end ? end : wire::kHeaderSize;
+}
+
+RateLimiter::Stats RateLimiter::GetStats() const {
+  Stats stats;
+  stats.sent = sent_.load(std::memory_order_relaxed);
+  stats.slipped = slipped_.load(std::memory_order_relaxed);
+  stats.dropped = limited_.load(std::memory_order_relaxed) - stats.slipped;
+  return stats;
+}
+
+base::json::Object RateLimiter::Render() const {
+  Stats stats = GetStats();
+  std::map<std::string, base::json::JSON> result;
+  result["Sent"] = (int)stats.sent;
+  result["Slipped"] = (int)stats.slipped;
+  result["Dropped"] = (int)stats.dropped;
+  return base::json::Object(std::move(result));
+}
+
+}  // namespace homedns
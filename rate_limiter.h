@@ -0,0 +1,95 @@
+#pragma once
+
+#include <netinet/in.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+
+#include "base/json/json.h"
+
+namespace homedns {
+
+// Response rate limiting (RRL): bounds how many identical responses go to any
+// one network, so that the server can't be used to flood a spoofed victim,
+// and a single noisy client can't monopolize the loop.
+//
+// Responses are charged to a token bucket keyed on the client's /24 (or /56
+// for IPv6) and the response's identity: its question and rcode, except that
+// errors and NXDOMAINs are keyed on the rcode alone, so that a flood of random
+// names still lands in one bucket. Buckets live in a fixed size table which is
+// allocated once, and updated with atomic compare and swap, so checking a
+// response never locks or allocates, and one limiter can be shared by every
+// thread that sends. Two keys which hash to the same slot share its tokens,
+// which at worst limits them together. Slots are picked with a per-process
+// seed, so which keys collide can't be worked out ahead.
+class RateLimiter {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  struct Options {
+    // Steady state responses per second allowed for each bucket.
+    uint32_t responses_per_second = 20;
+
+    // How many responses a bucket can send in a burst. At most 16000.
+    uint32_t burst = 40;
+
+    // Every |slip|th limited response is sent as an empty truncated reply
+    // (telling a real client to retry over TCP) instead of being dropped.
+    // Zero drops every limited response.
+    uint32_t slip = 2;
+
+    // Rounded up to a power of two.
+    size_t table_size = 1 << 16;
+  };
+
+  enum class Action : uint8_t { kSend, kSlip, kDrop };
+
+  struct Stats {
+    uint64_t sent = 0;
+    uint64_t slipped = 0;
+    uint64_t dropped = 0;
+  };
+
+  RateLimiter();
+  explicit RateLimiter(Options options);
+
+  // Charges |reply| to |client|'s bucket, and says what to do with it.
+  Action Check(const struct sockaddr_in& client,
+               const uint8_t* reply,
+               size_t len,
+               Clock::time_point now = Clock::now());
+  Action Check(const struct in6_addr& client,
+               const uint8_t* reply,
+               size_t len,
+               Clock::time_point now = Clock::now());
+
+  // Cuts |reply| down to its header and question and sets TC. Returns the new
+  // length.
+  static size_t Slip(uint8_t* reply, size_t len);
+
+  Stats GetStats() const;
+  base::json::Object Render() const;
+
+ private:
+  struct Bucket {
+    // Tokens (in thousandths) in the top 24 bits, and the time they were last
+    // counted, in milliseconds since |epoch_|, in the bottom 40. Zero until
+    // the first charge.
+    std::atomic<uint64_t> state;
+  };
+
+  Action Charge(uint64_t key, Clock::time_point now);
+
+  const Options options_;
+  const Clock::time_point epoch_;
+  const uint64_t seed_;
+  const size_t mask_;
+  std::unique_ptr<Bucket[]> buckets_;
+
+  std::atomic<uint64_t> limited_ = 0;
+  std::atomic<uint64_t> sent_ = 0;
+  std::atomic<uint64_t> slipped_ = 0;
+};
+
+}  // namespace homedns
@@ -0,0 +1,257 @@
+#include "record_store.h"
+
+#include <algorithm>
+#include <map>
+#include <string>
+
+#include "wire.h"
+
+namespace homedns {
+
+#define ASSIGN_OR_ERROR(ato, expr)             \
+  do {                                         \
+    auto maybe = (expr);                       \
+    if (maybe.has_error())                     \
+      RETURN_TRACED(std::move(maybe).error()); \
+    ato = std::move(maybe).value();            \
+  } while (0)
+
+#define RETURN_ON_ERROR(expr) \
+  do {                        \
+    auto st = (expr);         \
+    if (!st.is_ok())          \
+      RETURN_TRACED(st);      \
+  } while (0)
+
+#define CAUSE_ON_ERROR(expr)                       \
+  do {                                             \
+    auto st = (expr);                              \
+    if (!st.is_ok())                               \
+      return CausedBy<PacketStatus>(               \
+          PacketStatus::Codes::kParsingError, st); \
+  } while (0)
+
+namespace {
+
+void AppendName(const DnsLabelSeq& name, std::pmr::vector<uint8_t>* out) {
+  for (const Segment* seg = name.value; seg; seg = seg->next) {
+    out->push_back(static_cast<uint8_t>(seg->segment.size()));
+    out->insert(out->end(), seg->segment.begin(), seg->segment.end());
+  }
+  out->push_back(0);
+}
+
+// Copies the RDATA of a well known type from |stream| up to |end|, expanding
+// the names in it, which may be compressed against the rest of the packet.
+PacketStatus ImportFields(std::span<const RdataField> layout,
+                          size_t end,
+                          ReadStream* stream,
+                          LabelManager* labels,
+                          std::pmr::vector<uint8_t>* out) {
+  for (const RdataField& field : layout) {
+    size_t size = field.size;
+    switch (field.kind) {
+      case RdataField::kName:
+      case RdataField::kCompressedName: {
+        DnsLabelSeq name;
+        ASSIGN_OR_ERROR(name, labels->ImportLabelSequence(stream));
+        AppendName(name, out);
+        continue;
+      }
+      case RdataField::kRest:
+        size = end - std::min(end, stream->CurrentByte());
+        break;
+      case RdataField::kFixed:
+        break;
+    }
+    if (stream->CurrentByte() + size > end)
+      return PacketStatus::Codes::kParsingError;
+    size_t offset = out->size();
+    out->resize(offset + size);
+    CAUSE_ON_ERROR(stream->NextBytes(out->data() + offset, size));
+  }
+  if (stream->CurrentByte() != end)
+    return PacketStatus::Codes::kParsingError;
+  return base::OkStatus();
+}
+
+// Writes |rdata| laid out as |layout|, compressing the names that may be.
+PacketStatus ExportFields(std::span<const RdataField> layout,
+                          std::span<const uint8_t> rdata,
+                          WriteStream* stream,
+                          LabelManager* labels) {
+  size_t i = 0;
+  for (const RdataField& field : layout) {
+    size_t end = i + field.size;
+    if (field.kind == RdataField::kRest) {
+      end = rdata.size();
+    } else if (field.kind != RdataField::kFixed &&
+               !wire::SkipName(rdata.data(), rdata.size(), &end)) {
+      return PacketStatus::Codes::kParsingError;
+    }
+    if (end > rdata.size())
+      return PacketStatus::Codes::kParsingError;
+    if (field.kind == RdataField::kCompressedName) {
+      ReadStream name_stream(end - i, const_cast<uint8_t*>(&rdata[i]));
+      DnsLabelSeq name;
+      ASSIGN_OR_ERROR(name, labels->ImportLabelSequence(&name_stream));
+      RETURN_ON_ERROR(labels->ExportLabelSeq(stream, name));
+    } else {
+      CAUSE_ON_ERROR(stream->WriteBytes(&rdata[i], end - i));
+    }
+    i = end;
+  }
+  return base::OkStatus();
+}
+
+}  // namespace
+
+RecordStore::RecordStore(std::pmr::memory_resource* memory)
+    : preambles_(memory), rdata_(memory) {}
+
+bool RecordStore::Commit(DnsLabelSeq name,
+                         uint16_t type,
+                         uint16_t klass,
+                         uint32_t ttl,
+                         size_t offset) {
+  size_t length = rdata_.size() - offset;
+  if (length > UINT16_MAX)
+    return Discard(offset);
+  preambles_.push_back({name, type, klass, ttl, static_cast<uint16_t>(length),
+                        static_cast<uint32_t>(offset)});
+  return true;
+}
+
+bool RecordStore::Discard(size_t offset) {
+  rdata_.resize(offset);
+  return false;
+}
+
+bool RecordStore::Add(DnsLabelSeq name,
+                      uint16_t type,
+                      uint16_t klass,
+                      uint32_t ttl,
+                      std::span<const uint8_t> rdata) {
+  size_t offset = rdata_.size();
+  rdata_.insert(rdata_.end(), rdata.begin(), rdata.end());
+  return Commit(name, type, klass, ttl, offset);
+}
+
+bool RecordStore::Add(DnsLabelSeq name,
+                      uint16_t type,
+                      uint16_t klass,
+                      uint32_t ttl,
+                      const DnsRecord& record) {
+  size_t offset = rdata_.size();
+  bool encoded = std::visit(
+      [this](const auto& data) { return data.Encode(&rdata_); }, record);
+  if (!encoded)
+    return Discard(offset);
+  return Commit(name, type, klass, ttl, offset);
+}
+
+PacketStatus RecordStore::Import(uint16_t count,
+                                 ReadStream* stream,
+                                 LabelManager* labels) {
+  for (uint16_t i = 0; i < count; i++) {
+    DnsRecordPreamble preamble;
+    ASSIGN_OR_ERROR(preamble.LabelSequence,
+                    labels->ImportLabelSequence(stream));
+    CAUSE_ON_ERROR(stream->Next<16>(&preamble.Type));
+    CAUSE_ON_ERROR(stream->Next<16>(&preamble.Class));
+    CAUSE_ON_ERROR(stream->Next<32>(&preamble.TTL));
+    CAUSE_ON_ERROR(stream->Next<16>(&preamble.Length));
+
+    size_t offset = rdata_.size();
+    size_t end = stream->CurrentByte() + preamble.Length;
+    if (end > stream->Size())
+      return PacketStatus::Codes::kParsingError;
+    const RecordDescriptor* type = FindRecordType(preamble.Type);
+    // UPDATE prerequisites and deletions name an RRset with class ANY or
+    // NONE and no RDATA at all, whatever its type.
+    bool empty = preamble.Length == 0 &&
+                 (preamble.Class == 254 || preamble.Class == 255);
+    if (type != nullptr && type->has_names && !empty) {
+      RETURN_ON_ERROR(
+          ImportFields(type->layout, end, stream, labels, &rdata_));
+    } else {
+      if (type != nullptr && !type->variable && !empty &&
+          preamble.Length != type->fixed_size) {
+        return PacketStatus::Codes::kParsingError;
+      }
+      rdata_.resize(offset + preamble.Length);
+      CAUSE_ON_ERROR(stream->NextBytes(&rdata_[offset], preamble.Length));
+    }
+    if (!Commit(preamble.LabelSequence, preamble.Type, preamble.Class,
+                preamble.TTL, offset)) {
+      return PacketStatus::Codes::kParsingError;
+    }
+  }
+  return base::OkStatus();
+}
+
+PacketStatus RecordStore::Export(size_t i,
+                                 WriteStream* stream,
+                                 LabelManager* labels) const {
+  const DnsRecordPreamble& preamble = preambles_[i];
+  RETURN_ON_ERROR(labels->ExportLabelSeq(stream, preamble.LabelSequence));
+  CAUSE_ON_ERROR(stream->Write<16>(preamble.Type));
+  CAUSE_ON_ERROR(stream->Write<16>(preamble.Class));
+  CAUSE_ON_ERROR(stream->Write<32>(preamble.TTL));
+
+  std::span<const uint8_t> rdata = Rdata(i);
+  const RecordDescriptor* type = FindRecordType(preamble.Type);
+  if (type == nullptr || !type->compresses || rdata.empty()) {
+    CAUSE_ON_ERROR(stream->Write<16>(preamble.Length));
+    CAUSE_ON_ERROR(stream->WriteBytes(rdata.data(), rdata.size()));
+    return base::OkStatus();
+  }
+
+  size_t length_location = stream->CurrentByte();
+  CAUSE_ON_ERROR(stream->Write<16>(0));
+  RETURN_ON_ERROR(ExportFields(type->layout, rdata, stream, labels));
+  uint16_t length = stream->CurrentByte() - length_location - 2;
+  CAUSE_ON_ERROR(stream->WriteAt<16>(length, length_location));
+  return base::OkStatus();
+}
+
+// RDATA is stored uncompressed, so its length is already an upper bound.
+size_t RecordStore::EstimateSize(size_t begin, size_t end) const {
+  size_t size = 0;
+  for (size_t i = begin; i < end; i++)
+    size += preambles_[i].LabelSequence.WireSize() + 10 + preambles_[i].Length;
+  return size;
+}
+
+size_t RecordStore::RRsetEnd(size_t i) const {
+  const DnsRecordPreamble& first = preambles_[i];
+  for (i++; i < preambles_.size(); i++) {
+    const DnsRecordPreamble& next = preambles_[i];
+    if (next.Type != first.Type || next.Class != first.Class ||
+        next.LabelSequence.value != first.LabelSequence.value) {
+      break;
+    }
+  }
+  return i;
+}
+
+base::json::Array RecordStore::Render() const {
+  std::vector<base::json::JSON> result;
+  for (size_t i = 0; i < preambles_.size(); i++) {
+    const DnsRecordPreamble& preamble = preambles_[i];
+    std::map<std::string, base::json::JSON> fields;
+    fields["Label"] = preamble.LabelSequence.Render();
+    fields["Type"] = preamble.Type;
+    fields["Class"] = preamble.Class;
+    fields["TTL"] = preamble.TTL;
+    fields["Length"] = preamble.Length;
+    const RecordDescriptor* type = FindRecordType(preamble.Type);
+    fields["Record"] =
+        type ? type->render(Rdata(i))
+             : base::json::Object(std::map<std::string, base::json::JSON>());
+    result.push_back(base::json::Object(std::move(fields)));
+  }
+  return base::json::Array(std::move(result));
+}
+
+}  // namespace homedns
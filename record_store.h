@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstdint>
+#include <memory_resource>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "base/json/json.h"
+#include "bitstream.h"
+#include "labels.h"
+#include "records.h"
+#include "status.h"
+
+namespace homedns {
+
+struct DnsRecordPreamble {
+  DnsLabelSeq LabelSequence;
+  uint16_t Type;
+  uint16_t Class;
+  uint32_t TTL;
+  uint16_t Length;
+  uint32_t Offset;  // Of the RDATA, in its RecordStore.
+};
+
+// A section's worth of resource records: an array of fixed size preambles,
+// and one buffer holding all of their RDATA back to back.
+//
+// RDATA is kept in uncompressed wire format, names included, so it doesn't
+// depend on the packet it came from. Which parts are names comes from each
+// type's RdataField layout.
+// Copying a record between stores (or out of a zone) is a memcpy, and so is
+// exporting one which has no names in it; names are only compressed against
+// the packet on the way out.
+class RecordStore {
+ public:
+  explicit RecordStore(
+      std::pmr::memory_resource* memory = std::pmr::get_default_resource());
+
+  size_t Size() const { return preambles_.size(); }
+  const DnsRecordPreamble& Preamble(size_t i) const { return preambles_[i]; }
+  std::span<const uint8_t> Rdata(size_t i) const {
+    return {rdata_.data() + preambles_[i].Offset, preambles_[i].Length};
+  }
+
+  // The record at |i| as a T, if that is what it is.
+  template <typename T>
+  std::optional<T> Get(size_t i) const {
+    if (i >= preambles_.size() || preambles_[i].Type != T::TYPE)
+      return std::nullopt;
+    return T::Decode(Rdata(i));
+  }
+
+  // Adds a record whose RDATA is already in uncompressed wire format.
+  bool Add(DnsLabelSeq name,
+           uint16_t type,
+           uint16_t klass,
+           uint32_t ttl,
+           std::span<const uint8_t> rdata);
+
+  // Adds a typed record, encoding it in place. Fails (adding nothing) if the
+  // record can't be encoded.
+  template <typename T>
+  bool Add(DnsLabelSeq name, uint16_t klass, uint32_t ttl, const T& record) {
+    size_t offset = rdata_.size();
+    if (!record.Encode(&rdata_))
+      return Discard(offset);
+    return Commit(name, T::TYPE, klass, ttl, offset);
+  }
+  bool Add(DnsLabelSeq name,
+           uint16_t type,
+           uint16_t klass,
+           uint32_t ttl,
+           const DnsRecord& record);
+
+  // Reads |count| records from |stream|, interning their names in |labels|.
+  PacketStatus Import(uint16_t count, ReadStream* stream, LabelManager* labels);
+
+  // Writes record |i| to |stream|, compressing names against |labels|.
+  PacketStatus Export(size_t i,
+                      WriteStream* stream,
+                      LabelManager* labels) const;
+
+  // An upper bound on what exporting records [begin, end) writes.
+  size_t EstimateSize(size_t begin, size_t end) const;
+
+  // Records sharing a name, type and class form an RRset, which has to be
+  // sent whole or not at all. Returns the index just past the set starting
+  // at |i|.
+  size_t RRsetEnd(size_t i) const;
+
+  base::json::Array Render() const;
+
+ private:
+  bool Commit(DnsLabelSeq name,
+              uint16_t type,
+              uint16_t klass,
+              uint32_t ttl,
+              size_t offset);
+  bool Discard(size_t offset);
+
+  std::pmr::vector<DnsRecordPreamble> preambles_;
+  std::pmr::vector<uint8_t> rdata_;
+};
+
+}  // namespace homedns
@@ -1,37 +1,93 @@
 #include "records.h"
 
-#include "packet.h"
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+
+#include "wire.h"
 
 namespace homedns {
 
-#define RETURN_ON_ERROR(expr)         \
-  do {                                \
-    auto st = (expr);                 \
-    if (!st.is_ok())                  \
-      return std::move(st).AddHere(); \
-  } while (0)
+namespace {
+
+static_assert(!kRecordDescriptors.HasDuplicates());
+
+void Append(Rdata* out, const uint8_t* bytes, size_t length) {
+  out->insert(out->end(), bytes, bytes + length);
+}
+
+void AppendU16(Rdata* out, uint16_t value) {
+  out->push_back(value >> 8);
+  out->push_back(value);
+}
 
-#define CAUSE_ON_ERROR(expr)                                  \
-  do {                                                        \
-    auto st = (expr);                                         \
-    if (!st.is_ok())                                          \
-      return PacketStatus(PacketStatus::Codes::kParsingError) \
-          .AddCause(std::move(st));                           \
-  } while (0)
+void AppendU32(Rdata* out, uint32_t value) {
+  AppendU16(out, value >> 16);
+  AppendU16(out, value);
+}
 
-PacketStatus DnsARecord::Export(WriteStream* stream,
-                                LabelManager* labels) const {
-  (void)labels;
-  for (int i = 0; i < 4; i++)
-    CAUSE_ON_ERROR(stream->Write<8>(IP[i]));
-  return base::OkStatus();
+// Decodes a record whose RDATA is just one name.
+template <typename T>
+std::optional<T> DecodeLabel(std::span<const uint8_t> rdata) {
+  T record;
+  if (DecodeName(rdata, &record.label) != rdata.size())
+    return std::nullopt;
+  return record;
 }
 
-PacketStatus DnsARecord::Import(ReadStream* stream, LabelManager* labels) {
-  (void)labels;
-  for (int i = 0; i < 4; i++)
-    CAUSE_ON_ERROR(stream->Next<8>(&IP[i]));
-  return base::OkStatus();
+template <typename T, size_t N>
+std::optional<T> DecodeFixed(std::span<const uint8_t> rdata) {
+  if (rdata.size() != N)
+    return std::nullopt;
+  T record;
+  memcpy(record.IP, rdata.data(), N);
+  return record;
+}
+
+}  // namespace
+
+bool EncodeName(std::string_view name, Rdata* out) {
+  if (!name.empty() && name.back() == '.')
+    name.remove_suffix(1);
+  if (name.size() > 253)
+    return false;
+  while (!name.empty()) {
+    size_t dot = std::min(name.find('.'), name.size());
+    if (dot == 0 || dot > 63)
+      return false;
+    out->push_back(static_cast<uint8_t>(dot));
+    Append(out, reinterpret_cast<const uint8_t*>(name.data()), dot);
+    name.remove_prefix(std::min(dot + 1, name.size()));
+  }
+  out->push_back(0);
+  return true;
+}
+
+size_t DecodeName(std::span<const uint8_t> rdata, std::string* name) {
+  name->clear();
+  size_t i = 0;
+  while (i < rdata.size()) {
+    uint8_t length = rdata[i++];
+    if (length == 0)
+      return i;
+    if (length > 63 || i + length > rdata.size())
+      return 0;
+    if (!name->empty())
+      name->push_back('.');
+    name->append(reinterpret_cast<const char*>(&rdata[i]), length);
+    i += length;
+  }
+  return 0;
+}
+
+bool DnsARecord::Encode(Rdata* out) const {
+  Append(out, IP, sizeof(IP));
+  return true;
+}
+
+// static
+std::optional<DnsARecord> DnsARecord::Decode(std::span<const uint8_t> rdata) {
+  return DecodeFixed<DnsARecord, 4>(rdata);
 }
 
 base::json::Object DnsARecord::Render() const {
@@ -43,21 +99,14 @@ base::json::Object DnsARecord::Render() const {
   return base::json::Object(std::move(result));
 }
 
-PacketStatus DnsNSRecord::Export(WriteStream* stream,
-                                 LabelManager* labels) const {
-  auto m_seq = labels->GetLabelSeq(label);
-  if (m_seq.has_error())
-    return std::move(m_seq).error();
-  auto seq = std::move(m_seq).value();
-  return labels->ExportLabelSeq(stream, seq.get());
+bool DnsNSRecord::Encode(Rdata* out) const {
+  return EncodeName(label, out);
 }
 
-PacketStatus DnsNSRecord::Import(ReadStream* stream, LabelManager* labels) {
-  auto m_seq = labels->ImportLabelSequence(stream);
-  if (m_seq.has_error())
-    return std::move(m_seq).error();
-  label = std::move(m_seq).value()->Render();
-  return base::OkStatus();
+// static
+std::optional<DnsNSRecord> DnsNSRecord::Decode(
+    std::span<const uint8_t> rdata) {
+  return DecodeLabel<DnsNSRecord>(rdata);
 }
 
 base::json::Object DnsNSRecord::Render() const {
@@ -66,21 +115,14 @@ base::json::Object DnsNSRecord::Render() const {
   return base::json::Object(std::move(result));
 }
 
-PacketStatus DnsCNAMERecord::Export(WriteStream* stream,
-                                    LabelManager* labels) const {
-  auto m_seq = labels->GetLabelSeq(label);
-  if (m_seq.has_error())
-    return std::move(m_seq).error();
-  auto seq = std::move(m_seq).value();
-  return labels->ExportLabelSeq(stream, seq.get());
+bool DnsCNAMERecord::Encode(Rdata* out) const {
+  return EncodeName(label, out);
 }
 
-PacketStatus DnsCNAMERecord::Import(ReadStream* stream, LabelManager* labels) {
-  auto m_seq = labels->ImportLabelSequence(stream);
-  if (m_seq.has_error())
-    return std::move(m_seq).error();
-  label = std::move(m_seq).value()->Render();
-  return base::OkStatus();
+// static
+std::optional<DnsCNAMERecord> DnsCNAMERecord::Decode(
+    std::span<const uint8_t> rdata) {
+  return DecodeLabel<DnsCNAMERecord>(rdata);
 }
 
 base::json::Object DnsCNAMERecord::Render() const {
@@ -89,19 +131,15 @@ base::json::Object DnsCNAMERecord::Render() const {
   return base::json::Object(std::move(result));
 }
 
-PacketStatus DnsAAAARecord::Export(WriteStream* stream,
-                                   LabelManager* labels) const {
-  (void)labels;
-  for (int i = 0; i < 16; i++)
-    CAUSE_ON_ERROR(stream->Write<8>(IP[i]));
-  return base::OkStatus();
+bool DnsAAAARecord::Encode(Rdata* out) const {
+  Append(out, IP, sizeof(IP));
+  return true;
 }
 
-PacketStatus DnsAAAARecord::Import(ReadStream* stream, LabelManager* labels) {
-  (void)labels;
-  for (int i = 0; i < 16; i++)
-    CAUSE_ON_ERROR(stream->Next<8>(&IP[i]));
-  return base::OkStatus();
+// static
+std::optional<DnsAAAARecord> DnsAAAARecord::Decode(
+    std::span<const uint8_t> rdata) {
+  return DecodeFixed<DnsAAAARecord, 16>(rdata);
 }
 
 base::json::Object DnsAAAARecord::Render() const {
@@ -120,40 +158,261 @@ base::json::Object DnsAAAARecord::Render() const {
   return base::json::Object(std::move(result));
 }
 
-PacketStatus DnsMXRecord::Export(WriteStream* stream,
-                                 LabelManager* labels) const {
-  CAUSE_ON_ERROR(stream->Write<8>(priority[0]));
-  CAUSE_ON_ERROR(stream->Write<8>(priority[1]));
-  auto m_seq = labels->GetLabelSeq(label);
-  if (m_seq.has_error())
-    return std::move(m_seq).error();
-  auto seq = std::move(m_seq).value();
-  return labels->ExportLabelSeq(stream, seq.get());
+bool DnsMXRecord::Encode(Rdata* out) const {
+  Append(out, priority, sizeof(priority));
+  return EncodeName(label, out);
 }
 
-PacketStatus DnsMXRecord::Import(ReadStream* stream, LabelManager* labels) {
-  CAUSE_ON_ERROR(stream->Next<8>(&priority[0]));
-  CAUSE_ON_ERROR(stream->Next<8>(&priority[1]));
-  auto m_seq = labels->ImportLabelSequence(stream);
-  if (m_seq.has_error())
-    return std::move(m_seq).error();
-  label = std::move(m_seq).value()->Render();
-  return base::OkStatus();
+// static
+std::optional<DnsMXRecord> DnsMXRecord::Decode(
+    std::span<const uint8_t> rdata) {
+  DnsMXRecord record;
+  if (rdata.size() < 2 ||
+      DecodeName(rdata.subspan(2), &record.label) != rdata.size() - 2) {
+    return std::nullopt;
+  }
+  memcpy(record.priority, rdata.data(), 2);
+  return record;
 }
 
 base::json::Object DnsMXRecord::Render() const {
   std::map<std::string, base::json::JSON> result;
-  result["Priority"] = "TODO: serialize";
+  result["Priority"] = static_cast<uint16_t>((priority[0] << 8) | priority[1]);
   result["Label"] = label;
   return base::json::Object(std::move(result));
 }
 
-PacketStatus DnsUnknownRecord::Export(WriteStream* stream,
-                                      LabelManager* labels) const {
-  (void)labels;
-  for (const uint8_t byte : data)
-    CAUSE_ON_ERROR(stream->Write<8>(byte));
-  return base::OkStatus();
+bool DnsSOARecord::Encode(Rdata* out) const {
+  if (!EncodeName(mname, out) || !EncodeName(rname, out))
+    return false;
+  for (uint32_t value : {serial, refresh, retry, expire, minimum})
+    AppendU32(out, value);
+  return true;
+}
+
+// static
+std::optional<DnsSOARecord> DnsSOARecord::Decode(
+    std::span<const uint8_t> rdata) {
+  DnsSOARecord record;
+  size_t mname = DecodeName(rdata, &record.mname);
+  if (mname == 0)
+    return std::nullopt;
+  size_t rname = DecodeName(rdata.subspan(mname), &record.rname);
+  if (rname == 0 || rdata.size() != mname + rname + 20)
+    return std::nullopt;
+  const uint8_t* numbers = rdata.data() + mname + rname;
+  record.serial = wire::ReadU32(numbers);
+  record.refresh = wire::ReadU32(numbers + 4);
+  record.retry = wire::ReadU32(numbers + 8);
+  record.expire = wire::ReadU32(numbers + 12);
+  record.minimum = wire::ReadU32(numbers + 16);
+  return record;
+}
+
+base::json::Object DnsSOARecord::Render() const {
+  std::map<std::string, base::json::JSON> result;
+  result["MName"] = mname;
+  result["RName"] = rname;
+  result["Serial"] = serial;
+  result["Refresh"] = refresh;
+  result["Retry"] = retry;
+  result["Expire"] = expire;
+  result["Minimum"] = minimum;
+  return base::json::Object(std::move(result));
+}
+
+bool DnsPTRRecord::Encode(Rdata* out) const {
+  return EncodeName(label, out);
+}
+
+// static
+std::optional<DnsPTRRecord> DnsPTRRecord::Decode(
+    std::span<const uint8_t> rdata) {
+  return DecodeLabel<DnsPTRRecord>(rdata);
+}
+
+base::json::Object DnsPTRRecord::Render() const {
+  std::map<std::string, base::json::JSON> result;
+  result["Name"] = label;
+  return base::json::Object(std::move(result));
+}
+
+bool DnsTXTRecord::Encode(Rdata* out) const {
+  // There has to be at least one string, even if it's empty.
+  if (strings.empty()) {
+    out->push_back(0);
+    return true;
+  }
+  for (const std::string& text : strings) {
+    if (text.size() > 255)
+      return false;
+    out->push_back(static_cast<uint8_t>(text.size()));
+    Append(out, reinterpret_cast<const uint8_t*>(text.data()), text.size());
+  }
+  return true;
+}
+
+// static
+std::optional<DnsTXTRecord> DnsTXTRecord::Decode(
+    std::span<const uint8_t> rdata) {
+  DnsTXTRecord record;
+  size_t i = 0;
+  while (i < rdata.size()) {
+    uint8_t length = rdata[i++];
+    if (i + length > rdata.size())
+      return std::nullopt;
+    record.strings.emplace_back(reinterpret_cast<const char*>(&rdata[i]),
+                                length);
+    i += length;
+  }
+  if (record.strings.empty())
+    return std::nullopt;
+  return record;
+}
+
+base::json::Object DnsTXTRecord::Render() const {
+  std::vector<base::json::JSON> texts;
+  for (const std::string& text : strings)
+    texts.push_back(text);
+  std::map<std::string, base::json::JSON> result;
+  result["Strings"] = base::json::Array(std::move(texts));
+  return base::json::Object(std::move(result));
+}
+
+bool DnsRPRecord::Encode(Rdata* out) const {
+  return EncodeName(mailbox, out) && EncodeName(text, out);
+}
+
+// static
+std::optional<DnsRPRecord> DnsRPRecord::Decode(std::span<const uint8_t> rdata) {
+  DnsRPRecord record;
+  size_t mailbox = DecodeName(rdata, &record.mailbox);
+  if (mailbox == 0 ||
+      DecodeName(rdata.subspan(mailbox), &record.text) !=
+          rdata.size() - mailbox) {
+    return std::nullopt;
+  }
+  return record;
+}
+
+base::json::Object DnsRPRecord::Render() const {
+  std::map<std::string, base::json::JSON> result;
+  result["Mailbox"] = mailbox;
+  result["Text"] = text;
+  return base::json::Object(std::move(result));
+}
+
+bool DnsLOCRecord::Encode(Rdata* out) const {
+  for (uint8_t value :
+       {version, size, horizontal_precision, vertical_precision}) {
+    out->push_back(value);
+  }
+  for (uint32_t value : {latitude, longitude, altitude})
+    AppendU32(out, value);
+  return true;
+}
+
+// static
+std::optional<DnsLOCRecord> DnsLOCRecord::Decode(
+    std::span<const uint8_t> rdata) {
+  // Only version 0 is defined, and its size is fixed.
+  if (rdata.size() != 16 || rdata[0] != 0)
+    return std::nullopt;
+  DnsLOCRecord record;
+  record.version = rdata[0];
+  record.size = rdata[1];
+  record.horizontal_precision = rdata[2];
+  record.vertical_precision = rdata[3];
+  record.latitude = wire::ReadU32(&rdata[4]);
+  record.longitude = wire::ReadU32(&rdata[8]);
+  record.altitude = wire::ReadU32(&rdata[12]);
+  return record;
+}
+
+base::json::Object DnsLOCRecord::Render() const {
+  std::map<std::string, base::json::JSON> result;
+  result["Size"] = (int)size;
+  result["Horizontal Precision"] = (int)horizontal_precision;
+  result["Vertical Precision"] = (int)vertical_precision;
+  result["Latitude"] = latitude;
+  result["Longitude"] = longitude;
+  result["Altitude"] = altitude;
+  return base::json::Object(std::move(result));
+}
+
+bool DnsSRVRecord::Encode(Rdata* out) const {
+  AppendU16(out, priority);
+  AppendU16(out, weight);
+  AppendU16(out, port);
+  return EncodeName(target, out);
+}
+
+// static
+std::optional<DnsSRVRecord> DnsSRVRecord::Decode(
+    std::span<const uint8_t> rdata) {
+  DnsSRVRecord record;
+  if (rdata.size() < 6 ||
+      DecodeName(rdata.subspan(6), &record.target) != rdata.size() - 6) {
+    return std::nullopt;
+  }
+  record.priority = wire::ReadU16(&rdata[0]);
+  record.weight = wire::ReadU16(&rdata[2]);
+  record.port = wire::ReadU16(&rdata[4]);
+  return record;
+}
+
+base::json::Object DnsSRVRecord::Render() const {
+  std::map<std::string, base::json::JSON> result;
+  result["Priority"] = priority;
+  result["Weight"] = weight;
+  result["Port"] = port;
+  result["Target"] = target;
+  return base::json::Object(std::move(result));
+}
+
+bool DnsOPTRecord::Encode(Rdata* out) const {
+  for (const Option& option : options) {
+    if (option.data.size() > UINT16_MAX)
+      return false;
+    AppendU16(out, option.code);
+    AppendU16(out, option.data.size());
+    Append(out, option.data.data(), option.data.size());
+  }
+  return true;
+}
+
+// static
+std::optional<DnsOPTRecord> DnsOPTRecord::Decode(
+    std::span<const uint8_t> rdata) {
+  DnsOPTRecord record;
+  size_t i = 0;
+  while (i < rdata.size()) {
+    if (i + 4 > rdata.size())
+      return std::nullopt;
+    uint16_t code = wire::ReadU16(&rdata[i]);
+    uint16_t length = wire::ReadU16(&rdata[i + 2]);
+    i += 4;
+    if (i + length > rdata.size())
+      return std::nullopt;
+    record.options.push_back(
+        {code, std::vector<uint8_t>(&rdata[i], &rdata[i] + length)});
+    i += length;
+  }
+  return record;
+}
+
+base::json::Object DnsOPTRecord::Render() const {
+  std::vector<base::json::JSON> codes;
+  for (const Option& option : options)
+    codes.push_back(option.code);
+  std::map<std::string, base::json::JSON> result;
+  result["Options"] = base::json::Array(std::move(codes));
+  return base::json::Object(std::move(result));
+}
+
+bool DnsUnknownRecord::Encode(Rdata* out) const {
+  Append(out, data.data(), data.size());
+  return true;
 }
 
-}  // namespace homedns
\ No newline at end of file
+}  // namespace homedns
@@ -1,6 +1,16 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <map>
+#include <memory_resource>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
 #include <variant>
+#include <vector>
 
 #include "base/json/json.h"
 
@@ -12,18 +22,48 @@ namespace homedns {
 
 class DnsPacket;
 
+// Uncompressed wire format RDATA, as kept in a RecordStore.
+using Rdata = std::pmr::vector<uint8_t>;
+
+// Appends |name| ("www.example.com", with or without the trailing dot) to
+// |out| as uncompressed wire format labels. Fails on empty or long labels.
+bool EncodeName(std::string_view name, Rdata* out);
+
+// Reads an uncompressed wire format name from the front of |rdata| in dotted
+// form. Returns how many bytes it took, or zero if it isn't a valid name.
+size_t DecodeName(std::span<const uint8_t> rdata, std::string* name);
+
+// One piece of a record type's RDATA, as far as moving it on and off the wire
+// is concerned. Only names need any work: they may arrive compressed, and
+// some of them may be compressed again on the way out.
+struct RdataField {
+  enum Kind : uint8_t {
+    kFixed,           // |size| opaque bytes.
+    kName,            // A name that is never compressed when sent.
+    kCompressedName,  // A name that may be (RFC 3597 section 4).
+    kRest,            // Opaque bytes up to the end of the RDATA.
+  };
+  Kind kind;
+  uint8_t size = 0;
+};
+
+// Each record type converts between its fields and its RDATA: Encode appends
+// the RDATA to |out|, and Decode parses the whole of |rdata|. LAYOUT is what
+// RecordStore uses to import and export the RDATA without decoding it.
 struct DnsARecord {
   static constexpr uint16_t TYPE = 1;
-  PacketStatus Import(ReadStream* stream, LabelManager* labels);
-  PacketStatus Export(WriteStream* stream, LabelManager* labels) const;
+  static constexpr RdataField LAYOUT[] = {{RdataField::kFixed, 4}};
+  bool Encode(Rdata* out) const;
+  static std::optional<DnsARecord> Decode(std::span<const uint8_t> rdata);
   base::json::Object Render() const;
   uint8_t IP[4];
 };
 
 struct DnsNSRecord {
   static constexpr uint16_t TYPE = 2;
-  PacketStatus Import(ReadStream* stream, LabelManager* labels);
-  PacketStatus Export(WriteStream* stream, LabelManager* labels) const;
+  static constexpr RdataField LAYOUT[] = {{RdataField::kCompressedName}};
+  bool Encode(Rdata* out) const;
+  static std::optional<DnsNSRecord> Decode(std::span<const uint8_t> rdata);
   base::json::Object Render() const;
 
   std::string label;
@@ -31,8 +71,37 @@ struct DnsNSRecord {
 
 struct DnsCNAMERecord {
   static constexpr uint16_t TYPE = 5;
-  PacketStatus Import(ReadStream* stream, LabelManager* labels);
-  PacketStatus Export(WriteStream* stream, LabelManager* labels) const;
+  static constexpr RdataField LAYOUT[] = {{RdataField::kCompressedName}};
+  bool Encode(Rdata* out) const;
+  static std::optional<DnsCNAMERecord> Decode(std::span<const uint8_t> rdata);
+  base::json::Object Render() const;
+
+  std::string label;
+};
+
+struct DnsSOARecord {
+  static constexpr uint16_t TYPE = 6;
+  static constexpr RdataField LAYOUT[] = {{RdataField::kCompressedName},
+                                          {RdataField::kCompressedName},
+                                          {RdataField::kFixed, 20}};
+  bool Encode(Rdata* out) const;
+  static std::optional<DnsSOARecord> Decode(std::span<const uint8_t> rdata);
+  base::json::Object Render() const;
+
+  std::string mname;  // The primary server.
+  std::string rname;  // The admin's mailbox, with the @ as a dot.
+  uint32_t serial;
+  uint32_t refresh;
+  uint32_t retry;
+  uint32_t expire;
+  uint32_t minimum;  // The TTL for negative answers (RFC 2308).
+};
+
+struct DnsPTRRecord {
+  static constexpr uint16_t TYPE = 12;
+  static constexpr RdataField LAYOUT[] = {{RdataField::kCompressedName}};
+  bool Encode(Rdata* out) const;
+  static std::optional<DnsPTRRecord> Decode(std::span<const uint8_t> rdata);
   base::json::Object Render() const;
 
   std::string label;
@@ -40,71 +109,230 @@ struct DnsCNAMERecord {
 
 struct DnsMXRecord {
   static constexpr uint16_t TYPE = 15;
-  PacketStatus Import(ReadStream* stream, LabelManager* labels);
-  PacketStatus Export(WriteStream* stream, LabelManager* labels) const;
+  static constexpr RdataField LAYOUT[] = {{RdataField::kFixed, 2},
+                                          {RdataField::kCompressedName}};
+  bool Encode(Rdata* out) const;
+  static std::optional<DnsMXRecord> Decode(std::span<const uint8_t> rdata);
   base::json::Object Render() const;
 
   uint8_t priority[2];
   std::string label;
 };
 
+struct DnsTXTRecord {
+  static constexpr uint16_t TYPE = 16;
+  static constexpr RdataField LAYOUT[] = {{RdataField::kRest}};
+  bool Encode(Rdata* out) const;
+  static std::optional<DnsTXTRecord> Decode(std::span<const uint8_t> rdata);
+  base::json::Object Render() const;
+
+  // Each at most 255 bytes.
+  std::vector<std::string> strings;
+};
+
+struct DnsRPRecord {
+  static constexpr uint16_t TYPE = 17;
+  static constexpr RdataField LAYOUT[] = {{RdataField::kName},
+                                          {RdataField::kName}};
+  bool Encode(Rdata* out) const;
+  static std::optional<DnsRPRecord> Decode(std::span<const uint8_t> rdata);
+  base::json::Object Render() const;
+
+  std::string mailbox;
+  std::string text;  // Where to find a TXT record with more, or ".".
+};
+
 struct DnsAAAARecord {
   static constexpr uint16_t TYPE = 28;
-  PacketStatus Import(ReadStream* stream, LabelManager* labels);
-  PacketStatus Export(WriteStream* stream, LabelManager* labels) const;
+  static constexpr RdataField LAYOUT[] = {{RdataField::kFixed, 16}};
+  bool Encode(Rdata* out) const;
+  static std::optional<DnsAAAARecord> Decode(std::span<const uint8_t> rdata);
   base::json::Object Render() const;
 
   uint8_t IP[16];
 };
 
+// RFC 1876. Sizes and precisions are in centimeters as a digit and a power of
+// ten in each nibble; latitude and longitude in thousandths of an arcsecond
+// offset by 2^31, and altitude in centimeters above 100km below the WGS 84
+// spheroid.
 struct DnsLOCRecord {
   static constexpr uint16_t TYPE = 29;
-  PacketStatus Import(ReadStream* stream, LabelManager* labels);
-  PacketStatus Export(WriteStream* stream, LabelManager* labels) const;
+  static constexpr RdataField LAYOUT[] = {{RdataField::kFixed, 16}};
+  bool Encode(Rdata* out) const;
+  static std::optional<DnsLOCRecord> Decode(std::span<const uint8_t> rdata);
   base::json::Object Render() const;
 
-  // TODO: what goes here?
-  int foo;
+  uint8_t version;
+  uint8_t size;
+  uint8_t horizontal_precision;
+  uint8_t vertical_precision;
+  uint32_t latitude;
+  uint32_t longitude;
+  uint32_t altitude;
 };
 
-struct DnsRPRecord {
-  static constexpr uint16_t TYPE = 17;
-  PacketStatus Import(ReadStream* stream, LabelManager* labels);
-  PacketStatus Export(WriteStream* stream, LabelManager* labels) const;
+struct DnsSRVRecord {
+  static constexpr uint16_t TYPE = 33;
+  static constexpr RdataField LAYOUT[] = {{RdataField::kFixed, 6},
+                                          {RdataField::kName}};
+  bool Encode(Rdata* out) const;
+  static std::optional<DnsSRVRecord> Decode(std::span<const uint8_t> rdata);
   base::json::Object Render() const;
 
-  std::string email;
+  uint16_t priority;
+  uint16_t weight;
+  uint16_t port;
+  std::string target;
 };
 
-struct DnsSOARecord {
-  static constexpr uint16_t TYPE = 6;
-  PacketStatus Import(ReadStream* stream, LabelManager* labels);
-  PacketStatus Export(WriteStream* stream, LabelManager* labels) const;
+// The EDNS pseudo-record (RFC 6891). Its class is the requester's UDP payload
+// size and its TTL the extended rcode and flags, so only the options are
+// here.
+struct DnsOPTRecord {
+  static constexpr uint16_t TYPE = 41;
+  static constexpr RdataField LAYOUT[] = {{RdataField::kRest}};
+  bool Encode(Rdata* out) const;
+  static std::optional<DnsOPTRecord> Decode(std::span<const uint8_t> rdata);
   base::json::Object Render() const;
 
-  std::string email;
+  struct Option {
+    uint16_t code;
+    std::vector<uint8_t> data;
+  };
+  std::vector<Option> options;
 };
 
-struct DnsTXTRecord {
-  static constexpr uint16_t TYPE = 16;
-  PacketStatus Import(ReadStream* stream, LabelManager* labels);
-  PacketStatus Export(WriteStream* stream, LabelManager* labels) const;
+struct DnsUnknownRecord {
+  std::vector<uint8_t> data;
+  bool Encode(Rdata* out) const;
   base::json::Object Render() const;
+};
 
-  std::string email;
+template <typename... Ts>
+struct RecordTypeList {
+  template <template <typename...> typename F, typename... Extra>
+  using Apply = F<Ts..., Extra...>;
 };
 
-struct DnsUnknownRecord {
-  std::vector<uint8_t> data;
-  PacketStatus Export(WriteStream* stream, LabelManager* labels) const;
-  base::json::Object Render() const;
+// Every record type with wire support. Everything that dispatches on a type
+// code is generated from this list, so a new type only needs its struct
+// added here.
+using KnownRecordTypes = RecordTypeList<DnsARecord,
+                                        DnsNSRecord,
+                                        DnsCNAMERecord,
+                                        DnsSOARecord,
+                                        DnsPTRRecord,
+                                        DnsMXRecord,
+                                        DnsTXTRecord,
+                                        DnsRPRecord,
+                                        DnsAAAARecord,
+                                        DnsLOCRecord,
+                                        DnsSRVRecord,
+                                        DnsOPTRecord>;
+
+using DnsRecord = KnownRecordTypes::Apply<std::variant, DnsUnknownRecord>;
+
+// A dispatch table from type code to |V|. Type codes run up to 65535 (CAA is
+// 257), so only the known types are kept, sorted by code, and looked up with
+// a binary search; anything else gets the fallback.
+template <typename V, size_t N>
+class RecordTable {
+ public:
+  struct Entry {
+    uint16_t type;
+    V value;
+  };
+
+  constexpr RecordTable(std::array<Entry, N> entries, V fallback)
+      : entries_(entries), fallback_(fallback) {
+    std::sort(entries_.begin(), entries_.end(), ByType);
+  }
+
+  constexpr V Find(uint16_t type) const {
+    auto it = std::lower_bound(entries_.begin(), entries_.end(),
+                               Entry{type, fallback_}, ByType);
+    return it != entries_.end() && it->type == type ? it->value : fallback_;
+  }
+
+  // Two types with the same code would quietly shadow one another.
+  constexpr bool HasDuplicates() const {
+    return std::adjacent_find(entries_.begin(), entries_.end(),
+                              [](const Entry& a, const Entry& b) {
+                                return a.type == b.type;
+                              }) != entries_.end();
+  }
+
+ private:
+  static constexpr bool ByType(const Entry& a, const Entry& b) {
+    return a.type < b.type;
+  }
+
+  std::array<Entry, N> entries_;
+  V fallback_;
 };
 
-using DnsRecord = std::variant<DnsARecord,
-                               DnsNSRecord,
-                               DnsCNAMERecord,
-                               DnsMXRecord,
-                               DnsAAAARecord,
-                               DnsUnknownRecord>;
+// Builds a table with make.template operator()<T>() for each known type T,
+// and |fallback| for everything else.
+template <typename V, typename F, typename... Ts>
+constexpr RecordTable<V, sizeof...(Ts)> MakeRecordTable(RecordTypeList<Ts...>,
+                                                        V fallback,
+                                                        F make) {
+  using Entry = typename RecordTable<V, sizeof...(Ts)>::Entry;
+  return RecordTable<V, sizeof...(Ts)>(
+      {Entry{Ts::TYPE, make.template operator()<Ts>()}...}, fallback);
+}
+
+template <typename V, typename F>
+constexpr auto MakeRecordTable(V fallback, F make) {
+  return MakeRecordTable(KnownRecordTypes{}, fallback, make);
+}
+
+// What the code that doesn't care about a type's fields needs to know about
+// it.
+struct RecordDescriptor {
+  uint16_t type;
+  std::span<const RdataField> layout;
+  bool has_names;     // So importing has to expand them.
+  bool compresses;    // So exporting has to look at them.
+  size_t fixed_size;  // Of the RDATA, unless |variable| is set.
+  bool variable;
+  base::json::Object (*render)(std::span<const uint8_t> rdata);
+};
+
+template <typename T>
+base::json::Object RenderRdata(std::span<const uint8_t> rdata) {
+  std::optional<T> record = T::Decode(rdata);
+  if (!record.has_value())
+    return base::json::Object(std::map<std::string, base::json::JSON>());
+  return record->Render();
+}
+
+template <typename T>
+constexpr RecordDescriptor DescribeRecord() {
+  RecordDescriptor d{T::TYPE, T::LAYOUT, false, false, 0, false,
+                     &RenderRdata<T>};
+  for (const RdataField& field : T::LAYOUT) {
+    d.has_names |= field.kind == RdataField::kName ||
+                   field.kind == RdataField::kCompressedName;
+    d.compresses |= field.kind == RdataField::kCompressedName;
+    d.variable |= field.kind != RdataField::kFixed;
+    d.fixed_size += field.size;
+  }
+  return d;
+}
+
+template <typename T>
+inline constexpr RecordDescriptor kRecordDescriptor = DescribeRecord<T>();
+
+inline constexpr auto kRecordDescriptors =
+    MakeRecordTable<const RecordDescriptor*>(
+        nullptr,
+        []<typename T>() { return &kRecordDescriptor<T>; });
+
+// Null for types without wire support, whose RDATA is passed along as is.
+inline const RecordDescriptor* FindRecordType(uint16_t type) {
+  return kRecordDescriptors.Find(type);
+}
 
-}  // namespace homedns
\ No newline at end of file
+}  // namespace homedns
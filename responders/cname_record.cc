@@ -1,6 +1,9 @@
 
 #include "responders.h"
 
+#include <algorithm>
+#include <cctype>
+
 namespace homedns {
 
 PacketStatus::Or<DnsPacket> ReplyCNAMERecord(const DnsQuestion* question,
@@ -8,4 +11,79 @@ PacketStatus::Or<DnsPacket> ReplyCNAMERecord(const DnsQuestion* question,
   return PacketStatus::Codes::kInvalidRecordType;
 }
 
+namespace {
+
+// An upstream reply's alias chains are only ever this long.
+constexpr int kMaxChain = 8;
+
+bool SameName(std::string_view a, std::string_view b) {
+  if (!a.empty() && a.back() == '.')
+    a.remove_suffix(1);
+  if (!b.empty() && b.back() == '.')
+    b.remove_suffix(1);
+  return a.size() == b.size() &&
+         std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+           return std::tolower(static_cast<unsigned char>(x)) ==
+                  std::tolower(static_cast<unsigned char>(y));
+         });
+}
+
+}  // namespace
+
+AsyncResponse FollowCNAMERecord(const ResponderContext* context,
+                                DnsPacket response) {
+  std::optional<std::string> target = AliasTarget(response);
+  std::optional<const DnsQuestion*> question = response.GetQuestion(0);
+  if (!target.has_value() || !question.has_value() ||
+      (*question)->Type == DnsCNAMERecord::TYPE) {
+    co_return std::move(response);
+  }
+  uint16_t type = (*question)->Type;
+  uint16_t klass = (*question)->Class;
+  CacheKey key = CacheKey::Create(*target, type, klass);
+
+  std::vector<uint8_t> reply = co_await AskUpstream(context, key);
+  ReadStream stream(reply.size(), reply.data());
+  auto m_upstream = DnsPacket::Import(&stream);
+  if (!m_upstream.has_value())
+    co_return std::move(response);
+  DnsPacket upstream = std::move(m_upstream).value();
+  if (upstream.GetPacketHeader().RC != 0)
+    co_return std::move(response);
+
+  // Only what is on the chain from the target is taken, one alias at a time,
+  // so that upstream can't slip records for other names into the answer.
+  const RecordStore& answers = upstream.GetAnswers();
+  std::string owner = *target;
+  for (int hop = 0; hop < kMaxChain; hop++) {
+    std::optional<std::string> next;
+    for (size_t i = 0; i < answers.Size(); i++) {
+      const DnsRecordPreamble& preamble = answers.Preamble(i);
+      if (preamble.Class != klass ||
+          !SameName(preamble.LabelSequence.Render(), owner)) {
+        continue;
+      }
+      if (preamble.Type == DnsCNAMERecord::TYPE && !next.has_value()) {
+        std::optional<DnsCNAMERecord> alias = answers.Get<DnsCNAMERecord>(i);
+        if (!alias.has_value())
+          continue;
+        next = std::move(alias->label);
+      } else if (preamble.Type != type) {
+        continue;
+      }
+      auto added =
+          std::move(response).AddRecordData<DnsPacket::RecordType::kAnswer>(
+              preamble.LabelSequence.Render(), preamble.Type, preamble.Class,
+              preamble.TTL, answers.Rdata(i));
+      if (!added.has_value())
+        co_return std::move(added).error();
+      response = std::move(added).value();
+    }
+    if (!next.has_value())
+      break;
+    owner = std::move(*next);
+  }
+  co_return std::move(response);
+}
+
 }  // namespace homedns
\ No newline at end of file
@@ -0,0 +1,97 @@
+#include "responders.h"
+
+namespace homedns {
+
+namespace {
+
+template <typename T>
+constexpr Responder kResponder = ReplyUnknownRecord;
+template <>
+constexpr Responder kResponder<DnsARecord> = ReplyARecord;
+template <>
+constexpr Responder kResponder<DnsNSRecord> = ReplyNSRecord;
+template <>
+constexpr Responder kResponder<DnsCNAMERecord> = ReplyCNAMERecord;
+template <>
+constexpr Responder kResponder<DnsSOARecord> = ReplySOARecord;
+template <>
+constexpr Responder kResponder<DnsMXRecord> = ReplyMXRecord;
+template <>
+constexpr Responder kResponder<DnsTXTRecord> = ReplyTXTRecord;
+template <>
+constexpr Responder kResponder<DnsRPRecord> = ReplyRPRecord;
+template <>
+constexpr Responder kResponder<DnsAAAARecord> = ReplyAAAARecord;
+template <>
+constexpr Responder kResponder<DnsLOCRecord> = ReplyLOCRecord;
+
+constexpr auto kResponders = MakeRecordTable<Responder>(
+    ReplyUnknownRecord,
+    []<typename T>() { return kResponder<T>; });
+
+// Types whose answers have to be waited for get a specialization here. A
+// local alias to a name elsewhere is followed for the address types, which
+// are what stub resolvers expect the whole chain of.
+template <typename T>
+constexpr AsyncResponder kAsyncResponder = nullptr;
+template <>
+constexpr AsyncResponder kAsyncResponder<DnsARecord> = FollowCNAMERecord;
+template <>
+constexpr AsyncResponder kAsyncResponder<DnsAAAARecord> = FollowCNAMERecord;
+
+constexpr auto kAsyncResponders = MakeRecordTable<AsyncResponder>(
+    nullptr,
+    []<typename T>() { return kAsyncResponder<T>; });
+
+void StartUpstream(const ResponderContext* context,
+                   CacheKey key,
+                   base::RepeatingCallback<void(std::vector<uint8_t>)> done) {
+  context->ask_upstream.Run(key, std::move(done));
+}
+
+void StartSleep(const ResponderContext* context,
+                std::chrono::milliseconds delay,
+                base::RepeatingCallback<void()> done) {
+  context->run_after.Run(delay, std::move(done));
+}
+
+}  // namespace
+
+PacketStatus::Or<DnsPacket> ReplyUnknownRecord(const DnsQuestion* question,
+                                               DnsPacket&& response) {
+  return PacketStatus::Codes::kInvalidRecordType;
+}
+
+Responder FindResponder(uint16_t type) {
+  return kResponders.Find(type);
+}
+
+AsyncResponder FindAsyncResponder(uint16_t type) {
+  return kAsyncResponders.Find(type);
+}
+
+std::optional<std::string> AliasTarget(const DnsPacket& response) {
+  const RecordStore& answers = response.GetAnswers();
+  if (answers.Size() == 0)
+    return std::nullopt;
+  std::optional<DnsCNAMERecord> alias =
+      answers.Get<DnsCNAMERecord>(answers.Size() - 1);
+  if (!alias.has_value())
+    return std::nullopt;
+  return std::move(alias->label);
+}
+
+CallbackAwaiter<std::vector<uint8_t>> AskUpstream(
+    const ResponderContext* context,
+    const CacheKey& key) {
+  return CallbackAwaiter<std::vector<uint8_t>>(
+      base::BindRepeating(&StartUpstream, context, key));
+}
+
+CallbackAwaiter<void> Sleep(const ResponderContext* context,
+                            std::chrono::milliseconds delay) {
+  return CallbackAwaiter<void>(
+      base::BindRepeating(&StartSleep, context, delay));
+}
+
+}  // namespace homedns
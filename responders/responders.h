@@ -1,8 +1,18 @@
 #pragma once
 
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "base/bind/bind.h"
+
+#include "../answer_cache.h"
 #include "../packet.h"
 #include "../records.h"
 #include "../status.h"
+#include "../task.h"
 
 namespace homedns {
 
@@ -27,4 +37,55 @@ PacketStatus::Or<DnsPacket> ReplyTXTRecord(const DnsQuestion* question,
 PacketStatus::Or<DnsPacket> ReplyUnknownRecord(const DnsQuestion* question,
                                                DnsPacket&& response);
 
+using Responder = PacketStatus::Or<DnsPacket> (*)(const DnsQuestion* question,
+                                                  DnsPacket&& response);
+
+// The responder for |type|, which is ReplyUnknownRecord for anything without
+// one of its own.
+Responder FindResponder(uint16_t type);
+
+// What an asynchronous responder can wait on, as wired up by the server.
+struct ResponderContext {
+  // Starts an upstream query, calling back with the reply, or with nothing
+  // if there is none.
+  base::RepeatingCallback<void(const CacheKey&,
+                               base::RepeatingCallback<void(
+                                   std::vector<uint8_t>)>)>
+      ask_upstream;
+  // Calls back on the loop after a delay.
+  base::RepeatingCallback<void(std::chrono::milliseconds,
+                               base::RepeatingCallback<void()>)>
+      run_after;
+};
+
+// A responder that may have to wait for the rest of its answer, without
+// holding up the loop while it does. It owns |response|, which holds the
+// question and whatever could be answered locally, so nothing it uses goes
+// away while it is suspended; the server sends whatever it co_returns once it
+// finishes.
+using AsyncResponse = Task<PacketStatus::Or<DnsPacket>>;
+using AsyncResponder = AsyncResponse (*)(const ResponderContext* context,
+                                         DnsPacket response);
+
+// The asynchronous responder that finishes answers to |type|, or null if
+// they are always complete once answered locally.
+AsyncResponder FindAsyncResponder(uint16_t type);
+
+// The name that the answer in |response| ends in an alias to, if it does.
+std::optional<std::string> AliasTarget(const DnsPacket& response);
+
+// Finishes an answer that ends in an alias by asking upstream for the records
+// of the question's type at its target, and adding whatever comes back. If
+// nothing does, the alias is answered alone, for the client to follow.
+AsyncResponse FollowCNAMERecord(const ResponderContext* context,
+                                DnsPacket response);
+
+// co_await these from an AsyncResponder: the first resumes with upstream's
+// reply to |key| (empty if there isn't one), and the second after |delay|.
+CallbackAwaiter<std::vector<uint8_t>> AskUpstream(
+    const ResponderContext* context,
+    const CacheKey& key);
+CallbackAwaiter<void> Sleep(const ResponderContext* context,
+                            std::chrono::milliseconds delay);
+
 }  // namespace homedns
\ No newline at end of file
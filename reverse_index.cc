@@ -0,0 +1,263 @@
+#include "reverse_index.h"
+
+#include <arpa/inet.h>
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+
+#include "suffix_tree.h"
+#include "wire.h"
+
+namespace homedns {
+
+namespace {
+
+constexpr uint16_t kPTRRecordType = 12;
+constexpr uint16_t kInternetClass = 1;
+
+// in-addr.arpa names have four address labels, ip6.arpa ones 32.
+constexpr size_t kMaxReverseLabels = 34;
+
+// Whether the length prefixed |label| is |text|, in any case.
+bool LabelIs(const uint8_t* label, std::string_view text) {
+  if (label[0] != text.size())
+    return false;
+  for (size_t i = 0; i < text.size(); i++) {
+    if (_suffix_tree::Lower(static_cast<char>(label[1 + i])) != text[i])
+      return false;
+  }
+  return true;
+}
+
+int HexDigit(uint8_t c) {
+  c = _suffix_tree::Lower(static_cast<char>(c));
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  return -1;
+}
+
+std::string WireName(std::string_view name) {
+  if (!name.empty() && name.back() == '.')
+    name.remove_suffix(1);
+  std::string wire;
+  while (!name.empty()) {
+    size_t dot = std::min(name.find('.'), name.size());
+    wire.push_back(static_cast<char>(dot));
+    for (char c : name.substr(0, dot))
+      wire.push_back(_suffix_tree::Lower(c));
+    name.remove_prefix(std::min(dot + 1, name.size()));
+  }
+  wire.push_back(0);
+  return wire;
+}
+
+std::string DottedName(std::string_view wire) {
+  std::string name;
+  for (size_t at = 0; at < wire.size() && wire[at] != 0;) {
+    uint8_t length = wire[at];
+    if (!name.empty())
+      name.push_back('.');
+    name.append(wire.substr(at + 1, length));
+    at += 1 + length;
+  }
+  return name;
+}
+
+}  // namespace
+
+// static
+std::optional<HostAddress> HostAddress::Parse(std::string_view text) {
+  std::string copy(text);
+  HostAddress address;
+  memset(address.bytes, 0, sizeof(address.bytes));
+  if (inet_pton(AF_INET, copy.c_str(), address.bytes) == 1) {
+    address.family = AF_INET;
+    return address;
+  }
+  if (inet_pton(AF_INET6, copy.c_str(), address.bytes) == 1) {
+    address.family = AF_INET6;
+    return address;
+  }
+  return std::nullopt;
+}
+
+// static
+std::optional<HostAddress> HostAddress::FromReverseName(const uint8_t* name,
+                                                        size_t len) {
+  const uint8_t* labels[kMaxReverseLabels];
+  size_t count = 0;
+  for (size_t at = 0;;) {
+    if (at >= len)
+      return std::nullopt;
+    uint8_t length = name[at];
+    if (length == 0)
+      break;
+    if ((length & 0xC0) || count == kMaxReverseLabels || at + 1 + length > len)
+      return std::nullopt;
+    labels[count++] = name + at;
+    at += 1 + length;
+  }
+
+  HostAddress address;
+  memset(address.bytes, 0, sizeof(address.bytes));
+  if (count == 6 && LabelIs(labels[5], "arpa") &&
+      LabelIs(labels[4], "in-addr")) {
+    address.family = AF_INET;
+    // Least significant byte first.
+    for (size_t i = 0; i < 4; i++) {
+      const uint8_t* label = labels[i];
+      if (label[0] > 3 || (label[0] > 1 && label[1] == '0'))
+        return std::nullopt;
+      unsigned value = 0;
+      for (size_t j = 1; j <= label[0]; j++) {
+        if (label[j] < '0' || label[j] > '9')
+          return std::nullopt;
+        value = value * 10 + (label[j] - '0');
+      }
+      if (value > 255)
+        return std::nullopt;
+      address.bytes[3 - i] = value;
+    }
+    return address;
+  }
+  if (count == 34 && LabelIs(labels[33], "arpa") &&
+      LabelIs(labels[32], "ip6")) {
+    address.family = AF_INET6;
+    // One nibble a label, least significant first.
+    for (size_t i = 0; i < 32; i++) {
+      int nibble = labels[i][0] == 1 ? HexDigit(labels[i][1]) : -1;
+      if (nibble < 0)
+        return std::nullopt;
+      size_t at = 31 - i;
+      address.bytes[at / 2] |= at % 2 ? nibble : nibble << 4;
+    }
+    return address;
+  }
+  return std::nullopt;
+}
+
+std::string HostAddress::ReverseName() const {
+  static const char kHex[] = "0123456789abcdef";
+  std::string name;
+  if (family == AF_INET) {
+    for (int i = 3; i >= 0; i--)
+      name += std::to_string(bytes[i]) + ".";
+    return name + "in-addr.arpa";
+  }
+  for (int i = 15; i >= 0; i--) {
+    name += kHex[bytes[i] & 0x0F];
+    name += '.';
+    name += kHex[bytes[i] >> 4];
+    name += '.';
+  }
+  return name + "ip6.arpa";
+}
+
+ReverseIndex::ReverseIndex(uint32_t ttl) : ttl_(ttl) {}
+
+ReverseIndex::Shard& ReverseIndex::ShardFor(const HostAddress& address) const {
+  return shards_[KeyHash()(address.Key()) % kShards];
+}
+
+void ReverseIndex::Add(const HostAddress& address, std::string_view name) {
+  std::string wire = WireName(name);
+  Shard& shard = ShardFor(address);
+  std::unique_lock lock(shard.mutex);
+  auto& names = shard.names[std::string(address.Key())];
+  auto it = std::find_if(names.begin(), names.end(),
+                         [&](const Name& n) { return n.wire == wire; });
+  if (it != names.end()) {
+    it->refs++;
+    return;
+  }
+  names.push_back({std::move(wire), 1});
+  size_++;
+}
+
+void ReverseIndex::Remove(const HostAddress& address, std::string_view name) {
+  std::string wire = WireName(name);
+  Shard& shard = ShardFor(address);
+  std::unique_lock lock(shard.mutex);
+  auto found = shard.names.find(address.Key());
+  if (found == shard.names.end())
+    return;
+  auto& names = found->second;
+  auto it = std::find_if(names.begin(), names.end(),
+                         [&](const Name& n) { return n.wire == wire; });
+  if (it == names.end() || --it->refs > 0)
+    return;
+  names.erase(it);
+  size_--;
+  if (names.empty())
+    shard.names.erase(found);
+}
+
+std::vector<std::string> ReverseIndex::Names(
+    const HostAddress& address) const {
+  std::vector<std::string> names;
+  Shard& shard = ShardFor(address);
+  std::shared_lock lock(shard.mutex);
+  auto found = shard.names.find(address.Key());
+  if (found != shard.names.end()) {
+    for (const Name& name : found->second)
+      names.push_back(DottedName(name.wire));
+  }
+  return names;
+}
+
+size_t ReverseIndex::Write(const uint8_t* query,
+                           size_t len,
+                           uint8_t* out,
+                           size_t out_len) const {
+  if (Size() == 0 || len < wire::kHeaderSize || (query[2] & 0xF8) ||
+      wire::ReadU16(query + 4) != 1) {
+    return 0;
+  }
+  size_t question_end = wire::QuestionEnd(query, len);
+  if (question_end == 0 || question_end > out_len ||
+      wire::ReadU16(query + question_end - 4) != kPTRRecordType ||
+      wire::ReadU16(query + question_end - 2) != kInternetClass) {
+    return 0;
+  }
+  std::optional<HostAddress> address = HostAddress::FromReverseName(
+      query + wire::kHeaderSize, question_end - 4 - wire::kHeaderSize);
+  if (!address.has_value())
+    return 0;
+
+  Shard& shard = ShardFor(*address);
+  std::shared_lock lock(shard.mutex);
+  auto found = shard.names.find(address->Key());
+  if (found == shard.names.end())
+    return 0;
+
+  memcpy(out, query, question_end);
+  // QR and AA, RD as asked, and RA if there is recursion to be had.
+  out[2] = 0x84 | (query[2] & 0x01);
+  out[3] = recursion_available_ ? 0x80 : 0;
+  wire::WriteU16(out + 6, 0);
+  wire::WriteU16(out + 8, 0);
+  wire::WriteU16(out + 10, 0);
+  size_t at = question_end;
+  uint16_t answers = 0;
+  for (const Name& name : found->second) {
+    if (at + 12 + name.wire.size() > out_len) {
+      out[2] |= 0x02;
+      break;
+    }
+    // The owner is the question's name.
+    wire::WriteU16(out + at, 0xC000 | wire::kHeaderSize);
+    wire::WriteU16(out + at + 2, kPTRRecordType);
+    wire::WriteU16(out + at + 4, kInternetClass);
+    wire::WriteU32(out + at + 6, ttl_);
+    wire::WriteU16(out + at + 10, name.wire.size());
+    memcpy(out + at + 12, name.wire.data(), name.wire.size());
+    at += 12 + name.wire.size();
+    answers++;
+  }
+  wire::WriteU16(out + 6, answers);
+  return at;
+}
+
+}  // namespace homedns
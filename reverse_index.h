@@ -0,0 +1,111 @@
+#pragma once
+
+#include <sys/socket.h>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace homedns {
+
+// An IPv4 or IPv6 address of a local host.
+struct HostAddress {
+  int family;  // AF_INET or AF_INET6.
+  uint8_t bytes[16];
+
+  // "192.168.1.9" or "fd00::9".
+  static std::optional<HostAddress> Parse(std::string_view text);
+  // The address a reverse name stands for, read straight off the labels of
+  // |name|, in uncompressed wire format: 9.1.168.192.in-addr.arpa, or the 32
+  // nibble ip6.arpa form.
+  static std::optional<HostAddress> FromReverseName(const uint8_t* name,
+                                                    size_t len);
+
+  // The reverse name, dotted.
+  std::string ReverseName() const;
+
+  size_t Size() const { return family == AF_INET ? 4 : 16; }
+  std::string_view Key() const {
+    return {reinterpret_cast<const char*>(bytes), Size()};
+  }
+  bool operator==(const HostAddress& other) const {
+    return family == other.family && Key() == other.Key();
+  }
+};
+
+// The names of local addresses, kept alongside the A and AAAA records they
+// come from (a HostTable's, a DynamicZone's) as those change, to answer PTR
+// queries with. A query is answered straight off the wire: the address is
+// read from the question's labels, and the reply is the query's header and
+// question followed by names already in wire format, with no packet built.
+//
+// Like HostTable, it is a hash table in shards behind reader writer locks,
+// and the same address and name stay until every source that added them has
+// removed them.
+class ReverseIndex {
+ public:
+  explicit ReverseIndex(uint32_t ttl = 60);
+
+  void Add(const HostAddress& address, std::string_view name);
+  void Remove(const HostAddress& address, std::string_view name);
+
+  std::vector<std::string> Names(const HostAddress& address) const;
+
+  // Whether replies set RA, as they should when the server forwards what it
+  // can't answer itself. Off until set; set it before serving.
+  void SetRecursionAvailable(bool available) {
+    recursion_available_ = available;
+  }
+
+  // The number of distinct address and name pairs.
+  size_t Size() const { return size_.load(std::memory_order_relaxed); }
+
+  // Writes the reply to |query| if it asks for the PTR records of an address
+  // in the index. Returns its length, or 0 to leave the query to the usual
+  // path: it asks about something else, or an address nobody has.
+  size_t Write(const uint8_t* query,
+               size_t len,
+               uint8_t* out,
+               size_t out_len) const;
+
+ private:
+  static constexpr size_t kShards = 16;
+
+  struct Name {
+    // Lowercased, in uncompressed wire format.
+    std::string wire;
+    uint32_t refs;
+  };
+  // So that lookups go straight from HostAddress::Key(), without copying
+  // it into a string.
+  struct KeyHash {
+    using is_transparent = void;
+    size_t operator()(std::string_view key) const {
+      return std::hash<std::string_view>()(key);
+    }
+  };
+  struct Shard {
+    mutable std::shared_mutex mutex;
+    // Keyed by HostAddress::Key().
+    std::unordered_map<std::string,
+                       std::vector<Name>,
+                       KeyHash,
+                       std::equal_to<>>
+        names;
+  };
+
+  Shard& ShardFor(const HostAddress& address) const;
+
+  uint32_t ttl_;
+  bool recursion_available_ = false;
+  std::atomic<size_t> size_ = 0;
+  mutable std::array<Shard, kShards> shards_;
+};
+
+}  // namespace homedns
@@ -1,15 +1,74 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
+#include <utility>
+
 #include "base/status/status.h"
 
 namespace homedns {
 
+namespace internal {
+inline std::atomic<bool> trace_errors = false;
+}  // namespace internal
+
+// Whether errors should carry full diagnostics: messages, data, causes and
+// locations. Those allocate, and malformed packets arrive all the time, so
+// the parse and serialize paths return bare codes unless this is on.
+inline bool TraceErrors() {
+  return internal::trace_errors.load(std::memory_order_relaxed);
+}
+
+inline void SetTraceErrors(bool enabled) {
+  internal::trace_errors.store(enabled, std::memory_order_relaxed);
+}
+
+// Returns |error| from the calling function, adding the call site to its trace
+// when tracing.
+#define RETURN_TRACED(error)             \
+  do {                                   \
+    if (::homedns::TraceErrors())        \
+      return std::move(error).AddHere(); \
+    return error;                        \
+  } while (0)
+
+// A status which is just a code and the byte offset it happened at. It never
+// allocates, so it can be returned from every read and write of a field; a
+// full TypedStatus is only made from it when there is somebody to show it to.
+template <typename Spec>
+class CompactStatus {
+ public:
+  using Codes = typename Spec::Codes;
+
+  CompactStatus(Codes code, uint32_t byte = 0) : code_(code), byte_(byte) {}
+  CompactStatus(base::OkStatusT) : code_(Codes::kOk) {}
+
+  bool is_ok() const { return code_ == Codes::kOk; }
+  Codes code() const { return code_; }
+  uint32_t byte() const { return byte_; }
+
+  // For parity with TypedStatus. There is no trace to add to.
+  CompactStatus AddHere() && { return *this; }
+
+  base::TypedStatus<Spec> ToStatus() const {
+    return base::TypedStatus<Spec>(code_).WithData("byte",
+                                                   static_cast<int>(byte_));
+  }
+
+  void Print() const { ToStatus().Print(); }
+
+ private:
+  Codes code_;
+  uint32_t byte_ = 0;
+};
+
 struct PacketStatusSpec {
   enum class Codes : base::StatusCodeType {
     kOk,
     kParsingError,
     kIndexOutOfRange,
     kInvalidRecordType,
+    kNameNotFound,
   };
 
   static base::StatusGroupType Group() { return "PacketStatus"; }
@@ -27,6 +86,27 @@ struct BitstreamErrorSpec {
   static base::StatusGroupType Group() { return "BitstreamStatus"; }
 };
 
-using BitstreamStatus = base::TypedStatus<BitstreamErrorSpec>;
+using BitstreamStatus = CompactStatus<BitstreamErrorSpec>;
+
+// A |Status| error with |code|, which only carries |cause| when tracing.
+template <typename Status, typename Spec>
+Status CausedBy(typename Status::Codes code,
+                const CompactStatus<Spec>& cause) {
+  if (!TraceErrors())
+    return Status(code);
+  return Status(code).AddCause(cause.ToStatus());
+}
+
+struct ConfigStatusSpec {
+  enum class Codes : base::StatusCodeType {
+    kOk,
+    kFileNotFound,
+    kSyntaxError,
+  };
+
+  static base::StatusGroupType Group() { return "ConfigStatus"; }
+};
+
+using ConfigStatus = base::TypedStatus<ConfigStatusSpec>;
 
 }  // namespace homedns
\ No newline at end of file
@@ -0,0 +1,345 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "labels.h"
+
+namespace homedns {
+
+namespace _suffix_tree {
+
+constexpr size_t kMaxLabels = 128;
+
+// DNS names compare case-insensitively in ASCII only, whatever the locale.
+inline unsigned char Lower(char c) {
+  unsigned char u = static_cast<unsigned char>(c);
+  return (u >= 'A' && u <= 'Z') ? (u | 0x20) : u;
+}
+
+inline bool LabelEquals(const char* stored, uint8_t len, std::string_view in) {
+  if (in.size() != len)
+    return false;
+  for (uint8_t i = 0; i < len; i++) {
+    if (static_cast<unsigned char>(stored[i]) != Lower(in[i]))
+      return false;
+  }
+  return true;
+}
+
+// Orders a stored (already lowercased) label against one from a query, the
+// same way std::string orders them.
+inline int LabelCompare(const char* stored, uint8_t len, std::string_view in) {
+  size_t shared = std::min<size_t>(len, in.size());
+  for (size_t i = 0; i < shared; i++) {
+    int diff = static_cast<unsigned char>(stored[i]) - Lower(in[i]);
+    if (diff)
+      return diff;
+  }
+  return static_cast<int>(len) - static_cast<int>(in.size());
+}
+
+// Splits a dotted name into its labels. Returns the number of labels, or 0 if
+// the name has too many of them.
+inline size_t SplitName(std::string_view name, std::string_view* labels) {
+  if (!name.empty() && name.back() == '.')
+    name.remove_suffix(1);
+  if (name.empty())
+    return 0;
+  size_t count = 0;
+  while (true) {
+    if (count == kMaxLabels)
+      return 0;
+    size_t dot = name.find('.');
+    labels[count++] = name.substr(0, dot);
+    if (dot == std::string_view::npos)
+      return count;
+    name.remove_prefix(dot + 1);
+  }
+}
+
+inline size_t SplitName(const DnsLabelSeq& seq, std::string_view* labels) {
+  size_t count = 0;
+  for (Segment* seg = seq.value; seg; seg = seg->next) {
+    if (count == kMaxLabels)
+      return 0;
+    labels[count++] = seg->segment;
+  }
+  return count;
+}
+
+}  // namespace _suffix_tree
+
+// A compressed radix tree keyed on reversed labels, so that every suffix of a
+// name ("com", "google.com", "www.google.com") is a prefix of the walk, and a
+// single pass from the last label of a name towards the first finds the
+// longest stored suffix. Chains of nodes with one child and no value are
+// collapsed into a single multi-label edge.
+//
+// The tree is immutable once built. Nodes live in one flat array with the
+// children of each node stored contiguously and sorted by their first label,
+// and all edge labels live in one contiguous pool, so a lookup touches a few
+// cache lines per level rather than chasing a pointer per label.
+//
+// Names are matched case-insensitively. A stored "*" label matches any single
+// label, for wildcards such as "*.lan".
+template <typename T>
+class SuffixTree {
+ public:
+  struct Match {
+    // The value for the longest stored suffix of the name, if any.
+    const T* value = nullptr;
+
+    // How many labels of the name |value|'s entry covers.
+    size_t labels = 0;
+
+    // Whether |value| came from a wildcard entry.
+    bool wildcard = false;
+
+    // How many labels of the name exist in the tree, with or without a value
+    // (the closest encloser).
+    size_t encloser = 0;
+  };
+
+  class Builder {
+   public:
+    // Adds (or replaces) the value for |name|. Returns false if the name has
+    // too many labels to be stored.
+    bool Insert(std::string_view name, T value);
+    SuffixTree Build() &&;
+
+   private:
+    struct BuildNode {
+      std::map<std::string, std::unique_ptr<BuildNode>> children;
+      std::optional<T> value;
+    };
+    BuildNode root_;
+  };
+
+  SuffixTree() = default;
+
+  Match LongestMatch(std::string_view name) const;
+  Match LongestMatch(const DnsLabelSeq& seq) const;
+
+  // Finds the value stored for exactly |name|, ignoring wildcards.
+  const T* Exact(std::string_view name) const;
+  const T* Exact(const DnsLabelSeq& seq) const;
+
+  size_t NodeCount() const { return nodes_.size(); }
+  size_t ValueCount() const { return values_.size(); }
+  size_t MemoryUsage() const {
+    return nodes_.capacity() * sizeof(Node) + pool_.capacity() +
+           values_.capacity() * sizeof(T);
+  }
+
+ private:
+  static constexpr uint32_t kNoValue = UINT32_MAX;
+
+  struct Node {
+    uint32_t edge;         // Offset of the edge's labels in |pool_|.
+    uint16_t edge_labels;  // Number of labels on the edge.
+    uint16_t edge_bytes;   // Length of the edge in |pool_|.
+    uint32_t first_child;  // Index of the first child in |nodes_|.
+    uint32_t child_count;
+    uint32_t value;  // Index into |values_|, or kNoValue.
+  };
+
+  Match Walk(const std::string_view* labels, size_t count) const;
+  const T* WalkExact(const std::string_view* labels, size_t count) const;
+  const Node* FindChild(const Node& node, std::string_view label) const;
+  bool IsWildcard(const Node& node) const {
+    return node.edge_labels == 1 && pool_[node.edge] == 1 &&
+           pool_[node.edge + 1] == '*';
+  }
+
+  // Edges are stored as a run of length prefixed labels, in walk order.
+  std::vector<Node> nodes_;
+  std::vector<char> pool_;
+  std::vector<T> values_;
+};
+
+template <typename T>
+bool SuffixTree<T>::Builder::Insert(std::string_view name, T value) {
+  std::string_view labels[_suffix_tree::kMaxLabels];
+  size_t count = _suffix_tree::SplitName(name, labels);
+  if (count == 0)
+    return false;
+  BuildNode* node = &root_;
+  for (size_t i = count; i > 0; i--) {
+    std::string label(labels[i - 1]);
+    std::transform(label.begin(), label.end(), label.begin(),
+                   _suffix_tree::Lower);
+    auto& child = node->children[label];
+    if (!child)
+      child = std::make_unique<BuildNode>();
+    node = child.get();
+  }
+  node->value = std::move(value);
+  return true;
+}
+
+template <typename T>
+SuffixTree<T> SuffixTree<T>::Builder::Build() && {
+  SuffixTree tree;
+  tree.nodes_.push_back({0, 0, 0, 0, 0, kNoValue});
+  if (root_.value.has_value()) {
+    tree.nodes_[0].value = 0;
+    tree.values_.push_back(std::move(*root_.value));
+  }
+
+  // Breadth first, so that every node's children end up next to each other.
+  std::vector<std::pair<BuildNode*, uint32_t>> queue = {{&root_, 0}};
+  for (size_t head = 0; head < queue.size(); head++) {
+    auto [build_node, index] = queue[head];
+    tree.nodes_[index].first_child = tree.nodes_.size();
+    tree.nodes_[index].child_count = build_node->children.size();
+    for (auto& [label, child] : build_node->children) {
+      Node node = {static_cast<uint32_t>(tree.pool_.size()), 0, 0, 0, 0,
+                   kNoValue};
+      // Collapse chains of valueless single children into this edge.
+      BuildNode* tail = child.get();
+      const std::string* tail_label = &label;
+      while (true) {
+        tree.pool_.push_back(static_cast<char>(tail_label->size()));
+        tree.pool_.insert(tree.pool_.end(), tail_label->begin(),
+                          tail_label->end());
+        node.edge_labels++;
+        if (tail->value.has_value() || tail->children.size() != 1)
+          break;
+        // A wildcard has to stay on an edge of its own to be found.
+        if (tail->children.begin()->first == "*" || *tail_label == "*")
+          break;
+        tail_label = &tail->children.begin()->first;
+        tail = tail->children.begin()->second.get();
+      }
+      node.edge_bytes = tree.pool_.size() - node.edge;
+      if (tail->value.has_value()) {
+        node.value = tree.values_.size();
+        tree.values_.push_back(std::move(*tail->value));
+      }
+      queue.push_back({tail, static_cast<uint32_t>(tree.nodes_.size())});
+      tree.nodes_.push_back(node);
+    }
+  }
+  root_.children.clear();
+  return tree;
+}
+
+template <typename T>
+typename SuffixTree<T>::Match SuffixTree<T>::LongestMatch(
+    std::string_view name) const {
+  std::string_view labels[_suffix_tree::kMaxLabels];
+  return Walk(labels, _suffix_tree::SplitName(name, labels));
+}
+
+template <typename T>
+typename SuffixTree<T>::Match SuffixTree<T>::LongestMatch(
+    const DnsLabelSeq& seq) const {
+  std::string_view labels[_suffix_tree::kMaxLabels];
+  return Walk(labels, _suffix_tree::SplitName(seq, labels));
+}
+
+template <typename T>
+const T* SuffixTree<T>::Exact(std::string_view name) const {
+  std::string_view labels[_suffix_tree::kMaxLabels];
+  return WalkExact(labels, _suffix_tree::SplitName(name, labels));
+}
+
+template <typename T>
+const T* SuffixTree<T>::Exact(const DnsLabelSeq& seq) const {
+  std::string_view labels[_suffix_tree::kMaxLabels];
+  return WalkExact(labels, _suffix_tree::SplitName(seq, labels));
+}
+
+template <typename T>
+const T* SuffixTree<T>::WalkExact(const std::string_view* labels,
+                                  size_t count) const {
+  Match match = Walk(labels, count);
+  if (match.labels != count || match.wildcard)
+    return nullptr;
+  return match.value;
+}
+
+template <typename T>
+const typename SuffixTree<T>::Node* SuffixTree<T>::FindChild(
+    const Node& node,
+    std::string_view label) const {
+  const Node* lo = nodes_.data() + node.first_child;
+  const Node* hi = lo + node.child_count;
+  while (lo < hi) {
+    const Node* mid = lo + (hi - lo) / 2;
+    const char* edge = pool_.data() + mid->edge;
+    int cmp = _suffix_tree::LabelCompare(edge + 1, edge[0], label);
+    if (cmp == 0)
+      return mid;
+    if (cmp < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return nullptr;
+}
+
+template <typename T>
+typename SuffixTree<T>::Match SuffixTree<T>::Walk(
+    const std::string_view* labels,
+    size_t count) const {
+  Match match;
+  if (nodes_.empty())
+    return match;
+  const Node* node = &nodes_[0];
+  if (node->value != kNoValue)
+    match.value = &values_[node->value];
+
+  size_t remaining = count;
+  while (remaining > 0) {
+    const Node* child = FindChild(*node, labels[remaining - 1]);
+    if (child == nullptr) {
+      // This node is the closest encloser, so a wildcard directly below it
+      // covers the next label. '*' sorts before every character allowed in a
+      // hostname, so if there is a wildcard child it is the first one.
+      if (node->child_count) {
+        const Node& first = nodes_[node->first_child];
+        if (IsWildcard(first) && first.value != kNoValue) {
+          match.value = &values_[first.value];
+          match.labels = count - remaining + 1;
+          match.wildcard = true;
+        }
+      }
+      break;
+    }
+
+    // The first label matched in FindChild; the rest of the edge must too.
+    // Running out part way along an edge still counts towards the encloser,
+    // since the collapsed nodes along it do exist.
+    const char* edge = pool_.data() + child->edge;
+    edge += 1 + edge[0];
+    for (size_t consumed = 1; consumed < child->edge_labels; consumed++) {
+      if (consumed == remaining ||
+          !_suffix_tree::LabelEquals(edge + 1, edge[0],
+                                     labels[remaining - 1 - consumed])) {
+        match.encloser = count - remaining + consumed;
+        return match;
+      }
+      edge += 1 + edge[0];
+    }
+
+    remaining -= child->edge_labels;
+    node = child;
+    match.encloser = count - remaining;
+    if (node->value != kNoValue) {
+      match.value = &values_[node->value];
+      match.labels = count - remaining;
+    }
+  }
+  return match;
+}
+
+}  // namespace homedns
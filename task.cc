@@ -0,0 +1,81 @@
+#include "task.h"
+
+#include <new>
+
+namespace homedns {
+
+namespace {
+
+constexpr size_t kSizes = FramePool::kMaxPooled / FramePool::kGranularity;
+
+struct FreeFrame {
+  FreeFrame* next;
+};
+
+struct ThreadPool {
+  ~ThreadPool() {
+    for (FreeFrame*& head : free) {
+      while (head)
+        ::operator delete(std::exchange(head, head->next));
+    }
+  }
+
+  FreeFrame* free[kSizes] = {};
+  size_t counts[kSizes] = {};
+  FramePool::Stats stats;
+};
+
+ThreadPool& ThisThread() {
+  thread_local ThreadPool pool;
+  return pool;
+}
+
+// Zero for frames too big to pool.
+size_t SizeClass(size_t size) {
+  if (size > FramePool::kMaxPooled)
+    return 0;
+  return (size + FramePool::kGranularity - 1) / FramePool::kGranularity;
+}
+
+}  // namespace
+
+// static
+void* FramePool::Allocate(size_t size) {
+  ThreadPool& pool = ThisThread();
+  pool.stats.live++;
+  size_t size_class = SizeClass(size);
+  if (size_class == 0) {
+    pool.stats.heap_allocations++;
+    return ::operator new(size);
+  }
+  FreeFrame*& head = pool.free[size_class - 1];
+  if (head == nullptr) {
+    pool.stats.heap_allocations++;
+    return ::operator new(size_class * kGranularity);
+  }
+  pool.counts[size_class - 1]--;
+  pool.stats.pooled--;
+  return std::exchange(head, head->next);
+}
+
+// static
+void FramePool::Free(void* frame, size_t size) {
+  ThreadPool& pool = ThisThread();
+  pool.stats.live--;
+  size_t size_class = SizeClass(size);
+  if (size_class == 0 || pool.counts[size_class - 1] >= kMaxFreePerSize) {
+    ::operator delete(frame);
+    return;
+  }
+  FreeFrame* free = new (frame) FreeFrame{pool.free[size_class - 1]};
+  pool.free[size_class - 1] = free;
+  pool.counts[size_class - 1]++;
+  pool.stats.pooled++;
+}
+
+// static
+FramePool::Stats FramePool::GetStats() {
+  return ThisThread().stats;
+}
+
+}  // namespace homedns
@@ -0,0 +1,197 @@
+#pragma once
+
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <optional>
+#include <utility>
+
+#include "base/bind/bind.h"
+
+namespace homedns {
+
+// Recycles coroutine frames, so that a suspended query costs its frame and
+// nothing else, and starting one doesn't usually touch the heap. Frames are
+// rounded up to a multiple of 64 bytes, and each size up to kMaxPooled has a
+// free list; anything bigger comes straight from the heap.
+//
+// Each thread keeps its own free lists. A frame is given back to the list of
+// the thread that frees it, which need not be the one that made it, so each
+// list is capped and frees beyond that go back to the heap.
+class FramePool {
+ public:
+  static constexpr size_t kGranularity = 64;
+  static constexpr size_t kMaxPooled = 1024;
+  static constexpr size_t kMaxFreePerSize = 4096;
+
+  struct Stats {
+    // Frames handed out and not yet freed, by this thread.
+    int64_t live = 0;
+    // Frames sitting in this thread's free lists.
+    size_t pooled = 0;
+    // Frames this thread had to get from the heap.
+    uint64_t heap_allocations = 0;
+  };
+
+  static void* Allocate(size_t size);
+  static void Free(void* frame, size_t size);
+
+  // This thread's.
+  static Stats GetStats();
+};
+
+// A coroutine producing a T. It starts suspended, and runs when it is
+// co_awaited, resuming the awaiter as soon as it has co_returned; or when it
+// is handed to Spawn. Exceptions aren't supported, since nothing in this tree
+// throws.
+template <typename T>
+class [[nodiscard]] Task {
+ public:
+  struct promise_type {
+    static void* operator new(size_t size) { return FramePool::Allocate(size); }
+    static void operator delete(void* frame, size_t size) {
+      FramePool::Free(frame, size);
+    }
+
+    Task get_return_object() {
+      return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    auto final_suspend() noexcept { return FinalAwaiter(); }
+    void return_value(T result) { value.emplace(std::move(result)); }
+    void unhandled_exception() { std::terminate(); }
+
+    std::optional<T> value;
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+  };
+
+  Task(Task&& other) : handle_(std::exchange(other.handle_, nullptr)) {}
+  Task& operator=(Task&& other) {
+    std::swap(handle_, other.handle_);
+    return *this;
+  }
+  ~Task() {
+    if (handle_)
+      handle_.destroy();
+  }
+
+  bool await_ready() const { return false; }
+  // Switches straight to the task, which switches straight back when done,
+  // so that long chains of awaits don't grow the stack.
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) {
+    handle_.promise().continuation = caller;
+    return handle_;
+  }
+  T await_resume() { return std::move(*handle_.promise().value); }
+
+ private:
+  struct FinalAwaiter {
+    bool await_ready() noexcept { return false; }
+    std::coroutine_handle<> await_suspend(
+        std::coroutine_handle<promise_type> self) noexcept {
+      return self.promise().continuation;
+    }
+    void await_resume() noexcept {}
+  };
+
+  explicit Task(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+
+  std::coroutine_handle<promise_type> handle_;
+};
+
+namespace internal {
+
+// A coroutine nobody waits on, which frees itself when it finishes.
+struct Detached {
+  struct promise_type {
+    static void* operator new(size_t size) { return FramePool::Allocate(size); }
+    static void operator delete(void* frame, size_t size) {
+      FramePool::Free(frame, size);
+    }
+
+    Detached get_return_object() { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+};
+
+template <typename T>
+Detached RunDetached(Task<T> task, base::RepeatingCallback<void(T)> done) {
+  done.Run(co_await std::move(task));
+}
+
+}  // namespace internal
+
+// Runs |task| on this thread until it first suspends, and |done| with its
+// result once it finishes, on whichever thread resumed it last.
+template <typename T>
+void Spawn(Task<T> task, base::RepeatingCallback<void(T)> done) {
+  internal::RunDetached(std::move(task), std::move(done));
+}
+
+// Awaits a callback based operation: |start| is run with a callback, which
+// the operation runs exactly once with its result, on any thread and possibly
+// before |start| has returned. The coroutine carries on from there.
+template <typename T>
+class CallbackAwaiter {
+ public:
+  using DoneCB = base::RepeatingCallback<void(T)>;
+  using StartCB = base::RepeatingCallback<void(DoneCB)>;
+
+  explicit CallbackAwaiter(StartCB start) : start_(std::move(start)) {}
+
+  bool await_ready() const { return false; }
+  bool await_suspend(std::coroutine_handle<> caller) {
+    caller_ = caller;
+    start_.Run(base::BindRepeating(&CallbackAwaiter::Complete, this));
+    // Whichever of this and Complete() comes second resumes the coroutine;
+    // if it is this, that's by not suspending at all.
+    return !finished_.exchange(true, std::memory_order_acq_rel);
+  }
+  T await_resume() { return std::move(*value_); }
+
+ private:
+  static void Complete(CallbackAwaiter* self, T value) {
+    self->value_.emplace(std::move(value));
+    if (self->finished_.exchange(true, std::memory_order_acq_rel))
+      self->caller_.resume();
+  }
+
+  StartCB start_;
+  std::coroutine_handle<> caller_;
+  std::optional<T> value_;
+  std::atomic<bool> finished_ = false;
+};
+
+template <>
+class CallbackAwaiter<void> {
+ public:
+  using DoneCB = base::RepeatingCallback<void()>;
+  using StartCB = base::RepeatingCallback<void(DoneCB)>;
+
+  explicit CallbackAwaiter(StartCB start) : start_(std::move(start)) {}
+
+  bool await_ready() const { return false; }
+  bool await_suspend(std::coroutine_handle<> caller) {
+    caller_ = caller;
+    start_.Run(base::BindRepeating(&CallbackAwaiter::Complete, this));
+    return !finished_.exchange(true, std::memory_order_acq_rel);
+  }
+  void await_resume() {}
+
+ private:
+  static void Complete(CallbackAwaiter* self) {
+    if (self->finished_.exchange(true, std::memory_order_acq_rel))
+      self->caller_.resume();
+  }
+
+  StartCB start_;
+  std::coroutine_handle<> caller_;
+  std::atomic<bool> finished_ = false;
+};
+
+}  // namespace homedns
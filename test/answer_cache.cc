@@ -0,0 +1,219 @@
+#include <iostream>
+
+#include "base/json/json_io.h"
+#include "homedns/answer_cache.h"
+#include "homedns/bitstream.h"
+#include "homedns/packet.h"
+#include "homedns/test/check.h"
+
+using Clock = homedns::AnswerCache::Clock;
+
+std::unique_ptr<homedns::ReadStream> BuildResponse(uint32_t ttl) {
+  homedns::DnsPacket packet =
+      homedns::DnsPacket::Create(0x1234)
+          .SetQuestionOrResponse(homedns::DnsPacket::PacketType::kResponse)
+          .AddQuestion("popular.lan", homedns::DnsARecord::TYPE, 0x01)
+          .Unwrap()
+          .AddRecord<homedns::DnsPacket::RecordType::kAnswer>(
+              "popular.lan", 0x01, ttl, homedns::DnsARecord{{10, 0, 0, 1}})
+          .Unwrap();
+  auto ws = std::make_unique<homedns::WriteStream>(512);
+  auto ext = packet.Export(ws.get());
+  if (!ext.is_ok()) {
+    ext.Print();
+    exit(1);
+  }
+  return ws->Convert();
+}
+
+std::unique_ptr<homedns::ReadStream> BuildQuery(uint16_t id) {
+  homedns::DnsPacket packet =
+      homedns::DnsPacket::Create(id)
+          .AddQuestion("POPULAR.lan", homedns::DnsARecord::TYPE, 0x01)
+          .Unwrap();
+  auto ws = std::make_unique<homedns::WriteStream>(512);
+  auto ext = packet.Export(ws.get());
+  if (!ext.is_ok()) {
+    ext.Print();
+    exit(1);
+  }
+  return ws->Convert();
+}
+
+uint32_t TTLOf(const std::vector<uint8_t>& wire) {
+  // header(12) + popular.lan(13) + type/class(4) + pointer(2) + type/class(4)
+  size_t offset = 12 + 13 + 4 + 2 + 4;
+  return (wire[offset] << 24) | (wire[offset + 1] << 16) |
+         (wire[offset + 2] << 8) | wire[offset + 3];
+}
+
+void PrefetchTest() {
+  homedns::AnswerCache::Options options;
+  options.prefetch_fraction = 0.1;
+  options.prefetch_min_hits = 4;
+  options.prefetch_timeout = std::chrono::seconds(2);
+  homedns::AnswerCache cache(options);
+
+  auto key =
+      homedns::CacheKey::Create("Popular.LAN.", homedns::DnsARecord::TYPE, 1);
+  Clock::time_point start = Clock::now();
+  auto rs = BuildResponse(100);
+  cache.Insert(key, rs->GetBuffer(), rs->Size(), start);
+
+  auto query = BuildQuery(0xBEEF);
+  const uint8_t* q = query->GetBuffer();
+  size_t q_len = query->Size();
+  std::vector<uint8_t> out;
+  CHECK(cache.Lookup(key, q, q_len, &out, start + std::chrono::seconds(5)));
+  CHECK(out[0] == 0xBE && out[1] == 0xEF);
+  CHECK(out[13] == 'P');
+  CHECK(TTLOf(out) == 95);
+  // Part way through a second, the TTL is rounded up.
+  CHECK(cache.Lookup(key, q, q_len, &out,
+                     start + std::chrono::milliseconds(99500)));
+  CHECK(TTLOf(out) == 1);
+
+  // Hot, but not yet inside the prefetch window.
+  for (int i = 0; i < 8; i++)
+    cache.Lookup(key, q, q_len, &out, start + std::chrono::seconds(50));
+  CHECK(cache.TakePrefetches().empty());
+
+  // Inside the window: exactly one prefetch, no matter how many hits.
+  for (int i = 0; i < 8; i++)
+    cache.Lookup(key, q, q_len, &out, start + std::chrono::seconds(95));
+  CHECK(cache.TakePrefetches().size() == 1);
+  CHECK(cache.GetStats().prefetches_issued == 1);
+  // A refresh that never lands doesn't hold the next one up for good.
+  for (int i = 0; i < 8; i++)
+    cache.Lookup(key, q, q_len, &out, start + std::chrono::seconds(96));
+  CHECK(cache.TakePrefetches().empty());
+  cache.Lookup(key, q, q_len, &out,
+               start + std::chrono::seconds(95) + options.prefetch_timeout);
+  CHECK(cache.TakePrefetches().size() == 1);
+  CHECK(cache.GetStats().prefetches_issued == 2);
+
+  // The refresh lands before expiry, and hits past the old expiry are saved.
+  auto refreshed = BuildResponse(100);
+  cache.Insert(key, refreshed->GetBuffer(), refreshed->Size(),
+               start + std::chrono::seconds(98));
+  CHECK(cache.Lookup(key, q, q_len, &out, start + std::chrono::seconds(101)));
+  CHECK(TTLOf(out) == 97);
+  CHECK(cache.GetStats().prefetch_hits_saved == 1);
+
+  std::cout << cache.Render() << "\n";
+}
+
+void ColdEntryTest() {
+  homedns::AnswerCache cache;
+  auto key =
+      homedns::CacheKey::Create("popular.lan", homedns::DnsARecord::TYPE, 1);
+  Clock::time_point start = Clock::now();
+  auto rs = BuildResponse(100);
+  cache.Insert(key, rs->GetBuffer(), rs->Size(), start);
+
+  auto query = BuildQuery(1);
+  const uint8_t* q = query->GetBuffer();
+  size_t q_len = query->Size();
+  std::vector<uint8_t> out;
+  CHECK(cache.Lookup(key, q, q_len, &out, start + std::chrono::seconds(99)));
+  CHECK(cache.TakePrefetches().empty());
+  CHECK(!cache.Lookup(key, q, q_len, &out, start + std::chrono::seconds(100)));
+  CHECK(cache.GetStats().misses == 1);
+}
+
+void StaleTest() {
+  homedns::AnswerCache::Options options;
+  options.stale_window = std::chrono::seconds(60);
+  options.stale_ttl = 30;
+  homedns::AnswerCache cache(options);
+  auto key =
+      homedns::CacheKey::Create("popular.lan", homedns::DnsARecord::TYPE, 1);
+  Clock::time_point start = Clock::now();
+  auto rs = BuildResponse(100);
+  cache.Insert(key, rs->GetBuffer(), rs->Size(), start);
+
+  auto query = BuildQuery(1);
+  const uint8_t* q = query->GetBuffer();
+  size_t q_len = query->Size();
+  std::vector<uint8_t> out;
+
+  // Still live: a stale lookup is just a lookup.
+  CHECK(cache.LookupStale(key, q, q_len, &out,
+                          start + std::chrono::seconds(10)));
+  CHECK(TTLOf(out) == 90);
+  CHECK(cache.GetStats().stale_hits == 0);
+
+  // Expired: a plain lookup misses, but a stale one answers with a low TTL.
+  CHECK(!cache.Lookup(key, q, q_len, &out, start + std::chrono::seconds(110)));
+  CHECK(cache.LookupStale(key, q, q_len, &out,
+                          start + std::chrono::seconds(110)));
+  CHECK(TTLOf(out) == 30);
+  CHECK(cache.TakePrefetches().empty());
+
+  // Having just been served stale, plain lookups answer stale too for a bit,
+  // and queue a single refresh.
+  CHECK(cache.Lookup(key, q, q_len, &out, start + std::chrono::seconds(120)));
+  CHECK(cache.Lookup(key, q, q_len, &out, start + std::chrono::seconds(125)));
+  CHECK(TTLOf(out) == 30);
+  CHECK(cache.TakePrefetches().size() == 1);
+  CHECK(cache.GetStats().prefetches_issued == 1);
+  CHECK(!cache.Lookup(key, q, q_len, &out, start + std::chrono::seconds(145)));
+
+  // A refresh that fails doesn't stop the next stale answer asking again.
+  CHECK(cache.LookupStale(key, q, q_len, &out,
+                          start + std::chrono::seconds(146)));
+  CHECK(cache.Lookup(key, q, q_len, &out, start + std::chrono::seconds(150)));
+  CHECK(cache.TakePrefetches().size() == 1);
+  CHECK(cache.GetStats().prefetches_issued == 2);
+
+  // Beyond the stale window, nothing.
+  CHECK(!cache.LookupStale(key, q, q_len, &out,
+                           start + std::chrono::seconds(161)));
+  CHECK(cache.GetStats().stale_hits == 5);
+}
+
+void EvictionTest() {
+  homedns::AnswerCache::Options options;
+  options.max_entries = 3;
+  homedns::AnswerCache cache(options);
+  Clock::time_point start = Clock::now();
+  auto rs = BuildResponse(100);
+  auto short_lived = BuildResponse(5);
+  auto query = BuildQuery(1);
+  const uint8_t* q = query->GetBuffer();
+  size_t q_len = query->Size();
+  std::vector<uint8_t> out;
+  auto key = [](const char* name) {
+    return homedns::CacheKey::Create(name, homedns::DnsARecord::TYPE, 1);
+  };
+
+  cache.Insert(key("a.lan"), rs->GetBuffer(), rs->Size(), start);
+  cache.Insert(key("b.lan"), rs->GetBuffer(), rs->Size(), start);
+  cache.Insert(key("c.lan"), short_lived->GetBuffer(), short_lived->Size(),
+               start);
+  CHECK(cache.Lookup(key("a.lan"), q, q_len, &out, start));
+  CHECK(cache.Lookup(key("c.lan"), q, q_len, &out, start));
+
+  // "a" was hit, so it survives the hand passing; "b" wasn't, so it goes.
+  cache.Insert(key("d.lan"), rs->GetBuffer(), rs->Size(), start);
+  CHECK(cache.Size() == 3);
+  CHECK(!cache.Lookup(key("b.lan"), q, q_len, &out, start));
+  CHECK(cache.Lookup(key("a.lan"), q, q_len, &out, start));
+
+  // "c" was hit too, but has since expired, which a hit doesn't save it from.
+  auto later = start + std::chrono::seconds(10);
+  cache.Insert(key("e.lan"), rs->GetBuffer(), rs->Size(), later);
+  CHECK(!cache.LookupStale(key("c.lan"), q, q_len, &out, later));
+  CHECK(cache.Lookup(key("a.lan"), q, q_len, &out, later));
+  CHECK(cache.Lookup(key("d.lan"), q, q_len, &out, later));
+  CHECK(cache.Lookup(key("e.lan"), q, q_len, &out, later));
+  CHECK(cache.GetStats().evictions == 2);
+}
+
+int main() {
+  PrefetchTest();
+  ColdEntryTest();
+  StaleTest();
+  EvictionTest();
+  puts("OK");
+}
@@ -0,0 +1,164 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <vector>
+
+#include "homedns/arena.h"
+#include "homedns/packet.h"
+#include "homedns/test/check.h"
+
+// Counts every trip to the heap.
+size_t heap_allocations = 0;
+
+void* operator new(size_t size) {
+  heap_allocations++;
+  if (void* memory = malloc(size ? size : 1))
+    return memory;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept {
+  free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept {
+  free(memory);
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+  heap_allocations++;
+  size_t align = static_cast<size_t>(alignment);
+  if (void* memory = aligned_alloc(align, (size + align - 1) / align * align))
+    return memory;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* memory, std::align_val_t) noexcept {
+  free(memory);
+}
+
+void operator delete(void* memory, size_t, std::align_val_t) noexcept {
+  free(memory);
+}
+
+using homedns::Arena;
+using homedns::DnsPacket;
+
+// "www.example.lan A" with the RD bit set.
+const uint8_t kQuery[] = {0x12, 0x34, 0x01, 0x00, 0x00, 0x01, 0x00, 0x00,
+                          0x00, 0x00, 0x00, 0x00, 3,    'w',  'w',  'w',
+                          7,    'e',  'x',  'a',  'm',  'p',  'l',  'e',
+                          3,    'l',  'a',  'n',  0,    0x00, 0x01, 0x00,
+                          0x01};
+
+// What the server does for a local answer: parse the query, build a response
+// with a few records, and write it out.
+size_t Respond(std::pmr::memory_resource* memory, uint8_t* reply, size_t len) {
+  homedns::ReadStream stream(sizeof(kQuery), const_cast<uint8_t*>(kQuery));
+  DnsPacket query = DnsPacket::Import(&stream, memory).Unwrap();
+  const homedns::DnsQuestion* question = query.GetQuestion(0).value();
+  DnsPacket response =
+      DnsPacket::Create(query.GetPacketHeader().ID, memory)
+          .SetQuestionOrResponse(DnsPacket::PacketType::kResponse)
+          .AddQuestion(*question)
+          .Unwrap();
+  for (uint8_t i = 1; i <= 4; i++) {
+    response = std::move(response)
+                   .AddRecord<DnsPacket::RecordType::kAnswer>(
+                       "www.example.lan", 1, 60,
+                       homedns::DnsARecord{{192, 168, 1, i}})
+                   .Unwrap();
+  }
+  homedns::WriteStream ws(len, reply);
+  CHECK(response.Export(&ws).is_ok());
+  return ws.CurrentByte();
+}
+
+void ArenaTest() {
+  Arena arena(1024);
+  size_t before = heap_allocations;
+  {
+    std::pmr::vector<int> numbers(100, 7, &arena);
+    CHECK(heap_allocations == before);
+    CHECK(arena.BytesAllocated() >= 100 * sizeof(int));
+
+    // Outgrowing the initial block falls back to the heap until reset.
+    std::pmr::vector<int> more(1000, 7, &arena);
+    CHECK(heap_allocations > before);
+  }
+  size_t high_water = arena.HighWater();
+  arena.Reset();
+  CHECK(arena.BytesAllocated() == 0);
+  CHECK(arena.HighWater() == high_water);
+
+  before = heap_allocations;
+  {
+    std::pmr::vector<int> numbers(100, 7, &arena);
+    CHECK(heap_allocations == before);
+  }
+}
+
+void PacketTest() {
+  uint8_t expected[512];
+  size_t expected_len = Respond(std::pmr::get_default_resource(), expected,
+                                sizeof(expected));
+
+  Arena arena;
+  uint8_t reply[512];
+  size_t len;
+  {
+    Arena::ScopedReset reset(&arena);
+    len = Respond(&arena, reply, sizeof(reply));
+  }
+  CHECK(len == expected_len && memcmp(reply, expected, len) == 0);
+
+  // Once the arena has been through one query, the next one doesn't touch the
+  // heap at all.
+  size_t before = heap_allocations;
+  {
+    Arena::ScopedReset reset(&arena);
+    len = Respond(&arena, reply, sizeof(reply));
+  }
+  size_t with_arena = heap_allocations - before;
+  before = heap_allocations;
+  Respond(std::pmr::get_default_resource(), reply, sizeof(reply));
+  size_t without_arena = heap_allocations - before;
+  std::cout << "heap allocations per query: " << without_arena
+            << " without an arena, " << with_arena << " with one ("
+            << arena.HighWater() << " bytes)\n";
+  CHECK(with_arena == 0 && without_arena > 0);
+}
+
+void Benchmark(size_t queries) {
+  uint8_t reply[512];
+  auto ns_per_op = [queries](auto duration) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(duration)
+               .count() /
+           static_cast<double>(queries);
+  };
+
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < queries; i++)
+    Respond(std::pmr::get_default_resource(), reply, sizeof(reply));
+  auto heap_time = std::chrono::steady_clock::now() - start;
+
+  Arena arena;
+  start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < queries; i++) {
+    Arena::ScopedReset reset(&arena);
+    Respond(&arena, reply, sizeof(reply));
+  }
+  auto arena_time = std::chrono::steady_clock::now() - start;
+
+  std::cout << queries << " queries\n"
+            << "  heap:  " << ns_per_op(heap_time) << " ns/op\n"
+            << "  arena: " << ns_per_op(arena_time) << " ns/op\n";
+}
+
+int main() {
+  ArenaTest();
+  PacketTest();
+  Benchmark(100000);
+  puts("OK");
+}
@@ -0,0 +1,218 @@
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "homedns/bitstream.h"
+#include "homedns/blocklist.h"
+#include "homedns/labels.h"
+#include "homedns/packet.h"
+#include "homedns/suffix_tree.h"
+#include "homedns/test/check.h"
+#include "homedns/wire.h"
+
+using homedns::Blocklist;
+
+void MatchTest() {
+  Blocklist::Builder builder;
+  builder.Parse(
+      "# a hosts file\n"
+      "127.0.0.1 localhost\n"
+      "::1 localhost ip6-localhost\n"
+      "0.0.0.0 ads.example.com tracker.example.net  # two at once\n"
+      "0.0.0.0\tpixel.Example.ORG\r\n"
+      "\n"
+      "! an adblock list\n"
+      "||doubleclick.net^\n"
+      "@@||allowed.doubleclick.net^\n"
+      "example.com##.banner\n"
+      "*.metrics.io\n"
+      "plain.example.com\n"
+      "not a name\n"
+      "bad_chars?.com\n");
+  CHECK(builder.Add("exact.lan", Blocklist::Match::kExact));
+  CHECK(!builder.Add("", Blocklist::Match::kExact));
+  CHECK(!builder.Add("a..b", Blocklist::Match::kExact));
+  CHECK(!builder.Add(std::string(64, 'x') + ".com", Blocklist::Match::kExact));
+  // Repeats, and an entry that widens an earlier exact one.
+  builder.Add("ads.example.com", Blocklist::Match::kExact);
+  builder.Add("plain.example.com", Blocklist::Match::kSubdomains);
+  Blocklist list = std::move(builder).Build();
+  CHECK(list.Size() == 7);
+
+  CHECK(!list.Blocks("localhost"));
+  CHECK(list.Blocks("ads.example.com"));
+  CHECK(list.Blocks("ADS.Example.Com."));
+  CHECK(!list.Blocks("example.com"));
+  CHECK(!list.Blocks("x.ads.example.com"));
+  CHECK(list.Blocks("tracker.example.net"));
+  CHECK(list.Blocks("pixel.example.org"));
+
+  CHECK(list.Blocks("doubleclick.net"));
+  CHECK(list.Blocks("ad.g.doubleclick.net"));
+  CHECK(list.Blocks("allowed.doubleclick.net"));
+  CHECK(!list.Blocks("notdoubleclick.net"));
+  CHECK(list.Blocks("metrics.io"));
+  CHECK(list.Blocks("eu.metrics.io"));
+  CHECK(list.Blocks("x.plain.example.com"));
+  CHECK(list.Blocks("exact.lan"));
+  CHECK(!list.Blocks("a.exact.lan"));
+
+  homedns::LabelManager labels;
+  CHECK(list.Blocks(labels.GetLabelSeq("beacon.doubleclick.net").Unwrap()));
+  CHECK(!list.Blocks(labels.GetLabelSeq("www.lan").Unwrap()));
+
+  CHECK(!Blocklist().Blocks("ads.example.com"));
+}
+
+std::vector<uint8_t> BuildQuery(const std::string& name, uint16_t type) {
+  homedns::DnsPacket packet =
+      homedns::DnsPacket::Create(0xABCD).AddQuestion(name, type, 0x01).Unwrap();
+  homedns::WriteStream ws(512);
+  auto ext = packet.Export(&ws);
+  CHECK(ext.is_ok());
+  auto rs = ws.Convert();
+  return std::vector<uint8_t>(rs->GetBuffer(), rs->GetBuffer() + rs->Size());
+}
+
+void ReplyTest() {
+  using homedns::BlockedReplies;
+  using homedns::wire::ReadU16;
+  uint8_t reply[512];
+
+  BlockedReplies null_address(BlockedReplies::Mode::kNullAddress, 60);
+  std::vector<uint8_t> query = BuildQuery("ads.example.com", 1);
+  size_t len =
+      null_address.Write(query.data(), query.size(), reply, sizeof(reply));
+  CHECK(len == query.size() + 16);
+  CHECK(ReadU16(reply) == 0xABCD);
+  CHECK((reply[3] & 0x0F) == 0);
+  CHECK(ReadU16(reply + 6) == 1);
+  // The answer points back at the question, and holds 0.0.0.0 for a minute.
+  const uint8_t* answer = reply + query.size();
+  CHECK(ReadU16(answer) == 0xC00C && ReadU16(answer + 2) == 1);
+  CHECK(ReadU16(answer + 8) == 60 && ReadU16(answer + 10) == 4);
+  CHECK(answer[12] == 0 && answer[15] == 0);
+
+  query = BuildQuery("ads.example.com", 28);
+  len = null_address.Write(query.data(), query.size(), reply, sizeof(reply));
+  CHECK(len == query.size() + 28);
+  CHECK(ReadU16(reply + query.size() + 10) == 16);
+
+  // Other types exist, but have nothing.
+  query = BuildQuery("ads.example.com", 16);
+  len = null_address.Write(query.data(), query.size(), reply, sizeof(reply));
+  CHECK(len == query.size() && ReadU16(reply + 6) == 0);
+  CHECK((reply[3] & 0x0F) == 0);
+
+  BlockedReplies name_error(BlockedReplies::Mode::kNameError, 60);
+  query = BuildQuery("ads.example.com", 1);
+  len = name_error.Write(query.data(), query.size(), reply, sizeof(reply));
+  CHECK(len == query.size() && ReadU16(reply + 6) == 0);
+  CHECK((reply[3] & 0x0F) == 3);
+
+  // Responses are never answered.
+  query[2] |= 0x80;
+  CHECK(name_error.Write(query.data(), query.size(), reply, sizeof(reply)) ==
+        0);
+}
+
+std::string RandomLabel(std::mt19937* random) {
+  static const char kChars[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+  std::string label;
+  size_t length = 3 + (*random)() % 10;
+  for (size_t i = 0; i < length; i++)
+    label += kChars[(*random)() % 36];
+  return label;
+}
+
+// Blocks |entries| names, a tenth of them with their subdomains, and asks
+// about names of which a tenth are blocked, as a busy home network might.
+void Benchmark(size_t entries, size_t lookups) {
+  static const char* kTLDs[] = {"com", "net", "org", "io", "de", "co.uk"};
+  std::mt19937 random(1234);
+
+  std::vector<std::string> names;
+  Blocklist::Builder builder;
+  // Random short labels repeat; like the blocklist, the tree should cover
+  // subdomains if any entry for the name did.
+  std::unordered_map<std::string, uint8_t> covers;
+  for (size_t i = 0; i < entries; i++) {
+    std::string name = kTLDs[random() % 6];
+    size_t depth = 1 + random() % 3;
+    for (size_t d = 0; d < depth; d++)
+      name = RandomLabel(&random) + "." + name;
+    names.push_back(name);
+    bool subdomains = i % 10 == 0;
+    builder.Add(name, subdomains ? Blocklist::Match::kSubdomains
+                                 : Blocklist::Match::kExact);
+    covers[name] |= subdomains;
+  }
+  homedns::SuffixTree<uint8_t>::Builder tree_builder;
+  for (const auto& [name, subdomains] : covers)
+    tree_builder.Insert(name, subdomains);
+  auto start = std::chrono::steady_clock::now();
+  Blocklist list = std::move(builder).Build();
+  auto build_time = std::chrono::steady_clock::now() - start;
+  homedns::SuffixTree<uint8_t> tree = std::move(tree_builder).Build();
+
+  std::vector<std::string> queries;
+  for (size_t i = 0; i < lookups; i++) {
+    if (i % 10 == 0) {
+      queries.push_back(names[random() % names.size()]);
+    } else {
+      queries.push_back(RandomLabel(&random) + "." + RandomLabel(&random) +
+                        "." + kTLDs[random() % 6]);
+    }
+  }
+
+  // The same answers as an exact structure would give.
+  auto tree_blocks = [&tree](const std::string& query) {
+    auto match = tree.LongestMatch(query);
+    std::string_view labels[homedns::_suffix_tree::kMaxLabels];
+    size_t count = homedns::_suffix_tree::SplitName(query, labels);
+    return match.value && (*match.value || match.labels == count);
+  };
+  for (const std::string& query : queries)
+    CHECK(list.Blocks(query) == tree_blocks(query));
+
+  size_t blocked = 0;
+  start = std::chrono::steady_clock::now();
+  for (const std::string& query : queries)
+    blocked += list.Blocks(query);
+  auto list_time = std::chrono::steady_clock::now() - start;
+
+  start = std::chrono::steady_clock::now();
+  for (const std::string& query : queries)
+    blocked += tree_blocks(query);
+  auto tree_time = std::chrono::steady_clock::now() - start;
+
+  auto ns_per_op = [lookups](auto duration) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(duration)
+               .count() /
+           static_cast<double>(lookups);
+  };
+  double per_million = 1e6 / entries / (1024 * 1024);
+  std::cout << entries << " names, " << lookups << " lookups (" << blocked / 2
+            << " blocked)\n"
+            << "  blocklist:   " << ns_per_op(list_time) << " ns/op, "
+            << list.MemoryUsage() * per_million << " MiB per million names, "
+            << "built in "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(
+                   build_time)
+                   .count()
+            << " ms\n"
+            << "  suffix tree: " << ns_per_op(tree_time) << " ns/op, "
+            << tree.MemoryUsage() * per_million << " MiB per million names\n";
+  CHECK(ns_per_op(list_time) < 1000);
+}
+
+int main() {
+  MatchTest();
+  ReplyTest();
+  Benchmark(100000, 1000000);
+  Benchmark(2000000, 1000000);
+  puts("OK");
+}
@@ -0,0 +1,113 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+#include "base/bind/bind.h"
+#include "homedns/busy_poll.h"
+#include "homedns/latency_histogram.h"
+#include "homedns/test/check.h"
+#include "homedns/udp_server.h"
+#include "homedns/wire.h"
+
+using Clock = std::chrono::steady_clock;
+using std::chrono::microseconds;
+
+constexpr uint16_t kServerPort = 5401;
+
+// A busy socket keeps the whole budget, and an idle one backs off to the
+// minimum.
+void BackOffTest() {
+  homedns::BusyPoller poller(microseconds(100));
+  CHECK(poller.CurrentBudget() == microseconds(100));
+  int calls = 0;
+  CHECK(poller.Spin([&] { return ++calls == 3; }));
+  CHECK(calls == 3);
+
+  auto start = Clock::now();
+  CHECK(!poller.Spin([] { return false; }));
+  CHECK(Clock::now() - start >= microseconds(100));
+  CHECK(poller.CurrentBudget() == microseconds(50));
+  for (int i = 0; i < 10; i++)
+    CHECK(!poller.Spin([] { return false; }));
+  CHECK(poller.CurrentBudget() == homedns::BusyPoller::kMinSpin);
+
+  CHECK(poller.Spin([] { return true; }));
+  CHECK(poller.CurrentBudget() == microseconds(100));
+  CHECK(poller.GetStats().hits == 2);
+  CHECK(poller.GetStats().misses == 11);
+}
+
+void Echo(homedns::Response response,
+          uint8_t* data,
+          size_t len,
+          struct sockaddr_in) {
+  data[2] |= 0x80;
+  response.SendData(data, len);
+}
+
+// Plays a client asking one question at a time, with a pause between them
+// like real traffic has, so that every query finds the server idle.
+homedns::LatencyHistogram::Summary Load(int queries, microseconds pause) {
+  int client = socket(AF_INET, SOCK_DGRAM, 0);
+  struct sockaddr_in server_addr;
+  memset(&server_addr, 0, sizeof(server_addr));
+  server_addr.sin_family = AF_INET;
+  server_addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+  server_addr.sin_port = htons(kServerPort);
+  connect(client, reinterpret_cast<sockaddr*>(&server_addr),
+          sizeof(server_addr));
+
+  uint8_t query[] = {0, 0, 0x01, 0, 0, 1, 0, 0, 0, 0, 0, 0,
+                     1, 'a', 0, 0, 1, 0, 1};
+  uint8_t reply[512];
+  homedns::LatencyHistogram latency;
+  struct pollfd fd = {client, POLLIN, 0};
+  for (int i = 0; i < queries; i++) {
+    homedns::wire::WriteU16(query, i);
+    auto start = Clock::now();
+    send(client, query, sizeof(query), 0);
+    CHECK(poll(&fd, 1, 1000) == 1);
+    CHECK(recv(client, reply, sizeof(reply), 0) == sizeof(query));
+    latency.Record(Clock::now() - start);
+    CHECK(homedns::wire::ReadU16(reply) == i);
+    std::this_thread::sleep_for(pause);
+  }
+  close(client);
+  return latency.Summarize();
+}
+
+homedns::LatencyHistogram::Summary Run(microseconds busy_poll) {
+  auto server = homedns::UDPServer::Create(kServerPort);
+  CHECK(server);
+  server->OnData(base::BindRepeating(&Echo));
+  if (busy_poll.count() > 0)
+    server->EnableBusyPoll(busy_poll);
+  std::thread loop(&homedns::UDPServer::Start, server.get());
+
+  homedns::LatencyHistogram::Summary summary = Load(5000, microseconds(20));
+  server->Stop();
+  loop.join();
+  CHECK(summary.count == 5000);
+  return summary;
+}
+
+void Print(const char* mode, const homedns::LatencyHistogram::Summary& s) {
+  std::cout << mode << ": p50 " << s.p50.count() << " ns, p99 "
+            << s.p99.count() << " ns, max " << s.max.count() << " ns\n";
+}
+
+int main() {
+  BackOffTest();
+  // Whatever the kernel allows, the latencies below are from the loop alone
+  // when SO_BUSY_POLL is refused.
+  Print("poll()     ", Run(microseconds(0)));
+  Print("busy poll  ", Run(microseconds(200)));
+  puts("OK");
+}
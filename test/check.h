@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstdlib>
+#include <iostream>
+
+// Fails the test there and then, naming the line, unless |expr| holds.
+#define CHECK(expr)                                           \
+  do {                                                        \
+    if (!(expr)) {                                            \
+      std::cout << __LINE__ << ": CHECK(" #expr ") failed\n"; \
+      exit(1);                                                \
+    }                                                         \
+  } while (0)
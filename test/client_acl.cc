@@ -0,0 +1,163 @@
+#include <arpa/inet.h>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include "homedns/client_acl.h"
+#include "homedns/test/check.h"
+
+using homedns::ClientAcl;
+using Action = ClientAcl::Action;
+
+struct sockaddr_in V4(const char* address) {
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  inet_pton(AF_INET, address, &addr.sin_addr);
+  return addr;
+}
+
+struct in6_addr V6(const char* address) {
+  struct in6_addr addr = {};
+  inet_pton(AF_INET6, address, &addr);
+  return addr;
+}
+
+void MatchTest() {
+  auto m_acl = ClientAcl::Parse(
+      "# home network\n"
+      "allow 192.168.0.0/16\n"
+      "deny  192.168.66.0/24   # guests\n"
+      "allow 192.168.66.7\n"
+      "\n"
+      "allow 10.0.0.0/8\n"
+      "deny 10.200.0.0/13\n"
+      "allow fd00::/8\n"
+      "deny fd00:bad::/32\n");
+  CHECK(m_acl.has_value());
+  ClientAcl acl = std::move(m_acl).value();
+  CHECK(acl.PrefixCount() == 7);
+
+  CHECK(acl.Check(V4("192.168.1.20")) == Action::kAllow);
+  CHECK(acl.Check(V4("192.168.66.1")) == Action::kDeny);
+  CHECK(acl.Check(V4("192.168.66.7")) == Action::kAllow);
+  CHECK(acl.Check(V4("192.169.0.1")) == Action::kDeny);
+  CHECK(acl.Check(V4("10.1.2.3")) == Action::kAllow);
+  CHECK(acl.Check(V4("10.207.255.255")) == Action::kDeny);
+  CHECK(acl.Check(V4("10.208.0.0")) == Action::kAllow);
+  CHECK(acl.Check(V4("8.8.8.8")) == Action::kDeny);
+
+  CHECK(acl.Check(V6("fd12::1")) == Action::kAllow);
+  CHECK(acl.Check(V6("fd00:bad::1")) == Action::kDeny);
+  CHECK(acl.Check(V6("2001:db8::1")) == Action::kDeny);
+  CHECK(acl.Check(V6("::ffff:192.168.1.20")) == Action::kAllow);
+
+  auto everyone = ClientAcl::Parse("allow 0.0.0.0/0\ndeny 127.0.0.0/8\n");
+  CHECK(everyone.has_value());
+  acl = std::move(everyone).value();
+  CHECK(acl.Check(V4("1.2.3.4")) == Action::kAllow);
+  CHECK(acl.Check(V4("127.0.0.1")) == Action::kDeny);
+  CHECK(acl.Check(V6("::1")) == Action::kDeny);
+
+  CHECK(!ClientAcl::Parse("permit 10.0.0.0/8\n").has_value());
+  CHECK(!ClientAcl::Parse("allow 10.0.0.0/33\n").has_value());
+  CHECK(!ClientAcl::Parse("allow 10.0.0/8\n").has_value());
+  CHECK(!ClientAcl::Parse("allow 10.0.0.0/x\n").has_value());
+  CHECK(!ClientAcl::Load("/nonexistent/acl").has_value());
+}
+
+// Longest prefix match by probing a hash table per prefix length, longest
+// first. This is what the table is meant to beat.
+class HashPerLength {
+ public:
+  void Insert(uint32_t addr, size_t bits, Action action) {
+    tables_[bits][Mask(addr, bits)] = action;
+  }
+
+  Action Check(uint32_t addr) const {
+    for (size_t bits = 33; bits-- > 0;) {
+      if (tables_[bits].empty())
+        continue;
+      auto it = tables_[bits].find(Mask(addr, bits));
+      if (it != tables_[bits].end())
+        return it->second;
+    }
+    return Action::kDeny;
+  }
+
+ private:
+  static uint32_t Mask(uint32_t addr, size_t bits) {
+    return bits ? addr & ~((uint64_t(1) << (32 - bits)) - 1) : 0;
+  }
+
+  std::unordered_map<uint32_t, Action> tables_[33];
+};
+
+void Benchmark(size_t prefixes, size_t lookups) {
+  std::mt19937 random(1234);
+  ClientAcl::Builder builder;
+  HashPerLength hash;
+  std::vector<uint32_t> networks;
+  for (size_t i = 0; i < prefixes; i++) {
+    // Mostly /16 to /24, like a real allow list, with some hosts and a few
+    // large blocks.
+    size_t bits = 16 + random() % 9;
+    if (i % 10 == 0)
+      bits = 32;
+    if (i % 100 == 0)
+      bits = 8 + random() % 8;
+    uint32_t addr = random();
+    Action action = random() % 4 ? Action::kAllow : Action::kDeny;
+    struct in_addr in = {htonl(addr)};
+    std::string prefix =
+        std::string(inet_ntoa(in)) + "/" + std::to_string(bits);
+    CHECK(builder.Add(prefix, action).is_ok());
+    hash.Insert(addr, bits, action);
+    networks.push_back(addr);
+  }
+  ClientAcl acl = std::move(builder).Build();
+
+  // Half of the clients are inside a stored prefix, half are anywhere.
+  std::vector<struct sockaddr_in> clients;
+  for (size_t i = 0; i < lookups; i++) {
+    uint32_t addr = random();
+    if (i % 2)
+      addr = networks[random() % networks.size()] ^ (random() & 0xFF);
+    struct sockaddr_in client = {};
+    client.sin_addr.s_addr = htonl(addr);
+    clients.push_back(client);
+  }
+
+  for (const auto& client : clients)
+    CHECK(acl.Check(client) == hash.Check(ntohl(client.sin_addr.s_addr)));
+
+  size_t allowed = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (const auto& client : clients)
+    allowed += acl.Check(client) == Action::kAllow;
+  auto table_time = std::chrono::steady_clock::now() - start;
+
+  start = std::chrono::steady_clock::now();
+  for (const auto& client : clients)
+    allowed += hash.Check(ntohl(client.sin_addr.s_addr)) == Action::kAllow;
+  auto hash_time = std::chrono::steady_clock::now() - start;
+
+  auto ns_per_op = [lookups](auto duration) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(duration)
+               .count() /
+           static_cast<double>(lookups);
+  };
+  std::cout << prefixes << " prefixes, " << lookups << " lookups ("
+            << allowed / 2 << " allowed)\n"
+            << "  prefix table:    " << ns_per_op(table_time) << " ns/op, "
+            << acl.MemoryUsage() / 1024 << " KiB\n"
+            << "  hash per length: " << ns_per_op(hash_time) << " ns/op\n";
+}
+
+int main() {
+  MatchTest();
+  Benchmark(1000, 1000000);
+  Benchmark(50000, 1000000);
+  puts("OK");
+}
@@ -0,0 +1,490 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "homedns/dynamic_zone.h"
+#include "homedns/labels.h"
+#include "homedns/latency_histogram.h"
+#include "homedns/packet.h"
+#include "homedns/test/check.h"
+
+using homedns::DnsPacket;
+using homedns::DynamicZone;
+using homedns::HostAddress;
+using homedns::ResponseCode;
+
+constexpr uint16_t kA = 1;
+constexpr uint16_t kCNAME = 5;
+constexpr uint16_t kTXT = 16;
+constexpr uint16_t kIN = 1;
+constexpr uint16_t kNone = 254;
+constexpr uint16_t kAny = 255;
+
+struct RR {
+  std::string name;
+  uint16_t type;
+  uint16_t klass;
+  uint32_t ttl;
+  std::vector<uint8_t> rdata;
+};
+
+std::vector<uint8_t> Address(uint8_t last) {
+  return {192, 168, 1, last};
+}
+
+std::vector<uint8_t> Name(const std::string& name) {
+  std::vector<uint8_t> wire;
+  size_t start = 0;
+  while (start < name.size()) {
+    size_t dot = std::min(name.find('.', start), name.size());
+    wire.push_back(dot - start);
+    wire.insert(wire.end(), name.begin() + start, name.begin() + dot);
+    start = dot + 1;
+  }
+  wire.push_back(0);
+  return wire;
+}
+
+HostAddress Client(const char* address) {
+  return HostAddress::Parse(address).value();
+}
+
+const HostAddress kClient = Client("192.168.1.9");
+
+RR Add(const std::string& name, uint8_t last, uint32_t ttl = 300) {
+  return {name, kA, kIN, ttl, Address(last)};
+}
+
+DnsPacket Update(const std::vector<RR>& prerequisites,
+                 const std::vector<RR>& updates,
+                 const std::string& zone = "lan",
+                 uint16_t zone_type = 6) {
+  DnsPacket packet = DnsPacket::Create(0x1234)
+                         .SetOpCode(5)
+                         .AddQuestion(zone, zone_type, kIN)
+                         .Unwrap();
+  for (const RR& rr : prerequisites) {
+    packet = std::move(packet)
+                 .AddRecordData<DnsPacket::RecordType::kAnswer>(
+                     rr.name, rr.type, rr.klass, rr.ttl, rr.rdata)
+                 .Unwrap();
+  }
+  for (const RR& rr : updates) {
+    packet = std::move(packet)
+                 .AddRecordData<DnsPacket::RecordType::kAuthority>(
+                     rr.name, rr.type, rr.klass, rr.ttl, rr.rdata)
+                 .Unwrap();
+  }
+  return packet;
+}
+
+ResponseCode Apply(DynamicZone* zone,
+                   const std::vector<RR>& prerequisites,
+                   const std::vector<RR>& updates,
+                   const HostAddress& client = kClient) {
+  DnsPacket packet = Update(prerequisites, updates);
+  return zone->Update(&packet, client);
+}
+
+std::string TempJournal() {
+  char path[] = "/tmp/dynamic_zone.XXXXXX";
+  int fd = mkstemp(path);
+  CHECK(fd >= 0);
+  close(fd);
+  return path;
+}
+
+std::unique_ptr<DynamicZone> Open(const std::string& path) {
+  auto m_zone = DynamicZone::Open("lan", path);
+  CHECK(m_zone.has_value());
+  return std::move(m_zone).value();
+}
+
+void UpdateTest() {
+  std::string path = TempJournal();
+  auto zone = Open(path);
+  CHECK(zone->NameCount() == 0);
+
+  CHECK(Apply(zone.get(), {}, {Add("phone.lan", 20), Add("phone.lan", 21)}) ==
+        ResponseCode::kNoError);
+  CHECK(zone->Lookup("PHONE.lan.", kA).size() == 2);
+  CHECK(zone->Serial() == 1);
+  // A duplicate only changes the TTL.
+  CHECK(Apply(zone.get(), {}, {Add("phone.lan", 20, 60)}) ==
+        ResponseCode::kNoError);
+  CHECK(zone->Lookup("phone.lan", kA).size() == 2);
+  CHECK(zone->Lookup("phone.lan", kA)[0].ttl == 60);
+  // Nothing changed, nothing to bump.
+  CHECK(Apply(zone.get(), {}, {Add("phone.lan", 20, 60)}) ==
+        ResponseCode::kNoError);
+  CHECK(zone->Serial() == 2);
+
+  // An alias can't join other records, nor they it.
+  CHECK(Apply(zone.get(), {},
+              {{"phone.lan", kCNAME, kIN, 300, Name("tv.lan")},
+               {"alias.lan", kCNAME, kIN, 300, Name("phone.lan")},
+               Add("alias.lan", 30)}) == ResponseCode::kNoError);
+  CHECK(zone->Lookup("phone.lan", kCNAME).empty());
+  CHECK(zone->Lookup("alias.lan", kAny).size() == 1);
+
+  // One record, then the RRset, then the name.
+  CHECK(Apply(zone.get(), {}, {{"phone.lan", kA, kNone, 0, Address(21)}}) ==
+        ResponseCode::kNoError);
+  CHECK(zone->Lookup("phone.lan", kA).size() == 1);
+  CHECK(Apply(zone.get(), {},
+              {{"phone.lan", kTXT, kIN, 300, {5, 'h', 'e', 'l', 'l', 'o'}}}) ==
+        ResponseCode::kNoError);
+  CHECK(Apply(zone.get(), {}, {{"phone.lan", kA, kAny, 0, {}}}) ==
+        ResponseCode::kNoError);
+  CHECK(zone->Lookup("phone.lan", kAny).size() == 1);
+  CHECK(Apply(zone.get(), {}, {{"phone.lan", kAny, kAny, 0, {}}}) ==
+        ResponseCode::kNoError);
+  CHECK(zone->Lookup("phone.lan", kAny).empty());
+  CHECK(zone->NameCount() == 1);
+
+  // Refused as a whole.
+  CHECK(Apply(zone.get(), {}, {Add("tv.lan", 40), Add("tv.example.com", 40)}) ==
+        ResponseCode::kNotZone);
+  CHECK(zone->Lookup("tv.lan", kA).empty());
+  CHECK(Apply(zone.get(), {}, {{"tv.lan", kAny, kIN, 300, {}}}) ==
+        ResponseCode::kFormatError);
+  CHECK(Apply(zone.get(), {}, {{"tv.lan", kA, kAny, 300, {}}}) ==
+        ResponseCode::kFormatError);
+  CHECK(Apply(zone.get(), {}, {{"tv.lan", kA, 3, 300, Address(40)}}) ==
+        ResponseCode::kFormatError);
+  DnsPacket other_zone = Update({}, {Add("tv.home", 40)}, "home");
+  CHECK(zone->Update(&other_zone, kClient) == ResponseCode::kNotAuth);
+  DnsPacket not_soa = Update({}, {Add("tv.lan", 40)}, "lan", kA);
+  CHECK(zone->Update(&not_soa, kClient) == ResponseCode::kFormatError);
+  unlink(path.c_str());
+}
+
+void PrerequisiteTest() {
+  std::string path = TempJournal();
+  auto zone = Open(path);
+  CHECK(Apply(zone.get(), {}, {Add("nas.lan", 10), Add("nas.lan", 11)}) ==
+        ResponseCode::kNoError);
+
+  // Name in use, and not.
+  CHECK(Apply(zone.get(), {{"nas.lan", kAny, kAny, 0, {}}}, {}) ==
+        ResponseCode::kNoError);
+  CHECK(Apply(zone.get(), {{"tv.lan", kAny, kAny, 0, {}}}, {}) ==
+        ResponseCode::kNameError);
+  CHECK(Apply(zone.get(), {{"nas.lan", kAny, kNone, 0, {}}}, {}) ==
+        ResponseCode::kYXDomain);
+  // RRset exists, and doesn't.
+  CHECK(Apply(zone.get(), {{"nas.lan", kA, kAny, 0, {}}}, {}) ==
+        ResponseCode::kNoError);
+  CHECK(Apply(zone.get(), {{"nas.lan", kTXT, kAny, 0, {}}}, {}) ==
+        ResponseCode::kNXRRSet);
+  CHECK(Apply(zone.get(), {{"nas.lan", kA, kNone, 0, {}}}, {}) ==
+        ResponseCode::kYXRRSet);
+  // RRset exists with exactly these values, in any order.
+  CHECK(Apply(zone.get(),
+              {{"nas.lan", kA, kIN, 0, Address(11)},
+               {"nas.lan", kA, kIN, 0, Address(10)}},
+              {}) == ResponseCode::kNoError);
+  CHECK(Apply(zone.get(), {{"nas.lan", kA, kIN, 0, Address(10)}}, {}) ==
+        ResponseCode::kNXRRSet);
+  CHECK(Apply(zone.get(), {{"nas.lan", kA, kAny, 60, {}}}, {}) ==
+        ResponseCode::kFormatError);
+  CHECK(Apply(zone.get(), {{"nas.example.com", kA, kAny, 0, {}}}, {}) ==
+        ResponseCode::kNotZone);
+
+  // A failed prerequisite stops the update.
+  CHECK(Apply(zone.get(), {{"tv.lan", kAny, kAny, 0, {}}},
+              {Add("tv.lan", 40)}) == ResponseCode::kNameError);
+  CHECK(zone->Lookup("tv.lan", kA).empty());
+  // Register only if nobody has the name yet.
+  CHECK(Apply(zone.get(), {{"tv.lan", kAny, kNone, 0, {}}},
+              {Add("tv.lan", 40)}) == ResponseCode::kNoError);
+  CHECK(zone->Lookup("tv.lan", kA).size() == 1);
+  unlink(path.c_str());
+}
+
+void WireTest() {
+  std::string path = TempJournal();
+  auto zone = Open(path);
+  // Empty RDATA with class ANY or NONE survives a trip over the wire, even
+  // for types whose RDATA is a name.
+  DnsPacket update =
+      Update({{"files.lan", kCNAME, kNone, 0, {}}},
+             {Add("nas.lan", 10),
+              {"files.lan", kCNAME, kIN, 300, Name("nas.lan")},
+              {"old.lan", kCNAME, kAny, 0, {}}});
+  homedns::WriteStream ws(512);
+  CHECK(update.Export(&ws).is_ok());
+  auto rs = ws.Convert();
+  auto m_imported = DnsPacket::Import(rs.get());
+  CHECK(m_imported.has_value());
+  DnsPacket imported = std::move(m_imported).value();
+  CHECK(zone->Update(&imported, kClient) == ResponseCode::kNoError);
+
+  homedns::LabelManager labels;
+  CHECK(zone->Contains(labels.GetLabelSeq("Files.Lan").Unwrap()));
+  CHECK(!zone->Contains(labels.GetLabelSeq("old.lan").Unwrap()));
+  CHECK(!zone->Contains(labels.GetLabelSeq("files.example.com").Unwrap()));
+
+  // The alias answers for an A query, and the name stays as sent.
+  DnsPacket query = DnsPacket::Create(1).AddQuestion("FILES.lan", kA, kIN)
+                        .Unwrap();
+  auto m_answer = zone->Answer(query.GetQuestion(0).value(),
+                               DnsPacket::Create(1));
+  CHECK(m_answer.has_value());
+  DnsPacket answer = std::move(m_answer).value();
+  CHECK(answer.GetNumAnswers() == 1);
+  CHECK(answer.GetAnswers().Preamble(0).Type == kCNAME);
+  query = DnsPacket::Create(1).AddQuestion("nas.lan", kTXT, kIN).Unwrap();
+  CHECK(zone->Answer(query.GetQuestion(0).value(), DnsPacket::Create(1))
+            .code() == homedns::PacketStatus::Codes::kInvalidRecordType);
+  query = DnsPacket::Create(1).AddQuestion("tv.lan", kA, kIN).Unwrap();
+  CHECK(zone->Answer(query.GetQuestion(0).value(), DnsPacket::Create(1))
+            .code() == homedns::PacketStatus::Codes::kNameNotFound);
+  unlink(path.c_str());
+}
+
+void JournalTest() {
+  std::string path = TempJournal();
+  {
+    auto zone = Open(path);
+    for (int i = 0; i < 100; i++) {
+      CHECK(Apply(zone.get(), {},
+                  {Add("host" + std::to_string(i) + ".lan", i)}) ==
+            ResponseCode::kNoError);
+    }
+    CHECK(Apply(zone.get(), {}, {{"host7.lan", kAny, kAny, 0, {}}}) ==
+          ResponseCode::kNoError);
+  }
+  {
+    auto zone = Open(path);
+    CHECK(zone->NameCount() == 99);
+    CHECK(zone->Serial() == 101);
+    CHECK(zone->Lookup("host42.lan", kA)[0].rdata == Address(42));
+    CHECK(zone->Lookup("host7.lan", kA).empty());
+  }
+
+  // A crash mid-write leaves a torn entry, which is cut off.
+  uint64_t good_size;
+  {
+    auto zone = Open(path);
+    good_size = zone->JournalSize();
+  }
+  {
+    std::ofstream out(path, std::ios::app | std::ios::binary);
+    out << std::string("\x00\x00\x00\x40\x12\x34", 6);
+  }
+  {
+    auto zone = Open(path);
+    CHECK(zone->JournalSize() == good_size);
+    CHECK(zone->NameCount() == 99);
+    // And later entries follow on from the good ones.
+    CHECK(Apply(zone.get(), {}, {Add("late.lan", 200)}) ==
+          ResponseCode::kNoError);
+  }
+  {
+    auto zone = Open(path);
+    CHECK(zone->NameCount() == 100);
+    CHECK(zone->Serial() == 102);
+  }
+
+  // A chatty client whose address keeps changing grows the journal, but not
+  // for ever.
+  {
+    auto zone = Open(path);
+    for (int i = 0; i < 40000; i++) {
+      CHECK(Apply(zone.get(), {},
+                  {{"laptop.lan", kA, kAny, 0, {}},
+                   Add("laptop.lan", i % 250)}) == ResponseCode::kNoError);
+    }
+    CHECK(zone->JournalSize() < 2 << 20);
+    CHECK(zone->Lookup("laptop.lan", kA)[0].rdata == Address(39999 % 250));
+  }
+  {
+    auto zone = Open(path);
+    CHECK(zone->NameCount() == 101);
+    CHECK(zone->Lookup("laptop.lan", kA).size() == 1);
+    CHECK(zone->Lookup("laptop.lan", kA)[0].rdata == Address(39999 % 250));
+  }
+  unlink(path.c_str());
+}
+
+void OwnerTest() {
+  std::string path = TempJournal();
+  HostAddress other = Client("192.168.1.10");
+  {
+    auto zone = Open(path);
+    CHECK(Apply(zone.get(), {}, {Add("printer.lan", 9)}) ==
+          ResponseCode::kNoError);
+    // Another client can neither change the name nor remove it, not even as
+    // part of an update that also registers its own.
+    CHECK(Apply(zone.get(), {}, {Add("printer.lan", 10)}, other) ==
+          ResponseCode::kRefused);
+    CHECK(Apply(zone.get(), {}, {{"printer.lan", kAny, kAny, 0, {}}},
+                other) == ResponseCode::kRefused);
+    CHECK(Apply(zone.get(), {}, {Add("laptop.lan", 10), Add("printer.lan", 10)},
+                other) == ResponseCode::kRefused);
+    CHECK(zone->NameCount() == 1);
+    // Asking for what is already there changes nothing, so it isn't refused.
+    CHECK(Apply(zone.get(), {}, {Add("printer.lan", 9)}, other) ==
+          ResponseCode::kNoError);
+    CHECK(Apply(zone.get(), {}, {Add("laptop.lan", 10)}, other) ==
+          ResponseCode::kNoError);
+  }
+  {
+    // Who owns what is journaled too.
+    auto zone = Open(path);
+    CHECK(Apply(zone.get(), {}, {Add("printer.lan", 10)}, other) ==
+          ResponseCode::kRefused);
+    CHECK(Apply(zone.get(), {}, {Add("laptop.lan", 11)}) ==
+          ResponseCode::kRefused);
+    CHECK(Apply(zone.get(), {}, {Add("laptop.lan", 11)}, other) ==
+          ResponseCode::kNoError);
+    // The machine itself may change anything, without taking it over.
+    CHECK(Apply(zone.get(), {}, {Add("printer.lan", 12)},
+                Client("127.0.0.1")) == ResponseCode::kNoError);
+    CHECK(Apply(zone.get(), {}, {Add("printer.lan", 13)}, Client("::1")) ==
+          ResponseCode::kNoError);
+    CHECK(zone->Lookup("printer.lan", kA).size() == 3);
+    // Once its owner removes a name, it is anyone's.
+    CHECK(Apply(zone.get(), {}, {{"printer.lan", kAny, kAny, 0, {}}}) ==
+          ResponseCode::kNoError);
+    CHECK(Apply(zone.get(), {}, {Add("printer.lan", 10)}, other) ==
+          ResponseCode::kNoError);
+    CHECK(Apply(zone.get(), {}, {Add("printer.lan", 9)}) ==
+          ResponseCode::kRefused);
+  }
+  unlink(path.c_str());
+}
+
+// Update latency, and what readers get through while a client hammers the
+// zone with updates.
+void ReverseTest() {
+  std::string path = TempJournal();
+  auto address = homedns::HostAddress::Parse("192.168.1.20").value();
+  {
+    homedns::ReverseIndex reverse;
+    auto m_zone = DynamicZone::Open("lan", path, &reverse);
+    CHECK(m_zone.has_value());
+    auto zone = std::move(m_zone).value();
+    CHECK(Apply(zone.get(), {}, {Add("phone.lan", 20), Add("tv.lan", 20)}) ==
+          ResponseCode::kNoError);
+    CHECK(reverse.Names(address).size() == 2);
+    // A TTL change leaves it be, a move takes it along.
+    CHECK(Apply(zone.get(), {}, {Add("phone.lan", 20, 60)}) ==
+          ResponseCode::kNoError);
+    CHECK(reverse.Size() == 2);
+    CHECK(Apply(zone.get(), {},
+                {{"tv.lan", kA, kNone, 0, Address(20)}, Add("tv.lan", 21)}) ==
+          ResponseCode::kNoError);
+    CHECK(reverse.Names(address) == std::vector<std::string>{"phone.lan"});
+    CHECK(reverse.Size() == 2);
+    // A refused update changes nothing.
+    CHECK(Apply(zone.get(), {{"tv.lan", kAny, kNone, 0, {}}},
+                {Add("radio.lan", 20)}) == ResponseCode::kYXDomain);
+    CHECK(reverse.Names(address).size() == 1);
+  }
+  {
+    // Replayed from the journal.
+    homedns::ReverseIndex reverse;
+    auto m_zone = DynamicZone::Open("lan", path, &reverse);
+    CHECK(m_zone.has_value());
+    CHECK(reverse.Names(address) == std::vector<std::string>{"phone.lan"});
+    CHECK(reverse.Size() == 2);
+  }
+  unlink(path.c_str());
+}
+
+void Benchmark(size_t names) {
+  std::string path = TempJournal();
+  auto zone = Open(path);
+  std::vector<DnsPacket> registrations;
+  for (size_t i = 0; i < names; i++) {
+    registrations.push_back(
+        Update({}, {Add("host" + std::to_string(i) + ".lan", i % 250)}));
+  }
+  auto start = std::chrono::steady_clock::now();
+  for (DnsPacket& registration : registrations)
+    CHECK(zone->Update(&registration, kClient) == ResponseCode::kNoError);
+  auto load_time = std::chrono::steady_clock::now() - start;
+
+  homedns::LabelManager labels;
+  std::vector<homedns::DnsLabelSeq> lookups;
+  for (size_t i = 0; i < 1000; i++) {
+    lookups.push_back(
+        labels.GetLabelSeq("host" + std::to_string(i * 7 % names) + ".lan")
+            .Unwrap());
+  }
+
+  auto read_qps = [&](bool storm, homedns::LatencyHistogram* updates) {
+    std::atomic<bool> stop = false;
+    std::atomic<uint64_t> reads = 0;
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; t++) {
+      readers.emplace_back([&] {
+        uint64_t done = 0;
+        while (!stop.load(std::memory_order_relaxed)) {
+          for (const homedns::DnsLabelSeq& name : lookups)
+            CHECK(zone->Contains(name));
+          done += lookups.size();
+        }
+        reads += done;
+      });
+    }
+    auto begin = std::chrono::steady_clock::now();
+    auto until = begin + std::chrono::milliseconds(500);
+    size_t i = 0;
+    while (std::chrono::steady_clock::now() < until) {
+      if (!storm) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        continue;
+      }
+      DnsPacket update = Update(
+          {}, {{"host" + std::to_string(i % names) + ".lan", kA, kAny, 0, {}},
+               Add("host" + std::to_string(i % names) + ".lan", i % 250)});
+      auto update_start = std::chrono::steady_clock::now();
+      CHECK(zone->Update(&update, kClient) == ResponseCode::kNoError);
+      updates->Record(std::chrono::steady_clock::now() - update_start);
+      i++;
+    }
+    stop = true;
+    for (std::thread& reader : readers)
+      reader.join();
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - begin)
+                         .count();
+    return reads / seconds;
+  };
+  homedns::LatencyHistogram updates;
+  double idle = read_qps(false, &updates);
+  double storm = read_qps(true, &updates);
+
+  std::cout << names << " names, loaded in "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(load_time)
+                   .count()
+            << " ms\n"
+            << "  update: p50 " << updates.Percentile(0.5).count()
+            << " ns, p99 " << updates.Percentile(0.99).count() << " ns ("
+            << updates.Count() << " in 0.5 s)\n"
+            << "  4 readers: " << idle / 1e6 << " M lookups/s idle, "
+            << storm / 1e6 << " M lookups/s under the updates\n";
+  CHECK(zone->NameCount() == names);
+  unlink(path.c_str());
+}
+
+int main() {
+  UpdateTest();
+  PrerequisiteTest();
+  WireTest();
+  JournalTest();
+  OwnerTest();
+  ReverseTest();
+  Benchmark(1000);
+  Benchmark(20000);
+  puts("OK");
+}
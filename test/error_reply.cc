@@ -0,0 +1,87 @@
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "homedns/error_reply.h"
+#include "homedns/test/check.h"
+#include "homedns/wire.h"
+
+using homedns::NegativeReplies;
+using homedns::ResponseCode;
+
+std::vector<uint8_t> Query(std::string name, uint16_t type = 1) {
+  std::vector<uint8_t> query = {0x12, 0x34, 0x01, 0x00, 0, 1, 0, 0, 0, 0, 0, 0};
+  size_t start = 0;
+  while (start < name.size()) {
+    size_t dot = std::min(name.find('.', start), name.size());
+    query.push_back(dot - start);
+    query.insert(query.end(), name.begin() + start, name.begin() + dot);
+    start = dot + 1;
+  }
+  query.push_back(0);
+  query.push_back(type >> 8);
+  query.push_back(type);
+  query.push_back(0);
+  query.push_back(1);
+  return query;
+}
+
+void ErrorReplyTest() {
+  std::vector<uint8_t> query = Query("printer.lan");
+  uint8_t reply[512];
+  size_t n = homedns::WriteErrorReply(query.data(), query.size(),
+                                      ResponseCode::kServerFailure, reply,
+                                      sizeof(reply));
+  CHECK(n == query.size());
+  CHECK(reply[2] == 0x81 && reply[3] == 2);
+  CHECK(memcmp(reply + 12, query.data() + 12, query.size() - 12) == 0);
+
+  // Responses are never answered.
+  query[2] |= 0x80;
+  CHECK(homedns::WriteErrorReply(query.data(), query.size(),
+                                 ResponseCode::kServerFailure, reply,
+                                 sizeof(reply)) == 0);
+}
+
+void NegativeTest() {
+  NegativeReplies negative("lan", "ns.lan", "hostmaster.lan", 1, 60);
+  uint8_t reply[512];
+
+  // Names in the zone are denied with its authority.
+  for (const char* name : {"nothing.lan", "LAN", "a.b.Lan"}) {
+    std::vector<uint8_t> query = Query(name);
+    size_t n = negative.WriteNameError(query.data(), query.size(), reply,
+                                       sizeof(reply));
+    CHECK(n > query.size());
+    CHECK(reply[2] == 0x85 && reply[3] == 3);
+    CHECK(homedns::wire::ReadU16(reply + 8) == 1);
+  }
+  std::vector<uint8_t> query = Query("printer.lan", 28);
+  CHECK(negative.WriteNoData(query.data(), query.size(), reply,
+                             sizeof(reply)) > query.size());
+  CHECK(reply[2] == 0x85 && reply[3] == 0);
+
+  // Anything else isn't the zone's to deny.
+  for (const char* name : {"example.com", "plan", "lan.example.com"}) {
+    std::vector<uint8_t> query = Query(name);
+    size_t n = negative.WriteNameError(query.data(), query.size(), reply,
+                                       sizeof(reply));
+    CHECK(n == query.size());
+    CHECK(reply[2] == 0x81 && reply[3] == 3);
+    CHECK(homedns::wire::ReadU16(reply + 8) == 0);
+  }
+
+  // Nor is a query without a question.
+  std::vector<uint8_t> header(query.begin(), query.begin() + 12);
+  header[5] = 0;
+  CHECK(negative.WriteNameError(header.data(), header.size(), reply,
+                                sizeof(reply)) == 12);
+  CHECK(reply[2] == 0x81 && homedns::wire::ReadU16(reply + 8) == 0);
+}
+
+int main() {
+  ErrorReplyTest();
+  NegativeTest();
+  puts("OK");
+}
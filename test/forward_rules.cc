@@ -0,0 +1,102 @@
+#include <arpa/inet.h>
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include "homedns/forward_rules.h"
+#include "homedns/labels.h"
+#include "homedns/test/check.h"
+
+using homedns::ForwardRules;
+
+// The upstreams of the pool |name| goes to, or "" if it takes the default.
+std::string RouteOf(const ForwardRules& rules, const char* name) {
+  const uint32_t* index = rules.Route(name);
+  return index ? ForwardRules::Render(rules.Pools()[*index]) : "";
+}
+
+void RouteTest() {
+  auto m_rules = ForwardRules::Parse(
+      "# Work names go over the VPN.\n"
+      "*.corp.example     10.8.0.53 10.8.0.54:5353\n"
+      "eng.corp.example.  10.9.0.53\n"
+      "\n"
+      "lan                192.168.1.1  # the router\n"
+      "168.192.in-addr.arpa 192.168.1.1\n");
+  CHECK(m_rules.has_value());
+  ForwardRules rules = std::move(m_rules).value();
+  CHECK(rules.RuleCount() == 4);
+  // The router's two rules share its pool.
+  CHECK(rules.Pools().size() == 3);
+
+  CHECK(RouteOf(rules, "corp.example") == "10.8.0.53, 10.8.0.54:5353");
+  CHECK(RouteOf(rules, "WWW.Corp.Example") == "10.8.0.53, 10.8.0.54:5353");
+  CHECK(RouteOf(rules, "build.eng.corp.example") == "10.9.0.53");
+  CHECK(RouteOf(rules, "tv.lan") == "192.168.1.1");
+  CHECK(RouteOf(rules, "9.1.168.192.in-addr.arpa") == "192.168.1.1");
+  CHECK(RouteOf(rules, "example") == "");
+  CHECK(RouteOf(rules, "notcorp.example") == "");
+  CHECK(RouteOf(rules, "www.google.com") == "");
+
+  homedns::LabelManager labels;
+  const uint32_t* index =
+      rules.Route(labels.GetLabelSeq("printer.LAN").Unwrap());
+  CHECK(index && rules.Pools()[*index].size() == 1);
+  CHECK(ntohs(rules.Pools()[*index][0].sin_port) == 53);
+}
+
+void ParseErrorTest() {
+  CHECK(!ForwardRules::Parse("lan\n").has_value());
+  CHECK(!ForwardRules::Parse("lan 192.168.1\n").has_value());
+  CHECK(!ForwardRules::Parse("lan 192.168.1.1:0\n").has_value());
+  CHECK(!ForwardRules::Parse("lan 192.168.1.1:http\n").has_value());
+  CHECK(!ForwardRules::Parse("lan 192.168.1.1\nLAN. 10.0.0.1\n").has_value());
+  CHECK(!ForwardRules::Parse("a.*.lan 192.168.1.1\n").has_value());
+  CHECK(!ForwardRules::Parse(". 192.168.1.1\n").has_value());
+  CHECK(ForwardRules::Load("/nonexistent").code() ==
+        homedns::ConfigStatus::Codes::kFileNotFound);
+  auto pool = ForwardRules::ParsePool("1.1.1.1,8.8.8.8:5353 9.9.9.9");
+  CHECK(pool.has_value() && ForwardRules::Render(*pool) ==
+                                "1.1.1.1, 8.8.8.8:5353, 9.9.9.9");
+  CHECK(!ForwardRules::ParsePool(" , ").has_value());
+  CHECK(!ForwardRules::ParsePool("1.1.1.1,dns.google").has_value());
+  // Nothing to route is fine; everything takes the default.
+  CHECK(ForwardRules::Parse("# none yet\n").has_value());
+}
+
+// What routing adds to a query: one walk over its labels.
+void Benchmark() {
+  std::string text;
+  for (int i = 0; i < 100; i++) {
+    text += "site" + std::to_string(i) + ".corp.example 10.8.0." +
+            std::to_string(i % 4 + 1) + "\n";
+  }
+  text += "lan 192.168.1.1\n";
+  ForwardRules rules = ForwardRules::Parse(text).value();
+
+  homedns::LabelManager labels;
+  const char* names[] = {"www.site42.corp.example", "printer.lan",
+                         "www.google.com", "a.b.c.d.example.net"};
+  homedns::DnsLabelSeq seqs[4];
+  for (int i = 0; i < 4; i++)
+    seqs[i] = labels.GetLabelSeq(names[i]).Unwrap();
+
+  constexpr int kRounds = 4000000;
+  size_t routed = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < kRounds; i++)
+    routed += rules.Route(seqs[i % 4]) != nullptr;
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  CHECK(routed == kRounds / 2);
+  std::cout << "route: "
+            << std::chrono::duration<double, std::nano>(elapsed).count() /
+                   kRounds
+            << " ns/op\n";
+}
+
+int main() {
+  RouteTest();
+  ParseErrorTest();
+  Benchmark();
+  puts("OK");
+}
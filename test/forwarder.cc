@@ -0,0 +1,461 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <thread>
+
+#include "base/bind/bind.h"
+#include "base/json/json_io.h"
+#include "homedns/forwarder.h"
+#include "homedns/packet.h"
+#include "homedns/test/check.h"
+#include "homedns/udp_server.h"
+#include "homedns/wire.h"
+
+constexpr int kClients = 64;
+constexpr uint16_t kServerPort = 5398;
+
+struct sockaddr_in Loopback(uint16_t port) {
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+  addr.sin_port = htons(port);
+  return addr;
+}
+
+// Answers every query with a single A record, after |delay|. If |echo| is
+// set, each query is first sent straight back as it came, as someone forging
+// a reply from a copy of the query might.
+class StandInUpstream {
+ public:
+  explicit StandInUpstream(std::chrono::milliseconds delay, bool echo = false)
+      : delay_(delay), echo_(echo) {
+    socket_ = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr = Loopback(0);
+    bind(socket_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    socklen_t len = sizeof(addr_);
+    getsockname(socket_, reinterpret_cast<sockaddr*>(&addr_), &len);
+    thread_ = std::thread(&StandInUpstream::Serve, this);
+  }
+
+  ~StandInUpstream() {
+    running_ = false;
+    thread_.join();
+    close(socket_);
+  }
+
+  struct sockaddr_in Address() const { return addr_; }
+  int Queries() const { return queries_; }
+  // The distinct ports queries came from.
+  size_t Ports() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return ports_.size();
+  }
+
+ private:
+  void Serve() {
+    struct pollfd fd = {socket_, POLLIN, 0};
+    while (running_) {
+      if (poll(&fd, 1, 50) <= 0)
+        continue;
+      uint8_t buf[512];
+      struct sockaddr_in from;
+      socklen_t from_len = sizeof(from);
+      ssize_t len = recvfrom(socket_, buf, sizeof(buf) - 16, 0,
+                             reinterpret_cast<sockaddr*>(&from), &from_len);
+      if (len < 12)
+        continue;
+      queries_++;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ports_.insert(ntohs(from.sin_port));
+      }
+      if (echo_) {
+        sendto(socket_, buf, len, 0, reinterpret_cast<sockaddr*>(&from),
+               from_len);
+      }
+      std::this_thread::sleep_for(delay_);
+
+      uint8_t answer[] = {0xC0, 0x0C, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00,
+                          0x00, 0x3C, 0x00, 0x04, 10,   0,    0,    1};
+      buf[2] |= 0x80;
+      homedns::wire::WriteU16(buf + 6, 1);
+      memcpy(buf + len, answer, sizeof(answer));
+      sendto(socket_, buf, len + sizeof(answer), 0,
+             reinterpret_cast<sockaddr*>(&from), from_len);
+    }
+  }
+
+  std::chrono::milliseconds delay_;
+  const bool echo_;
+  int socket_;
+  struct sockaddr_in addr_;
+  std::atomic<bool> running_ = true;
+  std::atomic<int> queries_ = 0;
+  mutable std::mutex mutex_;
+  std::set<uint16_t> ports_;
+  std::thread thread_;
+};
+
+void Forward(homedns::Forwarder* forwarder,
+             homedns::Response response,
+             uint8_t* data,
+             size_t len,
+             struct sockaddr_in) {
+  auto m_packet = homedns::DnsPacket::Import(
+      std::make_unique<homedns::ReadStream>(len, data));
+  CHECK(m_packet.has_value());
+  homedns::DnsPacket packet = std::move(m_packet).value();
+  const homedns::DnsQuestion* q = packet.GetQuestion(0).value();
+  auto key = homedns::CacheKey::Create(q->LabelSequence.Render(), q->Type,
+                                       q->Class);
+  forwarder->Resolve(key, data, len, std::move(response));
+}
+
+void ReadUpstream(homedns::Forwarder* forwarder) {
+  forwarder->ReadReplies();
+}
+
+std::unique_ptr<homedns::ReadStream> BuildQuery(uint16_t id) {
+  homedns::DnsPacket packet =
+      homedns::DnsPacket::Create(id)
+          .SetRecursionDesired(1)
+          .AddQuestion("Hot.Example.COM", homedns::DnsARecord::TYPE, 0x01)
+          .Unwrap();
+  auto ws = std::make_unique<homedns::WriteStream>(512);
+  auto ext = packet.Export(ws.get());
+  if (!ext.is_ok()) {
+    ext.Print();
+    exit(1);
+  }
+  return ws->Convert();
+}
+
+// Everything the forwarder is driven by, running its loop on a thread.
+class Harness {
+ public:
+  Harness(struct sockaddr_in upstream, homedns::Forwarder::Options options)
+      : Harness(std::vector<struct sockaddr_in>{upstream}, options) {}
+
+  Harness(std::vector<struct sockaddr_in> upstreams,
+          homedns::Forwarder::Options options) {
+    forwarder_ = homedns::Forwarder::Create(std::move(upstreams), options);
+    server_ = homedns::UDPServer::Create(kServerPort);
+    CHECK(forwarder_ && server_);
+    server_->OnData(base::BindRepeating(&Forward, forwarder_.get()));
+    server_->Watch(forwarder_->GetFD(),
+                   base::BindRepeating(&ReadUpstream, forwarder_.get()));
+    // Often enough for races to start on time.
+    ExpireQueries(forwarder_.get(), server_.get());
+  }
+
+  ~Harness() {
+    server_.reset();
+    forwarder_.reset();
+  }
+
+  void Start() {
+    loop_ = std::thread(&homedns::UDPServer::Start, server_.get());
+  }
+
+  void Stop() {
+    server_->Stop();
+    loop_.join();
+  }
+
+  homedns::Forwarder* forwarder() { return forwarder_.get(); }
+
+ private:
+  static void ExpireQueries(homedns::Forwarder* forwarder,
+                            homedns::UDPServer* server) {
+    forwarder->ExpireQueries();
+    server->RunAfter(std::chrono::milliseconds(5),
+                     base::BindRepeating(&ExpireQueries, forwarder, server));
+  }
+
+  std::unique_ptr<homedns::Forwarder> forwarder_;
+  std::unique_ptr<homedns::UDPServer> server_;
+  std::thread loop_;
+};
+
+int SendQuery(uint16_t id) {
+  struct sockaddr_in server_addr = Loopback(kServerPort);
+  int client = socket(AF_INET, SOCK_DGRAM, 0);
+  auto rs = BuildQuery(id);
+  sendto(client, rs->GetBuffer(), rs->Size(), 0,
+         reinterpret_cast<sockaddr*>(&server_addr), sizeof(server_addr));
+  return client;
+}
+
+void ReceiveReply(int client, uint16_t id, int timeout_ms, uint8_t* buf) {
+  struct pollfd fd = {client, POLLIN, 0};
+  CHECK(poll(&fd, 1, timeout_ms) == 1);
+  ssize_t len = recv(client, buf, 512, 0);
+  CHECK(len > 12);
+  CHECK(homedns::wire::ReadU16(buf) == id);
+  CHECK(homedns::wire::ReadU16(buf + 6) == 1);
+  CHECK(memcmp(buf + 13, "Hot", 3) == 0);
+  close(client);
+}
+
+// The reply's rcode, or -1 if there is none in time.
+int ReceiveRcode(int client, int timeout_ms) {
+  struct pollfd fd = {client, POLLIN, 0};
+  uint8_t buf[512];
+  int rcode = -1;
+  if (poll(&fd, 1, timeout_ms) == 1 && recv(client, buf, sizeof(buf), 0) > 12)
+    rcode = buf[3] & 0x0F;
+  close(client);
+  return rcode;
+}
+
+// Fires a burst of identical queries at a slow upstream, and checks that only
+// one of them actually went upstream.
+void CoalesceTest() {
+  StandInUpstream upstream(std::chrono::milliseconds(200));
+  Harness harness(upstream.Address(), homedns::Forwarder::Options());
+  harness.Start();
+
+  int clients[kClients];
+  for (int i = 0; i < kClients; i++)
+    clients[i] = SendQuery(0x1000 + i);
+  uint8_t buf[512];
+  for (int i = 0; i < kClients; i++)
+    ReceiveReply(clients[i], 0x1000 + i, 2000, buf);
+
+  harness.Stop();
+  homedns::Forwarder* forwarder = harness.forwarder();
+  std::cout << forwarder->Render() << "\n";
+  std::cout << kClients << " clients answered by " << upstream.Queries()
+            << " upstream queries\n";
+  CHECK(upstream.Queries() == 1);
+  CHECK(forwarder->GetStats().coalesced == kClients - 1);
+  CHECK(forwarder->InFlight() == 0);
+}
+
+bool CannedStaleAnswer(int* calls,
+                       const homedns::CacheKey&,
+                       const uint8_t* query,
+                       size_t len,
+                       std::vector<uint8_t>* out) {
+  (*calls)++;
+  uint8_t answer[] = {0xC0, 0x0C, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00,
+                      0x00, 0x1E, 0x00, 0x04, 10,   0,    0,    2};
+  out->assign(query, query + len);
+  (*out)[2] |= 0x80;
+  homedns::wire::WriteU16(out->data() + 6, 1);
+  out->insert(out->end(), answer, answer + sizeof(answer));
+  return true;
+}
+
+void CountReply(int* replies,
+                const homedns::CacheKey&,
+                const uint8_t*,
+                size_t) {
+  (*replies)++;
+}
+
+// With an upstream much slower than the client deadline, the client gets the
+// stale answer on time and the upstream reply still lands afterwards.
+void ServeStaleTest() {
+  StandInUpstream upstream(std::chrono::milliseconds(1000));
+  homedns::Forwarder::Options options;
+  options.client_deadline = std::chrono::milliseconds(100);
+  Harness harness(upstream.Address(), options);
+  int stale_calls = 0;
+  int replies = 0;
+  harness.forwarder()->OnStale(
+      base::BindRepeating(&CannedStaleAnswer, &stale_calls));
+  harness.forwarder()->OnReply(base::BindRepeating(&CountReply, &replies));
+  harness.Start();
+
+  auto start = std::chrono::steady_clock::now();
+  int client = SendQuery(0x2000);
+  uint8_t buf[512];
+  ReceiveReply(client, 0x2000, 500, buf);
+  auto waited = std::chrono::steady_clock::now() - start;
+  CHECK(buf[12 + 17 + 4 + 15] == 2);
+  CHECK(waited < std::chrono::milliseconds(500));
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(1200));
+  harness.Stop();
+  std::cout << harness.forwarder()->Render() << "\n";
+  CHECK(stale_calls == 1);
+  CHECK(replies == 1);
+  CHECK(harness.forwarder()->GetStats().stale_answers == 1);
+  CHECK(harness.forwarder()->InFlight() == 0);
+}
+
+struct Lookups {
+  homedns::Forwarder* forwarder;
+  std::atomic<int> answered = 0;
+  std::atomic<int> asked_again = 0;
+};
+
+void AskAgain(Lookups* lookups, std::vector<uint8_t> reply) {
+  CHECK(reply.size() > 12);
+  lookups->asked_again++;
+}
+
+void CountLookup(Lookups* lookups, std::vector<uint8_t> reply) {
+  CHECK(reply.size() > 12);
+  CHECK(reply[reply.size() - 1] == 1);
+  // The forwarder isn't locked any more, so this can't deadlock.
+  if (lookups->answered++ == 0) {
+    auto key = homedns::CacheKey::Create("other.example.com",
+                                         homedns::DnsARecord::TYPE, 1);
+    lookups->forwarder->Lookup(key, base::BindRepeating(&AskAgain, lookups));
+  }
+}
+
+// Lookups for the same name share one upstream query, just like clients do.
+void LookupTest() {
+  StandInUpstream upstream(std::chrono::milliseconds(50));
+  Harness harness(upstream.Address(), homedns::Forwarder::Options());
+  Lookups lookups;
+  lookups.forwarder = harness.forwarder();
+  harness.Start();
+
+  auto key = homedns::CacheKey::Create("hot.example.com",
+                                       homedns::DnsARecord::TYPE, 1);
+  for (int i = 0; i < kClients; i++)
+    harness.forwarder()->Lookup(key,
+                                base::BindRepeating(&CountLookup, &lookups));
+  for (int i = 0; i < 100 && lookups.asked_again == 0; i++)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+  harness.Stop();
+  CHECK(lookups.answered == kClients);
+  CHECK(lookups.asked_again == 1);
+  CHECK(upstream.Queries() == 2);
+  CHECK(harness.forwarder()->InFlight() == 0);
+}
+
+// Every upstream of a pool is tried before any has answered twice, and each
+// reply is taken from wherever its query went.
+void PoolTest() {
+  StandInUpstream first(std::chrono::milliseconds(0));
+  StandInUpstream second(std::chrono::milliseconds(0));
+  Harness harness({first.Address(), second.Address()},
+                  homedns::Forwarder::Options());
+  harness.Start();
+
+  uint8_t buf[512];
+  for (int i = 0; i < 4; i++)
+    ReceiveReply(SendQuery(0x3000 + i), 0x3000 + i, 2000, buf);
+
+  harness.Stop();
+  CHECK(first.Queries() >= 1 && second.Queries() >= 1);
+  CHECK(first.Queries() + second.Queries() == 4);
+  CHECK(harness.forwarder()->GetStats().replies == 4);
+  CHECK(harness.forwarder()->GetStats().mismatched == 0);
+}
+
+// Once both upstreams have answered, queries go to the faster one.
+void SelectionTest() {
+  StandInUpstream slow(std::chrono::milliseconds(40));
+  StandInUpstream fast(std::chrono::milliseconds(0));
+  Harness harness({slow.Address(), fast.Address()},
+                  homedns::Forwarder::Options());
+  harness.Start();
+
+  uint8_t buf[512];
+  for (int i = 0; i < 12; i++)
+    ReceiveReply(SendQuery(0x4000 + i), 0x4000 + i, 2000, buf);
+
+  harness.Stop();
+  std::cout << harness.forwarder()->Render() << "\n";
+  CHECK(slow.Queries() == 1);
+  CHECK(fast.Queries() == 11);
+}
+
+// An upstream that times out is passed over until its penalty is up.
+void PenaltyTest() {
+  StandInUpstream dead(std::chrono::milliseconds(1000));
+  StandInUpstream alive(std::chrono::milliseconds(0));
+  homedns::Forwarder::Options options;
+  options.timeout = std::chrono::milliseconds(100);
+  options.penalty = std::chrono::milliseconds(10000);
+  Harness harness({dead.Address(), alive.Address()}, options);
+  harness.Start();
+
+  // Neither has answered yet, so the first in line gets the first query.
+  CHECK(ReceiveRcode(SendQuery(0x5000), 1000) == 2);
+  uint8_t buf[512];
+  for (int i = 1; i < 6; i++)
+    ReceiveReply(SendQuery(0x5000 + i), 0x5000 + i, 1000, buf);
+
+  harness.Stop();
+  CHECK(dead.Queries() == 1);
+  CHECK(alive.Queries() == 5);
+  CHECK(harness.forwarder()->GetStats().timeouts == 1);
+}
+
+// A query stuck on a slow upstream is raced against the other one, and
+// answered from whichever is first; the slow one then loses its place.
+void RaceTest() {
+  StandInUpstream slow(std::chrono::milliseconds(300));
+  StandInUpstream fast(std::chrono::milliseconds(0));
+  homedns::Forwarder::Options options;
+  options.race_percentile = 0.9;
+  options.race_floor = std::chrono::milliseconds(20);
+  Harness harness({slow.Address(), fast.Address()}, options);
+  harness.Start();
+
+  uint8_t buf[512];
+  auto start = std::chrono::steady_clock::now();
+  ReceiveReply(SendQuery(0x6000), 0x6000, 1000, buf);
+  auto waited = std::chrono::steady_clock::now() - start;
+  CHECK(waited < std::chrono::milliseconds(200));
+  ReceiveReply(SendQuery(0x6001), 0x6001, 1000, buf);
+
+  harness.Stop();
+  std::cout << "raced reply after "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(waited)
+                   .count()
+            << " ms, against a 300 ms upstream\n";
+  homedns::Forwarder::Stats stats = harness.forwarder()->GetStats();
+  CHECK(stats.races == 1);
+  CHECK(stats.races_won == 1);
+  CHECK(slow.Queries() == 1);
+  CHECK(fast.Queries() == 2);
+}
+
+// A query sent back with a matching ID and question isn't a reply, and each
+// upstream query comes from a port of its own.
+void SpoofTest() {
+  StandInUpstream upstream(std::chrono::milliseconds(20), /*echo=*/true);
+  Harness harness(upstream.Address(), homedns::Forwarder::Options());
+  harness.Start();
+
+  uint8_t buf[512];
+  for (int i = 0; i < 4; i++)
+    ReceiveReply(SendQuery(0x7000 + i), 0x7000 + i, 1000, buf);
+
+  harness.Stop();
+  homedns::Forwarder::Stats stats = harness.forwarder()->GetStats();
+  CHECK(stats.mismatched == 4);
+  CHECK(stats.replies == 4);
+  CHECK(upstream.Queries() == 4);
+  CHECK(upstream.Ports() >= 2);
+}
+
+int main() {
+  CoalesceTest();
+  ServeStaleTest();
+  LookupTest();
+  PoolTest();
+  SelectionTest();
+  PenaltyTest();
+  RaceTest();
+  SpoofTest();
+  puts("OK");
+}
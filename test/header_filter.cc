@@ -0,0 +1,122 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "base/bind/bind.h"
+#include "homedns/header_filter.h"
+#include "homedns/test/check.h"
+#include "homedns/udp_server.h"
+#include "homedns/wire.h"
+
+using homedns::HeaderFilter;
+using Reason = HeaderFilter::Reason;
+
+constexpr uint16_t kServerPort = 5397;
+
+// "example.lan A", with the given header flags and question count.
+std::vector<uint8_t> Query(uint8_t flags, uint16_t questions) {
+  constexpr std::array<uint8_t, 17> kQuestion = {
+      7, 'e', 'x', 'a', 'm', 'p', 'l', 'e', 3, 'l', 'a', 'n', 0, 0, 1, 0, 1};
+  std::vector<uint8_t> query(homedns::wire::kHeaderSize + kQuestion.size());
+  query[0] = 0x12;
+  query[1] = 0x34;
+  query[2] = flags;
+  homedns::wire::WriteU16(query.data() + 4, questions);
+  std::copy(kQuestion.begin(), kQuestion.end(),
+            query.begin() + homedns::wire::kHeaderSize);
+  return query;
+}
+
+Reason Classify(const std::vector<uint8_t>& data) {
+  return HeaderFilter::ClassifyHeader(data.data(), data.size());
+}
+
+void ClassifyTest() {
+  CHECK(Classify(Query(0x01, 1)) == Reason::kAccept);
+  CHECK(Classify({0x12, 0x34, 0x01}) == Reason::kTooShort);
+  CHECK(Classify(Query(0x81, 1)) == Reason::kResponse);
+  CHECK(Classify(Query(0x28, 1)) == Reason::kUpdate);
+  CHECK(Classify(Query(0x20, 1)) == Reason::kUnsupportedOpcode);  // NOTIFY
+  CHECK(Classify(Query(0x28, 2)) == Reason::kExtraQuestions);
+  CHECK(Classify(Query(0x01, 0)) == Reason::kNoQuestion);
+  CHECK(Classify(Query(0x01, 2)) == Reason::kExtraQuestions);
+  std::vector<uint8_t> cut = Query(0x01, 1);
+  cut.resize(cut.size() - 3);
+  CHECK(Classify(cut) == Reason::kBadQuestion);
+
+  HeaderFilter filter;
+  filter.Classify(cut.data(), cut.size());
+  filter.Classify(cut.data(), 3);
+  filter.Classify(cut.data(), 3);
+  CHECK(filter.Count(Reason::kBadQuestion) == 1);
+  CHECK(filter.Count(Reason::kTooShort) == 2);
+  CHECK(filter.Count(Reason::kAccept) == 0);
+}
+
+// Sends back whatever makes it past the filter, so that the client can tell.
+void Echo(homedns::Response response,
+          uint8_t* data,
+          size_t len,
+          struct sockaddr_in) {
+  response.SendData(data, len);
+}
+
+// The kernel drops only what would be dropped anyway; the wrong number of
+// questions makes it through, to be answered FORMERR.
+void KernelFilterTest() {
+  auto server = homedns::UDPServer::Create(kServerPort);
+  CHECK(server);
+  CHECK(server->AttachFilter(HeaderFilter::KernelProgram()));
+  server->OnData(base::BindRepeating(&Echo));
+  std::thread loop(&homedns::UDPServer::Start, server.get());
+
+  int client = socket(AF_INET, SOCK_DGRAM, 0);
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+  addr.sin_port = htons(kServerPort);
+  auto send_to_server = [&](const std::vector<uint8_t>& data) {
+    sendto(client, data.data(), data.size(), 0,
+           reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+  };
+  send_to_server({0x12, 0x34, 0x01});
+  send_to_server(Query(0x81, 1));
+  send_to_server(Query(0x01, 0));
+  send_to_server(Query(0x01, 3));
+  send_to_server(Query(0x01, 1));
+
+  // Datagrams are handled in order, so once the last one is back, everything
+  // that made it through is.
+  std::vector<std::vector<uint8_t>> received;
+  while (received.empty() || received.back() != Query(0x01, 1)) {
+    struct pollfd fd = {client, POLLIN, 0};
+    CHECK(poll(&fd, 1, 2000) == 1);
+    uint8_t buf[512];
+    ssize_t len = recv(client, buf, sizeof(buf), 0);
+    CHECK(len > 0);
+    received.emplace_back(buf, buf + len);
+  }
+  server->Stop();
+  loop.join();
+  close(client);
+
+  CHECK(received.size() == 3);
+  CHECK(received[0] == Query(0x01, 0));
+  CHECK(received[1] == Query(0x01, 3));
+  CHECK(received[2] == Query(0x01, 1));
+}
+
+int main() {
+  ClassifyTest();
+  KernelFilterTest();
+  puts("OK");
+}
@@ -0,0 +1,81 @@
+#include <arpa/inet.h>
+#include <iostream>
+#include <string>
+
+#include "homedns/host_table.h"
+#include "homedns/labels.h"
+#include "homedns/packet.h"
+#include "homedns/test/check.h"
+
+using homedns::HostAddress;
+using homedns::HostTable;
+
+HostAddress Address(const char* text) {
+  return HostAddress::Parse(text).value();
+}
+
+void AddRemoveTest() {
+  homedns::ReverseIndex reverse;
+  HostTable table(&reverse);
+  table.Add("printer.lan", Address("192.168.1.9"));
+  table.Add("Printer.LAN.", Address("192.168.1.9"));
+  table.Add("printer.lan", Address("fd00::9"));
+  table.Add("nas.lan", Address("192.168.1.9"));
+  CHECK(table.Size() == 3);
+  CHECK(table.Addresses("PRINTER.lan").size() == 2);
+  CHECK(reverse.Names(Address("192.168.1.9")).size() == 2);
+  CHECK(reverse.Size() == 3);
+
+  // Added twice, so it takes two removals.
+  table.Remove("printer.lan", Address("192.168.1.9"));
+  CHECK(table.Addresses("printer.lan").size() == 2);
+  table.Remove("printer.lan", Address("192.168.1.9"));
+  CHECK(table.Addresses("printer.lan").size() == 1);
+  CHECK(reverse.Names(Address("192.168.1.9")) ==
+        std::vector<std::string>{"nas.lan"});
+  table.Remove("printer.lan", Address("192.168.1.9"));
+  table.Remove("unknown.lan", Address("192.168.1.9"));
+  CHECK(table.Size() == 2);
+
+  homedns::LabelManager labels;
+  CHECK(table.Contains(labels.GetLabelSeq("Nas.Lan").Unwrap()));
+  CHECK(!table.Contains(labels.GetLabelSeq("www.lan").Unwrap()));
+  table.Remove("nas.lan", Address("192.168.1.9"));
+  table.Remove("printer.lan", Address("fd00::9"));
+  CHECK(table.Size() == 0);
+  CHECK(reverse.Size() == 0);
+  CHECK(!table.Contains(labels.GetLabelSeq("nas.lan").Unwrap()));
+}
+
+void AnswerTest() {
+  HostTable table(nullptr, /*ttl=*/30);
+  table.Add("printer.lan", Address("192.168.1.9"));
+  table.Add("printer.lan", Address("192.168.1.10"));
+  table.Add("nas.lan", Address("192.168.1.9"));
+
+  auto answer = [&table](const std::string& name, uint16_t type) {
+    homedns::DnsPacket query = homedns::DnsPacket::Create(1)
+                                   .AddQuestion(name, type, 0x01)
+                                   .Unwrap();
+    const homedns::DnsQuestion* question = query.GetQuestion(0).value();
+    return table.Answer(question,
+                        homedns::DnsPacket::Create(1)
+                            .AddQuestion(*question)
+                            .Unwrap());
+  };
+
+  auto a = answer("PRINTER.lan", 1);
+  CHECK(a.has_value() && std::move(a).value().GetNumAnswers() == 2);
+
+  using Codes = homedns::PacketStatus::Codes;
+  CHECK(answer("printer.lan", 28).code() == Codes::kInvalidRecordType);
+  CHECK(answer("scanner.lan", 1).code() == Codes::kNameNotFound);
+  // Reverse names are the ReverseIndex's.
+  CHECK(answer("9.1.168.192.in-addr.arpa", 12).code() == Codes::kNameNotFound);
+}
+
+int main() {
+  AddRemoveTest();
+  AnswerTest();
+  puts("OK");
+}
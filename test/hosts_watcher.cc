@@ -0,0 +1,158 @@
+#include <poll.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "homedns/host_table.h"
+#include "homedns/hosts_watcher.h"
+#include "homedns/test/check.h"
+
+using homedns::HostAddress;
+using homedns::HostsWatcher;
+using homedns::HostTable;
+
+HostAddress Address(const char* text) {
+  return HostAddress::Parse(text).value();
+}
+
+void Write(const std::string& path, const std::string& text, bool append) {
+  std::ofstream out(path, append ? std::ios::app : std::ios::trunc);
+  out << text;
+}
+
+// Waits for the watcher to hear about changes, and catches up with them,
+// returning how long that took.
+std::chrono::nanoseconds Catch(HostsWatcher* watcher) {
+  struct pollfd fd = {watcher->GetFD(), POLLIN, 0};
+  CHECK(poll(&fd, 1, 1000) == 1);
+  // Let the burst of events for one write all arrive.
+  usleep(10000);
+  auto start = std::chrono::steady_clock::now();
+  watcher->ReadEvents();
+  return std::chrono::steady_clock::now() - start;
+}
+
+std::string Lease(int host) {
+  return "1700000000 02:00:00:00:" + std::to_string(host / 256) + ":" +
+         std::to_string(host % 256) + " 10.0." + std::to_string(host / 256) +
+         "." + std::to_string(host % 256) + " host" + std::to_string(host) +
+         " *\n";
+}
+
+void HostsTest(const std::string& dir) {
+  HostTable table;
+  auto watcher = HostsWatcher::Create(&table, "lan");
+  std::string path = dir + "/hosts";
+  Write(path,
+        "# local hosts\n"
+        "192.168.1.9 printer printer.home.arpa\r\n"
+        "fd00::9 printer  # and over IPv6\n"
+        "192.168.1.9 printer\n"
+        "not-an-address nas\n"
+        "192.168.1.2 bad!name\n",
+        false);
+  CHECK(watcher->Watch(path, HostsWatcher::Format::kHosts).is_ok());
+  CHECK(table.Size() == 3);
+  CHECK(table.Addresses("printer.lan").size() == 2);
+  CHECK(table.Addresses("printer.home.arpa").size() == 1);
+
+  // A duplicate line going away leaves its twin's entries.
+  Write(path, "192.168.1.9 printer\nfd00::9 printer\n", false);
+  Catch(watcher.get());
+  CHECK(table.Size() == 2);
+  CHECK(table.Addresses("printer.lan").size() == 2);
+  CHECK(table.Addresses("printer.home.arpa").empty());
+
+  CHECK(!watcher->Watch("/nonexistent/hosts", HostsWatcher::Format::kHosts)
+             .is_ok());
+  unlink(path.c_str());
+  Catch(watcher.get());
+  CHECK(table.Size() == 0);
+}
+
+void LeasesTest(const std::string& dir) {
+  HostTable table;
+  auto watcher = HostsWatcher::Create(&table, "lan");
+  std::string path = dir + "/leases";
+  // Not there yet.
+  CHECK(watcher->Watch(path, HostsWatcher::Format::kLeases).is_ok());
+  CHECK(table.Size() == 0);
+
+  std::string leases;
+  for (int host = 1; host <= 10000; host++)
+    leases += Lease(host);
+  Write(path, leases, false);
+  Catch(watcher.get());
+  CHECK(table.Size() == 10000);
+  CHECK(table.Addresses("host258.lan") ==
+        std::vector<HostAddress>{Address("10.0.1.2")});
+  HostsWatcher::Stats stats = watcher->GetStats();
+  CHECK(stats.lines_parsed == 10000);
+
+  // Appended to: only the new lines are read. A partial line waits for the
+  // rest of it.
+  Write(path, Lease(10001) + "1700000000 02:00:00:00:99:99 10.0.", true);
+  Catch(watcher.get());
+  CHECK(watcher->GetStats().appends == stats.appends + 1);
+  CHECK(watcher->GetStats().lines_parsed == stats.lines_parsed + 1);
+  CHECK(table.Size() == 10001);
+  Write(path, "99.99 phone *\n", true);
+  Catch(watcher.get());
+  CHECK(table.Addresses("phone.lan").size() == 1);
+  stats = watcher->GetStats();
+
+  // Rewritten and renamed into place, as dnsmasq does, with one lease
+  // changed: one line parsed, one entry in and one out.
+  leases += Lease(10001) + "1700000000 02:00:00:00:99:99 10.0.99.99 phone *\n";
+  size_t at = leases.find(" host5000 ");
+  leases.replace(at, 10, " tablet ");
+  std::string temp = dir + "/leases.new";
+  Write(temp, leases, false);
+  CHECK(rename(temp.c_str(), path.c_str()) == 0);
+  auto elapsed = Catch(watcher.get());
+  HostsWatcher::Stats after = watcher->GetStats();
+  CHECK(after.rescans == stats.rescans + 1);
+  CHECK(after.lines_parsed == stats.lines_parsed + 1);
+  CHECK(after.entries_added == stats.entries_added + 1);
+  CHECK(after.entries_removed == stats.entries_removed + 1);
+  CHECK(table.Addresses("host5000.lan").empty());
+  CHECK(table.Addresses("tablet.lan").size() == 1);
+  CHECK(table.Size() == 10002);
+  std::cout << "10002 leases, one changed: caught up in "
+            << std::chrono::duration_cast<std::chrono::microseconds>(elapsed)
+                   .count()
+            << " us\n";
+
+  // Touched without changing: nothing to do.
+  Write(path, "", true);
+  Catch(watcher.get());
+  CHECK(watcher->GetStats().lines_parsed == after.lines_parsed);
+  CHECK(table.Size() == 10002);
+
+  // Rewritten in place, growing, with a line far from the end changed: that
+  // isn't an append, however the end of the file looks.
+  at = leases.find(" host10 ");
+  leases.replace(at, 8, " laptop ");
+  Write(path, leases + Lease(10002), false);
+  Catch(watcher.get());
+  CHECK(watcher->GetStats().rescans == after.rescans + 1);
+  CHECK(table.Addresses("host10.lan").empty());
+  CHECK(table.Addresses("laptop.lan").size() == 1);
+  CHECK(table.Addresses("host10002.lan").size() == 1);
+  CHECK(table.Size() == 10003);
+}
+
+int main() {
+  char dir[] = "/tmp/hosts_watcher.XXXXXX";
+  CHECK(mkdtemp(dir));
+  HostsTest(dir);
+  LeasesTest(dir);
+  std::string leases = std::string(dir) + "/leases";
+  unlink(leases.c_str());
+  rmdir(dir);
+  puts("OK");
+}
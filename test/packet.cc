@@ -1,4 +1,7 @@
 
+#include <chrono>
+#include <cstring>
+
 #include "homedns/packet.h"
 #include "base/json/json_io.h"
 #include "homedns/bitstream.h"
@@ -56,35 +59,37 @@ void BuildPacket() {
   DumpBuffer(rs.get());
 }
 
+const uint8_t kResponse[44] = {
+    // 12 byte header
+    // 1 question
+    // 1 answer
+    0x86, 0x2a, 0x81, 0x80, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00,
+    // Questions [1]:
+
+    // label seq:
+    // [6] g     O     O     g     l     e
+    0x06, 0x67, 0x6f, 0x6f, 0x67, 0x6c, 0x65,
+    // [3] c     o     m
+    0x03, 0x63, 0x6f, 0x6d,
+    // [0]
+    0x00,
+
+    // Type=1   class=1
+    0x00, 0x01, 0x00, 0x01,
+
+    // label seq:
+    // offset to 0xc = 12
+    0xc0, 0x0c,
+
+    // Type=1   class=1     ttl=293                 // len=4
+    0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x01, 0x25, 0x00, 0x04,
+
+    // len = 4, 4 bytes of data
+    0xd8, 0x3a, 0xd3, 0x8e};
 
 void ImportPacket() {
-  uint8_t query[44] = {
-      // 12 byte header
-      // 1 question
-      // 1 answer
-      0x86, 0x2a, 0x81, 0x80, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00,
-      // Questions [1]:
-
-      // label seq:
-      // [6] g     O     O     g     l     e
-      0x06, 0x67, 0x6f, 0x6f, 0x67, 0x6c, 0x65,
-      // [3] c     o     m
-      0x03, 0x63, 0x6f, 0x6d,
-      // [0]
-      0x00,
-
-      // Type=1   class=1
-      0x00, 0x01, 0x00, 0x01,
-
-      // label seq:
-      // offset to 0xc = 12
-      0xc0, 0x0c,
-
-      // Type=1   class=1     ttl=293                 // len=4
-      0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x01, 0x25, 0x00, 0x04,
-
-      // len = 4, 4 bytes of data
-      0xd8, 0x3a, 0xd3, 0x8e};
+  uint8_t query[44];
+  memcpy(query, kResponse, sizeof(query));
 
   auto m_packet = homedns::DnsPacket::Import(
       std::make_unique<homedns::ReadStream>(44, query));
@@ -95,24 +100,111 @@ void ImportPacket() {
   homedns::DnsPacket packet = std::move(m_packet).value();
   std::cout << packet.Render() << "\n";
 
-  /*
-  if (packet.GetAnswerType(0) != homedns::DnsARecord::TYPE) {
-    printf("Not an A record! (%i)\n", packet.GetAnswerType(0));
+
+  auto record = packet.GetAnswers().Get<homedns::DnsARecord>(0);
+  if (!record.has_value() || record->IP[0] != 216 || record->IP[1] != 58 ||
+      record->IP[2] != 211 || record->IP[3] != 142) {
+    puts("Not the expected A record!");
+    exit(1);
+  }
+  if (packet.GetAnswers().Get<homedns::DnsAAAARecord>(0).has_value()) {
+    puts("A record read back as AAAA!");
+    exit(1);
+  }
+}
+
+homedns::DnsPacket ExportAndImport(homedns::DnsPacket* packet, size_t size) {
+  auto ws = std::make_unique<homedns::WriteStream>(size);
+  auto ext = packet->Export(ws.get());
+  if (!ext.is_ok()) {
+    ext.Print();
+    exit(1);
+  }
+  auto m_packet = homedns::DnsPacket::Import(ws->Convert());
+  if (!m_packet.has_value()) {
+    std::move(m_packet).error().Print();
+    exit(1);
+  }
+  return std::move(m_packet).value();
+}
+
+void TruncatePacket() {
+  using homedns::DnsPacket;
+  DnsPacket packet = DnsPacket::Create(0x1234)
+                         .SetQuestionOrResponse(DnsPacket::PacketType::kResponse)
+                         .AddQuestion("big.lan", homedns::DnsARecord::TYPE, 1)
+                         .Unwrap();
+  for (uint8_t i = 0; i < 10; i++) {
+    packet = packet.AddRecord<DnsPacket::RecordType::kAnswer>(
+                       "big.lan", 1, 60, homedns::DnsARecord{{10, 0, 0, i}})
+                 .Unwrap();
+  }
+  homedns::DnsAAAARecord v6 = {};
+  for (uint8_t i = 0; i < 40; i++) {
+    v6.IP[15] = i;
+    packet = packet.AddRecord<DnsPacket::RecordType::kAdditional>(
+                       "big.lan", 1, 60, v6)
+                 .Unwrap();
+  }
+
+  // Additional records that don't fit are dropped without setting TC.
+  DnsPacket reply = ExportAndImport(&packet, 512);
+  if (reply.GetPacketHeader().TC || reply.GetNumAnswers() != 10 ||
+      reply.GetNumAdditional() != 0) {
+    puts("additional records were not dropped cleanly");
     exit(1);
   }
-  auto record = packet.GetAnswer<homedns::DnsARecord>(0);
-  if (record.has_value()) {
-    homedns::DnsARecord rec = std::move(record).value();
-    std::cout << "A ip: " << std::dec << static_cast<uint16_t>(rec.IP[0]) << "."
-              << static_cast<uint16_t>(rec.IP[1]) << "."
-              << static_cast<uint16_t>(rec.IP[2]) << "."
-              << static_cast<uint16_t>(rec.IP[3]) << "\n";
-  } else {
-    std::move(record).error().Print();
+
+  // The A records are one RRset, so if they don't all fit none are sent.
+  reply = ExportAndImport(&packet, 100);
+  if (!reply.GetPacketHeader().TC || reply.GetNumAnswers() != 0 ||
+      reply.GetNumQuestions() != 1) {
+    puts("answers were not truncated");
+    exit(1);
   }
-  */
+  std::cout << reply.Render() << "\n";
 }
 
+// Malformed packets should be turned away about as cheaply as good ones are
+// parsed: the error is a code, unless tracing asks for the whole story.
+void ImportBenchmark(size_t packets) {
+  uint8_t cut[40];
+  memcpy(cut, kResponse, sizeof(cut));
+  uint8_t loop[44];
+  memcpy(loop, kResponse, sizeof(loop));
+  loop[29] = 0x1c;  // The answer's name points at itself.
+
+  auto import = [](const uint8_t* data, size_t len) {
+    return homedns::DnsPacket::Import(std::make_unique<homedns::ReadStream>(
+        len, const_cast<uint8_t*>(data)));
+  };
+  if (!import(kResponse, sizeof(kResponse)).has_value() ||
+      import(cut, sizeof(cut)).code() !=
+          homedns::PacketStatus::Codes::kParsingError ||
+      import(loop, sizeof(loop)).has_value()) {
+    puts("unexpected import result");
+    exit(1);
+  }
+
+  auto ns_per_op = [packets, &import](const uint8_t* data, size_t len) {
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < packets; i++)
+      import(data, len);
+    auto duration = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(duration)
+               .count() /
+           static_cast<double>(packets);
+  };
+
+  std::cout << packets << " imports\n"
+            << "  valid:             " << ns_per_op(kResponse, 44)
+            << " ns/op\n"
+            << "  truncated:         " << ns_per_op(cut, 40) << " ns/op\n"
+            << "  pointer loop:      " << ns_per_op(loop, 44) << " ns/op\n";
+  homedns::SetTraceErrors(true);
+  std::cout << "  truncated, traced: " << ns_per_op(cut, 40) << " ns/op\n";
+  homedns::SetTraceErrors(false);
+}
 
 int main() {
   // RequestHeader();
@@ -120,4 +212,6 @@ int main() {
   // ResponseHeader();
   // BuildPacket();
   ImportPacket();
+  TruncatePacket();
+  ImportBenchmark(200000);
 }
\ No newline at end of file
@@ -0,0 +1,225 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "base/bind/bind.h"
+#include "base/json/json_io.h"
+#include "homedns/latency_histogram.h"
+#include "homedns/mpmc_queue.h"
+#include "homedns/pipeline.h"
+#include "homedns/test/check.h"
+#include "homedns/udp_server.h"
+#include "homedns/wire.h"
+
+constexpr uint16_t kServerPort = 5399;
+
+struct sockaddr_in Loopback(uint16_t port) {
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+  addr.sin_port = htons(port);
+  return addr;
+}
+
+// Four producers and four consumers move a million values through a small
+// queue, and between them see every one exactly once.
+void QueueTest() {
+  constexpr int kThreads = 4;
+  constexpr uint64_t kPerThread = 250000;
+  homedns::MpmcQueue<uint64_t> queue(64);
+  CHECK(queue.Capacity() == 64);
+
+  std::atomic<uint64_t> sum = 0;
+  std::atomic<uint64_t> popped = 0;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; t++) {
+    threads.emplace_back([&queue, t] {
+      for (uint64_t i = 0; i < kPerThread; i++) {
+        while (!queue.TryPush(t * kPerThread + i))
+          std::this_thread::yield();
+      }
+    });
+    threads.emplace_back([&] {
+      uint64_t value;
+      while (popped.load() < kThreads * kPerThread) {
+        if (!queue.TryPop(&value)) {
+          std::this_thread::yield();
+          continue;
+        }
+        sum.fetch_add(value);
+        popped.fetch_add(1);
+      }
+    });
+  }
+  for (auto& thread : threads)
+    thread.join();
+
+  uint64_t n = kThreads * kPerThread;
+  CHECK(popped == n);
+  CHECK(sum == n * (n - 1) / 2);
+  uint64_t value;
+  CHECK(!queue.TryPop(&value));
+  CHECK(queue.ApproxSize() == 0);
+}
+
+// Made up durations, recorded straight in, so the bounds below are the
+// histogram's own precision and nothing is timed.
+void HistogramTest() {
+  homedns::LatencyHistogram histogram;
+  CHECK(histogram.Percentile(0.5).count() == 0);
+  for (int i = 1; i <= 1000; i++)
+    histogram.Record(std::chrono::microseconds(i));
+  CHECK(histogram.Count() == 1000);
+  CHECK(histogram.Max() == std::chrono::microseconds(1000));
+
+  // Within an eighth, and never under.
+  auto p50 = histogram.Percentile(0.5);
+  auto p99 = histogram.Percentile(0.99);
+  CHECK(p50 >= std::chrono::microseconds(500));
+  CHECK(p50 <= std::chrono::microseconds(500 * 9 / 8));
+  CHECK(p99 >= std::chrono::microseconds(990));
+  CHECK(p99 <= std::chrono::microseconds(1000));
+
+  homedns::LatencyHistogram merged;
+  merged.Record(std::chrono::milliseconds(5));
+  merged.Merge(histogram);
+  homedns::LatencyHistogram::Summary summary = merged.Summarize();
+  CHECK(summary.count == 1001);
+  CHECK(summary.max == std::chrono::milliseconds(5));
+  CHECK(summary.p50 == p50);
+}
+
+// Echoes each query back with QR set, after |delay|.
+void Echo(std::chrono::microseconds delay,
+          homedns::Response response,
+          uint8_t* data,
+          size_t len,
+          struct sockaddr_in) {
+  std::this_thread::sleep_for(delay);
+  data[2] |= 0x80;
+  response.SendData(data, len);
+}
+
+std::vector<uint8_t> Query(uint16_t id) {
+  // Header, then "a." A IN.
+  std::vector<uint8_t> query = {0,    0, 0x01, 0, 0, 1, 0, 0, 0, 0, 0, 0,
+                                0x01, 'a', 0,  0, 1, 0, 1};
+  homedns::wire::WriteU16(query.data(), id);
+  return query;
+}
+
+class Harness {
+ public:
+  Harness(std::chrono::microseconds delay, homedns::Pipeline::Options options) {
+    server_ = homedns::UDPServer::Create(kServerPort);
+    CHECK(server_);
+    pipeline_ = std::make_unique<homedns::Pipeline>(
+        server_.get(), base::BindRepeating(&Echo, delay), options);
+    pipeline_->Start();
+    loop_ = std::thread(&homedns::UDPServer::Start, server_.get());
+  }
+
+  ~Harness() {
+    server_->Stop();
+    loop_.join();
+    pipeline_.reset();
+    server_.reset();
+  }
+
+  homedns::Pipeline* pipeline() { return pipeline_.get(); }
+
+ private:
+  std::unique_ptr<homedns::UDPServer> server_;
+  std::unique_ptr<homedns::Pipeline> pipeline_;
+  std::thread loop_;
+};
+
+// Sends |count| queries from one socket, and counts the replies by rcode.
+void Burst(int count, int* answered, int* refused) {
+  int client = socket(AF_INET, SOCK_DGRAM, 0);
+  struct sockaddr_in server_addr = Loopback(kServerPort);
+  for (int i = 0; i < count; i++) {
+    std::vector<uint8_t> query = Query(i);
+    sendto(client, query.data(), query.size(), 0,
+           reinterpret_cast<sockaddr*>(&server_addr), sizeof(server_addr));
+  }
+  struct pollfd fd = {client, POLLIN, 0};
+  uint8_t buf[512];
+  while (*answered + *refused < count && poll(&fd, 1, 1000) == 1) {
+    ssize_t len = recv(client, buf, sizeof(buf), 0);
+    CHECK(len >= 12);
+    CHECK(buf[2] & 0x80);
+    if ((buf[3] & 0x0F) == 5)
+      (*refused)++;
+    else
+      (*answered)++;
+  }
+  close(client);
+}
+
+// Plenty of room: every query gets its echo, spread over the workers.
+void PipelineTest() {
+  homedns::Pipeline::Options options;
+  options.workers = 4;
+  Harness harness(std::chrono::microseconds(200), options);
+  CHECK(harness.pipeline()->WorkerCount() == 4);
+
+  constexpr int kQueries = 200;
+  int answered = 0;
+  int refused = 0;
+  Burst(kQueries, &answered, &refused);
+  // Workers count a query once its reply is on its way, so the last few may
+  // not be counted yet.
+  homedns::Pipeline::Stats stats = harness.pipeline()->GetStats();
+  for (int i = 0; i < 200 && stats.handled < kQueries; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    stats = harness.pipeline()->GetStats();
+  }
+  std::cout << harness.pipeline()->Render() << "\n";
+  CHECK(answered == kQueries);
+  CHECK(refused == 0);
+  CHECK(stats.received == kQueries);
+  CHECK(stats.handled == kQueries);
+  CHECK(stats.shed == 0);
+  CHECK(stats.wait.count == kQueries);
+  CHECK(stats.service.count == kQueries);
+}
+
+// One slow worker with a tiny queue: whatever doesn't fit is refused at once
+// rather than left to wait.
+void OverloadTest() {
+  homedns::Pipeline::Options options;
+  options.workers = 1;
+  options.queue_capacity = 2;
+  Harness harness(std::chrono::milliseconds(20), options);
+
+  constexpr int kQueries = 50;
+  int answered = 0;
+  int refused = 0;
+  Burst(kQueries, &answered, &refused);
+  homedns::Pipeline::Stats stats = harness.pipeline()->GetStats();
+  std::cout << harness.pipeline()->Render() << "\n";
+  std::cout << answered << " answered, " << refused << " refused\n";
+  CHECK(answered + refused == kQueries);
+  CHECK(refused > 0);
+  CHECK(stats.shed == (uint64_t)refused);
+  CHECK(stats.max_queue_depth <= 2);
+}
+
+int main() {
+  QueueTest();
+  HistogramTest();
+  PipelineTest();
+  OverloadTest();
+  puts("OK");
+}
@@ -0,0 +1,231 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "homedns/answer_cache.h"
+#include "homedns/bitstream.h"
+#include "homedns/packet.h"
+#include "homedns/qname_steering.h"
+#include "homedns/test/check.h"
+#include "homedns/udp_server.h"
+
+using homedns::QnameSteering;
+
+constexpr uint16_t kPort = 5402;
+constexpr size_t kSockets = 4;
+
+std::vector<uint8_t> Export(homedns::DnsPacket packet) {
+  homedns::WriteStream ws(512);
+  auto ext = packet.Export(&ws);
+  if (!ext.is_ok()) {
+    ext.Print();
+    exit(1);
+  }
+  auto rs = ws.Convert();
+  return std::vector<uint8_t>(rs->GetBuffer(), rs->GetBuffer() + rs->Size());
+}
+
+std::vector<uint8_t> BuildQuery(const std::string& name) {
+  return Export(homedns::DnsPacket::Create(1)
+                    .AddQuestion(name, homedns::DnsARecord::TYPE, 0x01)
+                    .Unwrap());
+}
+
+std::vector<uint8_t> BuildReply(const std::string& name) {
+  return Export(
+      homedns::DnsPacket::Create(1)
+          .SetQuestionOrResponse(homedns::DnsPacket::PacketType::kResponse)
+          .AddQuestion(name, homedns::DnsARecord::TYPE, 0x01)
+          .Unwrap()
+          .AddRecord<homedns::DnsPacket::RecordType::kAnswer>(
+              name, 0x01, 3600, homedns::DnsARecord{{10, 0, 0, 1}})
+          .Unwrap());
+}
+
+// The hash of a query is the hash of its name however it is spelled, and
+// only its first kHashedBytes count.
+void HashTest() {
+  const char* names[] = {"a", "www.example.com", "printer.lan",
+                         "a.b.c.d.e.f.g.h.i.j.k.l.m.n.o.p.q.r.s.t.u.v.w.x.y.z"
+                         ".aa.bb.cc.dd.ee"};
+  for (const char* name : names) {
+    std::vector<uint8_t> query = BuildQuery(name);
+    uint32_t hash = QnameSteering::HashQuery(query.data(), query.size());
+    CHECK(hash == QnameSteering::HashName(name));
+    CHECK(hash == QnameSteering::HashName(std::string(name) + "."));
+  }
+  std::vector<uint8_t> upper = BuildQuery("WWW.Example.COM");
+  CHECK(QnameSteering::HashQuery(upper.data(), upper.size()) ==
+        QnameSteering::HashName("www.example.com"));
+  CHECK(QnameSteering::HashName("www.example.com") !=
+        QnameSteering::HashName("www.example.org"));
+
+  std::string prefix(70, 'x');
+  CHECK(QnameSteering::HashName(prefix.substr(0, 60) + ".one") !=
+        QnameSteering::HashName(prefix.substr(0, 60) + ".two"));
+  CHECK(QnameSteering::HashName(prefix + ".one") ==
+        QnameSteering::HashName(prefix + ".two"));
+
+  // Truncated mid-name, the rest simply doesn't count.
+  std::vector<uint8_t> query = BuildQuery("www.example.com");
+  CHECK(QnameSteering::HashQuery(query.data(), 12 + 4) ==
+        QnameSteering::HashName("www"));
+}
+
+// Every query arrives on the socket the hash predicts.
+void KernelTest() {
+  std::vector<std::unique_ptr<homedns::UDPServer>> servers;
+  for (size_t i = 0; i < kSockets; i++) {
+    servers.push_back(homedns::UDPServer::Create(kPort, true));
+    CHECK(servers.back());
+  }
+  if (!servers[0]->AttachSteering(QnameSteering::KernelProgram(kSockets))) {
+    std::cout << "SO_ATTACH_REUSEPORT_CBPF refused, skipping\n";
+    return;
+  }
+
+  int client = socket(AF_INET, SOCK_DGRAM, 0);
+  struct sockaddr_in server_addr;
+  memset(&server_addr, 0, sizeof(server_addr));
+  server_addr.sin_family = AF_INET;
+  server_addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+  server_addr.sin_port = htons(kPort);
+  connect(client, reinterpret_cast<sockaddr*>(&server_addr),
+          sizeof(server_addr));
+
+  std::vector<struct pollfd> fds;
+  for (const auto& server : servers)
+    fds.push_back({server->GetFD(), POLLIN, 0});
+  std::vector<int> per_socket(kSockets);
+  for (int i = 0; i < 200; i++) {
+    std::string name = "host" + std::to_string(i) + ".Example.com";
+    std::vector<uint8_t> query = BuildQuery(name);
+    send(client, query.data(), query.size(), 0);
+    CHECK(poll(fds.data(), fds.size(), 1000) == 1);
+    size_t expected =
+        QnameSteering::Shard(QnameSteering::HashName(name), kSockets);
+    CHECK(fds[expected].revents & POLLIN);
+    uint8_t buffer[512];
+    CHECK(recv(fds[expected].fd, buffer, sizeof(buffer), 0) ==
+          (ssize_t)query.size());
+    per_socket[expected]++;
+  }
+  close(client);
+  for (int count : per_socket)
+    CHECK(count > 20);
+}
+
+struct Result {
+  double hit_ratio;
+  size_t entries;
+  size_t bytes;
+};
+
+// Replays the same Zipf distributed queries from many clients over kSockets
+// loops' caches of |max_entries| each, with each query going to the cache
+// chosen by |steer|.
+template <typename F>
+Result Replay(size_t max_entries, F steer) {
+  constexpr size_t kNames = 50000;
+  constexpr size_t kClients = 2000;
+  constexpr size_t kQueries = 200000;
+
+  std::vector<double> cdf(kNames);
+  double total = 0;
+  for (size_t i = 0; i < kNames; i++)
+    cdf[i] = total += 1.0 / (i + 1);
+  std::mt19937 random(7);
+  std::uniform_real_distribution<double> uniform(0, total);
+
+  std::vector<std::unique_ptr<homedns::AnswerCache>> caches;
+  homedns::AnswerCache::Options options;
+  options.max_entries = max_entries;
+  for (size_t i = 0; i < kSockets; i++)
+    caches.push_back(std::make_unique<homedns::AnswerCache>(options));
+  std::vector<std::vector<uint8_t>> queries(kNames);
+  std::vector<size_t> reply_size(kNames);
+  auto now = homedns::AnswerCache::Clock::now();
+  std::vector<uint8_t> out;
+  uint64_t hits = 0;
+  for (size_t i = 0; i < kQueries; i++) {
+    size_t rank = std::lower_bound(cdf.begin(), cdf.end(), uniform(random)) -
+                  cdf.begin();
+    rank = std::min(rank, kNames - 1);
+    uint32_t client = random() % kClients;
+    std::string name = "host" + std::to_string(rank) + ".example.com";
+    if (queries[rank].empty())
+      queries[rank] = BuildQuery(name);
+    auto key = homedns::CacheKey::Create(name, homedns::DnsARecord::TYPE, 1);
+    homedns::AnswerCache* cache = caches[steer(client, name)].get();
+    if (cache->Lookup(key, queries[rank].data(), queries[rank].size(), &out,
+                      now)) {
+      hits++;
+      continue;
+    }
+    std::vector<uint8_t> reply = BuildReply(name);
+    reply_size[rank] = reply.size();
+    cache->Insert(key, reply.data(), reply.size(), now);
+  }
+
+  Result result{static_cast<double>(hits) / kQueries, 0, 0};
+  double average_reply = 0;
+  size_t seen = 0;
+  for (size_t size : reply_size) {
+    if (size) {
+      average_reply += size;
+      seen++;
+    }
+  }
+  average_reply /= seen;
+  for (const auto& cache : caches)
+    result.entries += cache->Size();
+  result.bytes = result.entries * average_reply;
+  return result;
+}
+
+void Print(const char* mode, const Result& result) {
+  std::cout << "  " << mode << ": hit ratio " << result.hit_ratio * 100
+            << "%, " << result.entries << " entries, ~"
+            << result.bytes / 1024 << " KB of replies\n";
+}
+
+// The kernel's own balancing hashes the client's address and port, which
+// for a cache amounts to picking one at random.
+size_t ByClient(uint32_t client, const std::string&) {
+  return (client * 2654435761u) % kSockets;
+}
+
+size_t ByName(uint32_t, const std::string& name) {
+  return QnameSteering::Shard(QnameSteering::HashName(name), kSockets);
+}
+
+// Given room for everything, steering by name holds each name once rather
+// than once per loop; given less, that room goes further.
+void Benchmark() {
+  for (size_t max_entries : {size_t(1) << 20, size_t(2048)}) {
+    std::cout << kSockets << " loops, " << max_entries
+              << " entries per cache\n";
+    Result by_client = Replay(max_entries, &ByClient);
+    Result by_name = Replay(max_entries, &ByName);
+    Print("4-tuple", by_client);
+    Print("qname  ", by_name);
+    CHECK(by_name.hit_ratio > by_client.hit_ratio);
+    CHECK(by_name.entries <= by_client.entries);
+  }
+}
+
+int main() {
+  HashTest();
+  KernelTest();
+  Benchmark();
+  puts("OK");
+}
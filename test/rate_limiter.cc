@@ -0,0 +1,212 @@
+#include <arpa/inet.h>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "homedns/rate_limiter.h"
+#include "homedns/test/check.h"
+#include "homedns/wire.h"
+
+using homedns::RateLimiter;
+using Action = RateLimiter::Action;
+using Clock = RateLimiter::Clock;
+
+struct sockaddr_in V4(const char* address) {
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  inet_pton(AF_INET, address, &addr.sin_addr);
+  return addr;
+}
+
+// A NOERROR reply to "<name> A", with one answer.
+std::vector<uint8_t> Reply(const std::string& name, uint8_t rcode = 0) {
+  std::vector<uint8_t> reply = {0x12, 0x34, 0x81, 0x80, 0, 1,
+                                0,    1,    0,    0,    0, 0};
+  reply[3] |= rcode;
+  size_t start = 0;
+  while (start < name.size()) {
+    size_t dot = std::min(name.find('.', start), name.size());
+    reply.push_back(dot - start);
+    reply.insert(reply.end(), name.begin() + start, name.begin() + dot);
+    start = dot + 1;
+  }
+  reply.insert(reply.end(), {0, 0, 1, 0, 1});
+  reply.insert(reply.end(), {0xc0, 0x0c, 0, 1, 0, 1, 0, 0, 0, 60, 0, 4,
+                             192, 168, 1, 1});
+  return reply;
+}
+
+size_t CountSent(RateLimiter* limiter,
+                 const struct sockaddr_in& client,
+                 const std::vector<uint8_t>& reply,
+                 size_t count,
+                 Clock::time_point now) {
+  size_t sent = 0;
+  for (size_t i = 0; i < count; i++)
+    sent += limiter->Check(client, reply.data(), reply.size(), now) ==
+            Action::kSend;
+  return sent;
+}
+
+void LimitTest() {
+  RateLimiter::Options options;
+  options.responses_per_second = 10;
+  options.burst = 20;
+  options.slip = 0;
+  options.table_size = 1024;
+  RateLimiter limiter(options);
+  Clock::time_point now = Clock::now();
+  std::vector<uint8_t> reply = Reply("www.example.com");
+
+  // A full bucket lets a burst through, then nothing until it refills.
+  CHECK(CountSent(&limiter, V4("10.0.0.1"), reply, 100, now) == 20);
+  // The rest of the /24 shares the bucket; other networks and other answers
+  // don't.
+  CHECK(CountSent(&limiter, V4("10.0.0.200"), reply, 10, now) == 0);
+  CHECK(CountSent(&limiter, V4("10.0.1.1"), reply, 10, now) == 10);
+  CHECK(CountSent(&limiter, V4("10.0.0.1"), Reply("mail.example.com"), 10,
+                  now) == 10);
+  // Name case doesn't make a new identity.
+  CHECK(CountSent(&limiter, V4("10.0.0.1"), Reply("WWW.example.com"), 10,
+                  now) == 0);
+
+  now += std::chrono::milliseconds(500);
+  CHECK(CountSent(&limiter, V4("10.0.0.1"), reply, 100, now) == 5);
+  now += std::chrono::seconds(60);
+  CHECK(CountSent(&limiter, V4("10.0.0.1"), reply, 100, now) == 20);
+
+  // Every NXDOMAIN shares a bucket, however random the names.
+  size_t sent = 0;
+  for (size_t i = 0; i < 100; i++) {
+    std::vector<uint8_t> nx = Reply(std::to_string(i) + ".example.com", 3);
+    sent += CountSent(&limiter, V4("10.0.2.1"), nx, 1, now);
+  }
+  CHECK(sent == 20);
+
+  RateLimiter::Stats stats = limiter.GetStats();
+  CHECK(stats.slipped == 0);
+  CHECK(stats.sent + stats.dropped == 440);
+}
+
+void SlipTest() {
+  RateLimiter::Options options;
+  options.burst = 1;
+  options.slip = 2;
+  RateLimiter limiter(options);
+  Clock::time_point now = Clock::now();
+  std::vector<uint8_t> reply = Reply("www.example.com");
+
+  CHECK(limiter.Check(V4("10.0.0.1"), reply.data(), reply.size(), now) ==
+        Action::kSend);
+  size_t slipped = 0;
+  for (size_t i = 0; i < 10; i++) {
+    slipped += limiter.Check(V4("10.0.0.1"), reply.data(), reply.size(),
+                             now) == Action::kSlip;
+  }
+  CHECK(slipped == 5);
+
+  size_t len = RateLimiter::Slip(reply.data(), reply.size());
+  CHECK(len == homedns::wire::QuestionEnd(reply.data(), reply.size()));
+  CHECK(reply[2] & 0x02);
+  CHECK(homedns::wire::ReadU16(reply.data() + 4) == 1);
+  CHECK(homedns::wire::ReadU16(reply.data() + 6) == 0);
+}
+
+void CollisionTest() {
+  // One slot, so every key collides.
+  RateLimiter::Options options;
+  options.burst = 10;
+  options.slip = 0;
+  options.table_size = 1;
+  RateLimiter limiter(options);
+  Clock::time_point now = Clock::now();
+  std::vector<uint8_t> a = Reply("a.example.com");
+  std::vector<uint8_t> b = Reply("b.example.com");
+
+  // Taking turns in the slot doesn't earn either a fresh bucket.
+  size_t sent = 0;
+  for (size_t i = 0; i < 50; i++) {
+    sent += CountSent(&limiter, V4("10.0.0.1"), a, 1, now);
+    sent += CountSent(&limiter, V4("10.0.0.1"), b, 1, now);
+  }
+  CHECK(sent == 10);
+}
+
+void SharedTest() {
+  RateLimiter::Options options;
+  options.burst = 20;
+  options.slip = 0;
+  RateLimiter limiter(options);
+  Clock::time_point now = Clock::now();
+  std::vector<uint8_t> reply = Reply("www.example.com");
+
+  // Threads sharing the limiter, as the sockets do, share its buckets too,
+  // however they race for a fresh one.
+  for (size_t round = 0; round < 100; round++) {
+    std::vector<uint8_t> each = Reply(std::to_string(round) + ".example.com");
+    std::atomic<size_t> sent = 0;
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < 4; i++) {
+      threads.emplace_back([&] {
+        sent += CountSent(&limiter, V4("10.0.0.1"), each, 10, now);
+      });
+    }
+    for (std::thread& thread : threads)
+      thread.join();
+    CHECK(sent == 20);
+  }
+}
+
+// How much the limiter adds to each response, for a flood from many networks
+// and for one client hammering a single name.
+void Benchmark(size_t packets) {
+  std::mt19937 random(1234);
+  std::vector<std::vector<uint8_t>> replies;
+  for (size_t i = 0; i < 64; i++)
+    replies.push_back(Reply("host" + std::to_string(i) + ".example.com"));
+  std::vector<struct sockaddr_in> clients;
+  for (size_t i = 0; i < packets; i++) {
+    struct sockaddr_in client = {};
+    client.sin_addr.s_addr = random();
+    clients.push_back(client);
+  }
+
+  auto ns_per_op = [packets](auto duration) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(duration)
+               .count() /
+           static_cast<double>(packets);
+  };
+
+  RateLimiter spread;
+  auto start = Clock::now();
+  for (size_t i = 0; i < packets; i++) {
+    const auto& reply = replies[i % replies.size()];
+    spread.Check(clients[i], reply.data(), reply.size(), start);
+  }
+  auto spread_time = Clock::now() - start;
+
+  RateLimiter hammered;
+  start = Clock::now();
+  for (size_t i = 0; i < packets; i++) {
+    hammered.Check(clients[0], replies[0].data(), replies[0].size(), start);
+  }
+  auto hammered_time = Clock::now() - start;
+
+  RateLimiter::Stats stats = hammered.GetStats();
+  std::cout << packets << " responses\n"
+            << "  many networks: " << ns_per_op(spread_time) << " ns/op\n"
+            << "  one client:    " << ns_per_op(hammered_time) << " ns/op ("
+            << stats.sent << " sent, " << stats.slipped << " slipped, "
+            << stats.dropped << " dropped)\n";
+}
+
+int main() {
+  LimitTest();
+  SlipTest();
+  CollisionTest();
+  SharedTest();
+  Benchmark(1000000);
+  puts("OK");
+}
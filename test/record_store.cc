@@ -0,0 +1,293 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+#include "homedns/packet.h"
+#include "homedns/record_store.h"
+#include "homedns/test/check.h"
+
+using homedns::DnsPacket;
+using homedns::RecordStore;
+
+DnsPacket RoundTrip(DnsPacket* packet, uint8_t* buffer, size_t* len) {
+  homedns::WriteStream ws(*len, buffer);
+  CHECK(packet->Export(&ws).is_ok());
+  *len = ws.CurrentByte();
+  homedns::ReadStream rs(*len, buffer);
+  return DnsPacket::Import(&rs).Unwrap();
+}
+
+void TypedRecords() {
+  RecordStore store;
+  homedns::DnsMXRecord mx;
+  mx.priority[0] = 0;
+  mx.priority[1] = 10;
+  mx.label = "mail.example.lan";
+  CHECK(store.Add(homedns::DnsLabelSeq{nullptr}, 1, 60,
+                  homedns::DnsARecord{{10, 1, 2, 3}}));
+  CHECK(store.Add(homedns::DnsLabelSeq{nullptr}, 1, 60, mx));
+  CHECK(store.Size() == 2);
+  CHECK(store.Preamble(0).Length == 4 && store.Preamble(1).Length == 20);
+
+  auto a = store.Get<homedns::DnsARecord>(0);
+  CHECK(a.has_value() && a->IP[0] == 10 && a->IP[3] == 3);
+  CHECK(!store.Get<homedns::DnsMXRecord>(0).has_value());
+  auto decoded = store.Get<homedns::DnsMXRecord>(1);
+  CHECK(decoded.has_value() && decoded->priority[1] == 10 &&
+        decoded->label == "mail.example.lan");
+  CHECK(!store.Get<homedns::DnsARecord>(2).has_value());
+
+  // A name that can't be encoded adds nothing.
+  CHECK(!store.Add(homedns::DnsLabelSeq{nullptr}, 1, 60,
+                   homedns::DnsNSRecord{"bad..name"}));
+  CHECK(store.Size() == 2);
+}
+
+// Names inside RDATA are stored whole but compressed on the way out.
+void CompressedNames() {
+  homedns::DnsMXRecord mx;
+  mx.priority[0] = 0;
+  mx.priority[1] = 5;
+  mx.label = "mail.example.lan";
+  DnsPacket packet =
+      DnsPacket::Create(0x4321)
+          .SetQuestionOrResponse(DnsPacket::PacketType::kResponse)
+          .AddQuestion("example.lan", homedns::DnsMXRecord::TYPE, 1)
+          .Unwrap()
+          .AddRecord<DnsPacket::RecordType::kAnswer>("example.lan", 1, 60, mx)
+          .Unwrap()
+          .AddRecord<DnsPacket::RecordType::kAuthority>(
+              "example.lan", 1, 60, homedns::DnsNSRecord{"ns.example.lan"})
+          .Unwrap();
+
+  uint8_t buffer[512];
+  size_t len = sizeof(buffer);
+  DnsPacket reply = RoundTrip(&packet, buffer, &len);
+  CHECK(len < packet.EstimateSize());
+
+  auto answer = reply.GetAnswers().Get<homedns::DnsMXRecord>(0);
+  CHECK(answer.has_value() && answer->priority[1] == 5 &&
+        answer->label == "mail.example.lan");
+  auto authority = reply.GetAuthorities().Get<homedns::DnsNSRecord>(0);
+  CHECK(authority.has_value() && authority->label == "ns.example.lan");
+
+  // Imported RDATA no longer refers to the packet it came from.
+  CHECK(reply.GetAnswers().Preamble(0).Length == 20);
+
+  // Exporting the imported packet compresses it the same way again.
+  uint8_t again[512];
+  size_t again_len = sizeof(again);
+  RoundTrip(&reply, again, &again_len);
+  CHECK(again_len == len && memcmp(buffer, again, len) == 0);
+}
+
+// Types without names, known or not, are copied through byte for byte.
+void OpaqueRecords() {
+  const uint8_t txt[] = {5, 'h', 'e', 'l', 'l', 'o'};
+  DnsPacket packet =
+      DnsPacket::Create(0x1111)
+          .SetQuestionOrResponse(DnsPacket::PacketType::kResponse)
+          .AddRecordData<DnsPacket::RecordType::kAnswer>("t.lan", 16, 1, 60,
+                                                         txt)
+          .Unwrap();
+  uint8_t buffer[512];
+  size_t len = sizeof(buffer);
+  DnsPacket reply = RoundTrip(&packet, buffer, &len);
+  CHECK(reply.GetNumAnswers() == 1);
+  auto rdata = reply.GetAnswers().Rdata(0);
+  CHECK(rdata.size() == sizeof(txt) &&
+        memcmp(rdata.data(), txt, sizeof(txt)) == 0);
+}
+
+// RDATA has to be exactly as long as its preamble says.
+void MalformedRdata() {
+  homedns::DnsMXRecord mx;
+  mx.priority[0] = 0;
+  mx.priority[1] = 5;
+  mx.label = "mx.home";  // Nothing to compress against.
+  DnsPacket packet =
+      DnsPacket::Create(0x2222)
+          .SetQuestionOrResponse(DnsPacket::PacketType::kResponse)
+          .AddRecord<DnsPacket::RecordType::kAnswer>("a.lan", 1, 60, mx)
+          .Unwrap();
+  uint8_t buffer[512];
+  homedns::WriteStream ws(sizeof(buffer), buffer);
+  CHECK(packet.Export(&ws).is_ok());
+  size_t len = ws.CurrentByte();
+  // The length sits just before the 11 bytes of RDATA at the end.
+  size_t length_at = len - 13;
+  CHECK(buffer[length_at + 1] == 11);
+
+  auto import = [&buffer](size_t len) {
+    homedns::ReadStream rs(len, buffer);
+    return DnsPacket::Import(&rs);
+  };
+  CHECK(import(len).has_value());
+
+  buffer[length_at + 1] = 12;  // Claims a byte past the name.
+  CHECK(!import(len).has_value());
+  buffer[length_at + 1] = 1;  // Shorter than the preference.
+  CHECK(!import(len).has_value());
+  buffer[length_at + 1] = 11;
+  CHECK(!import(len - 1).has_value());  // Cut off mid record.
+}
+
+// Every known type survives a trip through a packet, and only the names the
+// type allows are compressed.
+void AllTypes() {
+  homedns::DnsSOARecord soa{"ns.example.lan", "admin.example.lan", 7, 3600,
+                            600, 86400, 60};
+  homedns::DnsSRVRecord srv{10, 20, 5060, "sip.example.lan"};
+  homedns::DnsTXTRecord txt{{"v=spf1 -all", ""}};
+  homedns::DnsRPRecord rp{"admin.example.lan", "."};
+  homedns::DnsLOCRecord loc{0, 0x12, 0x16, 0x13, 0x89173e2c, 0x70be3b70,
+                            0x00989680};
+  homedns::DnsOPTRecord opt{{{10, {1, 2, 3, 4, 5, 6, 7, 8}}}};
+  DnsPacket packet =
+      DnsPacket::Create(0x5555)
+          .SetQuestionOrResponse(DnsPacket::PacketType::kResponse)
+          .AddQuestion("example.lan", homedns::DnsSOARecord::TYPE, 1)
+          .Unwrap()
+          .AddRecord<DnsPacket::RecordType::kAnswer>("example.lan", 1, 60, soa)
+          .Unwrap()
+          .AddRecord<DnsPacket::RecordType::kAnswer>(
+              "_sip._udp.example.lan", 1, 60, srv)
+          .Unwrap()
+          .AddRecord<DnsPacket::RecordType::kAnswer>("example.lan", 1, 60, txt)
+          .Unwrap()
+          .AddRecord<DnsPacket::RecordType::kAnswer>("example.lan", 1, 60, rp)
+          .Unwrap()
+          .AddRecord<DnsPacket::RecordType::kAnswer>("example.lan", 1, 60, loc)
+          .Unwrap()
+          .AddRecord<DnsPacket::RecordType::kAnswer>(
+              "1.1.168.192.in-addr.arpa", 1, 60,
+              homedns::DnsPTRRecord{"printer.example.lan"})
+          .Unwrap()
+          .AddRecord<DnsPacket::RecordType::kAdditional>("", 1232, 0, opt)
+          .Unwrap();
+
+  uint8_t buffer[512];
+  size_t len = sizeof(buffer);
+  DnsPacket reply = RoundTrip(&packet, buffer, &len);
+  const RecordStore& answers = reply.GetAnswers();
+  CHECK(answers.Size() == 6 && reply.GetNumAdditional() == 1);
+
+  auto s = answers.Get<homedns::DnsSOARecord>(0);
+  CHECK(s.has_value() && s->mname == soa.mname && s->rname == soa.rname &&
+        s->serial == 7 && s->refresh == 3600 && s->retry == 600 &&
+        s->expire == 86400 && s->minimum == 60);
+  auto v = answers.Get<homedns::DnsSRVRecord>(1);
+  CHECK(v.has_value() && v->priority == 10 && v->weight == 20 &&
+        v->port == 5060 && v->target == srv.target);
+  auto t = answers.Get<homedns::DnsTXTRecord>(2);
+  CHECK(t.has_value() && t->strings == txt.strings);
+  auto r = answers.Get<homedns::DnsRPRecord>(3);
+  CHECK(r.has_value() && r->mailbox == rp.mailbox && r->text.empty());
+  auto l = answers.Get<homedns::DnsLOCRecord>(4);
+  CHECK(l.has_value() && l->size == 0x12 && l->latitude == loc.latitude &&
+        l->longitude == loc.longitude && l->altitude == loc.altitude);
+  auto p = answers.Get<homedns::DnsPTRRecord>(5);
+  CHECK(p.has_value() && p->label == "printer.example.lan");
+  auto o = reply.GetAdditional().Get<homedns::DnsOPTRecord>(0);
+  CHECK(o.has_value() && o->options.size() == 1 && o->options[0].code == 10 &&
+        o->options[0].data == opt.options[0].data);
+  CHECK(reply.GetAdditional().Preamble(0).Class == 1232);
+
+  // SRV targets are never compressed (RFC 2782), so the name is sent whole
+  // even though "example.lan" was written just before it.
+  const uint8_t sip[] = {3, 's', 'i', 'p', 7, 'e', 'x', 'a', 'm', 'p', 'l',
+                         'e', 3, 'l', 'a', 'n', 0};
+  CHECK(std::search(buffer, buffer + len, sip, sip + sizeof(sip)) !=
+        buffer + len);
+  // Both SOA names are.
+  CHECK(answers.Preamble(0).Length > 20 + 8);
+  CHECK(len < packet.EstimateSize());
+}
+
+// Types with a fixed size are turned away if their RDATA is any other size.
+void FixedSizes() {
+  CHECK(homedns::FindRecordType(homedns::DnsARecord::TYPE)->fixed_size == 4);
+  CHECK(!homedns::FindRecordType(homedns::DnsAAAARecord::TYPE)->variable);
+  CHECK(homedns::FindRecordType(homedns::DnsTXTRecord::TYPE)->variable);
+  CHECK(homedns::FindRecordType(99) == nullptr);
+  CHECK(homedns::FindRecordType(65280) == nullptr);
+
+  const uint8_t five[] = {10, 0, 0, 1, 0};
+  DnsPacket packet =
+      DnsPacket::Create(0x6666)
+          .SetQuestionOrResponse(DnsPacket::PacketType::kResponse)
+          .AddRecordData<DnsPacket::RecordType::kAnswer>(
+              "a.lan", homedns::DnsARecord::TYPE, 1, 60, five)
+          .Unwrap();
+  uint8_t buffer[512];
+  homedns::WriteStream ws(sizeof(buffer), buffer);
+  CHECK(packet.Export(&ws).is_ok());
+  homedns::ReadStream rs(ws.CurrentByte(), buffer);
+  CHECK(!DnsPacket::Import(&rs).has_value());
+}
+
+// Tables dispatch on any type code, not just those that fit a small array.
+struct CAA {
+  static constexpr uint16_t TYPE = 257;
+};
+struct HTTPS {
+  static constexpr uint16_t TYPE = 65;
+};
+
+void SparseTypes() {
+  constexpr auto table = homedns::MakeRecordTable(
+      homedns::RecordTypeList<CAA, HTTPS, homedns::DnsARecord>{}, 0,
+      []<typename T>() { return int(T::TYPE); });
+  static_assert(!table.HasDuplicates());
+  for (uint16_t type : {1, 65, 257})
+    CHECK(table.Find(type) == type);
+  for (uint16_t type : {0, 2, 64, 66, 256, 65535})
+    CHECK(table.Find(type) == 0);
+}
+
+void Benchmark(size_t packets) {
+  DnsPacket packet =
+      DnsPacket::Create(0x3333)
+          .SetQuestionOrResponse(DnsPacket::PacketType::kResponse)
+          .AddQuestion("www.example.lan", homedns::DnsARecord::TYPE, 1)
+          .Unwrap();
+  for (uint8_t i = 0; i < 8; i++) {
+    packet = std::move(packet)
+                 .AddRecord<DnsPacket::RecordType::kAnswer>(
+                     "www.example.lan", 1, 60,
+                     homedns::DnsARecord{{192, 168, 1, i}})
+                 .Unwrap();
+  }
+  uint8_t buffer[512];
+  homedns::WriteStream ws(sizeof(buffer), buffer);
+  CHECK(packet.Export(&ws).is_ok());
+  size_t len = ws.CurrentByte();
+
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < packets; i++) {
+    homedns::ReadStream rs(len, buffer);
+    DnsPacket copy = DnsPacket::Import(&rs).Unwrap();
+    uint8_t out[512];
+    homedns::WriteStream reply(sizeof(out), out);
+    CHECK(copy.Export(&reply).is_ok());
+  }
+  auto duration = std::chrono::steady_clock::now() - start;
+  std::cout << packets << " import/export round trips of 8 A records: "
+            << std::chrono::duration_cast<std::chrono::nanoseconds>(duration)
+                       .count() /
+                   static_cast<double>(packets)
+            << " ns/op\n";
+}
+
+int main() {
+  TypedRecords();
+  CompressedNames();
+  OpaqueRecords();
+  MalformedRdata();
+  AllTypes();
+  FixedSizes();
+  SparseTypes();
+  Benchmark(100000);
+  puts("OK");
+}
@@ -0,0 +1,191 @@
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "homedns/reverse_index.h"
+#include "homedns/test/check.h"
+#include "homedns/wire.h"
+
+using homedns::HostAddress;
+using homedns::ReverseIndex;
+
+HostAddress Address(const char* text) {
+  return HostAddress::Parse(text).value();
+}
+
+// |name| in uncompressed wire format.
+std::vector<uint8_t> Wire(std::string name) {
+  std::vector<uint8_t> wire;
+  size_t start = 0;
+  while (start < name.size()) {
+    size_t dot = std::min(name.find('.', start), name.size());
+    wire.push_back(dot - start);
+    wire.insert(wire.end(), name.begin() + start, name.begin() + dot);
+    start = dot + 1;
+  }
+  wire.push_back(0);
+  return wire;
+}
+
+std::optional<HostAddress> FromReverseName(const char* name) {
+  std::vector<uint8_t> wire = Wire(name);
+  return HostAddress::FromReverseName(wire.data(), wire.size());
+}
+
+std::vector<uint8_t> Query(const char* name, uint16_t type) {
+  std::vector<uint8_t> query = {0x12, 0x34, 0x01, 0x00, 0, 1, 0, 0, 0, 0, 0, 0};
+  std::vector<uint8_t> wire = Wire(name);
+  query.insert(query.end(), wire.begin(), wire.end());
+  query.push_back(type >> 8);
+  query.push_back(type);
+  query.push_back(0);
+  query.push_back(1);
+  return query;
+}
+
+void AddressTest() {
+  CHECK(!HostAddress::Parse("printer").has_value());
+  CHECK(Address("192.168.1.9").family == AF_INET);
+  CHECK(Address("fd00::9").Size() == 16);
+
+  auto v4 = FromReverseName("9.1.168.192.in-addr.arpa");
+  CHECK(v4.has_value() && *v4 == Address("192.168.1.9"));
+  CHECK(FromReverseName("0.0.0.10.IN-ADDR.Arpa") == Address("10.0.0.0"));
+  CHECK(!FromReverseName("1.168.192.in-addr.arpa"));
+  CHECK(!FromReverseName("256.1.168.192.in-addr.arpa"));
+  CHECK(!FromReverseName("09.1.168.192.in-addr.arpa"));
+  CHECK(!FromReverseName("x.1.168.192.in-addr.arpa"));
+  CHECK(!FromReverseName("9.1.168.192.in-addr.arpa.lan"));
+  CHECK(!FromReverseName("printer.lan"));
+
+  const char* v6_name =
+      "9.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.D.F."
+      "ip6.arpa";
+  auto v6 = FromReverseName(v6_name);
+  CHECK(v6.has_value() && *v6 == Address("fd00::9"));
+  CHECK(v6->ReverseName() ==
+        "9.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.d.f."
+        "ip6.arpa");
+  CHECK(!FromReverseName("9.0.0.d.f.ip6.arpa"));
+  CHECK(!FromReverseName(
+      "g.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.d.f."
+      "ip6.arpa"));
+  CHECK(Address("192.168.1.9").ReverseName() == "9.1.168.192.in-addr.arpa");
+
+  // Cut short, and compressed.
+  std::vector<uint8_t> wire = Wire("9.1.168.192.in-addr.arpa");
+  CHECK(!HostAddress::FromReverseName(wire.data(), wire.size() - 1));
+  uint8_t pointer[] = {1, '9', 0xC0, 12};
+  CHECK(!HostAddress::FromReverseName(pointer, sizeof(pointer)));
+}
+
+void AddRemoveTest() {
+  ReverseIndex index;
+  index.Add(Address("192.168.1.9"), "printer.lan");
+  index.Add(Address("192.168.1.9"), "Printer.LAN.");
+  index.Add(Address("192.168.1.9"), "nas.lan");
+  CHECK(index.Size() == 2);
+  CHECK(index.Names(Address("192.168.1.9")) ==
+        (std::vector<std::string>{"printer.lan", "nas.lan"}));
+  CHECK(index.Names(Address("192.168.1.10")).empty());
+
+  // Added twice, so it takes two removals.
+  index.Remove(Address("192.168.1.9"), "printer.lan");
+  CHECK(index.Size() == 2);
+  index.Remove(Address("192.168.1.9"), "printer.lan");
+  index.Remove(Address("192.168.1.9"), "printer.lan");
+  index.Remove(Address("192.168.1.10"), "nas.lan");
+  CHECK(index.Size() == 1);
+  CHECK(index.Names(Address("192.168.1.9")) ==
+        std::vector<std::string>{"nas.lan"});
+}
+
+void WriteTest() {
+  ReverseIndex index(/*ttl=*/30);
+  uint8_t reply[512];
+  std::vector<uint8_t> query = Query("9.1.168.192.in-addr.arpa", 12);
+  // Nothing to answer with yet.
+  CHECK(index.Write(query.data(), query.size(), reply, sizeof(reply)) == 0);
+
+  index.Add(Address("192.168.1.9"), "printer.lan");
+  index.Add(Address("192.168.1.9"), "nas.lan");
+  size_t n = index.Write(query.data(), query.size(), reply, sizeof(reply));
+  size_t record = 12 + 13;  // Owner and fixed fields, then "printer.lan".
+  CHECK(n == query.size() + record + 12 + 9);
+  CHECK(reply[0] == 0x12 && reply[1] == 0x34);
+  CHECK(reply[2] == 0x85 && reply[3] == 0);  // QR AA RD, no error.
+  // With an upstream to recurse through, RA too.
+  index.SetRecursionAvailable(true);
+  CHECK(index.Write(query.data(), query.size(), reply, sizeof(reply)) == n);
+  CHECK(reply[2] == 0x85 && reply[3] == 0x80);
+  index.SetRecursionAvailable(false);
+  CHECK(homedns::wire::ReadU16(reply + 4) == 1);
+  CHECK(homedns::wire::ReadU16(reply + 6) == 2);
+  CHECK(homedns::wire::ReadU16(reply + 8) == 0);
+  CHECK(memcmp(reply + 12, query.data() + 12, query.size() - 12) == 0);
+  const uint8_t* answer = reply + query.size();
+  CHECK(homedns::wire::ReadU16(answer) == 0xC00C);
+  CHECK(homedns::wire::ReadU16(answer + 2) == 12);
+  CHECK(homedns::wire::ReadU32(answer + 6) == 30);
+  CHECK(homedns::wire::ReadU16(answer + 10) == 13);
+  std::vector<uint8_t> printer = Wire("printer.lan");
+  CHECK(memcmp(answer + 12, printer.data(), printer.size()) == 0);
+
+  // What doesn't fit is left off, and the reply marked truncated.
+  n = index.Write(query.data(), query.size(), reply, query.size() + record);
+  CHECK(n == query.size() + record);
+  CHECK(reply[2] & 0x02);
+  CHECK(homedns::wire::ReadU16(reply + 6) == 1);
+
+  // Anything else is left to the usual path.
+  std::vector<uint8_t> a = Query("9.1.168.192.in-addr.arpa", 1);
+  CHECK(index.Write(a.data(), a.size(), reply, sizeof(reply)) == 0);
+  std::vector<uint8_t> other = Query("10.1.168.192.in-addr.arpa", 12);
+  CHECK(index.Write(other.data(), other.size(), reply, sizeof(reply)) == 0);
+  std::vector<uint8_t> forward = Query("printer.lan", 12);
+  CHECK(index.Write(forward.data(), forward.size(), reply, sizeof(reply)) == 0);
+  std::vector<uint8_t> response = query;
+  response[2] |= 0x80;
+  CHECK(index.Write(response.data(), response.size(), reply, sizeof(reply)) ==
+        0);
+  CHECK(index.Write(query.data(), query.size() - 1, reply, sizeof(reply)) ==
+        0);
+
+  index.Remove(Address("192.168.1.9"), "printer.lan");
+  index.Remove(Address("192.168.1.9"), "nas.lan");
+  CHECK(index.Write(query.data(), query.size(), reply, sizeof(reply)) == 0);
+}
+
+void Benchmark() {
+  ReverseIndex index;
+  for (int i = 0; i < 1000; i++) {
+    HostAddress address = Address("192.168.0.0");
+    address.bytes[2] = i >> 8;
+    address.bytes[3] = i;
+    index.Add(address, "host" + std::to_string(i) + ".lan");
+  }
+  std::vector<uint8_t> query = Query("77.1.168.192.in-addr.arpa", 12);
+  uint8_t reply[512];
+  constexpr int kRounds = 1000000;
+  size_t total = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < kRounds; i++)
+    total += index.Write(query.data(), query.size(), reply, sizeof(reply));
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  CHECK(total > 0);
+  std::cout << "PTR reply: "
+            << std::chrono::duration<double, std::nano>(elapsed).count() /
+                   kRounds
+            << " ns/op\n";
+}
+
+int main() {
+  AddressTest();
+  AddRemoveTest();
+  WriteTest();
+  Benchmark();
+  puts("OK");
+}
@@ -0,0 +1,170 @@
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "homedns/suffix_tree.h"
+#include "homedns/test/check.h"
+
+using Tree = homedns::SuffixTree<int>;
+
+void MatchTest() {
+  Tree::Builder builder;
+  builder.Insert("lan", 1);
+  builder.Insert("printer.office.lan", 2);
+  builder.Insert("*.iot.lan", 3);
+  builder.Insert("corp.example.com.", 4);
+  builder.Insert("a.b.c.d.example.com", 5);
+  Tree tree = std::move(builder).Build();
+
+  Tree::Match match = tree.LongestMatch("laptop.LAN");
+  CHECK(match.value && *match.value == 1 && match.labels == 1);
+
+  match = tree.LongestMatch("Printer.Office.lan");
+  CHECK(match.value && *match.value == 2 && match.labels == 3);
+
+  // office.lan only exists as part of a collapsed edge.
+  match = tree.LongestMatch("scanner.office.lan");
+  CHECK(match.value && *match.value == 1 && match.encloser == 2);
+
+  match = tree.LongestMatch("bulb.iot.lan");
+  CHECK(match.value && *match.value == 3 && match.wildcard);
+  CHECK(match.labels == 3);
+
+  // A wildcard only covers a single label below its closest encloser.
+  match = tree.LongestMatch("iot.lan");
+  CHECK(match.value && *match.value == 1 && !match.wildcard);
+
+  match = tree.LongestMatch("x.corp.example.com");
+  CHECK(match.value && *match.value == 4 && match.labels == 3);
+
+  match = tree.LongestMatch("c.d.example.com");
+  CHECK(match.value == nullptr && match.encloser == 4);
+
+  match = tree.LongestMatch("google.com");
+  CHECK(match.value == nullptr && match.encloser == 1);
+
+  CHECK(tree.Exact("corp.example.com") && *tree.Exact("corp.example.com") == 4);
+  CHECK(tree.Exact("x.corp.example.com") == nullptr);
+  CHECK(tree.Exact("bulb.iot.lan") == nullptr);
+
+  homedns::LabelManager labels;
+  auto seq = labels.GetLabelSeq("host.printer.office.lan").Unwrap();
+  match = tree.LongestMatch(seq);
+  CHECK(match.value && *match.value == 2);
+}
+
+// Longest suffix match by probing a hash table with every suffix of the name,
+// longest first. This is what the tree is meant to beat.
+class HashPerSuffix {
+ public:
+  void Insert(const std::string& name, int value) { names_[name] = value; }
+
+  const int* LongestMatch(std::string_view name) const {
+    std::string lowered(name);
+    for (char& c : lowered)
+      c = std::tolower(static_cast<unsigned char>(c));
+    std::string_view rest = lowered;
+    while (!rest.empty()) {
+      auto it = names_.find(std::string(rest));
+      if (it != names_.end())
+        return &it->second;
+      size_t dot = rest.find('.');
+      if (dot == std::string_view::npos)
+        break;
+      rest.remove_prefix(dot + 1);
+    }
+    return nullptr;
+  }
+
+  size_t MemoryUsage() const {
+    size_t total = names_.bucket_count() * sizeof(void*);
+    for (const auto& [name, value] : names_)
+      total += sizeof(name) + sizeof(value) + 2 * sizeof(void*) +
+               (name.size() > 15 ? name.capacity() : 0);
+    return total;
+  }
+
+ private:
+  std::unordered_map<std::string, int> names_;
+};
+
+std::string RandomLabel(std::mt19937* random) {
+  static const char kChars[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+  std::string label;
+  size_t length = 3 + (*random)() % 10;
+  for (size_t i = 0; i < length; i++)
+    label += kChars[(*random)() % 36];
+  return label;
+}
+
+void Benchmark(size_t entries, size_t lookups) {
+  static const char* kTLDs[] = {"com", "net", "org", "lan", "io", "de"};
+  std::mt19937 random(1234);
+
+  std::vector<std::string> names;
+  Tree::Builder builder;
+  HashPerSuffix hash;
+  for (size_t i = 0; i < entries; i++) {
+    std::string name = kTLDs[random() % 6];
+    size_t depth = 1 + random() % 3;
+    for (size_t d = 0; d < depth; d++)
+      name = RandomLabel(&random) + "." + name;
+    names.push_back(name);
+    builder.Insert(name, i);
+    hash.Insert(name, i);
+  }
+  Tree tree = std::move(builder).Build();
+
+  // Half of the queries are subdomains of stored names, half are unrelated.
+  std::vector<std::string> queries;
+  for (size_t i = 0; i < lookups; i++) {
+    std::string query = names[random() % names.size()];
+    if (i % 2)
+      query = RandomLabel(&random) + ".example." + kTLDs[random() % 6];
+    size_t prefix = random() % 3;
+    for (size_t p = 0; p < prefix; p++)
+      query = RandomLabel(&random) + "." + query;
+    queries.push_back(query);
+  }
+
+  for (const std::string& query : queries) {
+    const int* expected = hash.LongestMatch(query);
+    const int* got = tree.LongestMatch(query).value;
+    CHECK((expected == nullptr) == (got == nullptr));
+    CHECK(expected == nullptr || *expected == *got);
+  }
+
+  size_t found = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (const std::string& query : queries)
+    found += tree.LongestMatch(query).value != nullptr;
+  auto tree_time = std::chrono::steady_clock::now() - start;
+
+  start = std::chrono::steady_clock::now();
+  for (const std::string& query : queries)
+    found += hash.LongestMatch(query) != nullptr;
+  auto hash_time = std::chrono::steady_clock::now() - start;
+
+  auto ns_per_op = [lookups](auto duration) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(duration)
+               .count() /
+           static_cast<double>(lookups);
+  };
+  std::cout << entries << " names, " << lookups << " lookups (" << found / 2
+            << " matched)\n"
+            << "  suffix tree:     " << ns_per_op(tree_time) << " ns/op, "
+            << tree.MemoryUsage() / 1024 << " KiB, " << tree.NodeCount()
+            << " nodes\n"
+            << "  hash per suffix: " << ns_per_op(hash_time) << " ns/op, ~"
+            << hash.MemoryUsage() / 1024 << " KiB\n";
+}
+
+int main() {
+  MatchTest();
+  Benchmark(10000, 1000000);
+  Benchmark(1000000, 1000000);
+  puts("OK");
+}
@@ -0,0 +1,278 @@
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include "base/bind/bind.h"
+#include "homedns/answer_cache.h"
+#include "homedns/packet.h"
+#include "homedns/responders/responders.h"
+#include "homedns/task.h"
+#include "homedns/test/check.h"
+#include "homedns/udp_server.h"
+
+constexpr uint16_t kServerPort = 5400;
+
+homedns::Task<int> Leaf(int value) {
+  co_return value;
+}
+
+homedns::Task<int> Sum(int depth) {
+  if (depth == 0)
+    co_return 0;
+  int below = co_await Sum(depth - 1);
+  co_return below + co_await Leaf(1);
+}
+
+void Store(int* out, int value) {
+  *out = value;
+}
+
+void ChainTest() {
+  int result = -1;
+  homedns::Spawn(Sum(1000), base::RepeatingCallback<void(int)>(
+                                base::BindRepeating(&Store, &result)));
+  CHECK(result == 1000);
+
+  // Every frame went back to the pool, and the second time round they all
+  // come from it.
+  homedns::FramePool::Stats before = homedns::FramePool::GetStats();
+  CHECK(before.live == 0);
+  CHECK(before.pooled > 0);
+  homedns::Spawn(Sum(1000), base::RepeatingCallback<void(int)>(
+                                base::BindRepeating(&Store, &result)));
+  homedns::FramePool::Stats after = homedns::FramePool::GetStats();
+  CHECK(result == 1000);
+  CHECK(after.live == 0);
+  CHECK(after.heap_allocations == before.heap_allocations);
+}
+
+// Stands in for the forwarder: holds on to every lookup until Answer().
+class FakeUpstream {
+ public:
+  void Ask(const homedns::CacheKey& key,
+           base::RepeatingCallback<void(std::vector<uint8_t>)> cb) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    waiting_.push_back(std::move(cb));
+  }
+
+  size_t Waiting() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return waiting_.size();
+  }
+
+  void Answer() {
+    std::vector<base::RepeatingCallback<void(std::vector<uint8_t>)>> waiting;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      waiting.swap(waiting_);
+    }
+    for (const auto& cb : waiting)
+      cb.Run({192, 168, 1, 9});
+  }
+
+ private:
+  std::mutex mutex_;
+  std::vector<base::RepeatingCallback<void(std::vector<uint8_t>)>> waiting_;
+};
+
+void AskFake(FakeUpstream* upstream,
+             const homedns::CacheKey& key,
+             base::RepeatingCallback<void(std::vector<uint8_t>)> cb) {
+  upstream->Ask(key, std::move(cb));
+}
+
+void RunAfter(homedns::UDPServer* server,
+              std::chrono::milliseconds delay,
+              base::RepeatingCallback<void()> cb) {
+  server->RunAfter(delay, std::move(cb));
+}
+
+// Answers A queries with whatever upstream says, after a short nap.
+homedns::AsyncResponse ReplyFromUpstream(
+    const homedns::ResponderContext* context,
+    homedns::DnsPacket response) {
+  const homedns::DnsQuestion* q = response.GetQuestion(0).value();
+  auto key = homedns::CacheKey::Create(q->LabelSequence.Render(), q->Type,
+                                       q->Class);
+  std::vector<uint8_t> ip = co_await homedns::AskUpstream(context, key);
+  if (ip.size() != 4)
+    co_return homedns::PacketStatus::Codes::kNameNotFound;
+  co_await homedns::Sleep(context, std::chrono::milliseconds(10));
+  homedns::DnsARecord a;
+  std::copy(ip.begin(), ip.end(), a.IP);
+  co_return std::move(response)
+      .AddRecord<homedns::DnsPacket::RecordType::kAnswer>(key.name, q->Class,
+                                                          60, a);
+}
+
+void CountAnswer(std::atomic<int>* answered,
+                 homedns::PacketStatus::Or<homedns::DnsPacket> m_response) {
+  CHECK(m_response.has_value());
+  homedns::DnsPacket response = std::move(m_response).value();
+  CHECK(response.GetAnswers().Size() == 1);
+  CHECK(response.GetAnswers().Get<homedns::DnsARecord>(0)->IP[3] == 9);
+  (*answered)++;
+}
+
+// Thousands of responders suspended on upstream at once cost a frame each,
+// and are resumed from another thread, then by the loop's timers.
+void ResponderTest() {
+  constexpr int kQueries = 5000;
+  auto server = homedns::UDPServer::Create(kServerPort);
+  CHECK(server);
+  std::thread loop(&homedns::UDPServer::Start, server.get());
+
+  FakeUpstream upstream;
+  homedns::ResponderContext context;
+  context.ask_upstream = base::BindRepeating(&AskFake, &upstream);
+  context.run_after = base::BindRepeating(&RunAfter, server.get());
+
+  std::atomic<int> answered = 0;
+  int64_t live_before = homedns::FramePool::GetStats().live;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < kQueries; i++) {
+    homedns::DnsPacket response =
+        homedns::DnsPacket::Create(i)
+            .AddQuestion("host" + std::to_string(i) + ".lan",
+                         homedns::DnsARecord::TYPE, 1)
+            .Unwrap();
+    homedns::Spawn(
+        ReplyFromUpstream(&context, std::move(response)),
+        base::RepeatingCallback<void(
+            homedns::PacketStatus::Or<homedns::DnsPacket>)>(
+            base::BindRepeating(&CountAnswer, &answered)));
+  }
+  auto spawned = std::chrono::steady_clock::now() - start;
+  CHECK(upstream.Waiting() == kQueries);
+  CHECK(answered == 0);
+  // Two frames each: the responder, and what Spawn wraps it in.
+  int64_t frames = homedns::FramePool::GetStats().live - live_before;
+  CHECK(frames == 2 * kQueries);
+  std::cout << kQueries << " responders suspended in "
+            << std::chrono::duration_cast<std::chrono::microseconds>(spawned)
+                   .count()
+            << "us\n";
+
+  std::thread answerer(&FakeUpstream::Answer, &upstream);
+  answerer.join();
+  for (int i = 0; i < 100 && answered < kQueries; i++)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  CHECK(answered == kQueries);
+
+  server->Stop();
+  loop.join();
+}
+
+// Stands in for a real upstream, answering every A question about
+// "home.example.net" with 10.0.0.9, and nothing else at all.
+// Answers home.example.net directly, and www.example.net through an alias of
+// its own, each along with a record for a name nobody asked about.
+void AnswerAlias(std::vector<homedns::CacheKey>* asked,
+                 const homedns::CacheKey& key,
+                 base::RepeatingCallback<void(std::vector<uint8_t>)> cb) {
+  asked->push_back(key);
+  if (key.name != "home.example.net" && key.name != "www.example.net") {
+    cb.Run({});
+    return;
+  }
+  homedns::DnsPacket reply =
+      homedns::DnsPacket::Create(7)
+          .SetQuestionOrResponse(homedns::DnsPacket::PacketType::kResponse)
+          .AddQuestion(key.name, key.type, key.klass)
+          .Unwrap()
+          .AddRecord<homedns::DnsPacket::RecordType::kAnswer>(
+              "bank.example.com", key.klass, 60,
+              homedns::DnsARecord{{6, 6, 6, 6}})
+          .Unwrap();
+  std::string owner = key.name;
+  if (key.name == "www.example.net") {
+    owner = "cdn.example.net";
+    reply = std::move(reply)
+                .AddRecord<homedns::DnsPacket::RecordType::kAnswer>(
+                    key.name, key.klass, 60, homedns::DnsCNAMERecord{owner})
+                .Unwrap();
+  }
+  reply = std::move(reply)
+              .AddRecord<homedns::DnsPacket::RecordType::kAnswer>(
+                  owner, key.klass, 60, homedns::DnsARecord{{10, 0, 0, 9}})
+              .Unwrap();
+  uint8_t wire[512];
+  homedns::WriteStream ws(sizeof(wire), wire);
+  CHECK(reply.Export(&ws).is_ok());
+  cb.Run(std::vector<uint8_t>(wire, wire + ws.CurrentByte()));
+}
+
+void StoreResponse(std::optional<homedns::DnsPacket>* out,
+                   homedns::PacketStatus::Or<homedns::DnsPacket> m_response) {
+  CHECK(m_response.has_value());
+  out->emplace(std::move(m_response).value());
+}
+
+// A local alias answered by FollowCNAMERecord, which asks upstream for its
+// target.
+std::optional<homedns::DnsPacket> FollowAlias(
+    const homedns::ResponderContext* context,
+    const char* target) {
+  homedns::DnsPacket response =
+      homedns::DnsPacket::Create(1)
+          .AddQuestion("nas.lan", homedns::DnsARecord::TYPE, 1)
+          .Unwrap()
+          .AddRecord<homedns::DnsPacket::RecordType::kAnswer>(
+              "nas.lan", 1, 300, homedns::DnsCNAMERecord{target})
+          .Unwrap();
+  homedns::AsyncResponder respond =
+      homedns::FindAsyncResponder(homedns::DnsARecord::TYPE);
+  CHECK(respond == &homedns::FollowCNAMERecord);
+  std::optional<homedns::DnsPacket> answered;
+  homedns::Spawn(
+      respond(context, std::move(response)),
+      base::RepeatingCallback<void(
+          homedns::PacketStatus::Or<homedns::DnsPacket>)>(
+          base::BindRepeating(&StoreResponse, &answered)));
+  return answered;
+}
+
+void AliasTest() {
+  std::vector<homedns::CacheKey> asked;
+  homedns::ResponderContext context;
+  context.ask_upstream = base::BindRepeating(&AnswerAlias, &asked);
+
+  std::optional<homedns::DnsPacket> response =
+      FollowAlias(&context, "Home.Example.Net");
+  CHECK(response.has_value());
+  CHECK(asked.size() == 1);
+  CHECK(asked[0].name == "home.example.net");
+  CHECK(asked[0].type == homedns::DnsARecord::TYPE);
+  const homedns::RecordStore& answers = response->GetAnswers();
+  CHECK(answers.Size() == 2);
+  CHECK(answers.Get<homedns::DnsCNAMERecord>(0).has_value());
+  CHECK(answers.Get<homedns::DnsARecord>(1)->IP[3] == 9);
+  CHECK(answers.Preamble(1).LabelSequence.Render() == "home.example.net");
+
+  // An alias upstream is followed too, and nothing off the chain is taken.
+  response = FollowAlias(&context, "www.example.net");
+  CHECK(response.has_value());
+  CHECK(asked.size() == 2);
+  const homedns::RecordStore& chain = response->GetAnswers();
+  CHECK(chain.Size() == 3);
+  CHECK(chain.Get<homedns::DnsCNAMERecord>(1)->label == "cdn.example.net");
+  CHECK(chain.Preamble(2).LabelSequence.Render() == "cdn.example.net");
+  CHECK(chain.Get<homedns::DnsARecord>(2)->IP[3] == 9);
+
+  // Without an answer from upstream, the alias is all there is.
+  response = FollowAlias(&context, "elsewhere.example.net");
+  CHECK(response.has_value());
+  CHECK(asked.size() == 3);
+  CHECK(response->GetAnswers().Size() == 1);
+  CHECK(homedns::AliasTarget(*response) == "elsewhere.example.net");
+}
+
+int main() {
+  ChainTest();
+  ResponderTest();
+  AliasTest();
+  puts("OK");
+}
@@ -0,0 +1,178 @@
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "base/bind/bind.h"
+#include "homedns/test/check.h"
+#include "homedns/timer_wheel.h"
+
+using homedns::TimerWheel;
+using Clock = TimerWheel::Clock;
+using std::chrono::hours;
+using std::chrono::milliseconds;
+
+void Record(std::vector<int>* fired, int which) {
+  fired->push_back(which);
+}
+
+void Nothing() {}
+
+// Timers on every level fire at their deadline, not before and not much
+// after, in order, however the clock gets there.
+void OrderTest() {
+  Clock::time_point epoch = Clock::now();
+  TimerWheel wheel(epoch);
+  std::vector<int> fired;
+  // One per level, plus one in the overflow list.
+  const milliseconds deadlines[] = {milliseconds(5), milliseconds(300),
+                                    milliseconds(70000), hours(5),
+                                    hours(24 * 60)};
+  for (int i = 4; i >= 0; i--) {
+    wheel.Schedule(epoch + deadlines[i],
+                   base::BindRepeating(&Record, &fired, i));
+  }
+  CHECK(wheel.Size() == 5);
+
+  std::vector<TimerWheel::Callback> due;
+  for (int i = 0; i < 5; i++) {
+    wheel.Advance(epoch + deadlines[i] - milliseconds(1), &due);
+    CHECK(due.size() == (size_t)i);
+    wheel.Advance(epoch + deadlines[i], &due);
+    CHECK(due.size() == (size_t)i + 1);
+  }
+  for (const auto& cb : due)
+    cb.Run();
+  CHECK((fired == std::vector<int>{0, 1, 2, 3, 4}));
+  CHECK(wheel.Size() == 0);
+
+  // Past deadlines fire on the next advance; same deadlines in the order
+  // they were scheduled.
+  Clock::time_point now = epoch + hours(24 * 60);
+  fired.clear();
+  due.clear();
+  wheel.Schedule(now - hours(1), base::BindRepeating(&Record, &fired, 1));
+  wheel.Schedule(now + milliseconds(1),
+                 base::BindRepeating(&Record, &fired, 2));
+  wheel.Schedule(now + milliseconds(1),
+                 base::BindRepeating(&Record, &fired, 3));
+  CHECK(wheel.UntilNext(milliseconds(100)) == milliseconds(1));
+  wheel.Advance(now + milliseconds(1), &due);
+  for (const auto& cb : due)
+    cb.Run();
+  CHECK((fired == std::vector<int>{1, 2, 3}));
+}
+
+void CancelTest() {
+  Clock::time_point epoch = Clock::now();
+  TimerWheel wheel(epoch);
+  std::vector<int> fired;
+  auto a = wheel.Schedule(epoch + milliseconds(10),
+                          base::BindRepeating(&Record, &fired, 1));
+  auto b = wheel.Schedule(epoch + milliseconds(100000),
+                          base::BindRepeating(&Record, &fired, 2));
+  CHECK(wheel.UntilNext(milliseconds(100)) == milliseconds(10));
+  CHECK(wheel.Cancel(b));
+  CHECK(!wheel.Cancel(b));
+  CHECK(wheel.Size() == 1);
+
+  std::vector<TimerWheel::Callback> due;
+  wheel.Advance(epoch + milliseconds(200000), &due);
+  CHECK(due.size() == 1);
+  CHECK(!wheel.Cancel(a));
+
+  // A stale id doesn't cancel whatever reused its slot.
+  auto c = wheel.Schedule(epoch + milliseconds(200010),
+                          base::BindRepeating(&Record, &fired, 3));
+  CHECK(c.index == a.index || c.index == b.index);
+  CHECK(!wheel.Cancel(c.index == a.index ? a : b));
+  CHECK(wheel.Size() == 1);
+  CHECK(!wheel.Cancel(TimerWheel::TimerId()));
+}
+
+// Random deadlines, checked against what has fired after each advance.
+void RandomTest() {
+  Clock::time_point epoch = Clock::now();
+  TimerWheel wheel(epoch);
+  std::mt19937 random(42);
+  std::vector<int> fired;
+  std::vector<milliseconds> deadlines;
+  for (int i = 0; i < 20000; i++) {
+    milliseconds deadline(random() % (1 << 20));
+    deadlines.push_back(deadline);
+    wheel.Schedule(epoch + deadline, base::BindRepeating(&Record, &fired, i));
+  }
+
+  milliseconds now(0);
+  std::vector<TimerWheel::Callback> due;
+  while (wheel.Size() > 0) {
+    now += milliseconds(random() % 5000);
+    due.clear();
+    wheel.Advance(epoch + now, &due);
+    size_t before = fired.size();
+    for (const auto& cb : due)
+      cb.Run();
+    for (size_t i = before; i < fired.size(); i++) {
+      CHECK(deadlines[fired[i]] <= now);
+      if (i > 0)
+        CHECK(deadlines[fired[i]] >= deadlines[fired[i - 1]]);
+    }
+  }
+  CHECK(fired.size() == deadlines.size());
+}
+
+// Schedules |count| timers spread over an hour, cancels half of them (as
+// answered queries would), and runs the clock through the rest.
+void Benchmark(size_t count) {
+  Clock::time_point epoch = Clock::now();
+  TimerWheel wheel(epoch);
+  std::mt19937 random(1234);
+  std::vector<milliseconds> deadlines;
+  for (size_t i = 0; i < count; i++)
+    deadlines.push_back(milliseconds(1 + random() % 3600000));
+  std::vector<TimerWheel::TimerId> ids(count);
+
+  auto ns_per_op = [count](auto duration) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(duration)
+               .count() /
+           static_cast<double>(count);
+  };
+
+  auto start = Clock::now();
+  for (size_t i = 0; i < count; i++)
+    ids[i] = wheel.Schedule(epoch + deadlines[i],
+                            base::BindRepeating(&Nothing));
+  auto schedule_time = Clock::now() - start;
+  CHECK(wheel.Size() == count);
+
+  start = Clock::now();
+  for (size_t i = 0; i < count; i += 2)
+    CHECK(wheel.Cancel(ids[i]));
+  auto cancel_time = (Clock::now() - start) * 2;
+
+  std::vector<TimerWheel::Callback> due;
+  due.reserve(count);
+  start = Clock::now();
+  for (milliseconds now(0); now <= hours(1); now += milliseconds(10))
+    wheel.Advance(epoch + now, &due);
+  auto advance_time = Clock::now() - start;
+  CHECK(due.size() == count / 2);
+  CHECK(wheel.Size() == 0);
+
+  std::cout << count << " timers\n"
+            << "  schedule: " << ns_per_op(schedule_time) << " ns/op\n"
+            << "  cancel:   " << ns_per_op(cancel_time) << " ns/op\n"
+            << "  an hour of 10ms ticks, firing half: "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(
+                   advance_time)
+                   .count()
+            << " ms\n";
+}
+
+int main() {
+  OrderTest();
+  CancelTest();
+  RandomTest();
+  Benchmark(2000000);
+  puts("OK");
+}
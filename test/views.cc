@@ -0,0 +1,98 @@
+#include <arpa/inet.h>
+#include <iostream>
+
+#include "homedns/test/check.h"
+#include "homedns/views.h"
+
+using homedns::DnsPacket;
+using homedns::PacketStatus;
+using homedns::Views;
+
+struct sockaddr_in V4(const char* address) {
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  inet_pton(AF_INET, address, &addr.sin_addr);
+  return addr;
+}
+
+PacketStatus::Or<DnsPacket> Ask(const homedns::View* view,
+                                const char* name,
+                                uint16_t type) {
+  DnsPacket query = DnsPacket::Create(1).AddQuestion(name, type, 1).Unwrap();
+  return view->zone.Answer(query.GetQuestion(0).value(), DnsPacket::Create(1));
+}
+
+void SelectTest() {
+  auto m_views = Views::Parse(
+      "view lan 192.168.0.0/16 127.0.0.1 fd00::/8\n"
+      "printer.lan 300 A 192.168.1.40\n"
+      "nas.lan     300 A 192.168.1.41\n"
+      "nas.lan     300 AAAA fd00::41\n"
+      "files.lan   300 CNAME nas.lan\n"
+      "\n"
+      "view wan 0.0.0.0/0  # everyone else\n"
+      "printer.lan 300 A 50.35.80.74\n"
+      "view guests 192.168.66.0/24\n");
+  CHECK(m_views.has_value());
+  Views views = std::move(m_views).value();
+  CHECK(views.Count() == 3);
+
+  CHECK(views.Select(V4("192.168.1.5"))->name == "lan");
+  CHECK(views.Select(V4("127.0.0.1"))->name == "lan");
+  CHECK(views.Select(V4("192.168.66.9"))->name == "guests");
+  CHECK(views.Select(V4("8.8.8.8"))->name == "wan");
+
+  struct in6_addr v6 = {};
+  inet_pton(AF_INET6, "fd00::99", &v6);
+  CHECK(views.Select(v6)->name == "lan");
+  inet_pton(AF_INET6, "2001:db8::1", &v6);
+  CHECK(views.Select(v6)->name == "lan");  // No match falls back to the first.
+
+  const homedns::View* lan = views.Select(V4("192.168.1.5"));
+  const homedns::View* wan = views.Select(V4("8.8.8.8"));
+  const homedns::View* guests = views.Select(V4("192.168.66.9"));
+  // Three PTR records come with the addresses.
+  CHECK(lan->zone.RecordCount() == 7);
+
+  auto answer = Ask(lan, "Printer.LAN", homedns::DnsARecord::TYPE);
+  CHECK(answer.has_value() && std::move(answer).value().GetNumAnswers() == 1);
+  answer = Ask(wan, "printer.lan", homedns::DnsARecord::TYPE);
+  CHECK(answer.has_value() && std::move(answer).value().GetNumAnswers() == 1);
+  answer = Ask(lan, "files.lan", homedns::DnsARecord::TYPE);
+  CHECK(answer.has_value() && std::move(answer).value().GetNumAnswers() == 1);
+
+  CHECK(Ask(wan, "nas.lan", homedns::DnsARecord::TYPE).code() ==
+        PacketStatus::Codes::kNameNotFound);
+  CHECK(Ask(guests, "printer.lan", homedns::DnsARecord::TYPE).code() ==
+        PacketStatus::Codes::kNameNotFound);
+  CHECK(Ask(lan, "printer.lan", homedns::DnsAAAARecord::TYPE).code() ==
+        PacketStatus::Codes::kInvalidRecordType);
+
+  answer = Ask(lan, "41.1.168.192.in-addr.arpa", homedns::DnsPTRRecord::TYPE);
+  CHECK(answer.has_value() && std::move(answer).value().GetNumAnswers() == 1);
+  answer = Ask(lan,
+               "1.4.0.0.0.0.0.0.0.0.0.0.0.0.0.0."
+               "0.0.0.0.0.0.0.0.0.0.0.0.0.0.d.f.ip6.arpa",
+               homedns::DnsPTRRecord::TYPE);
+  CHECK(answer.has_value() && std::move(answer).value().GetNumAnswers() == 1);
+  CHECK(Ask(wan, "41.1.168.192.in-addr.arpa", homedns::DnsPTRRecord::TYPE)
+            .code() == PacketStatus::Codes::kNameNotFound);
+
+  // Each view caches on its own.
+  CHECK(lan->cache.get() != wan->cache.get());
+}
+
+void ParseErrorTest() {
+  CHECK(!Views::Parse("printer.lan 300 A 192.168.1.40\n").has_value());
+  CHECK(!Views::Parse("view lan 192.168.0.0/40\n").has_value());
+  CHECK(!Views::Parse("view lan\nprinter.lan 300 A 300.1.1.1\n").has_value());
+  CHECK(!Views::Parse("view lan\nprinter.lan soon A 1.1.1.1\n").has_value());
+  CHECK(!Views::Parse("view lan\nprinter.lan 300 SPF v=spf1\n").has_value());
+  CHECK(!Views::Parse("# nothing\n").has_value());
+}
+
+int main() {
+  SelectTest();
+  ParseErrorTest();
+  puts("OK");
+}
@@ -0,0 +1,182 @@
+#include "timer_wheel.h"
+
+#include <algorithm>
+
+namespace homedns {
+
+TimerWheel::TimerWheel(Clock::time_point now) : epoch_(now) {
+  heads_.fill(kNone);
+  tails_.fill(kNone);
+}
+
+uint64_t TimerWheel::ToTick(Clock::time_point time) const {
+  if (time <= epoch_)
+    return 0;
+  return std::chrono::duration_cast<std::chrono::milliseconds>(time - epoch_)
+      .count();
+}
+
+TimerWheel::TimerId TimerWheel::Schedule(Clock::time_point deadline,
+                                         Callback cb) {
+  uint32_t index;
+  if (free_ != kNone) {
+    index = free_;
+    free_ = timers_[index].next;
+  } else {
+    index = timers_.size();
+    timers_.push_back({});
+    timers_.back().generation = 1;
+  }
+  Timer& timer = timers_[index];
+  // Rounded up, so that nothing fires early; and at the earliest on the next
+  // tick, since this one's slot may already have been run.
+  uint64_t expires = 0;
+  if (deadline > epoch_) {
+    expires = std::chrono::ceil<std::chrono::milliseconds>(deadline - epoch_)
+                  .count();
+  }
+  timer.expires = std::max(expires, tick_ + 1);
+  timer.cb = std::move(cb);
+  Place(index);
+  size_++;
+  return {index, timer.generation};
+}
+
+bool TimerWheel::Cancel(TimerId id) {
+  if (!id || id.index >= timers_.size() ||
+      timers_[id.index].generation != id.generation) {
+    return false;
+  }
+  Unlink(id.index);
+  Release(id.index);
+  return true;
+}
+
+void TimerWheel::Place(uint32_t index) {
+  uint64_t expires = timers_[index].expires;
+  uint64_t differs = expires ^ tick_;
+  for (int level = 0; level < kLevels; level++) {
+    // The finest level whose current span, the one |tick_| is in, holds the
+    // deadline.
+    if ((differs >> (kSlotBits * (level + 1))) == 0) {
+      uint32_t slot = (expires >> (kSlotBits * level)) & (kSlots - 1);
+      Link(level * kSlots + slot, index);
+      return;
+    }
+  }
+  Link(kOverflow, index);
+}
+
+void TimerWheel::Link(uint32_t list, uint32_t index) {
+  Timer& timer = timers_[index];
+  timer.list = list;
+  timer.next = kNone;
+  timer.prev = tails_[list];
+  if (tails_[list] == kNone)
+    heads_[list] = index;
+  else
+    timers_[tails_[list]].next = index;
+  tails_[list] = index;
+  counts_[list / kSlots]++;
+}
+
+void TimerWheel::Unlink(uint32_t index) {
+  Timer& timer = timers_[index];
+  if (timer.prev == kNone)
+    heads_[timer.list] = timer.next;
+  else
+    timers_[timer.prev].next = timer.next;
+  if (timer.next == kNone)
+    tails_[timer.list] = timer.prev;
+  else
+    timers_[timer.next].prev = timer.prev;
+  counts_[timer.list / kSlots]--;
+}
+
+void TimerWheel::Release(uint32_t index) {
+  Timer& timer = timers_[index];
+  timer.cb = Callback();
+  if (++timer.generation == 0)
+    timer.generation = 1;
+  timer.next = free_;
+  free_ = index;
+  size_--;
+}
+
+void TimerWheel::Cascade(uint32_t list) {
+  uint32_t index = heads_[list];
+  heads_[list] = kNone;
+  tails_[list] = kNone;
+  while (index != kNone) {
+    uint32_t next = timers_[index].next;
+    counts_[list / kSlots]--;
+    Place(index);
+    index = next;
+  }
+}
+
+void TimerWheel::CascadeAll() {
+  int top = 1;
+  while (top <= kLevels && (tick_ & ((1ull << (kSlotBits * top)) - 1)) == 0)
+    top++;
+  // From the coarsest level down, so that whatever lands in a slot about to
+  // be cascaded moves on down with it.
+  for (int level = top - 1; level >= 1; level--) {
+    if (level == kLevels) {
+      Cascade(kOverflow);
+      continue;
+    }
+    uint32_t slot = (tick_ >> (kSlotBits * level)) & (kSlots - 1);
+    Cascade(level * kSlots + slot);
+  }
+}
+
+void TimerWheel::Advance(Clock::time_point now, std::vector<Callback>* due) {
+  uint64_t target = ToTick(now);
+  while (tick_ < target) {
+    if (size_ == 0) {
+      tick_ = target;
+      break;
+    }
+    if (counts_[0] == 0) {
+      // Nothing can fire before the later levels are next looked at.
+      uint64_t boundary = (tick_ | (kSlots - 1)) + 1;
+      if (boundary > target) {
+        tick_ = target;
+        break;
+      }
+      tick_ = boundary;
+    } else {
+      tick_++;
+    }
+    if ((tick_ & (kSlots - 1)) == 0)
+      CascadeAll();
+
+    uint32_t list = tick_ & (kSlots - 1);
+    while (heads_[list] != kNone) {
+      uint32_t index = heads_[list];
+      Unlink(index);
+      due->push_back(std::move(timers_[index].cb));
+      Release(index);
+    }
+  }
+}
+
+std::chrono::milliseconds TimerWheel::UntilNext(
+    std::chrono::milliseconds limit) const {
+  if (size_ == 0)
+    return limit;
+  uint32_t current = tick_ & (kSlots - 1);
+  uint32_t until = kSlots - current;
+  if (counts_[0] > 0) {
+    for (uint32_t slot = current + 1; slot < kSlots; slot++) {
+      if (heads_[slot] != kNone) {
+        until = slot - current;
+        break;
+      }
+    }
+  }
+  return std::min(limit, std::chrono::milliseconds(until));
+}
+
+}  // namespace homedns
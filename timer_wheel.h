@@ -0,0 +1,99 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include "base/bind/bind.h"
+
+namespace homedns {
+
+// Millions of timers with O(1) scheduling and cancelling, to a millisecond.
+//
+// Four levels of 256 slots each cover successively coarser stretches of
+// time: the first a slot per millisecond for the current 256ms, the next a
+// slot per 256ms, and so on up to about 49 days, past which timers wait in
+// an overflow list. A timer goes in the finest level whose span holds its
+// deadline, and is moved down a level (cascaded) whenever the clock enters
+// its slot, so it is only ever touched a handful of times. Each slot is an
+// intrusive list threaded through one array of timers, so scheduling and
+// cancelling just link and unlink, and nothing is allocated once the array
+// has grown to the most timers ever live at once.
+//
+// Not thread safe: whoever owns the wheel has to serialize access to it.
+class TimerWheel {
+ public:
+  using Clock = std::chrono::steady_clock;
+  using Callback = base::RepeatingCallback<void()>;
+
+  // Names a scheduled timer. Stays safe to cancel after the timer has fired,
+  // or its slot has been reused.
+  struct TimerId {
+    uint32_t index = 0;
+    uint32_t generation = 0;  // Zero for an id that names no timer.
+    explicit operator bool() const { return generation != 0; }
+  };
+
+  explicit TimerWheel(Clock::time_point now = Clock::now());
+
+  // Runs |cb| from the first Advance() at or past |deadline|. Deadlines in
+  // the past fire on the next one.
+  TimerId Schedule(Clock::time_point deadline, Callback cb);
+
+  // Returns false if |id| has already fired or been cancelled.
+  bool Cancel(TimerId id);
+
+  // Moves the clock to |now|, and appends the callbacks of every timer due
+  // by then to |due|, in deadline order. The wheel is left consistent, so
+  // they may schedule and cancel more timers when they run.
+  void Advance(Clock::time_point now, std::vector<Callback>* due);
+
+  // How long from the last Advance() until the next timer is due, if that is
+  // less than |limit|. Never more than the time until the next 256ms
+  // boundary, where the later levels are next looked at.
+  std::chrono::milliseconds UntilNext(std::chrono::milliseconds limit) const;
+
+  size_t Size() const { return size_; }
+
+ private:
+  static constexpr int kLevels = 4;
+  static constexpr int kSlotBits = 8;
+  static constexpr uint32_t kSlots = 1 << kSlotBits;
+  // Past the last level, in a list of its own.
+  static constexpr uint32_t kOverflow = kLevels * kSlots;
+  static constexpr uint32_t kNone = UINT32_MAX;
+
+  struct Timer {
+    uint64_t expires;  // In ticks since |epoch_|.
+    uint32_t prev;
+    uint32_t next;     // Also links the free list.
+    uint32_t list;     // Which slot (or kOverflow) it is in.
+    uint32_t generation;
+    Callback cb;
+  };
+
+  // Rounded down.
+  uint64_t ToTick(Clock::time_point time) const;
+  // Puts |index| in the right list for |tick_|.
+  void Place(uint32_t index);
+  void Link(uint32_t list, uint32_t index);
+  void Unlink(uint32_t index);
+  void Release(uint32_t index);
+  // Moves everything in |list| down to where it now belongs.
+  void Cascade(uint32_t list);
+  // Called on entering a new tick that is a multiple of kSlots.
+  void CascadeAll();
+
+  Clock::time_point epoch_;
+  uint64_t tick_ = 0;
+  std::vector<Timer> timers_;
+  uint32_t free_ = kNone;
+  std::array<uint32_t, kOverflow + 1> heads_;
+  std::array<uint32_t, kOverflow + 1> tails_;
+  // Timers in each level, so that empty stretches can be skipped.
+  std::array<size_t, kLevels + 1> counts_ = {};
+  size_t size_ = 0;
+};
+
+}  // namespace homedns
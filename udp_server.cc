@@ -2,7 +2,11 @@
 
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
 #include <cstring>
 
 namespace homedns {
@@ -11,14 +15,26 @@ namespace {
 
 void DoNotReply(Response, uint8_t*, size_t, struct sockaddr_in) {}
 
+void DoNothing() {}
+
+// The server whose loop this thread is running, if any.
+thread_local const UDPServer* current_loop = nullptr;
+
 }  // namespace
 
-std::unique_ptr<UDPServer> UDPServer::Create(uint16_t port) {
+std::unique_ptr<UDPServer> UDPServer::Create(uint16_t port, bool reuse_port) {
   int sockfd;
   if ((sockfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
     perror("no socket");
     return nullptr;
   }
+  int one = 1;
+  if (reuse_port &&
+      setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0) {
+    perror("SO_REUSEPORT");
+    close(sockfd);
+    return nullptr;
+  }
   struct sockaddr_in server_address;
   memset(&server_address, 0, sizeof(server_address));
   server_address.sin_family = AF_INET;
@@ -37,11 +53,30 @@ UDPServer::~UDPServer() {
 }
 
 UDPServer::UDPServer(int socket)
-    : socket_(socket), cb_(base::BindRepeating(&DoNotReply)) {}
+    : socket_(socket),
+      cb_(base::BindRepeating(&DoNotReply)),
+      tick_cb_(base::BindRepeating(&DoNothing)),
+      now_(Clock::now()),
+      timers_(now_.load()) {}
 
 int UDPServer::SendData(const uint8_t* data,
                         size_t len,
                         struct sockaddr_in client_addr) {
+  uint8_t slipped[512];
+  if (limiter_) {
+    switch (limiter_->Check(client_addr, data, len)) {
+      case RateLimiter::Action::kSend:
+        break;
+      case RateLimiter::Action::kSlip:
+        len = std::min(len, sizeof(slipped));
+        memcpy(slipped, data, len);
+        len = RateLimiter::Slip(slipped, len);
+        data = slipped;
+        break;
+      case RateLimiter::Action::kDrop:
+        return 0;
+    }
+  }
   return sendto(socket_, data, len, MSG_CONFIRM,
                 reinterpret_cast<sockaddr*>(&client_addr), sizeof(client_addr));
 }
@@ -50,15 +85,132 @@ void UDPServer::OnData(UDPServer::DataCB cb) {
   cb_ = std::move(cb);
 }
 
+void UDPServer::Watch(int fd, base::RepeatingCallback<void()> cb) {
+  watched_.push_back({fd, std::move(cb)});
+}
+
+void UDPServer::OnTick(base::RepeatingCallback<void()> cb) {
+  tick_cb_ = std::move(cb);
+}
+
+UDPServer::TimerId UDPServer::RunAfter(std::chrono::milliseconds delay,
+                                       base::RepeatingCallback<void()> cb) {
+  Clock::time_point from = current_loop == this ? Now() : Clock::now();
+  std::lock_guard<std::mutex> lock(timers_mutex_);
+  return timers_.Schedule(from + delay, std::move(cb));
+}
+
+bool UDPServer::Cancel(TimerId id) {
+  std::lock_guard<std::mutex> lock(timers_mutex_);
+  return timers_.Cancel(id);
+}
+
+int UDPServer::RunTimers() {
+  {
+    std::lock_guard<std::mutex> lock(timers_mutex_);
+    timers_.Advance(Now(), &due_);
+  }
+  // Unlocked, so that they can add timers of their own.
+  for (const base::RepeatingCallback<void()>& cb : due_)
+    cb.Run();
+  due_.clear();
+  std::lock_guard<std::mutex> lock(timers_mutex_);
+  return timers_.UntilNext(std::chrono::milliseconds(kTickMillis)).count();
+}
+
+bool UDPServer::AttachFilter(const std::vector<struct sock_filter>& program) {
+  struct sock_fprog fprog;
+  fprog.len = program.size();
+  fprog.filter = const_cast<struct sock_filter*>(program.data());
+  if (setsockopt(socket_, SOL_SOCKET, SO_ATTACH_FILTER, &fprog,
+                 sizeof(fprog)) < 0) {
+    perror("SO_ATTACH_FILTER");
+    return false;
+  }
+  return true;
+}
+
+bool UDPServer::AttachSteering(const std::vector<struct sock_filter>& program) {
+  struct sock_fprog fprog;
+  fprog.len = program.size();
+  fprog.filter = const_cast<struct sock_filter*>(program.data());
+  if (setsockopt(socket_, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &fprog,
+                 sizeof(fprog)) < 0) {
+    perror("SO_ATTACH_REUSEPORT_CBPF");
+    return false;
+  }
+  return true;
+}
+
+void UDPServer::LimitResponses(std::shared_ptr<RateLimiter> limiter) {
+  limiter_ = std::move(limiter);
+}
+
+void UDPServer::EnableBusyPoll(std::chrono::microseconds budget) {
+  // Only lets the kernel spin on the device queue too; the loop spins
+  // either way.
+  int usecs = budget.count();
+  if (setsockopt(socket_, SOL_SOCKET, SO_BUSY_POLL, &usecs, sizeof(usecs)) < 0)
+    perror("SO_BUSY_POLL");
+  busy_poller_ = std::make_unique<BusyPoller>(budget);
+}
+
 void UDPServer::Start() {
+  running_ = true;
+  current_loop = this;
+  std::vector<struct pollfd> fds;
+  while (running_) {
+    now_.store(Clock::now(), std::memory_order_relaxed);
+    fds.clear();
+    // poll() skips negative descriptors.
+    fds.push_back({receiving_ ? socket_ : -1, POLLIN, 0});
+    for (const Watched& watched : watched_)
+      fds.push_back({watched.fd, POLLIN, 0});
+
+    int timeout = RunTimers();
+    // Spinning only stands in for the wait in poll(). Once it has received
+    // something the poll doesn't wait at all, so that watched descriptors
+    // and timers still get their turn.
+    if (busy_poller_ && receiving_ &&
+        busy_poller_->Spin([this] { return Receive(); })) {
+      timeout = 0;
+    }
+    int ready = poll(fds.data(), fds.size(), timeout);
+    if (ready < 0 && errno != EINTR) {
+      perror("poll");
+      return;
+    }
+    if (ready > 0) {
+      if (fds[0].revents & POLLIN)
+        Receive();
+      for (size_t i = 1; i < fds.size(); i++) {
+        if (fds[i].revents & POLLIN)
+          watched_[i - 1].cb.Run();
+      }
+    }
+    tick_cb_.Run();
+  }
+}
+
+void UDPServer::Stop() {
+  running_ = false;
+}
+
+bool UDPServer::Receive() {
   uint8_t buf[512];
   struct sockaddr_in client_addr;
   memset(&client_addr, 0, sizeof(client_addr));
   socklen_t client_len = sizeof(client_addr);
   sockaddr* addr = reinterpret_cast<sockaddr*>(&client_addr);
-  size_t bytes = recvfrom(socket_, buf, 512, MSG_WAITALL, addr, &client_len);
+  ssize_t bytes = recvfrom(socket_, buf, 512, MSG_DONTWAIT, addr, &client_len);
+  if (bytes < 0) {
+    if (errno != EAGAIN && errno != EWOULDBLOCK)
+      perror("recvfrom");
+    return false;
+  }
   Response response{this, client_addr};
   cb_.Run(std::move(response), buf, bytes, client_addr);
+  return true;
 }
 
 Response::Response(UDPServer* server, struct sockaddr_in client_addr)
@@ -1,9 +1,16 @@
 #pragma once
 
+#include <linux/filter.h>
 #include <netinet/in.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
 #include <vector>
 
 #include "base/bind/bind.h"
+#include "busy_poll.h"
+#include "rate_limiter.h"
+#include "timer_wheel.h"
 
 namespace homedns {
 
@@ -24,19 +31,93 @@ class UDPServer {
  public:
   using DataCB = base::RepeatingCallback<
       void(Response, uint8_t*, size_t, struct sockaddr_in)>;
-  static std::unique_ptr<UDPServer> Create(uint16_t port);
+  // With |reuse_port|, any number of servers can share the port, each with
+  // its own loop, and the kernel spreads queries between them.
+  static std::unique_ptr<UDPServer> Create(uint16_t port,
+                                           bool reuse_port = false);
 
   ~UDPServer();
   int SendData(const uint8_t* data, size_t len, struct sockaddr_in client_addr);
   void OnData(DataCB cb);
 
+  // Services another descriptor (ie an upstream socket) from the same loop,
+  // running |cb| whenever it becomes readable.
+  void Watch(int fd, base::RepeatingCallback<void()> cb);
+
+  // Runs |cb| after every loop iteration, and at least every |kTickMillis|
+  // while the server is idle.
+  void OnTick(base::RepeatingCallback<void()> cb);
+
+  using Clock = std::chrono::steady_clock;
+  using TimerId = TimerWheel::TimerId;
+
+  // Runs |cb| once on the loop, |delay| from now. Both are safe from any
+  // thread, and O(1). From the loop itself, |delay| counts from Now().
+  TimerId RunAfter(std::chrono::milliseconds delay,
+                   base::RepeatingCallback<void()> cb);
+  // Returns false if the timer has already run, or been cancelled.
+  bool Cancel(TimerId id);
+
+  // The time at the start of the loop's current iteration. Cheaper than
+  // asking the clock, and precise enough for timeouts and expiry.
+  Clock::time_point Now() const { return now_.load(std::memory_order_relaxed); }
+
+  // Attaches a classic BPF program to the socket, so that the kernel drops
+  // whatever it rejects. Returns false if the kernel refuses the program.
+  bool AttachFilter(const std::vector<struct sock_filter>& program);
+  // Attaches a classic BPF program which picks, by its return value, which
+  // server of a reuse_port group receives each datagram; the servers are
+  // numbered in the order they were created. Attaching it to any one of them
+  // steers the whole group. Returns false if the kernel refuses it, and the
+  // group goes on being balanced by the client's address and port.
+  bool AttachSteering(const std::vector<struct sock_filter>& program);
+
+  // Passes every response through |limiter| before it is sent. Servers
+  // sharing one limiter limit their responses together.
+  void LimitResponses(std::shared_ptr<RateLimiter> limiter);
+  const RateLimiter* GetRateLimiter() const { return limiter_.get(); }
+
+  // Spins on non-blocking receives for up to |budget| before sleeping in
+  // poll(), and asks the kernel to busy poll the socket for as long, which
+  // takes CAP_NET_ADMIN. See BusyPoller.
+  void EnableBusyPoll(std::chrono::microseconds budget);
+  const BusyPoller* GetBusyPoller() const { return busy_poller_.get(); }
+
+  // Whether the loop reads the socket itself. A Pipeline turns this off
+  // while its own threads are reading it.
+  void SetReceiving(bool receiving) { receiving_ = receiving; }
+  int GetFD() const { return socket_; }
+
   void Start();
+  void Stop();
+
+  static constexpr int kTickMillis = 100;
 
  private:
+  struct Watched {
+    int fd;
+    base::RepeatingCallback<void()> cb;
+  };
+
   UDPServer(int socket);
+  // Returns whether there was anything to receive.
+  bool Receive();
+  // Runs the timers that are due, and returns how long until the next one,
+  // at most |kTickMillis|.
+  int RunTimers();
 
   int socket_;
   DataCB cb_;
+  base::RepeatingCallback<void()> tick_cb_;
+  std::vector<Watched> watched_;
+  std::shared_ptr<RateLimiter> limiter_;
+  std::unique_ptr<BusyPoller> busy_poller_;
+  std::atomic<Clock::time_point> now_;
+  std::mutex timers_mutex_;
+  TimerWheel timers_;
+  std::vector<TimerWheel::Callback> due_;
+  std::atomic<bool> running_ = false;
+  std::atomic<bool> receiving_ = true;
 };
 
 }  // namespace homedns
\ No newline at end of file
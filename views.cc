@@ -0,0 +1,117 @@
+#include "views.h"
+
+#include <arpa/inet.h>
+#include <fstream>
+#include <sstream>
+
+namespace homedns {
+
+namespace {
+
+std::string_view Trim(std::string_view text) {
+  while (!text.empty() && isspace(static_cast<unsigned char>(text.front())))
+    text.remove_prefix(1);
+  while (!text.empty() && isspace(static_cast<unsigned char>(text.back())))
+    text.remove_suffix(1);
+  return text;
+}
+
+std::string_view NextField(std::string_view* text) {
+  *text = Trim(*text);
+  size_t end = std::min(text->find_first_of(" \t"), text->size());
+  std::string_view field = text->substr(0, end);
+  text->remove_prefix(end);
+  return field;
+}
+
+}  // namespace
+
+// static
+ConfigStatus::Or<Views> Views::Parse(std::string_view text) {
+  struct PendingView {
+    std::string name;
+    Zone::Builder zone;
+  };
+  std::vector<PendingView> pending;
+  PrefixTable<uint32_t, 4>::Builder v4;
+  PrefixTable<uint32_t, 16>::Builder v6;
+
+  size_t line_number = 0;
+  while (!text.empty()) {
+    line_number++;
+    size_t newline = text.find('\n');
+    std::string_view line = text.substr(0, newline);
+    text.remove_prefix(newline == std::string_view::npos ? text.size()
+                                                         : newline + 1);
+    line = Trim(line.substr(0, line.find('#')));
+    if (line.empty())
+      continue;
+
+    std::string_view rest = line;
+    if (NextField(&rest) != "view") {
+      if (pending.empty()) {
+        return ConfigStatus(ConfigStatus::Codes::kSyntaxError,
+                            "record before any view: " + std::string(line))
+            .WithData("line", (int)line_number);
+      }
+      auto status = pending.back().zone.AddLine(line);
+      if (!status.is_ok())
+        return std::move(status).WithData("line", (int)line_number);
+      continue;
+    }
+
+    std::string_view name = NextField(&rest);
+    if (name.empty()) {
+      return ConfigStatus(ConfigStatus::Codes::kSyntaxError,
+                          "view without a name")
+          .WithData("line", (int)line_number);
+    }
+    uint32_t index = pending.size();
+    pending.push_back({std::string(name), {}});
+    for (std::string_view field = NextField(&rest); !field.empty();
+         field = NextField(&rest)) {
+      auto m_prefix = AddressPrefix::Parse(field);
+      if (!m_prefix.has_value())
+        return std::move(m_prefix).error().WithData("line", (int)line_number);
+      AddressPrefix prefix = std::move(m_prefix).value();
+      if (prefix.family == AF_INET)
+        v4.Insert(prefix.bytes, prefix.bits, index);
+      else
+        v6.Insert(prefix.bytes, prefix.bits, index);
+    }
+  }
+  if (pending.empty()) {
+    return ConfigStatus(ConfigStatus::Codes::kSyntaxError,
+                        "no views defined");
+  }
+
+  Views views;
+  for (PendingView& view : pending) {
+    views.views_.push_back(std::unique_ptr<View>(
+        new View{std::move(view.name), std::move(view.zone).Build(),
+                 std::make_unique<AnswerCache>()}));
+  }
+  views.v4_ = std::move(v4).Build();
+  views.v6_ = std::move(v6).Build();
+  return views;
+}
+
+// static
+ConfigStatus::Or<Views> Views::Load(const std::string& path) {
+  std::ifstream file(path);
+  if (!file)
+    return ConfigStatus(ConfigStatus::Codes::kFileNotFound, path);
+  std::stringstream contents;
+  contents << file.rdbuf();
+  return Parse(contents.str());
+}
+
+// static
+Views Views::Default() {
+  Views views;
+  views.views_.push_back(std::unique_ptr<View>(
+      new View{"default", Zone(), std::make_unique<AnswerCache>()}));
+  return views;
+}
+
+}  // namespace homedns
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <netinet/in.h>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "answer_cache.h"
+#include "prefix_table.h"
+#include "status.h"
+#include "zone.h"
+
+namespace homedns {
+
+// What one group of clients sees: its own local records, and its own cache of
+// the answers built from them.
+struct View {
+  std::string name;
+  const Zone zone;
+  std::unique_ptr<AnswerCache> cache;
+};
+
+// Split horizon: picks the view for each client by the longest prefix its
+// address matches, once per packet. Selection is a prefix table lookup, with
+// no locks or allocations, and the views' zones are never written after
+// loading, so every worker can share them.
+class Views {
+ public:
+  // Parses a views file. A "view <name> <prefix>..." line starts a view for
+  // clients in any of the given prefixes, and the record lines after it (see
+  // Zone::Builder::AddLine) are that view's zone. Blank lines and anything
+  // after a '#' are ignored. Clients which match no view get the first one.
+  static ConfigStatus::Or<Views> Parse(std::string_view text);
+  static ConfigStatus::Or<Views> Load(const std::string& path);
+
+  // One view, for every client, with no records of its own.
+  static Views Default();
+
+  View* Select(const struct sockaddr_in& client) const {
+    const uint32_t* index =
+        v4_.Lookup(reinterpret_cast<const uint8_t*>(&client.sin_addr.s_addr));
+    return views_[index ? *index : 0].get();
+  }
+
+  View* Select(const struct in6_addr& client) const {
+    const uint32_t* index = IN6_IS_ADDR_V4MAPPED(&client)
+                                ? v4_.Lookup(client.s6_addr + 12)
+                                : v6_.Lookup(client.s6_addr);
+    return views_[index ? *index : 0].get();
+  }
+
+  size_t Count() const { return views_.size(); }
+  View* Get(size_t index) const { return views_[index].get(); }
+
+ private:
+  std::vector<std::unique_ptr<View>> views_;
+  PrefixTable<uint32_t, 4> v4_;
+  PrefixTable<uint32_t, 16> v6_;
+};
+
+}  // namespace homedns
@@ -0,0 +1,47 @@
+#include "wire.h"
+
+#include <cstring>
+
+namespace homedns {
+
+namespace wire {
+
+bool SkipName(const uint8_t* data, size_t len, size_t* offset) {
+  while (*offset < len) {
+    uint8_t length = data[*offset];
+    if ((length & 0xC0) == 0xC0) {
+      *offset += 2;
+      return *offset <= len;
+    }
+    if (length & 0xC0)
+      return false;
+    *offset += length + 1;
+    if (length == 0)
+      return true;
+  }
+  return false;
+}
+
+size_t QuestionEnd(const uint8_t* data, size_t len) {
+  size_t offset = kHeaderSize;
+  if (len < kHeaderSize || !SkipName(data, len, &offset) || offset + 4 > len)
+    return 0;
+  return offset + 4;
+}
+
+void PatchFromQuery(uint8_t* reply,
+                    size_t reply_len,
+                    const uint8_t* query,
+                    size_t query_len) {
+  if (reply_len < kHeaderSize || query_len < kHeaderSize)
+    return;
+  reply[0] = query[0];
+  reply[1] = query[1];
+  size_t query_end = QuestionEnd(query, query_len);
+  if (query_end && query_end == QuestionEnd(reply, reply_len))
+    memcpy(reply + kHeaderSize, query + kHeaderSize, query_end - kHeaderSize);
+}
+
+}  // namespace wire
+
+}  // namespace homedns
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace homedns {
+
+// Helpers for reading and patching serialized messages in place, for the
+// paths where a full DnsPacket import/export would cost more than the work
+// being done.
+namespace wire {
+
+constexpr size_t kHeaderSize = 12;
+
+inline uint16_t ReadU16(const uint8_t* data) {
+  return (data[0] << 8) | data[1];
+}
+
+inline uint32_t ReadU32(const uint8_t* data) {
+  return (data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+}
+
+inline void WriteU16(uint8_t* data, uint16_t value) {
+  data[0] = value >> 8;
+  data[1] = value;
+}
+
+inline void WriteU32(uint8_t* data, uint32_t value) {
+  data[0] = value >> 24;
+  data[1] = value >> 16;
+  data[2] = value >> 8;
+  data[3] = value;
+}
+
+// Advances |offset| past the (possibly compressed) name that starts there.
+// Returns false if the name runs off the end of the buffer.
+bool SkipName(const uint8_t* data, size_t len, size_t* offset);
+
+// Returns the offset just past the first question (name, type and class), or
+// 0 if the message doesn't hold a complete one.
+size_t QuestionEnd(const uint8_t* data, size_t len);
+
+// Overwrites the ID and first question of |reply| with those of |query|, so
+// that a stored reply can answer a new asker. The question is only copied
+// when both have the same length, which holds for any two spellings of a
+// name that differ only in case.
+void PatchFromQuery(uint8_t* reply,
+                    size_t reply_len,
+                    const uint8_t* query,
+                    size_t query_len);
+
+}  // namespace wire
+
+}  // namespace homedns
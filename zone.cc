@@ -0,0 +1,175 @@
+#include "zone.h"
+
+#include <arpa/inet.h>
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+
+#include "reverse_index.h"
+
+namespace homedns {
+
+namespace {
+
+// Splits off the next whitespace separated field of |text|.
+std::string_view NextField(std::string_view* text) {
+  size_t start = text->find_first_not_of(" \t");
+  if (start == std::string_view::npos) {
+    *text = {};
+    return {};
+  }
+  text->remove_prefix(start);
+  size_t end = std::min(text->find_first_of(" \t"), text->size());
+  std::string_view field = text->substr(0, end);
+  text->remove_prefix(end);
+  return field;
+}
+
+template <typename T>
+bool ParseNumber(std::string_view field, T* out) {
+  auto [end, error] =
+      std::from_chars(field.data(), field.data() + field.size(), *out);
+  return error == std::errc() && end == field.data() + field.size();
+}
+
+ConfigStatus BadLine(const char* problem, std::string_view line) {
+  return {ConfigStatus::Codes::kSyntaxError,
+          std::string(problem) + ": " + std::string(line)};
+}
+
+}  // namespace
+
+ConfigStatus Zone::Builder::AddLine(std::string_view line) {
+  std::string_view rest = line;
+  std::string_view name = NextField(&rest);
+  std::string_view ttl_field = NextField(&rest);
+  std::string_view type = NextField(&rest);
+  std::string data(NextField(&rest));
+
+  uint32_t ttl;
+  if (name.empty() || !ParseNumber(ttl_field, &ttl))
+    return BadLine("expected <name> <ttl> <type> <data>", line);
+
+  if (type == "A") {
+    DnsARecord record;
+    if (inet_pton(AF_INET, data.c_str(), record.IP) != 1)
+      return BadLine("bad IPv4 address", line);
+    Add(name, ttl, DnsARecord::TYPE, record);
+  } else if (type == "AAAA") {
+    DnsAAAARecord record;
+    if (inet_pton(AF_INET6, data.c_str(), record.IP) != 1)
+      return BadLine("bad IPv6 address", line);
+    Add(name, ttl, DnsAAAARecord::TYPE, record);
+  } else if (type == "NS" && !data.empty()) {
+    Add(name, ttl, DnsNSRecord::TYPE, DnsNSRecord{data});
+  } else if (type == "CNAME" && !data.empty()) {
+    Add(name, ttl, DnsCNAMERecord::TYPE, DnsCNAMERecord{data});
+  } else if (type == "MX") {
+    uint16_t preference;
+    std::string exchange(NextField(&rest));
+    if (!ParseNumber(std::string_view(data), &preference) || exchange.empty())
+      return BadLine("expected <preference> <exchange>", line);
+    DnsMXRecord record;
+    record.priority[0] = preference >> 8;
+    record.priority[1] = preference;
+    record.label = exchange;
+    Add(name, ttl, DnsMXRecord::TYPE, record);
+  } else {
+    return BadLine("unsupported record", line);
+  }
+  return base::OkStatus();
+}
+
+void Zone::Builder::Add(std::string_view name,
+                        uint32_t ttl,
+                        uint16_t type,
+                        DnsRecord data) {
+  std::string key(name);
+  if (!key.empty() && key.back() == '.')
+    key.pop_back();
+  std::transform(key.begin(), key.end(), key.begin(), _suffix_tree::Lower);
+  names_[key].push_back({type, ttl, std::move(data)});
+}
+
+Zone Zone::Builder::Build() && {
+  // Each address answers PTR queries for the names that have it, unless its
+  // reverse name was given records of its own.
+  std::map<std::string, std::vector<Record>> reverse;
+  for (const auto& [name, records] : names_) {
+    for (const Record& record : records) {
+      HostAddress address;
+      if (const auto* a = std::get_if<DnsARecord>(&record.data)) {
+        address.family = AF_INET;
+        memcpy(address.bytes, a->IP, sizeof(a->IP));
+      } else if (const auto* aaaa = std::get_if<DnsAAAARecord>(&record.data)) {
+        address.family = AF_INET6;
+        memcpy(address.bytes, aaaa->IP, sizeof(aaaa->IP));
+      } else {
+        continue;
+      }
+      std::string reverse_name = address.ReverseName();
+      if (names_.count(reverse_name))
+        continue;
+      auto& ptrs = reverse[reverse_name];
+      bool seen = std::any_of(ptrs.begin(), ptrs.end(), [&](const Record& r) {
+        return std::get<DnsPTRRecord>(r.data).label == name;
+      });
+      if (!seen)
+        ptrs.push_back({DnsPTRRecord::TYPE, record.ttl, DnsPTRRecord{name}});
+    }
+  }
+  names_.merge(reverse);
+
+  Zone zone;
+  SuffixTree<Range>::Builder names;
+  for (auto& [name, records] : names_) {
+    uint32_t first = zone.records_.Size();
+    for (const Record& record : records) {
+      zone.records_.Add(DnsLabelSeq{nullptr}, record.type, 1, record.ttl,
+                        record.data);
+    }
+    names.Insert(name, {first, uint32_t(zone.records_.Size() - first)});
+  }
+  zone.names_ = std::move(names).Build();
+  names_.clear();
+  return zone;
+}
+
+PacketStatus::Or<DnsPacket> Zone::Answer(const DnsQuestion* question,
+                                         DnsPacket response) const {
+  const Range* range = names_.Exact(question->LabelSequence);
+  if (range == nullptr)
+    return PacketStatus::Codes::kNameNotFound;
+
+  // An alias stands in for every type but itself.
+  uint16_t type = question->Type;
+  size_t begin = range->first;
+  size_t end = begin + range->count;
+  auto has_type = [&](uint16_t type) {
+    for (size_t i = begin; i < end; i++) {
+      if (records_.Preamble(i).Type == type)
+        return true;
+    }
+    return false;
+  };
+  if (!has_type(type))
+    type = DnsCNAMERecord::TYPE;
+  if (!has_type(type))
+    return PacketStatus::Codes::kInvalidRecordType;
+
+  std::string name = question->LabelSequence.Render();
+  for (size_t i = begin; i < end; i++) {
+    const DnsRecordPreamble& preamble = records_.Preamble(i);
+    if (preamble.Type != type)
+      continue;
+    auto added =
+        std::move(response).AddRecordData<DnsPacket::RecordType::kAnswer>(
+            name, type, question->Class, preamble.TTL, records_.Rdata(i));
+    if (!added.has_value())
+      return std::move(added).error();
+    response = std::move(added).value();
+  }
+  return response;
+}
+
+}  // namespace homedns
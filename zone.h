@@ -0,0 +1,73 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "packet.h"
+#include "record_store.h"
+#include "records.h"
+#include "status.h"
+#include "suffix_tree.h"
+
+namespace homedns {
+
+// Records served locally, by exact name. Names are matched case-insensitively
+// and a lookup doesn't allocate. A zone is immutable once built, so one can be
+// read from any number of threads. Each A and AAAA record also gets a PTR
+// record, at its address's in-addr.arpa or ip6.arpa name.
+class Zone {
+ public:
+  struct Record {
+    uint16_t type;
+    uint32_t ttl;
+    DnsRecord data;
+  };
+
+  class Builder {
+   public:
+    // Parses a "<name> <ttl> <type> <data>" line, where type is one of A,
+    // AAAA, NS, CNAME or MX, and data is an address, a name, or for MX a
+    // preference and a name.
+    ConfigStatus AddLine(std::string_view line);
+    void Add(std::string_view name,
+             uint32_t ttl,
+             uint16_t type,
+             DnsRecord data);
+    Zone Build() &&;
+
+   private:
+    std::map<std::string, std::vector<Record>> names_;
+  };
+
+  Zone() = default;
+
+  bool Contains(const DnsLabelSeq& name) const {
+    return names_.Exact(name) != nullptr;
+  }
+  bool Contains(std::string_view name) const {
+    return names_.Exact(name) != nullptr;
+  }
+
+  // Adds the records answering |question| to |response|. Fails with
+  // kNameNotFound if the zone doesn't have the name, and kInvalidRecordType if
+  // it has the name but no records of the type.
+  PacketStatus::Or<DnsPacket> Answer(const DnsQuestion* question,
+                                     DnsPacket response) const;
+
+  size_t RecordCount() const { return records_.Size(); }
+
+ private:
+  struct Range {
+    uint32_t first;
+    uint32_t count;
+  };
+
+  SuffixTree<Range> names_;
+  // Grouped by name, which the preambles leave out since |names_| has them.
+  // Answering copies the RDATA as is.
+  RecordStore records_;
+};
+
+}  // namespace homedns